@@ -18,6 +18,9 @@ Requirements:
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #define SQZ_IMPLEMENTATION
 #include "sqz.h"
@@ -32,8 +35,8 @@ void usage(char* progname)
 {
     fprintf(stderr,
         "%s %s %s\n",
-        "Usage:", progname, "[-h] [-c budget] [-d] [-l level] [-m mode] [-o order] input output\n"
-        "SQZ encode/decode an image.\n"
+        "Usage:", progname, "[-h] [-a] [-b bytes] [-B bands] [-c budget] [-d] [-D] [-e] [-E error] [-F floor] [-g] [-H] [-l level] [-L] [-m mode] [-M] [-o order] [-p] [-Q interval] [-r x,y,w,h] [-R shift] [-s subsampling] [-S schedule] [-T tile] [-Y format:WxH] input... output\n"
+        "SQZ encode/decode an image, or a sequence of frames.\n"
      );
 }
 
@@ -41,50 +44,450 @@ void help()
 {
     fprintf(stderr,
         "%s\n",
+        "-a                Use adaptive arithmetic coding, for smaller but slower to decode images\n"
+        "-b bytes          Maximum number of bytes spent on the chroma planes\n"
+        "-B bands          Decode only the given bands of a multispectral image, as a comma-separated list (up to 4)\n"
         "-c budget         Requested output image size\n"
         "-d                Decode\n"
-        "-l level          Number of DWT decompositions to perform (default: 5)\n"
-        "-m mode           Internal color mode (default: Grayscale / YCoCg-R)\n0: Grayscale\n1: YCoCg-R\n2: Oklab\n3: logl1\n"
+        "-D                Code the sorting passes where most coefficients become significant as raw significance maps\n"
+        "-e                Print an estimate of the lossless compressed size, without encoding (no output needed)\n"
+        "-E error          Near-lossless encoding, bounding the absolute error of each sample (1 to 15)\n"
+        "-F floor          Lowest bitplane coded in the chroma planes (default: 0, all)\n"
+        "-g                Use adaptive Rice coding of the WDR runs, ignored with -a\n"
+        "-H                Print the perceptual hash of an SQZ image, from its first bytes as given by -c (no output needed)\n"
+        "-l level          Number of DWT decompositions to perform (default: 0, automatic)\n"
+        "-L                Order the stream by resolution, completing each level before the next finer one\n"
+        "-m mode           Internal color mode (default: Grayscale / YCoCg-R)\n0: Grayscale\n1: YCoCg-R\n2: Oklab\n3: logl1\n4: Multispectral, a band per channel (default for 2 and 4 channel images)\n5: Y'CbCr 4:2:0\n"
+        "-M                Decode to the mipmap chain of the image, down to 1x1, as PNG images numbered after the output\n"
         "-o order          DWT coefficient scanning order (default: Snake)\n0: Raster\n1: Snake\n2: Morton\n3: Hilbert\n"
+        "-p                Fast preview encoding, from a downsampled image when the budget is small\n"
+        "-Q interval       Encode the input images as the frames of a sequence, with a key frame every interval frames,\n"
+        "                  or decode a sequence to PNG images numbered after the output (0 for key frames only)\n"
+        "-r x,y,w,h        Add a region of interest, to be coded with priority (up to 8)\n"
+        "-R shift          Number of bitplanes by which the regions of interest are prioritized (default: 4)\n"
         "-s subsampling    Use additional chroma subsampling\n"
+        "-S schedule       Load a custom processing schedule from a file (see stbisqz-tune)\n"
+        "-T tile           Decode to a Deep Zoom (DZI) pyramid of PNG tiles of the given size, named after the output\n"
+        "-Y format:WxH     Encode a raw YUV 4:2:0 frame of the given size, without color conversion\ni420: Planar\nnv12: Semi-planar\n"
         "\n"
         "stb_image and stb_image_write by Sean Barrett and others is used to read and\n"
         "write images.\n"
     );
 }
 
+#define PYRAMID_MAX_LEVELS  17
+#define PYRAMID_OVERLAP     1
+
+/* Deep Zoom pyramid, whose tiles are written by several threads */
+typedef struct
+{
+    char const* name;
+    uint8_t* pixels[PYRAMID_MAX_LEVELS];        /* levels indexed from the full resolution one, DZI numbers them the other way */
+    size_t width[PYRAMID_MAX_LEVELS];
+    size_t height[PYRAMID_MAX_LEVELS];
+    size_t tiles[PYRAMID_MAX_LEVELS];
+    size_t count;
+    size_t tile;
+    size_t num_planes;
+    size_t next;
+    int failed;
+    pthread_mutex_t lock;
+} pyramid_t;
+
+/* Cuts and writes the tiles taken in turn from the pyramid, until none are left */
+void* write_tiles(void* argument)
+{
+    pyramid_t* const pyramid = (pyramid_t*)argument;
+    char path[FILENAME_MAX];
+    for (;;)
+    {
+        pthread_mutex_lock(&pyramid->lock);
+        size_t index = pyramid->next++;
+        pthread_mutex_unlock(&pyramid->lock);
+        size_t level = 0u;
+        while ((level < pyramid->count) && (index >= pyramid->tiles[level]))
+        {
+            index -= pyramid->tiles[level++];
+        }
+        if (level >= pyramid->count)
+        {
+            return NULL;
+        }
+        size_t const width = pyramid->width[level], height = pyramid->height[level];
+        size_t const columns = (width + pyramid->tile - 1u) / pyramid->tile;
+        size_t const column = index % columns, row = index / columns;
+        size_t const x0 = column * pyramid->tile - ((column > 0u) ? PYRAMID_OVERLAP : 0u);
+        size_t const y0 = row * pyramid->tile - ((row > 0u) ? PYRAMID_OVERLAP : 0u);
+        size_t x1 = (column + 1u) * pyramid->tile + PYRAMID_OVERLAP, y1 = (row + 1u) * pyramid->tile + PYRAMID_OVERLAP;
+        x1 = (x1 < width) ? x1 : width;
+        y1 = (y1 < height) ? y1 : height;
+        snprintf(path, sizeof(path), "%s_files/%zu/%zu_%zu.png", pyramid->name, pyramid->count - 1u - level, column, row);
+        if (!stbi_write_png(path, (int)(x1 - x0), (int)(y1 - y0), (int)pyramid->num_planes,
+            pyramid->pixels[level] + (y0 * width + x0) * pyramid->num_planes, (int)(width * pyramid->num_planes)))
+        {
+            pthread_mutex_lock(&pyramid->lock);
+            pyramid->failed = 1;
+            pthread_mutex_unlock(&pyramid->lock);
+        }
+    }
+}
+
+/* Writes a Deep Zoom pyramid from the mipmap chain of the image, down to a single pixel */
+int write_pyramid(char const* name, uint8_t* const images, SQZ_image_descriptor_t const* image, size_t tile)
+{
+    pyramid_t pyramid = { .name = name, .tile = tile, .num_planes = image->num_planes };
+    size_t width = image->width, height = image->height;
+    uint8_t* pixels = images;
+    int result = 1;
+    while (pyramid.count < PYRAMID_MAX_LEVELS)
+    {
+        size_t const level = pyramid.count++;
+        pyramid.pixels[level] = pixels;
+        pyramid.width[level] = width;
+        pyramid.height[level] = height;
+        pyramid.tiles[level] = ((width + tile - 1u) / tile) * ((height + tile - 1u) / tile);
+        if ((width == 1u) && (height == 1u))
+        {
+            break;
+        }
+        pixels += width * height * image->num_planes;
+        width = (width + 1u) >> 1u;
+        height = (height + 1u) >> 1u;
+    }
+
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "%s_files", name);
+    mkdir(path, 0755);
+    for (size_t level = 0u; (result) && (level < pyramid.count); ++level)
+    {
+        snprintf(path, sizeof(path), "%s_files/%zu", name, level);
+        result = (mkdir(path, 0755) == 0) || (errno == EEXIST);
+    }
+    if (result)
+    {
+        long const cores = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t const count = (cores > 64) ? 64u : ((cores > 0) ? (size_t)cores : 1u);
+        pthread_t threads[64];
+        size_t started = 0u;
+        pthread_mutex_init(&pyramid.lock, NULL);
+        while ((started < count) && (pthread_create(&threads[started], NULL, &write_tiles, &pyramid) == 0))
+        {
+            ++started;
+        }
+        if (started == 0u)
+        {
+            write_tiles(&pyramid);
+        }
+        for (size_t i = 0u; i < started; ++i)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&pyramid.lock);
+        result = !pyramid.failed;
+    }
+    if (result)
+    {
+        snprintf(path, sizeof(path), "%s.dzi", name);
+        FILE* output = fopen(path, "w");
+        result = (output != NULL);
+        if (result)
+        {
+            fprintf(output, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" Overlap=\"%d\" TileSize=\"%zu\">\n"
+                "    <Size Width=\"%zu\" Height=\"%zu\"/>\n"
+                "</Image>\n", PYRAMID_OVERLAP, tile, image->width, image->height);
+            fclose(output);
+        }
+    }
+    return result;
+}
+
+/* Writes each level of the mipmap chain of the image to a PNG image, numbered after the name from the full resolution one */
+int write_mipmaps(char const* name, uint8_t* const images, SQZ_image_descriptor_t const* image)
+{
+    char path[FILENAME_MAX];
+    size_t width = image->width, height = image->height;
+    uint8_t* pixels = images;
+    for (size_t level = 0u; ; ++level)
+    {
+        snprintf(path, sizeof(path), "%s_%zu.png", name, level);
+        if (!stbi_write_png(path, (int)width, (int)height, (int)image->num_planes, pixels, 0))
+        {
+            return 0;
+        }
+        if ((width == 1u) && (height == 1u))
+        {
+            return 1;
+        }
+        pixels += width * height * image->num_planes;
+        width = (width + 1u) >> 1u;
+        height = (height + 1u) >> 1u;
+    }
+}
+
+/* Reads a schedule file, made of the starting rounds of each subband (LL, HL, LH, HH) per level and plane, '#' starts a comment */
+int load_schedule(char const* filename, SQZ_schedule_t* schedule, size_t num_planes)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    size_t const count = num_planes * sizeof(SQZ_schedule_t);
+    size_t index = 0u;
+    int c = fgetc(file);
+    while ((c != EOF) && (index < count))
+    {
+        if (c == '#')
+        {
+            while ((c != EOF) && (c != '\n'))
+            {
+                c = fgetc(file);
+            }
+        }
+        else if ((c >= '0') && (c <= '9'))
+        {
+            int value = 0;
+            while ((c >= '0') && (c <= '9'))
+            {
+                value = value * 10 + (c - '0');
+                c = fgetc(file);
+            }
+            if (value > UINT8_MAX)
+            {
+                break;
+            }
+            ((uint8_t*)schedule)[index++] = (uint8_t)value;
+            continue;
+        }
+        c = fgetc(file);
+    }
+    fclose(file);
+    return (index == count);
+}
+
+/* Encodes the images as the frames of a sequence, each preceded by its size as 4 bytes, most significant first */
+int encode_sequence(char** names, size_t count, char const* output_name, SQZ_image_descriptor_t const* image, size_t budget, size_t interval)
+{
+    SQZ_sequence_state_t state = { .descriptor = *image, .key_interval = interval };
+    FILE* output = fopen(output_name, "wb");
+    uint8_t* buffer = (uint8_t*)malloc(budget);
+    int result = (output != NULL) && (buffer != NULL);
+    for (size_t i = 0u; (result) && (i < count); ++i)
+    {
+        int width = 0, height = 0;
+        uint8_t* pixels = (uint8_t*)stbi_load(names[i], &width, &height, 0, (int)image->num_planes);
+        if ((pixels == NULL) || ((size_t)width != image->width) || ((size_t)height != image->height))
+        {
+            fprintf(stderr, "Error loading frame %s, all frames must be of the same size\n", names[i]);
+            stbi_image_free(pixels);
+            result = 0;
+            break;
+        }
+        size_t size = budget;
+        memset(buffer, 0, budget);
+        SQZ_status_t const status = SQZ_encode_frame(pixels, buffer, &size, &state);
+        stbi_image_free(pixels);
+        if (status != SQZ_RESULT_OK)
+        {
+            fprintf(stderr, "Error compressing frame %s, code: %d\n", names[i], (int)status);
+            result = 0;
+            break;
+        }
+        uint8_t const length[4] = { (uint8_t)(size >> 24u), (uint8_t)(size >> 16u), (uint8_t)(size >> 8u), (uint8_t)size };
+        result = (fwrite(length, sizeof(uint8_t), 4u, output) == 4u) && (fwrite(buffer, sizeof(uint8_t), size, output) == size);
+    }
+    if (output != NULL)
+    {
+        fclose(output);
+    }
+    free(buffer);
+    SQZ_sequence_state_free(&state);
+    return result;
+}
+
+/* Decodes the frames of a sequence to PNG images, numbered after the output name */
+int decode_sequence(char const* input_name, char const* output_name)
+{
+    SQZ_sequence_state_t state = { 0 };
+    FILE* input = fopen(input_name, "rb");
+    uint8_t *src = NULL, *buffer = NULL;
+    size_t capacity = 0u, frame = 0u;
+    uint8_t length[4];
+    int result = (input != NULL);
+    while ((result) && (fread(length, sizeof(uint8_t), 4u, input) == 4u))
+    {
+        size_t const size = ((size_t)length[0] << 24u) | ((size_t)length[1] << 16u) | ((size_t)length[2] << 8u) | (size_t)length[3];
+        uint8_t* const data = (uint8_t*)realloc(src, size);
+        result = (data != NULL);
+        if (!result)
+        {
+            break;
+        }
+        src = data;
+        if (fread(src, sizeof(uint8_t), size, input) != size)
+        {
+            fprintf(stderr, "Error reading frame %zu\n", frame);
+            result = 0;
+            break;
+        }
+        size_t needed = 0u;
+        SQZ_status_t status = SQZ_decode_frame(src, NULL, size, &needed, &state);
+        if ((status == SQZ_BUFFER_TOO_SMALL) && (needed > capacity))
+        {
+            free(buffer);
+            buffer = (uint8_t*)malloc(needed);
+            capacity = (buffer != NULL) ? needed : 0u;
+        }
+        if ((status == SQZ_BUFFER_TOO_SMALL) && (buffer != NULL))
+        {
+            status = SQZ_decode_frame(src, buffer, size, &needed, &state);
+        }
+        if (status != SQZ_RESULT_OK)
+        {
+            fprintf(stderr, "Error decompressing frame %zu, code: %d\n", frame, (int)status);
+            result = 0;
+            break;
+        }
+        char path[FILENAME_MAX];
+        snprintf(path, sizeof(path), "%s_%04zu.png", output_name, frame++);
+        result = stbi_write_png(path, (int)state.descriptor.width, (int)state.descriptor.height,
+            (int)(needed / (state.descriptor.width * state.descriptor.height)), buffer, 0);
+    }
+    if (input != NULL)
+    {
+        fclose(input);
+    }
+    free(src);
+    free(buffer);
+    SQZ_sequence_state_free(&state);
+    return (result) && (frame > 0u);
+}
+
 int main(int argc, char** argv)
 {
     SQZ_image_descriptor_t image = {};
     size_t budget = 0u;
     FILE *input = NULL, *output = NULL;
+    char const* schedule_file = NULL;
+    SQZ_schedule_t schedule[SQZ_MAX_PLANES];
+    SQZ_region_t roi[SQZ_ROI_MAX_REGIONS];
+    size_t roi_count = 0u, chroma_budget = 0u, tile = 0u, interval = 0u;
+    uint32_t bands = 0u;
     uint8_t *src = NULL, *buffer = NULL;
-    bool decode = false;
-    int levels = 5, color_mode = 1, scan_order = 1, subsampling = 0;
+    bool decode = false, hash = false, estimate = false, fast_preview = false, arithmetic = false, rice = false, dense = false, resolution = false, sequence = false, mipmaps = false;
+    int levels = SQZ_DWT_LEVELS_AUTO, color_mode = 1, scan_order = 1, subsampling = 0, roi_shift = 4, chroma_floor = 0, max_error = 0;
+    int yuv_format = -1, yuv_width = 0, yuv_height = 0;
 
     int opt;
-    while ( (opt = getopt(argc, argv, "c:dl:m:o:s:h")) != -1 )
+    while ( (opt = getopt(argc, argv, "ab:B:c:dDeE:F:gHl:Lm:Mo:pQ:r:R:s:S:T:Y:h")) != -1 )
     {
         switch(opt)
         {
+            case 'a':
+                arithmetic = true;
+                break;
+            case 'b':
+                chroma_budget = atoi(optarg);
+                break;
+            case 'B':
+                for (char* list = optarg; *list != '\0'; ++list)
+                {
+                    unsigned long const band = strtoul(list, &list, 10);
+                    if ((band >= SQZ_MAX_PLANES) || ((*list != ',') && (*list != '\0')))
+                    {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    bands |= 1u << band;
+                    if (*list == '\0')
+                    {
+                        break;
+                    }
+                }
+                decode = true;
+                break;
             case 'c':
                 budget = atoi(optarg);
                 break;
             case 'd':
                 decode = true;
                 break;
+            case 'D':
+                dense = true;
+                break;
+            case 'e':
+                estimate = true;
+                break;
+            case 'E':
+                max_error = atoi(optarg);
+                break;
+            case 'F':
+                chroma_floor = atoi(optarg);
+                break;
+            case 'g':
+                rice = true;
+                break;
+            case 'H':
+                decode = hash = true;
+                break;
             case 'l':
                 levels = atoi(optarg);
                 break;
+            case 'L':
+                resolution = true;
+                break;
             case 'm':
                 color_mode = atoi(optarg);
                 break;
+            case 'M':
+                decode = mipmaps = true;
+                break;
             case 'o':
                 scan_order = atoi(optarg);
                 break;
+            case 'p':
+                fast_preview = true;
+                break;
+            case 'Q':
+                interval = atoi(optarg);
+                sequence = true;
+                break;
+            case 'r':
+                if ((roi_count >= SQZ_ROI_MAX_REGIONS) ||
+                    (sscanf(optarg, "%zu,%zu,%zu,%zu", &roi[roi_count].x, &roi[roi_count].y, &roi[roi_count].width, &roi[roi_count].height) != 4))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                ++roi_count;
+                break;
+            case 'R':
+                roi_shift = atoi(optarg);
+                break;
             case 's':
                 subsampling = atoi(optarg);
                 break;
+            case 'S':
+                schedule_file = optarg;
+                break;
+            case 'T':
+                tile = atoi(optarg);
+                decode = true;
+                if (tile == 0u)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'Y':
+                yuv_format = (strncmp(optarg, "i420:", 5u) == 0) ? SQZ_YUV_FORMAT_I420 : ((strncmp(optarg, "nv12:", 5u) == 0) ? SQZ_YUV_FORMAT_NV12 : -1);
+                if ((yuv_format < 0) || (sscanf(optarg + 5, "%dx%d", &yuv_width, &yuv_height) != 2) || (yuv_width <= 0) || (yuv_height <= 0))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
             case 'h':
                 usage(argv[0]);
                 help();
@@ -95,14 +498,24 @@ int main(int argc, char** argv)
         }
     }
 
-    // Need at least two filenames after the last option
-    if (argc < optind + 2)
+    // Need at least two filenames after the last option, or just the input one for an estimate or a hash
+    if ((argc < optind + 2 - ((estimate && !decode) || hash)) || (((bands != 0u) + (tile > 0u) + mipmaps) > 1) || ((yuv_format >= 0) && (decode || estimate)) ||
+        (sequence && (estimate || hash || (bands != 0u) || (tile > 0u) || mipmaps || (yuv_format >= 0))))
     {
         usage(argv[0]);
         return 1;
     }
 
-    if (decode)
+    if (decode && sequence)
+    {
+        if (!decode_sequence(argv[optind], argv[optind + 1]))
+        {
+            fprintf(stderr, "Error decoding sequence");
+            return 5;
+        }
+        return 0;
+    }
+    else if (decode)
     {
         input = fopen(argv[optind], "rb");
         if (input == NULL)
@@ -133,7 +546,21 @@ int main(int argc, char** argv)
             return 3;
         }
         fclose(input);
-        SQZ_status_t result = SQZ_decode(src, buffer, budget, &size, &image);
+        if (hash)
+        {
+            uint64_t signature = 0u;
+            SQZ_status_t result = SQZ_perceptual_hash(src, budget, &signature);
+            free(src);
+            if (result != SQZ_RESULT_OK)
+            {
+                fprintf(stderr, "Error hashing SQZ image, code: %d", (int)result);
+                return (int)result;
+            }
+            printf("%016llx\n", (unsigned long long)signature);
+            return 0;
+        }
+        SQZ_status_t (*decoder)(void* const, void* const, size_t const, size_t* const, SQZ_image_descriptor_t* const) = ((tile > 0u) || mipmaps) ? &SQZ_decode_mipmaps : &SQZ_decode;
+        SQZ_status_t result = (bands != 0u) ? SQZ_decode_bands(src, buffer, budget, &size, &image, bands) : decoder(src, buffer, budget, &size, &image);
         if (result != SQZ_BUFFER_TOO_SMALL)
         {
             fprintf(stderr, "Error parsing SQZ image, code: %d", (int)result);
@@ -147,15 +574,33 @@ int main(int argc, char** argv)
             free(src);
             return 4;
         }
-        result = SQZ_decode(src, buffer, budget, &size, &image);
+        result = (bands != 0u) ? SQZ_decode_bands(src, buffer, budget, &size, &image, bands) : decoder(src, buffer, budget, &size, &image);
         free(src);
         if (result != SQZ_RESULT_OK)
         {
             fprintf(stderr, "Error decompressing SQZ image, code: %d", (int)result);
         }
+        else if (mipmaps)
+        {
+            if (!write_mipmaps(argv[optind + 1], buffer, &image))
+            {
+                fprintf(stderr, "Error writing output mipmaps");
+                free(buffer);
+                return 5;
+            }
+        }
+        else if (tile > 0u)
+        {
+            if (!write_pyramid(argv[optind + 1], buffer, &image, tile))
+            {
+                fprintf(stderr, "Error writing output tile pyramid");
+                free(buffer);
+                return 5;
+            }
+        }
         else
         {
-			if (!stbi_write_png(argv[optind + 1], (int)image.width, (int)image.height, (int)image.num_planes, buffer, 0))
+			if (!stbi_write_png(argv[optind + 1], (int)image.width, (int)image.height, (int)(size / (image.width * image.height)), buffer, 0))
 			{
 				fprintf(stderr, "Error writing output PNG image");
 				free(buffer);
@@ -167,8 +612,8 @@ int main(int argc, char** argv)
 	}
     else
     {
-        int width = 0, height = 0, channels = 0;
-        if (!stbi_info(argv[optind], &width, &height, &channels) || (width <= 0) || (height <= 0) || ((channels != 1) && (channels != 3)))
+        int width = yuv_width, height = yuv_height, channels = 3;
+        if ((yuv_format < 0) && (!stbi_info(argv[optind], &width, &height, &channels) || (width <= 0) || (height <= 0) || (channels < 1) || (channels > 4)))
         {
             fprintf(stderr, "Invalid image header, parsing failed");
             return 1;
@@ -180,16 +625,97 @@ int main(int argc, char** argv)
         image.color_mode = color_mode;
         image.scan_order = scan_order;
         image.subsampling = subsampling;
-        if ((channels == 1) && (image.color_mode > SQZ_COLOR_MODE_GRAYSCALE))
+        image.fast_preview = fast_preview;
+        image.arithmetic_coding = arithmetic;
+        image.rice_coding = rice;
+        image.dense_coding = dense;
+        image.resolution_order = resolution;
+        image.chroma_floor = chroma_floor;
+        image.chroma_budget = chroma_budget;
+        image.max_error = max_error;
+        if (roi_count > 0u)
+        {
+            image.roi = roi;
+            image.roi_count = roi_count;
+            image.roi_shift = roi_shift;
+        }
+        if ((channels == 2) || (channels == 4) || (image.color_mode == SQZ_COLOR_MODE_MULTISPECTRAL))
+        {
+            /* such as gray with alpha, RGBA, or the bands of a multispectral image stored in the channels */
+            image.color_mode = SQZ_COLOR_MODE_MULTISPECTRAL;
+            image.band_transform = 1;
+        }
+        else if ((channels == 1) && (image.color_mode > SQZ_COLOR_MODE_GRAYSCALE))
         {
             image.color_mode = SQZ_COLOR_MODE_GRAYSCALE;
         }
-        src = (uint8_t*)stbi_load(argv[optind], &width, &height, 0, channels);
+        else if (yuv_format >= 0)
+        {
+            image.color_mode = SQZ_COLOR_MODE_YCBCR_420;
+        }
+        if (schedule_file != NULL)
+        {
+            size_t const num_planes = (image.color_mode == SQZ_COLOR_MODE_MULTISPECTRAL) ? image.num_planes : ((image.color_mode == SQZ_COLOR_MODE_GRAYSCALE) ? 1u : 3u);
+            if (!load_schedule(schedule_file, schedule, num_planes))
+            {
+                fprintf(stderr, "Error loading schedule file");
+                return 1;
+            }
+            image.schedule = schedule;
+        }
+        if (sequence)
+        {
+            if (budget < SQZ_HEADER_SIZE + 1u)
+            {
+                budget = image.width * image.height * image.num_planes;
+                budget += budget >> 2u;
+            }
+            if (!encode_sequence(&argv[optind], (size_t)(argc - optind - 1), argv[argc - 1], &image, budget, interval))
+            {
+                fprintf(stderr, "Error encoding sequence");
+                return 8;
+            }
+            return 0;
+        }
+        if (yuv_format >= 0)
+        {
+            /* a luma plane and two chroma planes of half the resolution, rounded up */
+            size_t const length = image.width * image.height + 2u * ((image.width + 1u) / 2u) * ((image.height + 1u) / 2u);
+            input = fopen(argv[optind], "rb");
+            src = (uint8_t*)malloc(length);
+            if ((input == NULL) || (src == NULL) || (fread(src, sizeof(uint8_t), length, input) != length))
+            {
+                fprintf(stderr, "Error loading input frame");
+                free(src);
+                if (input != NULL)
+                {
+                    fclose(input);
+                }
+                return 2;
+            }
+            fclose(input);
+        }
+        else
+        {
+            src = (uint8_t*)stbi_load(argv[optind], &width, &height, 0, channels);
+        }
         if (src == NULL)
         {
             fprintf(stderr, "Error loading input image");
             return 2;
         }
+        if (estimate)
+        {
+            SQZ_status_t result = SQZ_estimate_size(src, &image, &budget);
+            free(src);
+            if (result != SQZ_RESULT_OK)
+            {
+                fprintf(stderr, "Error analyzing image, code: %d", (int)result);
+                return (int)result;
+            }
+            printf("%zu\n", budget);
+            return 0;
+        }
         if (budget < SQZ_HEADER_SIZE + 1u)      /* assume (near) lossless compression expected */
         {
             budget = image.width * image.height * image.num_planes;
@@ -201,7 +727,7 @@ int main(int argc, char** argv)
             fprintf(stderr, "Insufficient memory");
             return 7;
         }
-        SQZ_status_t result = SQZ_encode(src, buffer, &image, &budget);
+        SQZ_status_t result = (yuv_format >= 0) ? SQZ_encode_yuv(src, (SQZ_yuv_format_t)yuv_format, buffer, &image, &budget) : SQZ_encode(src, buffer, &image, &budget);
         free(src);
         if (result != SQZ_RESULT_OK)
         {
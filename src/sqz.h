@@ -20,7 +20,7 @@ the need to reencode on-the-fly or store multiple versions of the same image.
 
 (1) Technical details
 
-SQZ uses a run-length wavelet bitplane encoding scheme with no entropy coding.
+SQZ uses a run-length wavelet bitplane encoding scheme with no entropy coding by default.
 The chosen wavelet is the integer reversible 5/3 wavelet used in a myriad of other
 codecs, and each subband bitplane is coded using a simple 2 stage DWT coefficient
 significance and refinement method.
@@ -53,6 +53,57 @@ A compressed SQZ bitstream starts with a compact 6 byte header:
 No other information is stored, as it strives to provide the best possible LQIP
 at every byte allocation budget.
 
+Optional coding features are signalled by using the alternate magic byte ("0xA6"),
+in which case the header is followed by a set of extension flags, stored in groups
+of 7 bits each terminated by a continuation bit, and then by the parameters of each
+extension present, in the order of their flags, except for the multispectral one,
+whose parameters come first:
+     - Schedule     Custom starting rounds for each subband, coded as differences
+                    to the default schedule
+     - ROI          Regions of interest, snapped to a 64x64 grid over the image,
+                    whose coefficients are coded as if shifted up by a number of
+                    bitplanes, so they get coded in earlier rounds
+     - Chroma       Lowest bitplane coded in the chroma planes, and maximum number
+                    of bytes spent on them, after which only luma is coded
+     - Arithmetic   No parameters, the subbands are coded with a carry-less adaptive
+                    binary arithmetic coder starting at the next byte boundary, with
+                    a few contexts per subband for the signs, the refinement bits and
+                    the bits of the WDR runs. The decoder never reads past the end of
+                    the data, so any prefix of the stream remains a valid image
+     - Rice         No parameters, the WDR runs are coded with a Rice code whose
+                    parameter follows the mean number of bits of the previous runs
+                    in the subband, and the signs precede their runs. Ignored when
+                    arithmetic coding is used
+     - Resolution   No parameters, the levels are scheduled one at a time, from the
+                    coarsest to the finest, each one with all its bitplanes, so
+                    that a prefix holding a reduced resolution image has no data
+                    of the finer levels
+     - Near-lossless Bound on the error of the samples [4 bits], which were
+                    quantized to intervals of twice that bound plus 1
+     - Multispectral Number of bands minus 1 [4 bits], and a flag per band after
+                    the first, set if it's coded as its difference to the previous
+                    band. The color mode field is 0, each band being coded as an
+                    8bpp grayscale plane
+     - Y'CbCr 4:2:0 No parameters, the planes hold full range BT.601 Y'CbCr, the
+                    chroma ones at half resolution as the LL subband of the first
+                    decomposition, whose detail subbands are empty. The color mode
+                    field is 1
+     - Temporal     No parameters, the coefficients are residuals to those of the
+                    reconstruction of the previous frame of a sequence, and each
+                    subband is only coded down to the lowest bitplane coded in it
+                    in that frame. Such frames need the previous one to be decoded
+     - Gray         No parameters, the image was given as RGB but all its pixels
+                    are gray, so it's coded as a single 8bpp grayscale plane, whose
+                    samples are replicated to the 3 channels of the output. The
+                    color mode field is 0
+     - Dense        No parameters, each sorting pass starts with a flag set if it's
+                    coded as a raw significance map, with a bit per coefficient of
+                    the LIP followed by the sign of the new significant ones, which
+                    the encoder chooses when it's smaller than the WDR runs, as on
+                    the low bitplanes of the coarse subbands
+
+Streams that use none of the extensions keep the compact 6 byte header.
+
 (2) Implementation details
 
 SQZ is provided as a C single header file only, to use it just define the macro
@@ -68,6 +119,15 @@ To keep memory usage moderate, the DWT coefficients use 16 bits of precision, th
 list nodes use 32-bit indexes for linking instead of pointers, and the lists are
 only initialized on the first bitplane pass of their subband.
 
+The color conversion, the vertical DWT lifting steps and the whole image passes
+have SSE2, AVX2 and AVX-512 variants on x86, and the bitplane passes, with their
+bit IO, have a variant compiled for BMI2 and LZCNT used along AVX2 and AVX-512,
+all giving the exact same results. The best one supported by the CPU is selected
+at runtime, on first use, so a single binary runs on any x86 machine, and the
+`SQZ_CPU` environment variable can select a lesser one (scalar, sse2, avx2 or
+avx512) for testing. There are no NEON kernels: ARM and the other architectures
+use the scalar code, as do builds defining the macro `SQZ_NO_SIMD`.
+
 (3) License
 
 Permission is hereby granted, free of charge, to any person obtaining a copy
@@ -116,9 +176,18 @@ typedef enum
     SQZ_COLOR_MODE_YCOCG_R,                     /*!< YCoCg-R colorspace mode */
     SQZ_COLOR_MODE_OKLAB,                       /*!< Oklab perceptual colorspace mode */
     SQZ_COLOR_MODE_LOG_L1,                      /*!< logl1 colorspace mode */
+    SQZ_COLOR_MODE_MULTISPECTRAL,               /*!< Independent 8bpp spectral bands, up to \ref SQZ_MAX_PLANES */
+    SQZ_COLOR_MODE_YCBCR_420,                   /*!< Full range BT.601 Y'CbCr colorspace mode, with the chroma planes at half resolution */
     SQZ_COLOR_MODE_COUNT,                       /*!< Number of color modes supported */
 } SQZ_color_mode_t;
 
+typedef enum
+{
+    SQZ_YUV_FORMAT_I420,                        /*!< Planar 4:2:0, the Y plane followed by the U (Cb) and V (Cr) planes */
+    SQZ_YUV_FORMAT_NV12,                        /*!< Semi-planar 4:2:0, the Y plane followed by a plane of interleaved U and V samples */
+    SQZ_YUV_FORMAT_COUNT,                       /*!< Number of YUV frame layouts supported */
+} SQZ_yuv_format_t;
+
 typedef enum
 {
     SQZ_SCAN_ORDER_RASTER,                      /*!< Raster scan order */
@@ -134,6 +203,12 @@ typedef enum
  */
 #define SQZ_DWT_MAX_LEVEL   8
 
+/**
+ * \brief           Value of `dwt_levels` requesting the encoder to choose the number of DWT decompositions
+ * \hideinitializer
+ */
+#define SQZ_DWT_LEVELS_AUTO 0
+
 /**
  * \brief           Smallest spatial dimension supported
  * \hideinitializer
@@ -152,15 +227,62 @@ typedef enum
  */
 #define SQZ_HEADER_MAGIC    0xA5
 
+/**
+ * \brief           Magic byte for SQZ image header followed by extension flags
+ * \hideinitializer
+ */
+#define SQZ_HEADER_MAGIC_EXTENDED   0xA6
+
 /**
  * \brief           SQZ image header size (in bytes)
  * \hideinitializer
  */
 #define SQZ_HEADER_SIZE     6
 
+/**
+ * \brief           Maximum number of regions of interest
+ * \hideinitializer
+ */
+#define SQZ_ROI_MAX_REGIONS 8
+
+/**
+ * \brief           Maximum number of bitplanes by which the regions of interest can be prioritized
+ * \hideinitializer
+ */
+#define SQZ_ROI_MAX_SHIFT   16
+
+/**
+ * \brief           Largest bound on the absolute error of each sample supported by near-lossless coding
+ * \hideinitializer
+ */
+#define SQZ_NEAR_LOSSLESS_MAX_ERROR 15
+
+/**
+ * \brief           Maximum number of spectral planes (bands) of a multispectral image
+ * \hideinitializer
+ */
+#define SQZ_MAX_PLANES      16
+
+/**
+ * \brief           Starting rounds for each subband of a spectral plane, indexed by level (coarsest first) and orientation
+ * \note            Only the first orientation (LL) of the coarsest level is used
+ */
+typedef uint8_t SQZ_schedule_t[SQZ_DWT_MAX_LEVEL][4];
+
+/**
+ * \brief           Rectangular region of an image, in pixels
+ */
+typedef struct
+{
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+} SQZ_region_t;
+
 /**
  * \brief           Structure used to describe an image
- * \note            When encoding, there is no need specifiy the number of planes
+ * \note            When encoding, there is no need specifiy the number of planes, except for multispectral images
  */
 typedef struct
 {
@@ -168,13 +290,31 @@ typedef struct
     SQZ_scan_order_t scan_order;
     size_t width;
     size_t height;
-    size_t dwt_levels;                          /*!< Number of DWT decomposition levels used */
-    size_t num_planes;                          /*!< Number of spectral planes in the image */
+    size_t dwt_levels;                          /*!< Number of DWT decomposition levels used, or \ref SQZ_DWT_LEVELS_AUTO when encoding */
+    size_t num_planes;                          /*!< Number of spectral planes in the image, from 1 to \ref SQZ_MAX_PLANES for multispectral images */
     int subsampling;                            /*!< Specifies whether additional chroma subsampling is to be performed */
+    SQZ_schedule_t const* schedule;             /*!< Optional custom schedule, with one entry per plane, or `NULL` to use the default one. Not set when decoding */
+    int fast_preview;                           /*!< Allows encoding a small budget from a downsampled image, the finest levels being coded as empty. Ignored in resolution order, not set when decoding */
+    SQZ_region_t const* roi;                    /*!< Optional regions of interest, enlarged to a grid of 1/64 of the image dimensions. Not set when decoding */
+    size_t roi_count;                           /*!< Number of regions of interest, up to \ref SQZ_ROI_MAX_REGIONS */
+    int roi_shift;                              /*!< Number of bitplanes by which the regions of interest are prioritized, from 1 to \ref SQZ_ROI_MAX_SHIFT */
+    int chroma_floor;                           /*!< Lowest bitplane coded in the chroma planes, from 1 to 15, or 0 to code them fully. Not set when decoding */
+    size_t chroma_budget;                       /*!< Maximum number of bytes spent on the chroma planes, or 0 for no limit. Not set when decoding */
+    int arithmetic_coding;                      /*!< Specifies whether the subbands are coded with an adaptive binary arithmetic coder */
+    int rice_coding;                            /*!< Specifies whether the WDR runs are coded with an adaptive Rice code, ignored with arithmetic coding */
+    int resolution_order;                       /*!< Specifies whether the stream is ordered by resolution, each level being complete before the next finer one starts */
+    int max_error;                              /*!< Bound on the absolute error of each sample when encoding, up to \ref SQZ_NEAR_LOSSLESS_MAX_ERROR, or 0 for none. Set when decoding to that of the quantization of the samples, 0 if they weren't */
+    int band_transform;                         /*!< Specifies whether the bands of a multispectral image may be coded as their difference to the previous band, for those where it's predicted to be smaller */
+    int dense_coding;                           /*!< Specifies whether the sorting passes where most of the coefficients become significant may be coded as raw significance maps */
 } SQZ_image_descriptor_t;
 
 /**
  * \brief           Encode an image
+ * \note            With a bound on the error of each sample, the encoder keeps the smaller of two streams guaranteed to
+ *                  meet it, as checked by decoding them: the shortest prefix of the lossless stream, and the lossless
+ *                  stream of the samples quantized with a step of `2 * max_error + 1`, which needs a reversible color mode.
+ *                  The descriptor is updated with the error of the quantization used, if any, and \ref SQZ_BUFFER_TOO_SMALL
+ *                  is returned if the bound can't be met within the budget, as may happen with the lossy color modes
  * \warning         The destination buffer will NOT be cleared before encoding
  * \param[in]       source : Pointer to the input pixel data
  * \param[out]      dest : Pointer to the buffer that will receive the compressed data, of at least `budget` bytes in size
@@ -184,6 +324,36 @@ typedef struct
  */
 SQZ_status_t SQZ_encode(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget);
 
+/**
+ * \brief           Encode a YUV 4:2:0 frame, as output by cameras and video decoders, without any color conversion
+ * \note            The samples are coded in the \ref SQZ_COLOR_MODE_YCBCR_420 color mode, the chroma planes keeping their
+ *                  native resolution: they are placed as the LL subband of the first DWT decomposition, whose detail
+ *                  subbands are left empty. The chroma planes are `(width + 1) / 2` by `(height + 1) / 2` samples, and
+ *                  none of the planes are padded. Near-lossless and fast preview encoding aren't supported
+ * \warning         The destination buffer will NOT be cleared before encoding
+ * \param[in]       source : Pointer to the frame
+ * \param           format : Layout of the frame
+ * \param[out]      dest : Pointer to the buffer that will receive the compressed data, of at least `budget` bytes in size
+ * \param[in,out]   descriptor : Pointer to an image descriptor, holding information about the image. Its color mode is set
+ * \param[in,out]   budget : Pointer to the byte budget allowed for compression, will be updated with the final compressed data size
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_encode_yuv(void* const source, SQZ_yuv_format_t const format, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget);
+
+/**
+ * \brief           Estimate the lossless compressed size of an image, without encoding it
+ * \note            Only the color conversion and the DWT are performed, the cost of the coding passes being counted
+ *                  from a single scan of each subband, which measures the run of every coefficient becoming significant.
+ *                  The estimate is for the default coding, the optional coding features of the descriptor are ignored.
+ *                  It's then the actual size, but for the few bytes of the all zero chroma planes of RGB images whose
+ *                  pixels are all gray, which are coded as grayscale
+ * \param[in]       source : Pointer to the input pixel data
+ * \param[in,out]   descriptor : Pointer to an image descriptor, holding information about the image. Will be corrected if necessary
+ * \param[out]      size : Pointer to the estimated compressed size, in bytes
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_estimate_size(void* const source, SQZ_image_descriptor_t* const descriptor, size_t* const size);
+
 /**
  * \brief           Decode an image
  * \note            Call this function with `dest_size` set to 0 to receive an image descriptor and the required buffer size,
@@ -197,6 +367,232 @@ SQZ_status_t SQZ_encode(void* const source, void* const dest, SQZ_image_descript
  */
 SQZ_status_t SQZ_decode(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor);
 
+/**
+ * \brief           Decode a subset of the bands of a multispectral image
+ * \note            The stream has no band-major or per-band segmented layout: the schedule interleaves the bitplanes of
+ *                  all the bands, so every band is still entropy decoded, at the same cost as a full decode, and only the
+ *                  inverse DWT and color output are restricted to the selected bands and those they were coded as
+ *                  differences to. The output holds the selected bands only, interleaved in ascending order. Call this
+ *                  function with `dest_size` set to 0 to receive an image descriptor and the required buffer size
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[out]      dest : Pointer to the buffer that will receive the decompressed bands
+ * \param[in]       src_size: Size of the input buffer
+ * \param[in,out]   dest_size : Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   descriptor : Pointer to an image descriptor, to be filled with information about the image
+ * \param           bands : Mask of the bands to decode, bit `i` selecting band `i`
+ * \return          \ref SQZ_RESULT_OK on success, \ref SQZ_INVALID_PARAMETER if the image isn't multispectral or doesn't have
+ *                  the bands selected, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_bands(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor, uint32_t const bands);
+
+/**
+ * \brief           Decode an image along with its reductions by powers of 2, taken from the intermediate levels of the inverse DWT
+ * \note            The output holds `dwt_levels + 1` images, the full resolution one first, each of the next ones having
+ *                  half the dimensions of the previous one, rounded up, so the reductions need no resampling. Call this
+ *                  function with `dest_size` set to 0 to receive an image descriptor and the required buffer size
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[out]      dest : Pointer to the buffer that will receive the decompressed images, one after the other
+ * \param[in]       src_size: Size of the input buffer
+ * \param[in,out]   dest_size : Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   descriptor : Pointer to an image descriptor, to be filled with information about the image
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_pyramid(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor);
+
+/**
+ * \brief           Decode an image along with its full mipmap chain, down to a single pixel
+ * \note            The output holds the same images as \ref SQZ_decode_pyramid, followed by the reductions of the coarsest
+ *                  of them, each half the dimensions of the previous one, rounded up, until the last one is 1x1. These
+ *                  few extra levels average 2x2 pixels of the previous one, as usual for texture mipmaps. Call this
+ *                  function with `dest_size` set to 0 to receive an image descriptor and the required buffer size
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[out]      dest : Pointer to the buffer that will receive the decompressed images, one after the other
+ * \param[in]       src_size: Size of the input buffer
+ * \param[in,out]   dest_size : Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   descriptor : Pointer to an image descriptor, to be filled with information about the image
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_mipmaps(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor);
+
+/**
+ * \brief           Compute a perceptual hash of an image, from a prefix of its compressed data
+ * \note            Only the coarsest (LL) subband of the first plane is reconstructed, without any inverse DWT, and its
+ *                  mean over a 9x8 grid is reduced to 64 bits, each set if a cell is darker than the next one on its row.
+ *                  Near-duplicate images have hashes differing in a few bits only, regardless of their resolution and
+ *                  compressed size, and a few hundred bytes of the stream usually suffice to compute it
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[in]       src_size: Size of the input buffer, which may hold just a prefix of the compressed image
+ * \param[out]      hash : Pointer to the hash
+ * \return          \ref SQZ_RESULT_OK on success, \ref SQZ_BUFFER_TOO_SMALL if the prefix doesn't reach the LL subband,
+ *                  member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_perceptual_hash(void* const source, size_t const src_size, uint64_t* const hash);
+
+/**
+ * \brief           Working memory kept between the calls to \ref SQZ_encode_with_workspace and \ref SQZ_decode_with_workspace,
+ *                  must be zero-initialized before the first one
+ */
+typedef struct
+{
+    void* context;                              /*!< Internal buffers, reused by the next call when large enough */
+} SQZ_workspace_t;
+
+/**
+ * \brief           Encode an image, reusing the working memory of the previous calls, see \ref SQZ_encode
+ * \note            The context, coefficients, lists and scratch buffers of the codec are taken from the workspace, which
+ *                  only grows when an image needs larger ones, so encoding images of the same size and settings doesn't
+ *                  allocate memory once the first one is done. Near-lossless encoding and differencing of multispectral
+ *                  bands still allocate the buffers of their trial streams and transforms on each call.
+ *                  A workspace must not be used by two calls at the same time
+ * \warning         The destination buffer will NOT be cleared before encoding
+ * \param[in]       source : Pointer to the input pixel data
+ * \param[out]      dest : Pointer to the buffer that will receive the compressed data, of at least `budget` bytes in size
+ * \param[in,out]   descriptor : Pointer to an image descriptor, holding information about the image. Will be corrected if necessary
+ * \param[in,out]   budget : Pointer to the byte budget allowed for compression, will be updated with the final compressed data size
+ * \param[in,out]   workspace : Pointer to the workspace, to be freed with \ref SQZ_workspace_free
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_encode_with_workspace(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget, SQZ_workspace_t* const workspace);
+
+/**
+ * \brief           Decode an image, reusing the working memory of the previous calls, see \ref SQZ_decode
+ * \note            As with \ref SQZ_encode_with_workspace, decoding images of the same size and settings, from prefixes
+ *                  reaching the same subbands, doesn't allocate memory once the first one is done. The workspace may be
+ *                  shared with an encoder, as long as the calls don't overlap
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[out]      dest : Pointer to the buffer that will receive the decompressed pixel data
+ * \param[in]       src_size: Size of the input buffer
+ * \param[in,out]   dest_size : Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   descriptor : Pointer to an image descriptor, to be filled with information about the image
+ * \param[in,out]   workspace : Pointer to the workspace, to be freed with \ref SQZ_workspace_free
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_with_workspace(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor,
+                                       SQZ_workspace_t* const workspace);
+
+/**
+ * \brief           Release the memory held by a workspace
+ * \param[in,out]   workspace : Pointer to the workspace, zero-initialized on return
+ */
+void SQZ_workspace_free(SQZ_workspace_t* const workspace);
+
+/**
+ * \brief           State kept between the calls to \ref SQZ_decode_update, must be zero-initialized before the first one
+ */
+typedef struct
+{
+    SQZ_image_descriptor_t descriptor;          /*!< Descriptor of the image, set by the first call */
+    void* context;                              /*!< Internal decoder state, resumed by the next call */
+    int16_t* coefficients;                      /*!< Dequantized DWT coefficients of the last reconstruction */
+    int16_t* samples;                           /*!< Spectral planes of the last reconstruction, before color conversion */
+    SQZ_region_t region;                        /*!< Region of the output updated by the last call, empty if nothing changed */
+    size_t rounds;                              /*!< Number of rounds of the schedule completed so far, each refining every subband reached by a bitplane */
+    uint8_t* window;                            /*!< Bytes kept by \ref SQZ_decode_append, from the first one the decoder may resume at */
+    size_t window_size;                         /*!< Number of bytes kept */
+    size_t window_capacity;                     /*!< Size of the buffer holding them */
+} SQZ_decoder_state_t;
+
+/**
+ * \brief           Decode an image incrementally, refining a previous output with a longer prefix of the same stream
+ * \note            The first call decodes the whole image. The next ones resume decoding where the previous one stopped,
+ *                  and only reconstruct and color convert the region affected by the coefficients that changed since,
+ *                  the rest of the output being left untouched, so it must hold the previous output. The region updated
+ *                  and the number of rounds of the schedule completed are returned in the state, the latter telling
+ *                  when a refinement of the whole image is complete. A shorter prefix than the previous one is decoded
+ *                  from scratch. The whole prefix is given on each call, see \ref SQZ_decode_append to give only the
+ *                  new bytes instead
+ * \param[in]       source : Pointer to the input compressed data
+ * \param[in,out]   dest : Pointer to the buffer holding the previous output, of the size of the decompressed pixel data
+ * \param[in]       src_size: Size of the input buffer
+ * \param[in,out]   state : Pointer to the decoder state, to be freed with \ref SQZ_decoder_state_free
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_update(void* const source, void* const dest, size_t const src_size, SQZ_decoder_state_t* const state);
+
+/**
+ * \brief           Decode an image incrementally, from the bytes of the stream received since the previous call
+ * \note            As \ref SQZ_decode_update, but the caller only passes the new bytes. The state keeps those the decoder
+ *                  may still need: the header until the first task of the schedule is decoded, then only the bytes from
+ *                  the start of the task interrupted by the end of the data, so at most a task's worth of them.
+ *                  Until the header is complete, the bytes are only kept and the region updated is empty. Once it is,
+ *                  the descriptor of the state is set, and \ref SQZ_BUFFER_TOO_SMALL is returned if the output is too
+ *                  small, the bytes still being kept, so that the call can be repeated without any new ones. A corrupted
+ *                  header can't be told apart from an incomplete one, until the end of the stream. The two functions
+ *                  must not be used with the same state
+ * \param[in]       chunk : Pointer to the bytes received since the previous call
+ * \param[in,out]   dest : Pointer to the buffer holding the previous output, or `NULL` until the header is complete
+ * \param[in]       chunk_size: Number of bytes received, may be 0
+ * \param[in]       dest_size : Size of the output buffer, 0 until the header is complete
+ * \param[in,out]   state : Pointer to the decoder state, to be freed with \ref SQZ_decoder_state_free
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_append(void* const chunk, void* const dest, size_t const chunk_size, size_t const dest_size, SQZ_decoder_state_t* const state);
+
+/**
+ * \brief           Release the memory held by an incremental decoder state
+ * \param[in,out]   state : Pointer to the decoder state, zero-initialized on return
+ */
+void SQZ_decoder_state_free(SQZ_decoder_state_t* const state);
+
+/**
+ * \brief           State kept between the frames of a sequence, must be zero-initialized before the first one
+ */
+typedef struct
+{
+    SQZ_image_descriptor_t descriptor;          /*!< Descriptor of the frames, set by the caller before encoding the first one, or by each decoded frame */
+    size_t key_interval;                        /*!< Number of frames from a key frame to the next one, 0 or 1 for key frames only. Not used when decoding */
+    size_t frame;                               /*!< Number of frames coded since the last key frame, 0 for a key frame */
+    void* context;                              /*!< Internal sequence state, holding the reconstruction of the last frame */
+} SQZ_sequence_state_t;
+
+/**
+ * \brief           Encode the next frame of a sequence, such as a burst of photos or a screen recording
+ * \note            Key frames are coded as regular images, decodable on their own. The frames in between are coded as
+ *                  the residual of their DWT coefficients to those of the reconstruction of the previous frame, each
+ *                  subband only down to the bitplane that frame reached in it, so a frame of a static scene takes just
+ *                  a few bytes, and the quality is kept until the next key frame, unless the budget runs out first.
+ *                  Frames whose residual is estimated to be larger than themselves, as on scene changes, are coded as
+ *                  key frames too.
+ *                  The frames must be decoded in order and in full with \ref SQZ_decode_frame, the same budget should
+ *                  be given for all of them. Near-lossless encoding and differencing of multispectral bands aren't used
+ * \warning         The destination buffer will NOT be cleared before encoding
+ * \param[in]       source : Pointer to the input pixel data
+ * \param[out]      dest : Pointer to the buffer that will receive the compressed frame, of at least `budget` bytes in size
+ * \param[in,out]   budget : Pointer to the byte budget allowed for the frame, will be updated with its compressed data size
+ * \param[in,out]   state : Pointer to the sequence state, whose descriptor is corrected if necessary, to be freed with
+ *                  \ref SQZ_sequence_state_free
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_encode_frame(void* const source, void* const dest, size_t* const budget, SQZ_sequence_state_t* const state);
+
+/**
+ * \brief           Decode the next frame of a sequence
+ * \note            Call this function with `dest_size` set to 0 to receive the required buffer size, if the return result
+ *                  is \ref SQZ_BUFFER_TOO_SMALL, in which case the state is left unchanged
+ * \param[in]       source : Pointer to the compressed frame
+ * \param[out]      dest : Pointer to the buffer that will receive the decompressed pixel data
+ * \param[in]       src_size: Size of the compressed frame
+ * \param[in,out]   dest_size : Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   state : Pointer to the sequence state, to be freed with \ref SQZ_sequence_state_free
+ * \return          \ref SQZ_RESULT_OK on success, \ref SQZ_DATA_CORRUPTED if the frame doesn't follow the previous one,
+ *                  member of \ref SQZ_status_t otherwise
+ */
+SQZ_status_t SQZ_decode_frame(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_sequence_state_t* const state);
+
+/**
+ * \brief           Release the memory held by a sequence state
+ * \param[in,out]   state : Pointer to the sequence state, zero-initialized on return
+ */
+void SQZ_sequence_state_free(SQZ_sequence_state_t* const state);
+
+/**
+ * \brief           Get the name of the kernels selected for the CPU
+ * \note            The kernels are selected on first use, for the best instruction set extension supported, unless
+ *                  the `SQZ_CPU` environment variable names a supported one
+ * \return          One of "scalar", "sse2", "avx2" or "avx512"
+ */
+char const* SQZ_kernels_name(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -218,6 +614,29 @@ SQZ_status_t SQZ_decode(void* const source, void* const dest, size_t const src_s
 #error  "Unsupported platform"
 #endif
 
+#ifndef SQZ_NO_SIMD
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SQZ_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#endif /* SQZ_NO_SIMD */
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#define SQZ_C11_ATOMICS
+#include <stdatomic.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SQZ_TARGET(x) __attribute__((target(x)))
+#define SQZ_FLATTEN __attribute__((flatten))
+#else
+#define SQZ_TARGET(x)
+#define SQZ_FLATTEN
+#endif
+
 /**
  * \brief           Structure used for bitwise memory IO
  */
@@ -227,6 +646,10 @@ typedef struct
     uint8_t* ptr;                               /*!< Pointer to the current byte being used in the buffer */
     uint8_t* eob;                               /*!< End-of-buffer pointer */
     size_t index;                               /*!< Index of the next bit available in the current byte */
+    uint32_t low;                               /*!< Lower bound of the arithmetic coder interval */
+    uint32_t high;                              /*!< Upper bound of the arithmetic coder interval */
+    uint32_t code;                              /*!< Code value read by the arithmetic decoder */
+    int arithmetic;                             /*!< Specifies whether the bits are arithmetic coded */
 } SQZ_bit_buffer_t;
 
 /**
@@ -385,7 +808,13 @@ typedef struct
  * \brief           Number of spectral planes supported
  * \hideinitializer
  */
-#define SQZ_SPECTRAL_PLANES 3
+#define SQZ_SPECTRAL_PLANES SQZ_MAX_PLANES
+
+/**
+ * \brief           Number of spectral planes of the color modes, whose default schedules are tabulated
+ * \hideinitializer
+ */
+#define SQZ_COLOR_PLANES    3
 
 /**
  * \brief           Number of subbands output by the DWT per iteration
@@ -395,6 +824,65 @@ typedef struct
 
 typedef int16_t SQZ_dwt_coefficient_t;
 
+/**
+ * \brief           Number of arithmetic coder contexts used for the bits of the WDR run codes, by position in the code
+ * \hideinitializer
+ */
+#define SQZ_CONTEXT_RUN_LENGTH  12
+
+/**
+ * \brief           Adaptation rate of the running mean of the number of bits of the runs, as a right shift
+ * \hideinitializer
+ */
+#define SQZ_RICE_RATE       4
+
+/**
+ * \brief           Longest unary coded quotient, after which the quotient is coded with the WDR run code
+ * \hideinitializer
+ */
+#define SQZ_RICE_LIMIT      2
+
+/**
+ * \brief           Initial value of the running mean of the number of bits of the runs of a subband
+ * \hideinitializer
+ */
+#define SQZ_RICE_INITIAL_BITS   3u
+
+/**
+ * \brief           Arithmetic coder contexts kept per subband
+ */
+typedef enum
+{
+    SQZ_CONTEXT_SIGN = 0,                       /*!< Sign of the new significant coefficients */
+    SQZ_CONTEXT_REFINEMENT = 1,                 /*!< Refinement bits, for the first refinement of a coefficient or the later ones */
+    SQZ_CONTEXT_RUN_FLAG = 3,                   /*!< Continuation flags of the WDR run codes */
+    SQZ_CONTEXT_RUN_BIT = SQZ_CONTEXT_RUN_FLAG + SQZ_CONTEXT_RUN_LENGTH,    /*!< Value bits of the WDR run codes */
+    SQZ_CONTEXT_DENSE = SQZ_CONTEXT_RUN_BIT + SQZ_CONTEXT_RUN_LENGTH,       /*!< Flags of the sorting passes coded as raw significance maps */
+    SQZ_CONTEXT_SIGNIFICANCE = SQZ_CONTEXT_DENSE + 1,                       /*!< Bits of the raw significance maps */
+    SQZ_CONTEXT_COUNT = SQZ_CONTEXT_SIGNIFICANCE + 1
+} SQZ_context_index_t;
+
+/**
+ * \brief           Buffer held by a workspace, see \ref SQZ_workspace_alloc
+ */
+typedef struct
+{
+    void* data;                                 /*!< Pointer to the buffer */
+    size_t size;                                /*!< Size of the buffer, in bytes */
+    int used;                                   /*!< Specifies whether the buffer is handed out */
+} SQZ_workspace_block_t;
+
+/**
+ * \brief           Internal state of a workspace, holding the buffers released by the previous calls for the next ones
+ */
+typedef struct
+{
+    SQZ_workspace_block_t* blocks;              /*!< Dynamic array of the buffers held */
+    size_t count;                               /*!< Number of buffers held */
+    size_t capacity;                            /*!< Number of buffers the array can hold */
+    SQZ_scan_context_t scan;                    /*!< Scan context of the last schedule, whose type tells what its own workspace holds */
+} SQZ_workspace_context_t;
+
 /**
  * \brief           Structure used to describe a DWT subband
  */
@@ -411,6 +899,16 @@ typedef struct SQZ_dwt_subband
     int max_bitplane;                           /*!< Highest bitplane in this subband containing at least one coefficient */
     int bitplane;                               /*!< Current bitplane being processed */
     int round;                                  /*!< Starting round for scheduling processing of this subband */
+    uint16_t roi[SQZ_ROI_MAX_REGIONS][4];       /*!< Regions of interest projected onto this subband, as [x0, y0, x1, y1) */
+    size_t roi_count;                           /*!< Number of regions of interest */
+    int roi_shift;                              /*!< Number of bitplanes by which the coefficients in the regions of interest are shifted */
+    int min_bitplane;                           /*!< Lowest bitplane to be coded in this subband */
+    uint16_t contexts[SQZ_CONTEXT_COUNT];       /*!< Adaptive probabilities of the arithmetic coded bits */
+    int rice;                                   /*!< Specifies whether the WDR runs are coded with an adaptive Rice code */
+    uint32_t run_bits;                          /*!< Running mean of the number of bits of the WDR runs, scaled by 2^\ref SQZ_RICE_RATE */
+    int updated;                                /*!< Specifies whether the subband was processed since its coefficients were last dequantized */
+    int dense;                                  /*!< Specifies whether each sorting pass signals if it's coded as a raw significance map */
+    SQZ_workspace_context_t* workspace;         /*!< Workspace of the context, holding the node cache and the sparse storage, or `NULL` */
 } SQZ_dwt_subband_t;
 
 /**
@@ -422,27 +920,156 @@ typedef struct
     SQZ_dwt_coefficient_t* data;                /*!< Pointer to the buffer holding the pixel data for this plane */
 } SQZ_spectral_plane_t;
 
+/**
+ * \brief           Reconstruction of the last frame of a sequence, that the coefficients of the next one are residuals to
+ */
+typedef struct
+{
+    SQZ_dwt_coefficient_t* reference;           /*!< DWT coefficients of the reconstruction, with the layout of the spectral planes */
+    size_t length;                              /*!< Number of coefficients allocated for the reconstruction */
+    int precision[SQZ_SPECTRAL_PLANES][SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS];    /*!< Lowest bitplane coded in each subband, `INT_MAX` if none */
+} SQZ_sequence_context_t;
+
+/**
+ * \brief           Optional coding features signalled in the extended header, in the order their parameters are stored
+ * \note            The parameters of the multispectral extension are stored first, as those of the others depend on the
+ *                  number of planes
+ */
+typedef enum
+{
+    SQZ_HEADER_EXTENSION_SCHEDULE   = 1u << 0,    /*!< A custom processing schedule is used */
+    SQZ_HEADER_EXTENSION_ROI        = 1u << 1,    /*!< Regions of interest are prioritized */
+    SQZ_HEADER_EXTENSION_CHROMA     = 1u << 2,    /*!< Coding of the chroma planes is limited */
+    SQZ_HEADER_EXTENSION_ARITHMETIC = 1u << 3,    /*!< The subbands are coded with the adaptive binary arithmetic coder */
+    SQZ_HEADER_EXTENSION_RICE       = 1u << 4,    /*!< The WDR runs are coded with an adaptive Rice code */
+    SQZ_HEADER_EXTENSION_RESOLUTION = 1u << 5,    /*!< All the bitplanes of each level precede those of the finer levels */
+    SQZ_HEADER_EXTENSION_NEAR_LOSSLESS  = 1u << 6,    /*!< The samples were quantized before coding, within a bound on their error */
+    SQZ_HEADER_EXTENSION_MULTISPECTRAL  = 1u << 7,    /*!< The image has independent bands, some possibly coded as differences to the previous band */
+    SQZ_HEADER_EXTENSION_YCBCR_420      = 1u << 8,    /*!< The planes are Y'CbCr, the finest detail subbands of the chroma planes being empty */
+    SQZ_HEADER_EXTENSION_TEMPORAL       = 1u << 9,    /*!< The coefficients are residuals to those of the previous frame of a sequence */
+    SQZ_HEADER_EXTENSION_GRAY           = 1u << 10,   /*!< The image was given as RGB, but all its pixels are gray */
+    SQZ_HEADER_EXTENSION_DENSE          = 1u << 11,   /*!< The sorting passes may be coded as raw significance maps */
+} SQZ_header_extension_t;
+
+/**
+ * \brief           Number of extension flags stored in each group, before the continuation bit
+ * \hideinitializer
+ */
+#define SQZ_HEADER_EXTENSION_GROUP_BITS 7
+
+/**
+ * \brief           Mask of all the extension flags supported by this implementation
+ * \hideinitializer
+ */
+#define SQZ_HEADER_EXTENSION_SUPPORTED  (SQZ_HEADER_EXTENSION_SCHEDULE | SQZ_HEADER_EXTENSION_ROI | SQZ_HEADER_EXTENSION_CHROMA | SQZ_HEADER_EXTENSION_ARITHMETIC | SQZ_HEADER_EXTENSION_RICE | \
+                                         SQZ_HEADER_EXTENSION_RESOLUTION | SQZ_HEADER_EXTENSION_NEAR_LOSSLESS | \
+                                         SQZ_HEADER_EXTENSION_MULTISPECTRAL | SQZ_HEADER_EXTENSION_YCBCR_420 | SQZ_HEADER_EXTENSION_TEMPORAL | \
+                                         SQZ_HEADER_EXTENSION_GRAY | SQZ_HEADER_EXTENSION_DENSE)
+
+/**
+ * \brief           Number of bits used for the coordinates of the regions of interest, on a grid of 2^bits cells per dimension
+ * \hideinitializer
+ */
+#define SQZ_ROI_GRID_BITS   6
+
+/**
+ * \brief           Regions of interest, snapped to the grid
+ */
+typedef struct
+{
+    uint8_t region[SQZ_ROI_MAX_REGIONS][4];     /*!< Grid coordinates of each region, as [x0, y0, x1, y1) */
+    size_t count;                               /*!< Number of regions, 0 if none */
+    int shift;                                  /*!< Number of bitplanes by which the regions are prioritized */
+} SQZ_roi_t;
+
+/**
+ * \brief           Position of the scheduler in the processing of the subbands, where it resumes from
+ */
+typedef struct
+{
+    size_t state;                               /*!< 0 while processing the first plane, 1 while processing the others */
+    size_t plane;                               /*!< Plane of the current subband */
+    size_t level;                               /*!< Level of the current subband */
+    size_t orientation;                         /*!< Orientation of the current subband */
+    size_t resolution;                          /*!< Level being processed in resolution order */
+    int round;                                  /*!< Current round */
+    int done;                                   /*!< Specifies whether all the subbands visited so far in this round are complete */
+    int active;                                 /*!< Specifies whether the scheduler stopped in the middle of a task, which can be rolled back */
+} SQZ_schedule_cursor_t;
+
+/**
+ * \brief           State saved before each task of the scheduler, to roll it back if it's interrupted by the end of the data
+ */
+typedef struct
+{
+    size_t position;                            /*!< Offset of the current byte in the bit buffer */
+    size_t index;                               /*!< Index of the next bit available in the current byte */
+    uint32_t low;                               /*!< Lower bound of the arithmetic coder interval */
+    uint32_t high;                              /*!< Upper bound of the arithmetic coder interval */
+    uint32_t code;                              /*!< Code value read by the arithmetic decoder */
+    size_t chroma_bits;                         /*!< Number of bits spent on the chroma planes */
+    SQZ_list_node_t* tail;                      /*!< Last node of the LSP of the subband */
+    size_t length;                              /*!< Length of the LSP of the subband */
+    int initialized;                            /*!< Specifies whether the subband was already started */
+    int max_bitplane;                           /*!< Highest bitplane of the subband */
+    int bitplane;                               /*!< Current bitplane of the subband */
+    uint32_t run_bits;                          /*!< Running mean of the number of bits of the WDR runs of the subband */
+    uint16_t contexts[SQZ_CONTEXT_COUNT];       /*!< Adaptive probabilities of the subband */
+} SQZ_checkpoint_t;
+
+/**
+ * \brief           Last lines reconstructed for a DWT level whose detail subbands are all zero, see \ref SQZ_idwt_sparse
+ */
+typedef struct
+{
+    SQZ_dwt_coefficient_t* line[2];             /*!< Last two lines reconstructed */
+    size_t index[2];                            /*!< Indexes of those lines, `SIZE_MAX` if none */
+    size_t width;                               /*!< Width of the level */
+    size_t height;                              /*!< Height of the level */
+    size_t next;                                /*!< Line buffer to be used next */
+} SQZ_idwt_line_cache_t;
+
 /**
  * \brief           Structure used to store the codec internal state
  */
 typedef struct
 {
-    SQZ_spectral_plane_t plane[SQZ_SPECTRAL_PLANES];    /*!< Spectral planes for this image*/
+    SQZ_spectral_plane_t* plane;                /*!< Spectral planes for this image, allocated for its number of planes */
+    SQZ_schedule_t schedule[SQZ_SPECTRAL_PLANES];       /*!< Processing schedule in use, per plane */
     SQZ_dwt_coefficient_t* data;                /*!< Pointer to the buffer holding the pixel data for this image */
     SQZ_bit_buffer_t buffer;                    /*!< I/O bit-wise buffer storing the compressed data */
     SQZ_image_descriptor_t image;               /*!< Image descriptor holding the relevant image information */
+    uint32_t extensions;                        /*!< Header extension flags, see \ref SQZ_header_extension_t */
+    SQZ_roi_t roi;                              /*!< Regions of interest in use */
+    int chroma_floor;                           /*!< Lowest bitplane coded in the chroma planes, 0 or 1 if unlimited */
+    size_t chroma_budget;                       /*!< Maximum number of bytes spent on the chroma planes, 0 if unlimited */
+    size_t chroma_bits;                         /*!< Number of bits spent so far on the chroma planes */
+    int round;                                  /*!< Round in which the scheduler stopped */
+    size_t rounds;                              /*!< Number of rounds completed by the scheduler, over all the levels in resolution order */
+    SQZ_schedule_cursor_t cursor;               /*!< Position of the scheduler, to resume decoding */
+    SQZ_checkpoint_t checkpoint;                /*!< State before the last task of the scheduler */
+    int sparse;                                 /*!< Specifies whether the coefficients are only stored for the subbands reached, each on its own */
+    uint32_t band_differences;                  /*!< Bands of a multispectral image coded as their difference to the previous band */
+    uint32_t band_output;                       /*!< Bands of a multispectral image to be output when decoding, 0 for all */
+    SQZ_yuv_format_t const* yuv_format;         /*!< Layout of the YUV frame being encoded, `NULL` for interleaved samples */
+    SQZ_sequence_context_t const* sequence;     /*!< Previous frame of a sequence, that the coefficients are residuals to, or `NULL` */
+    SQZ_workspace_context_t* workspace;         /*!< Workspace the buffers are taken from, or `NULL` to allocate them */
 } SQZ_context_t;
 
 typedef SQZ_status_t (*SQZ_init_subband_fn)(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx, SQZ_bit_buffer_t* const buffer);
 
 typedef int (*SQZ_bitplane_task_fn)(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer);
 
-static uint8_t const SQZ_number_of_planes[SQZ_COLOR_MODE_COUNT] = { 1u, 3u, 3u, 3u, };
+/**
+ * \brief           Number of spectral planes per color mode, 0 if given by the image descriptor
+ */
+static uint8_t const SQZ_number_of_planes[SQZ_COLOR_MODE_COUNT] = { 1u, 3u, 3u, 3u, 0u, 3u, };
 
 /**
  * \brief           Codec processing schedule defining the starting rounds for each subband, per level, plane and color mode
+ * \note            Every band of a multispectral image uses the schedule of the grayscale plane, and Y'CbCr uses that of YCoCg-R
  */
-static uint8_t const SQZ_schedule[SQZ_COLOR_MODE_COUNT][SQZ_SPECTRAL_PLANES][SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS] =
+static uint8_t const SQZ_schedule[SQZ_COLOR_MODE_MULTISPECTRAL][SQZ_COLOR_PLANES][SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS] =
 {
     /* Grayscale */
     {
@@ -561,6 +1188,7 @@ static uint8_t const SQZ_schedule[SQZ_COLOR_MODE_COUNT][SQZ_SPECTRAL_PLANES][SQZ
 };
 
 #undef SQZ_SPECTRAL_PLANES
+#undef SQZ_COLOR_PLANES
 
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -651,6 +1279,7 @@ SQZ_bit_buffer_init(SQZ_bit_buffer_t* const buffer, void* const source, size_t c
     buffer->data = buffer->ptr = (uint8_t*)source;
     buffer->eob = buffer->data + capacity;
     buffer->index = 0u;
+    buffer->arithmetic = 0;
 }
 
 static int
@@ -677,21 +1306,231 @@ SQZ_bit_buffer_bits_used(SQZ_bit_buffer_t const * const buffer)
     return ((buffer->ptr - buffer->data) * CHAR_BIT) + buffer->index;
 }
 
-#define SQZ_BIT_BUFFER_MSB  ((sizeof(uint8_t) * CHAR_BIT) - 1u)
+/**
+ * \brief           Precision of the probabilities used by the arithmetic coder, in bits
+ * \hideinitializer
+ */
+#define SQZ_ARITHMETIC_PRECISION    16
 
-static int
-SQZ_bit_buffer_write_bit(SQZ_bit_buffer_t* const buffer, uint32_t const bit)
+/**
+ * \brief           Adaptation rate of the probabilities, as a right shift of the prediction error
+ * \hideinitializer
+ */
+#define SQZ_ARITHMETIC_RATE         5
+
+/**
+ * \brief           Initial probability of a context, also used for the bits coded without a context
+ * \hideinitializer
+ */
+#define SQZ_ARITHMETIC_HALF         (1u << (SQZ_ARITHMETIC_PRECISION - 1))
+
+/**
+ * \brief           Mask of the top byte of the arithmetic coder interval bounds
+ * \hideinitializer
+ */
+#define SQZ_ARITHMETIC_TOP          0xFF000000u
+
+/**
+ * \brief           Switches a bit buffer to arithmetic coding, starting at the next byte boundary
+ * \note            The coder is carry-less, so every byte it outputs is final and any prefix of its output
+ *                  remains decodable
+ * \param[in,out]   buffer: The bit buffer to write to
+ */
+static void
+SQZ_arithmetic_encoder_init(SQZ_bit_buffer_t* const buffer)
 {
 #ifdef DEBUG
     if (buffer == NULL)
     {
-        return 0;
+        return;
     }
 #endif
-    if (SQZ_bit_buffer_eob(buffer))
+    if (buffer->index > 0u)
     {
-        return 0;
-    }
+        buffer->ptr++;
+        buffer->index = 0u;
+    }
+    buffer->low = 0u;
+    buffer->high = UINT32_MAX;
+    buffer->arithmetic = 1;
+}
+
+/**
+ * \brief           Switches a bit buffer to arithmetic decoding, starting at the next byte boundary
+ * \note            The decoder reads 4 bytes ahead of the encoder output, and `ptr` tracks the encoder position,
+ *                  so the number of bits used is the same on both sides
+ * \param[in,out]   buffer: The bit buffer to read from
+ */
+static void
+SQZ_arithmetic_decoder_init(SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return;
+    }
+#endif
+    if (buffer->index > 0u)
+    {
+        buffer->ptr++;
+        buffer->index = 0u;
+    }
+    buffer->low = 0u;
+    buffer->high = UINT32_MAX;
+    buffer->code = 0u;
+    buffer->arithmetic = 1;
+    if ((buffer->ptr >= buffer->eob) || (buffer->eob - buffer->ptr < 4))
+    {
+        buffer->ptr = buffer->eob;
+        return;
+    }
+    for (size_t i = 0u; i < 4u; ++i)
+    {
+        buffer->code = (buffer->code << 8u) | buffer->ptr[i];
+    }
+}
+
+/**
+ * \brief           Outputs the bytes required to decode all the bits coded so far
+ * \param[in,out]   buffer: The bit buffer to write to
+ */
+static void
+SQZ_arithmetic_encoder_flush(SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return;
+    }
+#endif
+    for (size_t i = 0u; (i < 4u) && (buffer->ptr < buffer->eob); ++i)
+    {
+        *(buffer->ptr++) = (uint8_t)(buffer->low >> 24u);
+        buffer->low <<= 8u;
+    }
+}
+
+/**
+ * \brief           Codes a bit with the arithmetic coder
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \param           bit: The bit to code
+ * \param[in,out]   probability: Probability of the bit being set, updated after coding, or `NULL` for an equiprobable bit
+ * \return          1 if the bit was coded, 0 if the buffer is exhausted
+ */
+static int
+SQZ_arithmetic_encode_bit(SQZ_bit_buffer_t* const buffer, uint32_t const bit, uint16_t* const probability)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return 0;
+    }
+#endif
+    if (SQZ_bit_buffer_eob(buffer))
+    {
+        return 0;
+    }
+    uint32_t const p = (probability != NULL) ? *probability : SQZ_ARITHMETIC_HALF;
+    uint32_t const middle = buffer->low + (uint32_t)(((uint64_t)(buffer->high - buffer->low) * p) >> SQZ_ARITHMETIC_PRECISION);
+    if (bit)
+    {
+        buffer->high = middle;
+        if (probability != NULL)
+        {
+            *probability += ((1u << SQZ_ARITHMETIC_PRECISION) - p) >> SQZ_ARITHMETIC_RATE;
+        }
+    }
+    else
+    {
+        buffer->low = middle + 1u;
+        if (probability != NULL)
+        {
+            *probability -= p >> SQZ_ARITHMETIC_RATE;
+        }
+    }
+    while (((buffer->low ^ buffer->high) & SQZ_ARITHMETIC_TOP) == 0u)
+    {
+        if (SQZ_bit_buffer_eob(buffer))
+        {
+            break;
+        }
+        *(buffer->ptr++) = (uint8_t)(buffer->high >> 24u);
+        buffer->low <<= 8u;
+        buffer->high = (buffer->high << 8u) | 0xFFu;
+    }
+    return 1;
+}
+
+/**
+ * \brief           Decodes a bit with the arithmetic coder
+ * \note            Decoding stops as soon as a byte past the end of the buffer would be needed, so that no bit is
+ *                  ever decoded from missing data
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \param[in,out]   probability: Probability of the bit being set, updated after decoding, or `NULL` for an equiprobable bit
+ * \return          The decoded bit, or -1 if the buffer is exhausted
+ */
+static int32_t
+SQZ_arithmetic_decode_bit(SQZ_bit_buffer_t* const buffer, uint16_t* const probability)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+#endif
+    if (SQZ_bit_buffer_eob(buffer))
+    {
+        return -1;
+    }
+    uint32_t const p = (probability != NULL) ? *probability : SQZ_ARITHMETIC_HALF;
+    uint32_t const middle = buffer->low + (uint32_t)(((uint64_t)(buffer->high - buffer->low) * p) >> SQZ_ARITHMETIC_PRECISION);
+    int32_t const bit = (buffer->code <= middle);
+    if (bit)
+    {
+        buffer->high = middle;
+        if (probability != NULL)
+        {
+            *probability += ((1u << SQZ_ARITHMETIC_PRECISION) - p) >> SQZ_ARITHMETIC_RATE;
+        }
+    }
+    else
+    {
+        buffer->low = middle + 1u;
+        if (probability != NULL)
+        {
+            *probability -= p >> SQZ_ARITHMETIC_RATE;
+        }
+    }
+    while (((buffer->low ^ buffer->high) & SQZ_ARITHMETIC_TOP) == 0u)
+    {
+        if (buffer->eob - buffer->ptr <= 4)
+        {
+            buffer->ptr = buffer->eob;
+            break;
+        }
+        buffer->code = (buffer->code << 8u) | buffer->ptr[4];
+        buffer->ptr++;
+        buffer->low <<= 8u;
+        buffer->high = (buffer->high << 8u) | 0xFFu;
+    }
+    return bit;
+}
+
+#define SQZ_BIT_BUFFER_MSB  ((sizeof(uint8_t) * CHAR_BIT) - 1u)
+
+static int
+SQZ_bit_buffer_write_bit(SQZ_bit_buffer_t* const buffer, uint32_t const bit)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return 0;
+    }
+#endif
+    if (SQZ_bit_buffer_eob(buffer))
+    {
+        return 0;
+    }
     *(buffer->ptr) |= bit << (SQZ_BIT_BUFFER_MSB - buffer->index);
     if (buffer->index < SQZ_BIT_BUFFER_MSB)
     {
@@ -714,6 +1553,16 @@ SQZ_bit_buffer_write_bits(SQZ_bit_buffer_t* const buffer, uint32_t const bits, u
         return 0;
     }
 #endif
+    if (buffer->arithmetic)
+    {
+        /* only used for a few fields, so they are simply coded as equiprobable bits */
+        int result = 1;
+        while ((width > 0u) && (result))
+        {
+            result = SQZ_arithmetic_encode_bit(buffer, (bits >> --width) & 1u, NULL);
+        }
+        return result;
+    }
     do
     {
         if (SQZ_bit_buffer_eob(buffer))
@@ -779,6 +1628,20 @@ SQZ_bit_buffer_read_bits(SQZ_bit_buffer_t* const buffer, uint32_t width)
     }
 #endif
     int32_t bits = 0;
+    if (buffer->arithmetic)
+    {
+        while (width > 0u)
+        {
+            int32_t const bit = SQZ_arithmetic_decode_bit(buffer, NULL);
+            if (bit < 0)
+            {
+                return -1;
+            }
+            bits = (bits << 1) | bit;
+            --width;
+        }
+        return bits;
+    }
     do
     {
         if (SQZ_bit_buffer_eob(buffer))
@@ -811,10 +1674,118 @@ SQZ_bit_buffer_read_bits(SQZ_bit_buffer_t* const buffer, uint32_t width)
     return bits;
 }
 
+/**
+ * \brief           Writes a bit, arithmetic coded with the given context if the buffer is in arithmetic mode
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \param           bit: The bit to write
+ * \param[in,out]   probability: The context of the bit
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_bit_buffer_encode_bit(SQZ_bit_buffer_t* const buffer, uint32_t const bit, uint16_t* const probability)
+{
+    return (buffer->arithmetic) ? SQZ_arithmetic_encode_bit(buffer, bit, probability) : SQZ_bit_buffer_write_bit(buffer, bit);
+}
+
+/**
+ * \brief           Reads a bit, arithmetic decoded with the given context if the buffer is in arithmetic mode
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \param[in,out]   probability: The context of the bit
+ * \return          The bit read, or -1 if the buffer is exhausted
+ */
+static int32_t
+SQZ_bit_buffer_decode_bit(SQZ_bit_buffer_t* const buffer, uint16_t* const probability)
+{
+    return (buffer->arithmetic) ? SQZ_arithmetic_decode_bit(buffer, probability) : SQZ_bit_buffer_read_bit(buffer);
+}
+
 #undef SQZ_BIT_BUFFER_MSB
 
+/**
+ * \brief           Takes a buffer from a workspace, the smallest free one large enough
+ * \note            Failing that, a free buffer is replaced by a larger one, or a new one is added, so that a workspace
+ *                  serving the same requests as before doesn't allocate
+ * \param[in,out]   workspace: The workspace, or `NULL` to allocate the buffer
+ * \param           size: Size of the buffer, in bytes
+ * \param           clear: Specifies whether the buffer is zeroed
+ * \return          The buffer, or `NULL` if out of memory
+ */
+static void*
+SQZ_workspace_alloc(SQZ_workspace_context_t* const workspace, size_t const size, int const clear)
+{
+    if (workspace == NULL)
+    {
+        return (clear) ? calloc(size, 1u) : malloc(size);
+    }
+    SQZ_workspace_block_t* block = NULL;
+    for (size_t i = 0u; i < workspace->count; ++i)
+    {
+        SQZ_workspace_block_t* const candidate = &workspace->blocks[i];
+        if ((!candidate->used) && ((block == NULL) || ((block->size < size) ? candidate->size > block->size : (candidate->size >= size) && (candidate->size < block->size))))
+        {
+            block = candidate;
+        }
+    }
+    if ((block == NULL) && (workspace->count == workspace->capacity))
+    {
+        size_t const capacity = (workspace->capacity > 0u) ? workspace->capacity << 1u : 16u;
+        SQZ_workspace_block_t* const blocks = (SQZ_workspace_block_t*)realloc(workspace->blocks, capacity * sizeof(SQZ_workspace_block_t));
+        if (blocks == NULL)
+        {
+            return NULL;
+        }
+        workspace->blocks = blocks;
+        workspace->capacity = capacity;
+    }
+    if (block == NULL)
+    {
+        block = &workspace->blocks[workspace->count++];
+        *block = (SQZ_workspace_block_t){ NULL, 0u, 0 };
+    }
+    if (block->size < size)
+    {
+        /* the largest free buffer is still too small, its contents needn't be kept */
+        free(block->data);
+        block->data = malloc((size > 0u) ? size : 1u);
+        block->size = (block->data != NULL) ? size : 0u;
+        if (block->data == NULL)
+        {
+            return NULL;
+        }
+    }
+    if (clear)
+    {
+        memset(block->data, 0, size);
+    }
+    block->used = 1;
+    return block->data;
+}
+
+/**
+ * \brief           Returns a buffer to a workspace, for the next requests
+ * \param[in,out]   workspace: The workspace the buffer was taken from, or `NULL` to free it
+ * \param[in]       data: The buffer, or `NULL`
+ */
+static void
+SQZ_workspace_release(SQZ_workspace_context_t* const workspace, void* const data)
+{
+    if ((workspace == NULL) || (data == NULL))
+    {
+        free(data);
+        return;
+    }
+    for (size_t i = 0u; i < workspace->count; ++i)
+    {
+        if (workspace->blocks[i].data == data)
+        {
+            workspace->blocks[i].used = 0;
+            return;
+        }
+    }
+}
+
 static SQZ_status_t
-SQZ_node_cache_init(SQZ_list_node_cache_t* const cache, size_t const capacity)
+SQZ_node_cache_init(SQZ_list_node_cache_t* const cache, size_t const capacity, SQZ_workspace_context_t* const workspace)
 {
 #ifdef DEBUG
     if ((cache == NULL) || (capacity == 0u))
@@ -822,7 +1793,7 @@ SQZ_node_cache_init(SQZ_list_node_cache_t* const cache, size_t const capacity)
         return SQZ_INVALID_PARAMETER;
     }
 #endif
-    cache->nodes = (SQZ_list_node_t*)calloc(capacity, sizeof(SQZ_list_node_t));
+    cache->nodes = (SQZ_list_node_t*)SQZ_workspace_alloc(workspace, capacity * sizeof(SQZ_list_node_t), 1);
     if (cache->nodes == NULL)
     {
         return SQZ_OUT_OF_MEMORY;
@@ -934,6 +1905,50 @@ SQZ_list_exchange(SQZ_list_t* restrict const source, SQZ_list_t* restrict const
     return next;
 }
 
+/**
+ * \brief           Completes a walk over the source list that relinked each of its nodes, either keeping it or appending
+ *                  it to the destination list, updating both lists once instead of for every node exchanged
+ * \warning         Assumes that neither of the list pointers are `NULL`, and that both lists share the same node cache
+ *                  but are not the same
+ * \param[in,out]   source: Source list, whose head was set to the first node kept, if any
+ * \param[in,out]   dest: Destination list, whose head was set to the first node appended, if it was empty
+ * \param[in,out]   kept: Last node kept in the source list, or `NULL` if none
+ * \param[in,out]   moved: Last node of the destination list, or `NULL` if it's empty
+ * \param[in]       rest: First node of the source list that the walk didn't reach, or `NULL` if it completed
+ * \param           count: Number of nodes appended to the destination list
+ */
+static void
+SQZ_list_partition(SQZ_list_t* restrict const source, SQZ_list_t* restrict const dest, SQZ_list_node_t* const kept, SQZ_list_node_t* const moved,
+    SQZ_list_node_t* const rest, size_t const count)
+{
+#ifdef DEBUG
+    if ((source == NULL) || (dest == NULL) || (source == dest) || (source->cache != dest->cache))
+    {
+        return;
+    }
+#endif
+    SQZ_list_node_t* const base = source->cache->nodes;
+    if (kept != NULL)
+    {
+        kept->next = (rest != NULL) ? rest - base : SQZ_LIST_NULL;
+    }
+    else
+    {
+        source->head = rest;
+    }
+    if (rest == NULL)
+    {
+        source->tail = kept;
+    }
+    if (moved != NULL)
+    {
+        moved->next = SQZ_LIST_NULL;
+    }
+    dest->tail = moved;
+    source->length -= count;
+    dest->length += count;
+}
+
 /**
  * \brief           Merges the source list into the destination list, clearing the source list
  * \warning         Assumes that neither of the list pointers are `NULL`, and that both lists
@@ -968,57 +1983,157 @@ SQZ_list_merge(SQZ_list_t* const source, SQZ_list_t* const dest)
     source->head = source->tail = NULL;
 }
 
-#undef SQZ_LIST_NULL
-
-static int
-SQZ_scan_raster(SQZ_scan_context_t* const ctx)
+/**
+ * \brief           Moves the nodes following a given one in the source list to the head of the destination list
+ * \warning         Assumes that neither of the list pointers are `NULL`, and that both lists share the same node cache
+ *                  but are not the same
+ * \param[in,out]   source: Source list
+ * \param[in]       tail: Node of the source list after which it is split, or `NULL` to move all its nodes
+ * \param           length: Number of nodes of the source list up to `tail`
+ * \param[in,out]   dest: Destination list
+ */
+static void
+SQZ_list_split(SQZ_list_t* const source, SQZ_list_node_t* const tail, size_t const length, SQZ_list_t* const dest)
 {
 #ifdef DEBUG
-    if (ctx == NULL)
+    if ((source == NULL) || (dest == NULL) || (source == dest) || (source->cache != dest->cache))
     {
-        return 0;
+        return;
     }
 #endif
-    ++ctx->x;
-    if (ctx->x >= ctx->width)
+    if (source->length <= length)
     {
-        ctx->x = 0u;
-        ++ctx->y;
-        if (ctx->y >= ctx->height)
-        {
-            return 0;
-        }
+        return;
     }
-    return 1;
-}
-
-static SQZ_status_t
-SQZ_scan_init_raster_context(SQZ_scan_context_t* const ctx, size_t const width, size_t const height)
-{
-#ifdef DEBUG
-    if ((ctx == NULL) || (width == 0u) || (height == 0u))
+    SQZ_list_node_t* const base = source->cache->nodes;
+    SQZ_list_node_t* const first = (tail != NULL) ? base + tail->next : source->head;
+    if (dest->head != NULL)
     {
-        return SQZ_INVALID_PARAMETER;
+        source->tail->next = dest->head - base;
     }
-#endif
-    if (ctx->type != SQZ_SCAN_ORDER_RASTER)
+    else
     {
-        ctx->type = SQZ_SCAN_ORDER_RASTER;
+        dest->tail = source->tail;
+    }
+    dest->head = first;
+    dest->length += source->length - length;
+    source->length = length;
+    source->tail = tail;
+    if (tail != NULL)
+    {
+        tail->next = SQZ_LIST_NULL;
+    }
+    else
+    {
+        source->head = NULL;
     }
-    ctx->scan = SQZ_scan_raster;
-    ctx->x = ctx->y = 0u;
-    ctx->width = width;
-    ctx->height = height;
-    return SQZ_RESULT_OK;
 }
 
-static int
-SQZ_scan_snake(SQZ_scan_context_t* const ctx)
+/**
+ * \brief           Inserts the nodes of the source list back into the destination list, in the order of the node cache,
+ *                  clearing the source list
+ * \note            The destination list must be in the order of the node cache, and the source list made of runs in
+ *                  that order, as when the nodes were exchanged from the destination list by one or more passes
+ * \param[in,out]   source: Source list
+ * \param[in,out]   dest: Destination list
+ */
+static void
+SQZ_list_reinsert(SQZ_list_t* const source, SQZ_list_t* const dest)
 {
 #ifdef DEBUG
-    if ((ctx == NULL) || (ctx->workspace == NULL))
+    if ((source == NULL) || (dest == NULL) || (source == dest) || (source->cache != dest->cache))
     {
-        return 0;
+        return;
+    }
+#endif
+    SQZ_list_node_t* const base = source->cache->nodes;
+    SQZ_list_node_t *node = source->head, *previous = NULL, *current = dest->head;
+    while (node != NULL)
+    {
+        SQZ_list_node_t* const next = SQZ_list_node_next(node, base);
+        if ((previous != NULL) && (node < previous))
+        {
+            /* a new run starts, search from the head again */
+            previous = NULL;
+            current = dest->head;
+        }
+        while ((current != NULL) && (current < node))
+        {
+            previous = current;
+            current = SQZ_list_node_next(current, base);
+        }
+        node->next = (current != NULL) ? current - base : SQZ_LIST_NULL;
+        if (previous != NULL)
+        {
+            previous->next = node - base;
+        }
+        else
+        {
+            dest->head = node;
+        }
+        if (current == NULL)
+        {
+            dest->tail = node;
+        }
+        dest->length++;
+        previous = node;
+        node = next;
+    }
+    source->length = 0u;
+    source->head = source->tail = NULL;
+}
+
+#undef SQZ_LIST_NULL
+
+static int
+SQZ_scan_raster(SQZ_scan_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return 0;
+    }
+#endif
+    ++ctx->x;
+    if (ctx->x >= ctx->width)
+    {
+        ctx->x = 0u;
+        ++ctx->y;
+        if (ctx->y >= ctx->height)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static SQZ_status_t
+SQZ_scan_init_raster_context(SQZ_scan_context_t* const ctx, size_t const width, size_t const height)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (width == 0u) || (height == 0u))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    if (ctx->type != SQZ_SCAN_ORDER_RASTER)
+    {
+        ctx->type = SQZ_SCAN_ORDER_RASTER;
+    }
+    ctx->scan = SQZ_scan_raster;
+    ctx->x = ctx->y = 0u;
+    ctx->width = width;
+    ctx->height = height;
+    return SQZ_RESULT_OK;
+}
+
+static int
+SQZ_scan_snake(SQZ_scan_context_t* const ctx)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (ctx->workspace == NULL))
+    {
+        return 0;
     }
 #endif
     SQZ_snake_scan_context_t* const snake = (SQZ_snake_scan_context_t*)ctx->workspace;
@@ -1413,270 +2528,630 @@ SQZ_scan_init(SQZ_scan_context_t* const ctx, SQZ_dwt_subband_t const * const ban
 #define SQZ_COLOR_8BPC_LEVEL_OFFSET 128
 #define SQZ_COLOR_CLIP(v) (((v) < 0) ? 0u : ((v) > 255 ? 255u : (uint8_t)(v)))
 
+/**
+ * \brief           Table of the kernels with variants for the instruction set extensions of the CPU, see \ref SQZ_kernels
+ * \note            The sign-magnitude conversions and the maximum are whole buffer passes, and the lifting steps
+ *                  apply to the lines of the vertical DWT passes, each line being updated from two others, which
+ *                  may alias it. The bitplane passes run the sorting and refinement passes of a subband, with the bit
+ *                  IO and the run codes inlined. All the variants give the exact same results as the scalar code
+ */
+typedef struct
+{
+    char const* name;                           /*!< Name of the instruction set extension, as given to the `SQZ_CPU` environment variable */
+    void (*to_sign_magnitude)(SQZ_dwt_coefficient_t* const data, size_t const length);
+    void (*from_sign_magnitude)(SQZ_dwt_coefficient_t* const data, size_t const length);
+    SQZ_dwt_coefficient_t (*max)(SQZ_dwt_coefficient_t const * const data, size_t const length, SQZ_dwt_coefficient_t const initial);
+    void (*dwt_predict)(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse);
+    void (*dwt_update)(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse);
+    void (*ycocg_r_forward)(uint8_t const * const source, SQZ_dwt_coefficient_t* const Y, SQZ_dwt_coefficient_t* const Co, SQZ_dwt_coefficient_t* const Cg, size_t const length);
+    void (*ycocg_r_inverse)(SQZ_dwt_coefficient_t const * const Y, SQZ_dwt_coefficient_t const * const Co, SQZ_dwt_coefficient_t const * const Cg, uint8_t* const dest, size_t const length);
+    SQZ_bitplane_task_fn encode_bitplane;
+    SQZ_bitplane_task_fn decode_bitplane;
+} SQZ_kernels_t;
+
+static int SQZ_encode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer);
+static int SQZ_decode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer);
+
 static void
-SQZ_color_process_grayscale(SQZ_context_t* const ctx, void* const buffer, int const read)
+SQZ_kernel_to_sign_magnitude_scalar(SQZ_dwt_coefficient_t* const data, size_t const length)
 {
-#ifdef DEBUG
-    if ((ctx == NULL) || (buffer == NULL))
+    for (size_t i = 0u; i < length; ++i)
     {
-        return;
+        data[i] = (data[i] < 0) ? (-2 * data[i]) | 1 : 2 * data[i];
     }
-#endif
-    SQZ_dwt_coefficient_t* const data = ctx->data;
-    uint8_t * const ptr = (uint8_t*)buffer;
-    size_t const length = ctx->image.width * ctx->image.height;
-    if (read)
+}
+
+static void
+SQZ_kernel_from_sign_magnitude_scalar(SQZ_dwt_coefficient_t* const data, size_t const length)
+{
+    for (size_t i = 0u; i < length; ++i)
     {
-        for (size_t i = 0u; i < length; ++i)
+        data[i] = (data[i] & 1) ? - (data[i] >> 1) : data[i] >> 1;
+    }
+}
+
+static SQZ_dwt_coefficient_t
+SQZ_kernel_max_scalar(SQZ_dwt_coefficient_t const * const data, size_t const length, SQZ_dwt_coefficient_t const initial)
+{
+    SQZ_dwt_coefficient_t max = initial;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        if (data[i] > max)
         {
-            data[i] = ((SQZ_dwt_coefficient_t)ptr[i]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            max = data[i];
+        }
+    }
+    return max;
+}
+
+/**
+ * \brief           Predict step of the 5/3 lifting scheme, applied to a line from its two neighbors
+ * \param[in,out]   line: The line of odd coefficients
+ * \param[in]       a: The previous line
+ * \param[in]       b: The next line
+ * \param           length: Number of coefficients in the lines
+ * \param           inverse: Specifies whether the step is undone, for the inverse DWT
+ */
+static void
+SQZ_kernel_dwt_predict_scalar(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    if (inverse)
+    {
+        for (size_t k = 0u; k < length; ++k)
+        {
+            line[k] += (((int32_t)a[k]) + ((int32_t)b[k])) >> 1;
         }
     }
     else
     {
-        for (size_t i = 0u; i < length; ++i)
+        for (size_t k = 0u; k < length; ++k)
         {
-            SQZ_dwt_coefficient_t v = data[i] + SQZ_COLOR_8BPC_LEVEL_OFFSET;
-            ptr[i] = (v < 0) ? 0u : (v > 255 ? 255u : (uint8_t)v);
+            line[k] -= (((int32_t)a[k]) + ((int32_t)b[k])) >> 1;
         }
     }
 }
 
-/*
-Based on "YCoCg-R: A Color Space with RGB Reversibility and Low Dynamic Range" - by Henrique Malvar
-and Gary Sullivan - [https://wftp3.itu.int/av-arch/jvt-site/2003_09_SanDiego/JVT-I014r3.doc]
-*/
-
+/**
+ * \brief           Update step of the 5/3 lifting scheme, applied to a line from its two neighbors
+ * \param[in,out]   line: The line of even coefficients
+ * \param[in]       a: The previous line
+ * \param[in]       b: The next line
+ * \param           length: Number of coefficients in the lines
+ * \param           inverse: Specifies whether the step is undone, for the inverse DWT
+ */
 static void
-SQZ_color_process_ycocg_r(SQZ_context_t* const ctx, void* const buffer, int const read)
+SQZ_kernel_dwt_update_scalar(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
 {
-#ifdef DEBUG
-    if ((ctx == NULL) || (buffer == NULL))
-    {
-        return;
-    }
-#endif
-    SQZ_dwt_coefficient_t * restrict Y = ctx->plane[0].data, * restrict Co = ctx->plane[1].data, * restrict Cg = ctx->plane[2].data;
-    uint8_t* ptr = (uint8_t*)buffer;
-    size_t const length = ctx->image.width * ctx->image.height;
-    if (read)
+    if (inverse)
     {
-        for (size_t i = 0u; i < length; ++i)
+        for (size_t k = 0u; k < length; ++k)
         {
-            SQZ_dwt_coefficient_t const R = *ptr++, G = *ptr++, B = *ptr++, t = (R + B) >> 1;
-            *Y++ = ((t + G) >> 1) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
-            *Co++ = R - B;
-            *Cg++ = G - t;
+            line[k] -= (((int32_t)a[k]) + ((int32_t)b[k]) + 2) >> 2;
         }
     }
     else
     {
-        for (size_t i = 0u; i < length; ++i)
+        for (size_t k = 0u; k < length; ++k)
         {
-            SQZ_dwt_coefficient_t const Y_ = (*Y++) + SQZ_COLOR_8BPC_LEVEL_OFFSET, Co_ = (*Co++), Cg_ = (*Cg++);
-            SQZ_dwt_coefficient_t const B = Y_ + ((1 - Cg_) >> 1) - (Co_ >> 1);
-            SQZ_dwt_coefficient_t const G = Y_ - ((-Cg_) >> 1);
-            SQZ_dwt_coefficient_t const R = Co_ + B;
-            *ptr++ = SQZ_COLOR_CLIP(R);
-            *ptr++ = SQZ_COLOR_CLIP(G);
-            *ptr++ = SQZ_COLOR_CLIP(B);
+            line[k] += (((int32_t)a[k]) + ((int32_t)b[k]) + 2) >> 2;
         }
     }
 }
 
-#undef SQZ_COLOR_8BPC_LEVEL_OFFSET
-
 /*
-Based on "Oklab - A perceptual color space for image processing" - by Björn Ottosson
-                [https://bottosson.github.io/posts/oklab/]
-
-Oklab <-> sRGB conversion is based on "Porting OkLab colorspace to integer arithmetic"
-    [https://blog.pkh.me/p/38-porting-oklab-colorspace-to-integer-arithmetic.html]
-
-Accuracy was traded-off for performance whenever needed, 12bpc are used for Oklab
+Based on "YCoCg-R: A Color Space with RGB Reversibility and Low Dynamic Range" - by Henrique Malvar
+and Gary Sullivan - [https://wftp3.itu.int/av-arch/jvt-site/2003_09_SanDiego/JVT-I014r3.doc]
 */
 
-#define SQZ_COLOR_LINEAR_PRECISION          16
-#define SQZ_COLOR_LINEAR_MAX                ((1 << SQZ_COLOR_LINEAR_PRECISION) - 1)
-#define SQZ_COLOR_LINEAR_TO_SRGB_PRECISION  9
-#define SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE   ((1 << SQZ_COLOR_LINEAR_TO_SRGB_PRECISION) - 1)
+static void
+SQZ_kernel_ycocg_r_forward_scalar(uint8_t const * const source, SQZ_dwt_coefficient_t* const Y, SQZ_dwt_coefficient_t* const Co, SQZ_dwt_coefficient_t* const Cg, size_t const length)
+{
+    uint8_t const* ptr = source;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        SQZ_dwt_coefficient_t const R = *ptr++, G = *ptr++, B = *ptr++, t = (R + B) >> 1;
+        Y[i] = ((t + G) >> 1) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+        Co[i] = R - B;
+        Cg[i] = G - t;
+    }
+}
 
-static const uint16_t SQZ_sRGB_to_linear[256] =
+static void
+SQZ_kernel_ycocg_r_inverse_scalar(SQZ_dwt_coefficient_t const * const Y, SQZ_dwt_coefficient_t const * const Co, SQZ_dwt_coefficient_t const * const Cg, uint8_t* const dest, size_t const length)
 {
-    0x0000, 0x0014, 0x0028, 0x003C, 0x0050, 0x0063, 0x0077, 0x008B,
-    0x009F, 0x00B3, 0x00C7, 0x00DB, 0x00F1, 0x0108, 0x0120, 0x0139,
-    0x0154, 0x016F, 0x018C, 0x01AB, 0x01CA, 0x01EB, 0x020E, 0x0232,
-    0x0257, 0x027D, 0x02A5, 0x02CE, 0x02F9, 0x0325, 0x0353, 0x0382,
-    0x03B3, 0x03E5, 0x0418, 0x044D, 0x0484, 0x04BC, 0x04F6, 0x0532,
-    0x056F, 0x05AD, 0x05ED, 0x062F, 0x0673, 0x06B8, 0x06FE, 0x0747,
-    0x0791, 0x07DD, 0x082A, 0x087A, 0x08CA, 0x091D, 0x0972, 0x09C8,
-    0x0A20, 0x0A79, 0x0AD5, 0x0B32, 0x0B91, 0x0BF2, 0x0C55, 0x0CBA,
-    0x0D20, 0x0D88, 0x0DF2, 0x0E5E, 0x0ECC, 0x0F3C, 0x0FAE, 0x1021,
-    0x1097, 0x110E, 0x1188, 0x1203, 0x1280, 0x1300, 0x1381, 0x1404,
-    0x1489, 0x1510, 0x159A, 0x1625, 0x16B2, 0x1741, 0x17D3, 0x1866,
-    0x18FB, 0x1993, 0x1A2C, 0x1AC8, 0x1B66, 0x1C06, 0x1CA7, 0x1D4C,
-    0x1DF2, 0x1E9A, 0x1F44, 0x1FF1, 0x20A0, 0x2150, 0x2204, 0x22B9,
-    0x2370, 0x242A, 0x24E5, 0x25A3, 0x2664, 0x2726, 0x27EB, 0x28B1,
-    0x297B, 0x2A46, 0x2B14, 0x2BE3, 0x2CB6, 0x2D8A, 0x2E61, 0x2F3A,
-    0x3015, 0x30F2, 0x31D2, 0x32B4, 0x3399, 0x3480, 0x3569, 0x3655,
-    0x3742, 0x3833, 0x3925, 0x3A1A, 0x3B12, 0x3C0B, 0x3D07, 0x3E06,
-    0x3F07, 0x400A, 0x4110, 0x4218, 0x4323, 0x4430, 0x453F, 0x4651,
-    0x4765, 0x487C, 0x4995, 0x4AB1, 0x4BCF, 0x4CF0, 0x4E13, 0x4F39,
-    0x5061, 0x518C, 0x52B9, 0x53E9, 0x551B, 0x5650, 0x5787, 0x58C1,
-    0x59FE, 0x5B3D, 0x5C7E, 0x5DC2, 0x5F09, 0x6052, 0x619E, 0x62ED,
-    0x643E, 0x6591, 0x66E8, 0x6840, 0x699C, 0x6AFA, 0x6C5B, 0x6DBE,
-    0x6F24, 0x708D, 0x71F8, 0x7366, 0x74D7, 0x764A, 0x77C0, 0x7939,
-    0x7AB4, 0x7C32, 0x7DB3, 0x7F37, 0x80BD, 0x8246, 0x83D1, 0x855F,
-    0x86F0, 0x8884, 0x8A1B, 0x8BB4, 0x8D50, 0x8EEF, 0x9090, 0x9235,
-    0x93DC, 0x9586, 0x9732, 0x98E2, 0x9A94, 0x9C49, 0x9E01, 0x9FBB,
-    0xA179, 0xA339, 0xA4FC, 0xA6C2, 0xA88B, 0xAA56, 0xAC25, 0xADF6,
-    0xAFCA, 0xB1A1, 0xB37B, 0xB557, 0xB737, 0xB919, 0xBAFF, 0xBCE7,
-    0xBED2, 0xC0C0, 0xC2B1, 0xC4A5, 0xC69C, 0xC895, 0xCA92, 0xCC91,
-    0xCE94, 0xD099, 0xD2A1, 0xD4AD, 0xD6BB, 0xD8CC, 0xDAE0, 0xDCF7,
-    0xDF11, 0xE12E, 0xE34E, 0xE571, 0xE797, 0xE9C0, 0xEBEC, 0xEE1B,
-    0xF04D, 0xF282, 0xF4BA, 0xF6F5, 0xF933, 0xFB74, 0xFDB8, 0xFFFF,
-};
+    uint8_t* ptr = dest;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        SQZ_dwt_coefficient_t const Y_ = Y[i] + SQZ_COLOR_8BPC_LEVEL_OFFSET, Co_ = Co[i], Cg_ = Cg[i];
+        SQZ_dwt_coefficient_t const B = Y_ + ((1 - Cg_) >> 1) - (Co_ >> 1);
+        SQZ_dwt_coefficient_t const G = Y_ - ((-Cg_) >> 1);
+        SQZ_dwt_coefficient_t const R = Co_ + B;
+        *ptr++ = SQZ_COLOR_CLIP(R);
+        *ptr++ = SQZ_COLOR_CLIP(G);
+        *ptr++ = SQZ_COLOR_CLIP(B);
+    }
+}
 
-static const uint8_t SQZ_linear_to_sRGB[SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE + 1] =
+static SQZ_kernels_t const SQZ_kernels_scalar =
 {
-    0x00, 0x06, 0x0D, 0x12, 0x16, 0x19, 0x1C, 0x1F, 0x22, 0x24, 0x26, 0x28, 0x2A, 0x2C, 0x2E, 0x30,
-    0x32, 0x33, 0x35, 0x36, 0x38, 0x39, 0x3B, 0x3C, 0x3D, 0x3E, 0x40, 0x41, 0x42, 0x43, 0x45, 0x46,
-    0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56,
-    0x56, 0x57, 0x58, 0x59, 0x5A, 0x5B, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F, 0x5F, 0x60, 0x61, 0x62, 0x62,
-    0x63, 0x64, 0x65, 0x65, 0x66, 0x67, 0x67, 0x68, 0x69, 0x6A, 0x6A, 0x6B, 0x6C, 0x6C, 0x6D, 0x6E,
-    0x6E, 0x6F, 0x6F, 0x70, 0x71, 0x71, 0x72, 0x73, 0x73, 0x74, 0x74, 0x75, 0x76, 0x76, 0x77, 0x77,
-    0x78, 0x79, 0x79, 0x7A, 0x7A, 0x7B, 0x7B, 0x7C, 0x7D, 0x7D, 0x7E, 0x7E, 0x7F, 0x7F, 0x80, 0x80,
-    0x81, 0x81, 0x82, 0x82, 0x83, 0x84, 0x84, 0x85, 0x85, 0x86, 0x86, 0x87, 0x87, 0x88, 0x88, 0x89,
-    0x89, 0x8A, 0x8A, 0x8B, 0x8B, 0x8C, 0x8C, 0x8C, 0x8D, 0x8D, 0x8E, 0x8E, 0x8F, 0x8F, 0x90, 0x90,
-    0x91, 0x91, 0x92, 0x92, 0x93, 0x93, 0x93, 0x94, 0x94, 0x95, 0x95, 0x96, 0x96, 0x97, 0x97, 0x97,
-    0x98, 0x98, 0x99, 0x99, 0x9A, 0x9A, 0x9A, 0x9B, 0x9B, 0x9C, 0x9C, 0x9C, 0x9D, 0x9D, 0x9E, 0x9E,
-    0x9F, 0x9F, 0x9F, 0xA0, 0xA0, 0xA1, 0xA1, 0xA1, 0xA2, 0xA2, 0xA3, 0xA3, 0xA3, 0xA4, 0xA4, 0xA5,
-    0xA5, 0xA5, 0xA6, 0xA6, 0xA6, 0xA7, 0xA7, 0xA8, 0xA8, 0xA8, 0xA9, 0xA9, 0xA9, 0xAA, 0xAA, 0xAB,
-    0xAB, 0xAB, 0xAC, 0xAC, 0xAC, 0xAD, 0xAD, 0xAE, 0xAE, 0xAE, 0xAF, 0xAF, 0xAF, 0xB0, 0xB0, 0xB0,
-    0xB1, 0xB1, 0xB1, 0xB2, 0xB2, 0xB3, 0xB3, 0xB3, 0xB4, 0xB4, 0xB4, 0xB5, 0xB5, 0xB5, 0xB6, 0xB6,
-    0xB6, 0xB7, 0xB7, 0xB7, 0xB8, 0xB8, 0xB8, 0xB9, 0xB9, 0xB9, 0xBA, 0xBA, 0xBA, 0xBB, 0xBB, 0xBB,
-    0xBC, 0xBC, 0xBC, 0xBD, 0xBD, 0xBD, 0xBE, 0xBE, 0xBE, 0xBF, 0xBF, 0xBF, 0xC0, 0xC0, 0xC0, 0xC1,
-    0xC1, 0xC1, 0xC1, 0xC2, 0xC2, 0xC2, 0xC3, 0xC3, 0xC3, 0xC4, 0xC4, 0xC4, 0xC5, 0xC5, 0xC5, 0xC6,
-    0xC6, 0xC6, 0xC6, 0xC7, 0xC7, 0xC7, 0xC8, 0xC8, 0xC8, 0xC9, 0xC9, 0xC9, 0xC9, 0xCA, 0xCA, 0xCA,
-    0xCB, 0xCB, 0xCB, 0xCC, 0xCC, 0xCC, 0xCC, 0xCD, 0xCD, 0xCD, 0xCE, 0xCE, 0xCE, 0xCE, 0xCF, 0xCF,
-    0xCF, 0xD0, 0xD0, 0xD0, 0xD0, 0xD1, 0xD1, 0xD1, 0xD2, 0xD2, 0xD2, 0xD2, 0xD3, 0xD3, 0xD3, 0xD4,
-    0xD4, 0xD4, 0xD4, 0xD5, 0xD5, 0xD5, 0xD6, 0xD6, 0xD6, 0xD6, 0xD7, 0xD7, 0xD7, 0xD7, 0xD8, 0xD8,
-    0xD8, 0xD9, 0xD9, 0xD9, 0xD9, 0xDA, 0xDA, 0xDA, 0xDA, 0xDB, 0xDB, 0xDB, 0xDC, 0xDC, 0xDC, 0xDC,
-    0xDD, 0xDD, 0xDD, 0xDD, 0xDE, 0xDE, 0xDE, 0xDE, 0xDF, 0xDF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE1,
-    0xE1, 0xE1, 0xE1, 0xE2, 0xE2, 0xE2, 0xE2, 0xE3, 0xE3, 0xE3, 0xE3, 0xE4, 0xE4, 0xE4, 0xE4, 0xE5,
-    0xE5, 0xE5, 0xE5, 0xE6, 0xE6, 0xE6, 0xE6, 0xE7, 0xE7, 0xE7, 0xE7, 0xE8, 0xE8, 0xE8, 0xE8, 0xE9,
-    0xE9, 0xE9, 0xE9, 0xEA, 0xEA, 0xEA, 0xEA, 0xEB, 0xEB, 0xEB, 0xEB, 0xEC, 0xEC, 0xEC, 0xEC, 0xED,
-    0xED, 0xED, 0xED, 0xEE, 0xEE, 0xEE, 0xEE, 0xEF, 0xEF, 0xEF, 0xEF, 0xEF, 0xF0, 0xF0, 0xF0, 0xF0,
-    0xF1, 0xF1, 0xF1, 0xF1, 0xF2, 0xF2, 0xF2, 0xF2, 0xF3, 0xF3, 0xF3, 0xF3, 0xF3, 0xF4, 0xF4, 0xF4,
-    0xF4, 0xF5, 0xF5, 0xF5, 0xF5, 0xF6, 0xF6, 0xF6, 0xF6, 0xF6, 0xF7, 0xF7, 0xF7, 0xF7, 0xF8, 0xF8,
-    0xF8, 0xF8, 0xF9, 0xF9, 0xF9, 0xF9, 0xF9, 0xFA, 0xFA, 0xFA, 0xFA, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB,
-    0xFC, 0xFC, 0xFC, 0xFC, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFE, 0xFE, 0xFE, 0xFE, 0xFF, 0xFF, 0xFF,
+    "scalar",
+    &SQZ_kernel_to_sign_magnitude_scalar,
+    &SQZ_kernel_from_sign_magnitude_scalar,
+    &SQZ_kernel_max_scalar,
+    &SQZ_kernel_dwt_predict_scalar,
+    &SQZ_kernel_dwt_update_scalar,
+    &SQZ_kernel_ycocg_r_forward_scalar,
+    &SQZ_kernel_ycocg_r_inverse_scalar,
+    &SQZ_encode_bitplane,
+    &SQZ_decode_bitplane,
 };
 
-static uint8_t
-SQZ_linear_i32_to_sRGB_u8(int32_t const v)
+/*
+The vector kernels compute the lifting steps in 16 bits without overflow, as floor((a + b) / 2) is (a & b) + ((a ^ b) >> 1),
+and floor((a + b + 2) / 4) is floor((floor((a + b) / 2) + 1) / 2). In the inverse YCoCg-R transform, (1 - Cg) >> 1 is
+-(Cg >> 1), and (-Cg) >> 1 is -((Cg >> 1) + (Cg & 1)), so that every sum wraps around just as the scalar code does when
+it stores its results to 16 bits
+*/
+
+#ifdef SQZ_SIMD_X86
+
+static void SQZ_TARGET("sse2")
+SQZ_kernel_to_sign_magnitude_sse2(SQZ_dwt_coefficient_t* const data, size_t const length)
 {
-    if (v <= 0)
+    size_t i = 0u;
+    for (; i + 8u <= length; i += 8u)
     {
-        return 0;
+        __m128i const v = _mm_loadu_si128((__m128i const*)(data + i));
+        __m128i const sign = _mm_srai_epi16(v, 15);
+        __m128i const magnitude = _mm_sub_epi16(_mm_xor_si128(v, sign), sign);
+        _mm_storeu_si128((__m128i*)(data + i), _mm_or_si128(_mm_slli_epi16(magnitude, 1), _mm_srli_epi16(sign, 15)));
     }
-    if (v >= SQZ_COLOR_LINEAR_MAX)
+    SQZ_kernel_to_sign_magnitude_scalar(data + i, length - i);
+}
+
+static void SQZ_TARGET("sse2")
+SQZ_kernel_from_sign_magnitude_sse2(SQZ_dwt_coefficient_t* const data, size_t const length)
+{
+    __m128i const one = _mm_set1_epi16(1);
+    size_t i = 0u;
+    for (; i + 8u <= length; i += 8u)
     {
-        return 0xFF;
+        __m128i const v = _mm_loadu_si128((__m128i const*)(data + i));
+        __m128i const sign = _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one));
+        __m128i const magnitude = _mm_srai_epi16(v, 1);
+        _mm_storeu_si128((__m128i*)(data + i), _mm_sub_epi16(_mm_xor_si128(magnitude, sign), sign));
     }
-    int32_t const vmul = v * SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE;
-    int32_t const offset = vmul >> SQZ_COLOR_LINEAR_PRECISION;
-    int32_t const interpoland = vmul & SQZ_COLOR_LINEAR_MAX;
-    int32_t const base = SQZ_linear_to_sRGB[offset];
-    return base + ((interpoland * (SQZ_linear_to_sRGB[offset + 1] - base)) >> SQZ_COLOR_LINEAR_PRECISION);
+    SQZ_kernel_from_sign_magnitude_scalar(data + i, length - i);
 }
 
-static int32_t
-SQZ_i32_cbrt_01(int32_t const v)
+static SQZ_dwt_coefficient_t SQZ_TARGET("sse2")
+SQZ_kernel_max_sse2(SQZ_dwt_coefficient_t const * const data, size_t const length, SQZ_dwt_coefficient_t const initial)
 {
-    if (v <= 0)
+    __m128i max = _mm_set1_epi16(initial);
+    size_t i = 0u;
+    for (; i + 8u <= length; i += 8u)
     {
-        return 0;
+        max = _mm_max_epi16(max, _mm_loadu_si128((__m128i const*)(data + i)));
     }
-    if (v >= SQZ_COLOR_LINEAR_MAX)
+    max = _mm_max_epi16(max, _mm_srli_si128(max, 8));
+    max = _mm_max_epi16(max, _mm_srli_si128(max, 4));
+    max = _mm_max_epi16(max, _mm_srli_si128(max, 2));
+    return SQZ_kernel_max_scalar(data + i, length - i, (SQZ_dwt_coefficient_t)_mm_cvtsi128_si32(max));
+}
+
+static __m128i SQZ_TARGET("sse2")
+SQZ_kernel_half_sum_sse2(__m128i const a, __m128i const b)
+{
+    return _mm_add_epi16(_mm_and_si128(a, b), _mm_srai_epi16(_mm_xor_si128(a, b), 1));
+}
+
+static void SQZ_TARGET("sse2")
+SQZ_kernel_dwt_predict_sse2(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m128i const sign = _mm_set1_epi16(inverse ? 0 : -1);
+    size_t k = 0u;
+    for (; k + 8u <= length; k += 8u)
     {
-        return SQZ_COLOR_LINEAR_MAX;
+        __m128i const delta = SQZ_kernel_half_sum_sse2(_mm_loadu_si128((__m128i const*)(a + k)), _mm_loadu_si128((__m128i const*)(b + k)));
+        __m128i const v = _mm_loadu_si128((__m128i const*)(line + k));
+        _mm_storeu_si128((__m128i*)(line + k), _mm_add_epi16(v, _mm_sub_epi16(_mm_xor_si128(delta, sign), sign)));
     }
-    int64_t root = ((v * (((v * (v - 144107LL)) >> SQZ_COLOR_LINEAR_PRECISION) + 132114LL)) >> SQZ_COLOR_LINEAR_PRECISION) + 14379LL;
-    for (int i = 0; i < 2; i++)
+    SQZ_kernel_dwt_predict_scalar(line + k, a + k, b + k, length - k, inverse);
+}
+
+static void SQZ_TARGET("sse2")
+SQZ_kernel_dwt_update_sse2(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m128i const sign = _mm_set1_epi16(inverse ? -1 : 0), one = _mm_set1_epi16(1);
+    size_t k = 0u;
+    for (; k + 8u <= length; k += 8u)
     {
-        int64_t const n = root * root * root, denominator = v + (n >> (SQZ_COLOR_LINEAR_PRECISION * 2 - 1));
-        root = (root * (2LL * v + (n >> (SQZ_COLOR_LINEAR_PRECISION * 2)))) / denominator;
+        __m128i const half = SQZ_kernel_half_sum_sse2(_mm_loadu_si128((__m128i const*)(a + k)), _mm_loadu_si128((__m128i const*)(b + k)));
+        __m128i const delta = SQZ_kernel_half_sum_sse2(half, one);
+        __m128i const v = _mm_loadu_si128((__m128i const*)(line + k));
+        _mm_storeu_si128((__m128i*)(line + k), _mm_add_epi16(v, _mm_sub_epi16(_mm_xor_si128(delta, sign), sign)));
     }
-    return (int32_t)root;
+    SQZ_kernel_dwt_update_scalar(line + k, a + k, b + k, length - k, inverse);
 }
 
-#define SQZ_COLOR_OKLAB_PRECISION   12
-#define SQZ_COLOR_OKLAB_MUL         (1LL << (SQZ_COLOR_LINEAR_PRECISION - SQZ_COLOR_OKLAB_PRECISION))
-#define SQZ_COLOR_OKLAB_LEVEL_OFFSET (1 << (SQZ_COLOR_OKLAB_PRECISION - 1))
+static SQZ_kernels_t const SQZ_kernels_sse2 =
+{
+    "sse2",
+    &SQZ_kernel_to_sign_magnitude_sse2,
+    &SQZ_kernel_from_sign_magnitude_sse2,
+    &SQZ_kernel_max_sse2,
+    &SQZ_kernel_dwt_predict_sse2,
+    &SQZ_kernel_dwt_update_sse2,
+    &SQZ_kernel_ycocg_r_forward_scalar,
+    &SQZ_kernel_ycocg_r_inverse_scalar,
+    &SQZ_encode_bitplane,
+    &SQZ_decode_bitplane,
+};
 
-static void
-SQZ_color_process_oklab(SQZ_context_t* const ctx, void* const buffer, int const read)
+static void SQZ_TARGET("avx2")
+SQZ_kernel_to_sign_magnitude_avx2(SQZ_dwt_coefficient_t* const data, size_t const length)
 {
-#ifdef DEBUG
-    if ((ctx == NULL) || (buffer == NULL))
+    size_t i = 0u;
+    for (; i + 16u <= length; i += 16u)
     {
-        return;
+        __m256i const v = _mm256_loadu_si256((__m256i const*)(data + i));
+        __m256i const sign = _mm256_srai_epi16(v, 15);
+        __m256i const magnitude = _mm256_sub_epi16(_mm256_xor_si256(v, sign), sign);
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_or_si256(_mm256_slli_epi16(magnitude, 1), _mm256_srli_epi16(sign, 15)));
     }
-#endif
-    SQZ_dwt_coefficient_t * restrict L = ctx->plane[0].data, * restrict a = ctx->plane[1].data, * restrict b = ctx->plane[2].data;
-    uint8_t* ptr = (uint8_t*)buffer;
-    size_t const length = ctx->image.width * ctx->image.height;
-    if (read)
+    SQZ_kernel_to_sign_magnitude_scalar(data + i, length - i);
+}
+
+static void SQZ_TARGET("avx2")
+SQZ_kernel_from_sign_magnitude_avx2(SQZ_dwt_coefficient_t* const data, size_t const length)
+{
+    __m256i const one = _mm256_set1_epi16(1);
+    size_t i = 0u;
+    for (; i + 16u <= length; i += 16u)
     {
-        for (size_t i = 0u; i < length; ++i)
+        __m256i const v = _mm256_loadu_si256((__m256i const*)(data + i));
+        __m256i const sign = _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(v, one));
+        __m256i const magnitude = _mm256_srai_epi16(v, 1);
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_sub_epi16(_mm256_xor_si256(magnitude, sign), sign));
+    }
+    SQZ_kernel_from_sign_magnitude_scalar(data + i, length - i);
+}
+
+static SQZ_dwt_coefficient_t SQZ_TARGET("avx2")
+SQZ_kernel_max_avx2(SQZ_dwt_coefficient_t const * const data, size_t const length, SQZ_dwt_coefficient_t const initial)
+{
+    __m256i max = _mm256_set1_epi16(initial);
+    size_t i = 0u;
+    for (; i + 16u <= length; i += 16u)
+    {
+        max = _mm256_max_epi16(max, _mm256_loadu_si256((__m256i const*)(data + i)));
+    }
+    __m128i reduced = _mm_max_epi16(_mm256_castsi256_si128(max), _mm256_extracti128_si256(max, 1));
+    reduced = _mm_max_epi16(reduced, _mm_srli_si128(reduced, 8));
+    reduced = _mm_max_epi16(reduced, _mm_srli_si128(reduced, 4));
+    reduced = _mm_max_epi16(reduced, _mm_srli_si128(reduced, 2));
+    return SQZ_kernel_max_scalar(data + i, length - i, (SQZ_dwt_coefficient_t)_mm_cvtsi128_si32(reduced));
+}
+
+static __m256i SQZ_TARGET("avx2")
+SQZ_kernel_half_sum_avx2(__m256i const a, __m256i const b)
+{
+    return _mm256_add_epi16(_mm256_and_si256(a, b), _mm256_srai_epi16(_mm256_xor_si256(a, b), 1));
+}
+
+static void SQZ_TARGET("avx2")
+SQZ_kernel_dwt_predict_avx2(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m256i const sign = _mm256_set1_epi16(inverse ? 0 : -1);
+    size_t k = 0u;
+    for (; k + 16u <= length; k += 16u)
+    {
+        __m256i const delta = SQZ_kernel_half_sum_avx2(_mm256_loadu_si256((__m256i const*)(a + k)), _mm256_loadu_si256((__m256i const*)(b + k)));
+        __m256i const v = _mm256_loadu_si256((__m256i const*)(line + k));
+        _mm256_storeu_si256((__m256i*)(line + k), _mm256_add_epi16(v, _mm256_sub_epi16(_mm256_xor_si256(delta, sign), sign)));
+    }
+    SQZ_kernel_dwt_predict_scalar(line + k, a + k, b + k, length - k, inverse);
+}
+
+static void SQZ_TARGET("avx2")
+SQZ_kernel_dwt_update_avx2(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m256i const sign = _mm256_set1_epi16(inverse ? -1 : 0), one = _mm256_set1_epi16(1);
+    size_t k = 0u;
+    for (; k + 16u <= length; k += 16u)
+    {
+        __m256i const half = SQZ_kernel_half_sum_avx2(_mm256_loadu_si256((__m256i const*)(a + k)), _mm256_loadu_si256((__m256i const*)(b + k)));
+        __m256i const delta = SQZ_kernel_half_sum_avx2(half, one);
+        __m256i const v = _mm256_loadu_si256((__m256i const*)(line + k));
+        _mm256_storeu_si256((__m256i*)(line + k), _mm256_add_epi16(v, _mm256_sub_epi16(_mm256_xor_si256(delta, sign), sign)));
+    }
+    SQZ_kernel_dwt_update_scalar(line + k, a + k, b + k, length - k, inverse);
+}
+
+/**
+ * \brief           Forward YCoCg-R transform of 8 pixels at a time, deinterleaved with SSSE3 byte shuffles
+ */
+static void SQZ_TARGET("avx2")
+SQZ_kernel_ycocg_r_forward_avx2(uint8_t const * const source, SQZ_dwt_coefficient_t* const Y, SQZ_dwt_coefficient_t* const Co, SQZ_dwt_coefficient_t* const Cg, size_t const length)
+{
+    __m128i const r_low = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1);
+    __m128i const r_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, -1, 5, -1);
+    __m128i const g_low = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1);
+    __m128i const g_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1, 3, -1, 6, -1);
+    __m128i const b_low = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+    __m128i const b_high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, -1, 4, -1, 7, -1);
+    __m128i const offset = _mm_set1_epi16(SQZ_COLOR_8BPC_LEVEL_OFFSET);
+    size_t i = 0u;
+    for (; i + 8u <= length; i += 8u)
+    {
+        __m128i const low = _mm_loadu_si128((__m128i const*)(source + 3u * i));
+        __m128i const high = _mm_loadl_epi64((__m128i const*)(source + 3u * i + 16u));
+        __m128i const R = _mm_or_si128(_mm_shuffle_epi8(low, r_low), _mm_shuffle_epi8(high, r_high));
+        __m128i const G = _mm_or_si128(_mm_shuffle_epi8(low, g_low), _mm_shuffle_epi8(high, g_high));
+        __m128i const B = _mm_or_si128(_mm_shuffle_epi8(low, b_low), _mm_shuffle_epi8(high, b_high));
+        __m128i const t = _mm_srai_epi16(_mm_add_epi16(R, B), 1);
+        _mm_storeu_si128((__m128i*)(Y + i), _mm_sub_epi16(_mm_srai_epi16(_mm_add_epi16(t, G), 1), offset));
+        _mm_storeu_si128((__m128i*)(Co + i), _mm_sub_epi16(R, B));
+        _mm_storeu_si128((__m128i*)(Cg + i), _mm_sub_epi16(G, t));
+    }
+    SQZ_kernel_ycocg_r_forward_scalar(source + 3u * i, Y + i, Co + i, Cg + i, length - i);
+}
+
+/**
+ * \brief           Inverse YCoCg-R transform of 8 pixels at a time, clipped by saturation and interleaved with SSSE3 byte shuffles
+ */
+static void SQZ_TARGET("avx2")
+SQZ_kernel_ycocg_r_inverse_avx2(SQZ_dwt_coefficient_t const * const Y, SQZ_dwt_coefficient_t const * const Co, SQZ_dwt_coefficient_t const * const Cg, uint8_t* const dest, size_t const length)
+{
+    __m128i const rg_low = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+    __m128i const b_low = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    __m128i const rg_high = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i const b_high = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i const offset = _mm_set1_epi16(SQZ_COLOR_8BPC_LEVEL_OFFSET), one = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+    size_t i = 0u;
+    for (; i + 8u <= length; i += 8u)
+    {
+        __m128i const Y_ = _mm_add_epi16(_mm_loadu_si128((__m128i const*)(Y + i)), offset);
+        __m128i const Co_ = _mm_loadu_si128((__m128i const*)(Co + i));
+        __m128i const Cg_ = _mm_loadu_si128((__m128i const*)(Cg + i));
+        __m128i const half = _mm_srai_epi16(Cg_, 1);
+        __m128i const B = _mm_sub_epi16(_mm_sub_epi16(Y_, half), _mm_srai_epi16(Co_, 1));
+        __m128i const G = _mm_add_epi16(Y_, _mm_add_epi16(half, _mm_and_si128(Cg_, one)));
+        __m128i const R = _mm_add_epi16(Co_, B);
+        __m128i const RG = _mm_packus_epi16(R, G);
+        __m128i const BB = _mm_packus_epi16(B, zero);
+        _mm_storeu_si128((__m128i*)(dest + 3u * i), _mm_or_si128(_mm_shuffle_epi8(RG, rg_low), _mm_shuffle_epi8(BB, b_low)));
+        _mm_storel_epi64((__m128i*)(dest + 3u * i + 16u), _mm_or_si128(_mm_shuffle_epi8(RG, rg_high), _mm_shuffle_epi8(BB, b_high)));
+    }
+    SQZ_kernel_ycocg_r_inverse_scalar(Y + i, Co + i, Cg + i, dest + 3u * i, length - i);
+}
+
+static int SQZ_TARGET("bmi,bmi2,lzcnt") SQZ_encode_bitplane_bmi2(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer);
+static int SQZ_TARGET("bmi,bmi2,lzcnt") SQZ_decode_bitplane_bmi2(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer);
+
+static SQZ_kernels_t const SQZ_kernels_avx2 =
+{
+    "avx2",
+    &SQZ_kernel_to_sign_magnitude_avx2,
+    &SQZ_kernel_from_sign_magnitude_avx2,
+    &SQZ_kernel_max_avx2,
+    &SQZ_kernel_dwt_predict_avx2,
+    &SQZ_kernel_dwt_update_avx2,
+    &SQZ_kernel_ycocg_r_forward_avx2,
+    &SQZ_kernel_ycocg_r_inverse_avx2,
+    &SQZ_encode_bitplane_bmi2,
+    &SQZ_decode_bitplane_bmi2,
+};
+
+static void SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_to_sign_magnitude_avx512(SQZ_dwt_coefficient_t* const data, size_t const length)
+{
+    size_t i = 0u;
+    for (; i + 32u <= length; i += 32u)
+    {
+        __m512i const v = _mm512_loadu_si512((void const*)(data + i));
+        __m512i const sign = _mm512_srai_epi16(v, 15);
+        __m512i const magnitude = _mm512_sub_epi16(_mm512_xor_si512(v, sign), sign);
+        _mm512_storeu_si512((void*)(data + i), _mm512_or_si512(_mm512_slli_epi16(magnitude, 1), _mm512_srli_epi16(sign, 15)));
+    }
+    SQZ_kernel_to_sign_magnitude_avx2(data + i, length - i);
+}
+
+static void SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_from_sign_magnitude_avx512(SQZ_dwt_coefficient_t* const data, size_t const length)
+{
+    __m512i const one = _mm512_set1_epi16(1);
+    size_t i = 0u;
+    for (; i + 32u <= length; i += 32u)
+    {
+        __m512i const v = _mm512_loadu_si512((void const*)(data + i));
+        __m512i const sign = _mm512_sub_epi16(_mm512_setzero_si512(), _mm512_and_si512(v, one));
+        __m512i const magnitude = _mm512_srai_epi16(v, 1);
+        _mm512_storeu_si512((void*)(data + i), _mm512_sub_epi16(_mm512_xor_si512(magnitude, sign), sign));
+    }
+    SQZ_kernel_from_sign_magnitude_avx2(data + i, length - i);
+}
+
+static SQZ_dwt_coefficient_t SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_max_avx512(SQZ_dwt_coefficient_t const * const data, size_t const length, SQZ_dwt_coefficient_t const initial)
+{
+    __m512i max = _mm512_set1_epi16(initial);
+    size_t i = 0u;
+    for (; i + 32u <= length; i += 32u)
+    {
+        max = _mm512_max_epi16(max, _mm512_loadu_si512((void const*)(data + i)));
+    }
+    SQZ_dwt_coefficient_t lanes[32];
+    _mm512_storeu_si512((void*)lanes, max);
+    return SQZ_kernel_max_avx2(data + i, length - i, SQZ_kernel_max_avx2(lanes, 32u, initial));
+}
+
+static __m512i SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_half_sum_avx512(__m512i const a, __m512i const b)
+{
+    return _mm512_add_epi16(_mm512_and_si512(a, b), _mm512_srai_epi16(_mm512_xor_si512(a, b), 1));
+}
+
+static void SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_dwt_predict_avx512(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m512i const sign = _mm512_set1_epi16(inverse ? 0 : -1);
+    size_t k = 0u;
+    for (; k + 32u <= length; k += 32u)
+    {
+        __m512i const delta = SQZ_kernel_half_sum_avx512(_mm512_loadu_si512((void const*)(a + k)), _mm512_loadu_si512((void const*)(b + k)));
+        __m512i const v = _mm512_loadu_si512((void const*)(line + k));
+        _mm512_storeu_si512((void*)(line + k), _mm512_add_epi16(v, _mm512_sub_epi16(_mm512_xor_si512(delta, sign), sign)));
+    }
+    SQZ_kernel_dwt_predict_avx2(line + k, a + k, b + k, length - k, inverse);
+}
+
+static void SQZ_TARGET("avx512f,avx512bw")
+SQZ_kernel_dwt_update_avx512(SQZ_dwt_coefficient_t* const line, SQZ_dwt_coefficient_t const * const a, SQZ_dwt_coefficient_t const * const b, size_t const length, int const inverse)
+{
+    __m512i const sign = _mm512_set1_epi16(inverse ? -1 : 0), one = _mm512_set1_epi16(1);
+    size_t k = 0u;
+    for (; k + 32u <= length; k += 32u)
+    {
+        __m512i const half = SQZ_kernel_half_sum_avx512(_mm512_loadu_si512((void const*)(a + k)), _mm512_loadu_si512((void const*)(b + k)));
+        __m512i const delta = SQZ_kernel_half_sum_avx512(half, one);
+        __m512i const v = _mm512_loadu_si512((void const*)(line + k));
+        _mm512_storeu_si512((void*)(line + k), _mm512_add_epi16(v, _mm512_sub_epi16(_mm512_xor_si512(delta, sign), sign)));
+    }
+    SQZ_kernel_dwt_update_avx2(line + k, a + k, b + k, length - k, inverse);
+}
+
+static SQZ_kernels_t const SQZ_kernels_avx512 =
+{
+    "avx512",
+    &SQZ_kernel_to_sign_magnitude_avx512,
+    &SQZ_kernel_from_sign_magnitude_avx512,
+    &SQZ_kernel_max_avx512,
+    &SQZ_kernel_dwt_predict_avx512,
+    &SQZ_kernel_dwt_update_avx512,
+    &SQZ_kernel_ycocg_r_forward_avx2,
+    &SQZ_kernel_ycocg_r_inverse_avx2,
+    &SQZ_encode_bitplane_bmi2,
+    &SQZ_decode_bitplane_bmi2,
+};
+
+/**
+ * \brief           Finds the instruction set extensions supported by the CPU, and enabled by the operating system
+ * \param[out]      sse2: Set if SSE2 is supported
+ * \param[out]      avx2: Set if AVX2 is supported
+ * \param[out]      avx512: Set if AVX-512F and AVX-512BW are supported
+ */
+static void
+SQZ_cpu_detect(int* const sse2, int* const avx2, int* const avx512)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int const leaves = info[0];
+    __cpuid(info, 1);
+    *sse2 = !!(info[3] & (1 << 26));
+    int const ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 0x06u) == 0x06u);
+    int const zmm = ymm && ((_xgetbv(0) & 0xE6u) == 0xE6u);
+    *avx2 = *avx512 = 0;
+    if (leaves >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        *avx2 = ymm && (info[1] & (1 << 5));
+        *avx512 = zmm && (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+    }
+#else
+    __builtin_cpu_init();
+    *sse2 = __builtin_cpu_supports("sse2");
+    /* the bitplane passes of the AVX2 kernels are compiled for BMI2 and LZCNT, found along it in every CPU */
+    *avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("lzcnt");
+    *avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+}
+
+#endif /* SQZ_SIMD_X86 */
+
+/**
+ * \brief           Selects the kernels for the best instruction set extension supported by the CPU
+ * \note            The `SQZ_CPU` environment variable can select a lesser one, for testing and benchmarking, and is
+ *                  ignored if it names one that isn't supported
+ * \return          The kernels to use
+ */
+static SQZ_kernels_t const*
+SQZ_kernels_select(void)
+{
+    SQZ_kernels_t const* supported[4] = { &SQZ_kernels_scalar };
+    size_t count = 1u;
+#if defined(SQZ_SIMD_X86)
+    int sse2, avx2, avx512;
+    SQZ_cpu_detect(&sse2, &avx2, &avx512);
+    if (sse2)
+    {
+        supported[count++] = &SQZ_kernels_sse2;
+        if (avx2)
         {
-            int32_t const R = (int32_t)SQZ_sRGB_to_linear[*ptr++];
-            int32_t const G = (int32_t)SQZ_sRGB_to_linear[*ptr++];
-            int32_t const B = (int32_t)SQZ_sRGB_to_linear[*ptr++];
-            int32_t const l = SQZ_i32_cbrt_01((int32_t)((27015LL * R + 35149LL * G +  3372LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
-            int32_t const m = SQZ_i32_cbrt_01((int32_t)((13887LL * R + 44610LL * G +  7038LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
-            int32_t const s = SQZ_i32_cbrt_01((int32_t)(( 5787LL * R + 18462LL * G + 41286LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
-            *L++ =(( 862L * l + 3250L * m -   17L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION) - SQZ_COLOR_OKLAB_LEVEL_OFFSET;
-            *a++ = (8100L * l - 9945L * m + 1845L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION;
-            *b++ = ( 106L * l + 3205L * m - 3311L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION;
+            supported[count++] = &SQZ_kernels_avx2;
+            if (avx512)
+            {
+                supported[count++] = &SQZ_kernels_avx512;
+            }
         }
     }
-    else
+#endif
+    char const* const name = getenv("SQZ_CPU");
+    for (size_t i = 0u; (name != NULL) && (i < count); ++i)
     {
-        for (size_t i = 0u; i < length; ++i)
+        if (strcmp(name, supported[i]->name) == 0)
         {
-            SQZ_dwt_coefficient_t const L_ = (*L++) + SQZ_COLOR_OKLAB_LEVEL_OFFSET, a_ = (*a++), b_ = (*b++);
-            int64_t const l_ = L_ * SQZ_COLOR_OKLAB_MUL + ((25974LL * a_ + 14143LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
-            int64_t const m_ = L_ * SQZ_COLOR_OKLAB_MUL + ((-6918LL * a_ -  4185LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
-            int64_t const s_ = L_ * SQZ_COLOR_OKLAB_MUL + ((-5864LL * a_ - 84638LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
-            int64_t const l = (l_ * l_ * l_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
-            int64_t const m = (m_ * m_ * m_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
-            int64_t const s = (s_ * s_ * s_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
-            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((267169LL * l - 216771LL * m +  15137LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
-            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((-83127LL * l + 171030LL * m -  22368LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
-            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((  -275LL * l -  46099LL * m + 111909LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
+            return supported[i];
         }
     }
+    return supported[count - 1u];
 }
 
-#undef SQZ_COLOR_OKLAB_PRECISION
-#undef SQZ_COLOR_OKLAB_MUL
-#undef SQZ_COLOR_OKLAB_LEVEL_OFFSET
-#undef SQZ_COLOR_LINEAR_PRECISION
-#undef SQZ_COLOR_LINEAR_MAX
-#undef SQZ_COLOR_LINEAR_TO_SRGB_PRECISION
-#undef SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE
-
-#define SQZ_COLOR_LOGL1_LEVEL_OFFSET    221
+/**
+ * \brief           Gets the kernels in use, selected on first use
+ * \note            The cached pointer is only accessed atomically, concurrent first uses all selecting and storing the
+ *                  same kernels, and without atomics the kernels are selected on each call
+ * \return          The kernels to use
+ */
+static SQZ_kernels_t const*
+SQZ_kernels(void)
+{
+#if defined(SQZ_C11_ATOMICS)
+    static _Atomic(SQZ_kernels_t const*) kernels = NULL;
+    SQZ_kernels_t const* cached = atomic_load_explicit(&kernels, memory_order_acquire);
+    if (cached == NULL)
+    {
+        cached = SQZ_kernels_select();
+        atomic_store_explicit(&kernels, cached, memory_order_release);
+    }
+    return cached;
+#elif defined(__GNUC__) || defined(__clang__)
+    static SQZ_kernels_t const* kernels = NULL;
+    SQZ_kernels_t const* cached = __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+    if (cached == NULL)
+    {
+        cached = SQZ_kernels_select();
+        __atomic_store_n(&kernels, cached, __ATOMIC_RELEASE);
+    }
+    return cached;
+#elif defined(_MSC_VER)
+    static void* volatile kernels = NULL;
+    void* cached = _InterlockedCompareExchangePointer(&kernels, NULL, NULL);
+    if (cached == NULL)
+    {
+        cached = (void*)SQZ_kernels_select();
+        _InterlockedExchangePointer(&kernels, cached);
+    }
+    return (SQZ_kernels_t const*)cached;
+#else
+    return SQZ_kernels_select();
+#endif
+}
 
-/*
-Based on "Exploiting context dependence for image compression with upsampling" - by Jarek Duda
-                            [https://arxiv.org/abs/2004.03391]
-*/
 
 static void
-SQZ_color_process_logl1(SQZ_context_t* const ctx, void* const buffer, int const read)
+SQZ_color_process_grayscale(SQZ_context_t* const ctx, void* const buffer, int const read)
 {
 #ifdef DEBUG
     if ((ctx == NULL) || (buffer == NULL))
@@ -1684,991 +3159,4709 @@ SQZ_color_process_logl1(SQZ_context_t* const ctx, void* const buffer, int const
         return;
     }
 #endif
-    SQZ_dwt_coefficient_t * restrict Y = ctx->plane[0].data, * restrict c0 = ctx->plane[1].data, * restrict c1 = ctx->plane[2].data;
-    uint8_t* ptr = (uint8_t*)buffer;
+    SQZ_dwt_coefficient_t* const data = ctx->data;
+    uint8_t * const ptr = (uint8_t*)buffer;
     size_t const length = ctx->image.width * ctx->image.height;
     if (read)
     {
         for (size_t i = 0u; i < length; ++i)
         {
-            SQZ_dwt_coefficient_t const R = *ptr++, G = *ptr++, B = *ptr++;
-            *Y++ = (( 33779 * R + 41184 * G + 38182 * B) >> 16) - SQZ_COLOR_LOGL1_LEVEL_OFFSET;
-            *c0++ = (-52830 * R +  8188 * G + 37906 * B) >> 16;
-            *c1++ = ( 19051 * R - 50317 * G + 37420 * B) >> 16;
-
+            data[i] = ((SQZ_dwt_coefficient_t)ptr[i]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+        }
+    }
+    else if (ctx->extensions & SQZ_HEADER_EXTENSION_GRAY)
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            SQZ_dwt_coefficient_t v = data[i] + SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            ptr[3u * i] = ptr[3u * i + 1u] = ptr[3u * i + 2u] = (v < 0) ? 0u : (v > 255 ? 255u : (uint8_t)v);
         }
     }
     else
     {
         for (size_t i = 0u; i < length; ++i)
         {
-            SQZ_dwt_coefficient_t const Y_ = (*Y++) + SQZ_COLOR_LOGL1_LEVEL_OFFSET, c0_ = (*c0++), c1_ = (*c1++);
-            SQZ_dwt_coefficient_t const R = (33779 * Y_ - 52830 * c0_ + 19051 * c1_) >> 16;
-            SQZ_dwt_coefficient_t const G = (41184 * Y_ +  8188 * c0_ - 50317 * c1_) >> 16;
-            SQZ_dwt_coefficient_t const B = (38182 * Y_ + 37906 * c0_ + 37420 * c1_) >> 16;
-            *ptr++ = SQZ_COLOR_CLIP(R);
-            *ptr++ = SQZ_COLOR_CLIP(G);
-            *ptr++ = SQZ_COLOR_CLIP(B);
+            SQZ_dwt_coefficient_t v = data[i] + SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            ptr[i] = (v < 0) ? 0u : (v > 255 ? 255u : (uint8_t)v);
         }
     }
 }
 
-#undef SQZ_COLOR_LOGL1_LEVEL_OFFSET
-#undef SQZ_COLOR_CLIP
-
 static void
-SQZ_color_process(SQZ_context_t* const ctx, void* const buffer, int const read)
+SQZ_color_process_ycocg_r(SQZ_context_t* const ctx, void* const buffer, int const read)
 {
-    switch (ctx->image.color_mode)
-    {
-    case SQZ_COLOR_MODE_GRAYSCALE:
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
     {
-        SQZ_color_process_grayscale(ctx, buffer, read);
-        break;
+        return;
     }
-    case SQZ_COLOR_MODE_YCOCG_R:
+#endif
+    size_t const length = ctx->image.width * ctx->image.height;
+    if (read)
     {
-        SQZ_color_process_ycocg_r(ctx, buffer, read);
-        break;
+        SQZ_kernels()->ycocg_r_forward((uint8_t const*)buffer, ctx->plane[0].data, ctx->plane[1].data, ctx->plane[2].data, length);
     }
-    case SQZ_COLOR_MODE_OKLAB:
+    else
     {
-        SQZ_color_process_oklab(ctx, buffer, read);
-        break;
+        SQZ_kernels()->ycocg_r_inverse(ctx->plane[0].data, ctx->plane[1].data, ctx->plane[2].data, (uint8_t*)buffer, length);
     }
-    case SQZ_COLOR_MODE_LOG_L1:
+}
+
+/**
+ * \brief           Finds the bands of a multispectral image needed to output the selected ones
+ * \param[in]       ctx: The codec context
+ * \return          Mask of the bands selected for output, along with those they were coded as differences to,
+ *                  or of all the planes for the other color modes
+ */
+static uint32_t
+SQZ_color_bands_needed(SQZ_context_t const * const ctx)
+{
+    size_t const num_planes = ctx->image.num_planes;
+    uint32_t needed = (ctx->band_output != 0u) ? ctx->band_output : (uint32_t)((1u << num_planes) - 1u);
+    for (size_t plane = num_planes - 1u; plane > 0u; --plane)
     {
-        SQZ_color_process_logl1(ctx, buffer, read);
-        break;
-    }
-    default:
-        break;
+        if (needed & ctx->band_differences & (1u << plane))
+        {
+            needed |= 1u << (plane - 1u);
+        }
     }
+    return needed;
 }
 
 /**
- * \brief           Finds the maximum of the coefficient values in a subband
- * \note            Assumes that all of the subband coefficients have been converted to an explicit
- *                  sign-magnitude representation, forgoing the need to check against absolute values
- * \param[in]       band: The subband to be scanned
- * \return          Maximum coefficient value present in the subband
+ * \brief           Finds the number of interleaved samples per pixel of the output
+ * \param[in]       ctx: The codec context
+ * \return          Number of bands selected for output, 3 for a gray image given as RGB, or the number of spectral planes
  */
-static SQZ_dwt_coefficient_t
-SQZ_dwt_get_max(SQZ_dwt_subband_t* const band)
+static size_t
+SQZ_color_output_planes(SQZ_context_t const * const ctx)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (band->data == NULL))
+    if (ctx->extensions & SQZ_HEADER_EXTENSION_GRAY)
     {
-        return 0;
+        return 3u;
     }
-#endif
-    size_t const width = band->width, height = band->height;
-    SQZ_dwt_coefficient_t *ptr, max = *band->data;
-    for (size_t y = 0u; y < height; ++y)
+    size_t count = 0u;
+    for (uint32_t bands = ctx->band_output; bands != 0u; bands &= bands - 1u)
     {
-        ptr = band->data + y * band->stride;
-        for (size_t x = 0u; x < width; ++x)
-        {
-            if (ptr[x] > max)
-            {
-                max = ptr[x];
-            }
-        }
+        ++count;
     }
-    return max;
+    return (count > 0u) ? count : ctx->image.num_planes;
 }
 
+/**
+ * \brief           Fills an image descriptor with the information about a decoded image
+ * \note            A gray image given as RGB is described as a grayscale one with 3 planes, the channels of the output
+ * \param[in]       ctx: The codec context, with the header decoded
+ * \param[out]      descriptor: The image descriptor
+ */
 static void
-SQZ_dwt_convert_to_sign_magnitude(SQZ_context_t* const ctx)
+SQZ_color_describe(SQZ_context_t const * const ctx, SQZ_image_descriptor_t* const descriptor)
 {
-#ifdef DEBUG
-    if (ctx == NULL)
-    {
-        return;
-    }
-#endif
-    SQZ_dwt_coefficient_t* const data = ctx->data;
-    size_t const size = ctx->image.width * ctx->image.height * ctx->image.num_planes;
-    for (size_t i = 0u; i < size; ++i)
+    memcpy(descriptor, &ctx->image, sizeof(*descriptor));
+    if (ctx->extensions & SQZ_HEADER_EXTENSION_GRAY)
     {
-        data[i] = (data[i] < 0) ? (-2 * data[i]) | 1 : 2 * data[i];
+        descriptor->num_planes = SQZ_color_output_planes(ctx);
     }
 }
 
+/**
+ * \brief           Converts between the interleaved bands of a multispectral image and its spectral planes
+ * \note            The bands flagged in the context are coded as their difference to the previous band, which is exactly
+ *                  reversible. When writing, only the bands needed for those selected for output are reconstructed, and
+ *                  only the selected ones are stored
+ * \param[in,out]   ctx: The codec context
+ * \param[in,out]   buffer: The interleaved 8-bit samples
+ * \param           read: Specifies whether the samples are read into the spectral planes, or written from them
+ */
 static void
-SQZ_dwt_convert_from_sign_magnitude(SQZ_context_t* const ctx)
+SQZ_color_process_multispectral(SQZ_context_t* const ctx, void* const buffer, int const read)
 {
 #ifdef DEBUG
-    if (ctx == NULL)
+    if ((ctx == NULL) || (buffer == NULL))
     {
         return;
     }
 #endif
+    size_t const num_planes = ctx->image.num_planes, length = ctx->image.width * ctx->image.height;
+    uint32_t const differences = ctx->band_differences;
+    uint8_t* ptr = (uint8_t*)buffer;
+    if (read)
+    {
+        for (size_t i = 0u; i < length; ++i, ptr += num_planes)
+        {
+            ctx->plane[0].data[i] = ((SQZ_dwt_coefficient_t)ptr[0]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            for (size_t plane = 1u; plane < num_planes; ++plane)
+            {
+                ctx->plane[plane].data[i] = ((SQZ_dwt_coefficient_t)ptr[plane]) - ((differences & (1u << plane)) ? (SQZ_dwt_coefficient_t)ptr[plane - 1u] : SQZ_COLOR_8BPC_LEVEL_OFFSET);
+            }
+        }
+    }
+    else
+    {
+        uint32_t const needed = SQZ_color_bands_needed(ctx), output = (ctx->band_output != 0u) ? ctx->band_output : needed;
+        for (size_t i = 0u; i < length; ++i)
+        {
+            int32_t previous = 0;
+            for (size_t plane = 0u; plane < num_planes; ++plane)
+            {
+                if (needed & (1u << plane))
+                {
+                    /* the previous band is needed whenever this one was differenced, so it was just reconstructed */
+                    int32_t const v = (int32_t)ctx->plane[plane].data[i] + ((differences & (1u << plane)) ? previous : SQZ_COLOR_8BPC_LEVEL_OFFSET);
+                    if (output & (1u << plane))
+                    {
+                        *ptr++ = SQZ_COLOR_CLIP(v);
+                    }
+                    previous = v;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * \brief           Converts between RGB, or a YUV 4:2:0 frame, and the Y'CbCr spectral planes with half resolution chroma
+ * \note            When reading, the chroma samples are stored at the positions of the LL subband of the first DWT
+ *                  decomposition, the rest of the chroma planes being cleared. RGB pixels are converted with the full
+ *                  range BT.601 matrix, the chroma being averaged over each 2x2 block, while the samples of a YUV frame
+ *                  are used as they are. When writing, the chroma planes have been interpolated to full resolution by
+ *                  the inverse DWT, so each pixel is converted back to RGB
+ * \param[in,out]   ctx: The codec context, whose YUV frame layout, if any, describes the buffer being read
+ * \param[in,out]   buffer: The interleaved RGB pixels, or the YUV frame
+ * \param           read: Specifies whether the samples are read into the spectral planes, or written from them
+ */
+static void
+SQZ_color_process_ycbcr_420(SQZ_context_t* const ctx, void* const buffer, int const read)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return;
+    }
+#endif
+    SQZ_dwt_coefficient_t * restrict Y = ctx->plane[0].data, * restrict Cb = ctx->plane[1].data, * restrict Cr = ctx->plane[2].data;
+    size_t const width = ctx->image.width, height = ctx->image.height, length = width * height;
+    uint8_t* ptr = (uint8_t*)buffer;
+    if (read)
+    {
+        size_t const chroma_width = (width + 1u) >> 1u, chroma_height = (height + 1u) >> 1u;
+        memset(Cb, 0, length * sizeof(SQZ_dwt_coefficient_t));
+        memset(Cr, 0, length * sizeof(SQZ_dwt_coefficient_t));
+        if (ctx->yuv_format != NULL)
+        {
+            uint8_t const * const U = ptr + length;
+            int const interleaved = (*ctx->yuv_format == SQZ_YUV_FORMAT_NV12);
+            size_t const step = (interleaved) ? 2u : 1u;
+            uint8_t const * const V = (interleaved) ? U + 1u : U + chroma_width * chroma_height;
+            for (size_t i = 0u; i < length; ++i)
+            {
+                Y[i] = ((SQZ_dwt_coefficient_t)ptr[i]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            }
+            for (size_t y = 0u; y < chroma_height; ++y)
+            {
+                for (size_t x = 0u; x < chroma_width; ++x)
+                {
+                    size_t const i = (y * chroma_width + x) * step;
+                    Cb[2u * y * width + x] = ((SQZ_dwt_coefficient_t)U[i]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+                    Cr[2u * y * width + x] = ((SQZ_dwt_coefficient_t)V[i]) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+                }
+            }
+        }
+        else
+        {
+            for (size_t i = 0u; i < length; ++i, ptr += 3)
+            {
+                Y[i] = ((19595 * ptr[0] + 38470 * ptr[1] + 7471 * ptr[2] + 32768) >> 16) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            }
+            ptr = (uint8_t*)buffer;
+            for (size_t y = 0u; y < chroma_height; ++y)
+            {
+                for (size_t x = 0u; x < chroma_width; ++x)
+                {
+                    /* sums of the 2x2 block, offset to keep them positive, so that the average rounds to nearest */
+                    int32_t cb = 0, cr = 0, count = 0;
+                    for (size_t j = 2u * y; (j < 2u * y + 2u) && (j < height); ++j)
+                    {
+                        for (size_t i = 2u * x; (i < 2u * x + 2u) && (i < width); ++i, ++count)
+                        {
+                            int32_t const R = ptr[(j * width + i) * 3u], G = ptr[(j * width + i) * 3u + 1u], B = ptr[(j * width + i) * 3u + 2u];
+                            cb += -11058 * R - 21710 * G + 32768 * B + (SQZ_COLOR_8BPC_LEVEL_OFFSET << 16);
+                            cr +=  32768 * R - 27439 * G -  5329 * B + (SQZ_COLOR_8BPC_LEVEL_OFFSET << 16);
+                        }
+                    }
+                    Cb[2u * y * width + x] = (SQZ_dwt_coefficient_t)((cb + (count << 15)) / (count << 16)) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+                    Cr[2u * y * width + x] = (SQZ_dwt_coefficient_t)((cr + (count << 15)) / (count << 16)) - SQZ_COLOR_8BPC_LEVEL_OFFSET;
+                }
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            /* the chroma is clamped to its 8 bit range first, so that the products can't overflow */
+            int32_t const Y_ = (int32_t)(*Y++) + SQZ_COLOR_8BPC_LEVEL_OFFSET;
+            int32_t const Cb_ = (*Cb < -128) ? -128 : ((*Cb > 127) ? 127 : *Cb);
+            int32_t const Cr_ = (*Cr < -128) ? -128 : ((*Cr > 127) ? 127 : *Cr);
+            ++Cb, ++Cr;
+            int32_t const R = Y_ + ((91881 * Cr_ + 32768) >> 16);
+            int32_t const G = Y_ + ((-22554 * Cb_ - 46802 * Cr_ + 32768) >> 16);
+            int32_t const B = Y_ + ((116130 * Cb_ + 32768) >> 16);
+            *ptr++ = SQZ_COLOR_CLIP(R);
+            *ptr++ = SQZ_COLOR_CLIP(G);
+            *ptr++ = SQZ_COLOR_CLIP(B);
+        }
+    }
+}
+
+#undef SQZ_COLOR_8BPC_LEVEL_OFFSET
+
+/*
+Based on "Oklab - A perceptual color space for image processing" - by Björn Ottosson
+                [https://bottosson.github.io/posts/oklab/]
+
+Oklab <-> sRGB conversion is based on "Porting OkLab colorspace to integer arithmetic"
+    [https://blog.pkh.me/p/38-porting-oklab-colorspace-to-integer-arithmetic.html]
+
+Accuracy was traded-off for performance whenever needed, 12bpc are used for Oklab
+*/
+
+#define SQZ_COLOR_LINEAR_PRECISION          16
+#define SQZ_COLOR_LINEAR_MAX                ((1 << SQZ_COLOR_LINEAR_PRECISION) - 1)
+#define SQZ_COLOR_LINEAR_TO_SRGB_PRECISION  9
+#define SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE   ((1 << SQZ_COLOR_LINEAR_TO_SRGB_PRECISION) - 1)
+
+static const uint16_t SQZ_sRGB_to_linear[256] =
+{
+    0x0000, 0x0014, 0x0028, 0x003C, 0x0050, 0x0063, 0x0077, 0x008B,
+    0x009F, 0x00B3, 0x00C7, 0x00DB, 0x00F1, 0x0108, 0x0120, 0x0139,
+    0x0154, 0x016F, 0x018C, 0x01AB, 0x01CA, 0x01EB, 0x020E, 0x0232,
+    0x0257, 0x027D, 0x02A5, 0x02CE, 0x02F9, 0x0325, 0x0353, 0x0382,
+    0x03B3, 0x03E5, 0x0418, 0x044D, 0x0484, 0x04BC, 0x04F6, 0x0532,
+    0x056F, 0x05AD, 0x05ED, 0x062F, 0x0673, 0x06B8, 0x06FE, 0x0747,
+    0x0791, 0x07DD, 0x082A, 0x087A, 0x08CA, 0x091D, 0x0972, 0x09C8,
+    0x0A20, 0x0A79, 0x0AD5, 0x0B32, 0x0B91, 0x0BF2, 0x0C55, 0x0CBA,
+    0x0D20, 0x0D88, 0x0DF2, 0x0E5E, 0x0ECC, 0x0F3C, 0x0FAE, 0x1021,
+    0x1097, 0x110E, 0x1188, 0x1203, 0x1280, 0x1300, 0x1381, 0x1404,
+    0x1489, 0x1510, 0x159A, 0x1625, 0x16B2, 0x1741, 0x17D3, 0x1866,
+    0x18FB, 0x1993, 0x1A2C, 0x1AC8, 0x1B66, 0x1C06, 0x1CA7, 0x1D4C,
+    0x1DF2, 0x1E9A, 0x1F44, 0x1FF1, 0x20A0, 0x2150, 0x2204, 0x22B9,
+    0x2370, 0x242A, 0x24E5, 0x25A3, 0x2664, 0x2726, 0x27EB, 0x28B1,
+    0x297B, 0x2A46, 0x2B14, 0x2BE3, 0x2CB6, 0x2D8A, 0x2E61, 0x2F3A,
+    0x3015, 0x30F2, 0x31D2, 0x32B4, 0x3399, 0x3480, 0x3569, 0x3655,
+    0x3742, 0x3833, 0x3925, 0x3A1A, 0x3B12, 0x3C0B, 0x3D07, 0x3E06,
+    0x3F07, 0x400A, 0x4110, 0x4218, 0x4323, 0x4430, 0x453F, 0x4651,
+    0x4765, 0x487C, 0x4995, 0x4AB1, 0x4BCF, 0x4CF0, 0x4E13, 0x4F39,
+    0x5061, 0x518C, 0x52B9, 0x53E9, 0x551B, 0x5650, 0x5787, 0x58C1,
+    0x59FE, 0x5B3D, 0x5C7E, 0x5DC2, 0x5F09, 0x6052, 0x619E, 0x62ED,
+    0x643E, 0x6591, 0x66E8, 0x6840, 0x699C, 0x6AFA, 0x6C5B, 0x6DBE,
+    0x6F24, 0x708D, 0x71F8, 0x7366, 0x74D7, 0x764A, 0x77C0, 0x7939,
+    0x7AB4, 0x7C32, 0x7DB3, 0x7F37, 0x80BD, 0x8246, 0x83D1, 0x855F,
+    0x86F0, 0x8884, 0x8A1B, 0x8BB4, 0x8D50, 0x8EEF, 0x9090, 0x9235,
+    0x93DC, 0x9586, 0x9732, 0x98E2, 0x9A94, 0x9C49, 0x9E01, 0x9FBB,
+    0xA179, 0xA339, 0xA4FC, 0xA6C2, 0xA88B, 0xAA56, 0xAC25, 0xADF6,
+    0xAFCA, 0xB1A1, 0xB37B, 0xB557, 0xB737, 0xB919, 0xBAFF, 0xBCE7,
+    0xBED2, 0xC0C0, 0xC2B1, 0xC4A5, 0xC69C, 0xC895, 0xCA92, 0xCC91,
+    0xCE94, 0xD099, 0xD2A1, 0xD4AD, 0xD6BB, 0xD8CC, 0xDAE0, 0xDCF7,
+    0xDF11, 0xE12E, 0xE34E, 0xE571, 0xE797, 0xE9C0, 0xEBEC, 0xEE1B,
+    0xF04D, 0xF282, 0xF4BA, 0xF6F5, 0xF933, 0xFB74, 0xFDB8, 0xFFFF,
+};
+
+static const uint8_t SQZ_linear_to_sRGB[SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE + 1] =
+{
+    0x00, 0x06, 0x0D, 0x12, 0x16, 0x19, 0x1C, 0x1F, 0x22, 0x24, 0x26, 0x28, 0x2A, 0x2C, 0x2E, 0x30,
+    0x32, 0x33, 0x35, 0x36, 0x38, 0x39, 0x3B, 0x3C, 0x3D, 0x3E, 0x40, 0x41, 0x42, 0x43, 0x45, 0x46,
+    0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56,
+    0x56, 0x57, 0x58, 0x59, 0x5A, 0x5B, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F, 0x5F, 0x60, 0x61, 0x62, 0x62,
+    0x63, 0x64, 0x65, 0x65, 0x66, 0x67, 0x67, 0x68, 0x69, 0x6A, 0x6A, 0x6B, 0x6C, 0x6C, 0x6D, 0x6E,
+    0x6E, 0x6F, 0x6F, 0x70, 0x71, 0x71, 0x72, 0x73, 0x73, 0x74, 0x74, 0x75, 0x76, 0x76, 0x77, 0x77,
+    0x78, 0x79, 0x79, 0x7A, 0x7A, 0x7B, 0x7B, 0x7C, 0x7D, 0x7D, 0x7E, 0x7E, 0x7F, 0x7F, 0x80, 0x80,
+    0x81, 0x81, 0x82, 0x82, 0x83, 0x84, 0x84, 0x85, 0x85, 0x86, 0x86, 0x87, 0x87, 0x88, 0x88, 0x89,
+    0x89, 0x8A, 0x8A, 0x8B, 0x8B, 0x8C, 0x8C, 0x8C, 0x8D, 0x8D, 0x8E, 0x8E, 0x8F, 0x8F, 0x90, 0x90,
+    0x91, 0x91, 0x92, 0x92, 0x93, 0x93, 0x93, 0x94, 0x94, 0x95, 0x95, 0x96, 0x96, 0x97, 0x97, 0x97,
+    0x98, 0x98, 0x99, 0x99, 0x9A, 0x9A, 0x9A, 0x9B, 0x9B, 0x9C, 0x9C, 0x9C, 0x9D, 0x9D, 0x9E, 0x9E,
+    0x9F, 0x9F, 0x9F, 0xA0, 0xA0, 0xA1, 0xA1, 0xA1, 0xA2, 0xA2, 0xA3, 0xA3, 0xA3, 0xA4, 0xA4, 0xA5,
+    0xA5, 0xA5, 0xA6, 0xA6, 0xA6, 0xA7, 0xA7, 0xA8, 0xA8, 0xA8, 0xA9, 0xA9, 0xA9, 0xAA, 0xAA, 0xAB,
+    0xAB, 0xAB, 0xAC, 0xAC, 0xAC, 0xAD, 0xAD, 0xAE, 0xAE, 0xAE, 0xAF, 0xAF, 0xAF, 0xB0, 0xB0, 0xB0,
+    0xB1, 0xB1, 0xB1, 0xB2, 0xB2, 0xB3, 0xB3, 0xB3, 0xB4, 0xB4, 0xB4, 0xB5, 0xB5, 0xB5, 0xB6, 0xB6,
+    0xB6, 0xB7, 0xB7, 0xB7, 0xB8, 0xB8, 0xB8, 0xB9, 0xB9, 0xB9, 0xBA, 0xBA, 0xBA, 0xBB, 0xBB, 0xBB,
+    0xBC, 0xBC, 0xBC, 0xBD, 0xBD, 0xBD, 0xBE, 0xBE, 0xBE, 0xBF, 0xBF, 0xBF, 0xC0, 0xC0, 0xC0, 0xC1,
+    0xC1, 0xC1, 0xC1, 0xC2, 0xC2, 0xC2, 0xC3, 0xC3, 0xC3, 0xC4, 0xC4, 0xC4, 0xC5, 0xC5, 0xC5, 0xC6,
+    0xC6, 0xC6, 0xC6, 0xC7, 0xC7, 0xC7, 0xC8, 0xC8, 0xC8, 0xC9, 0xC9, 0xC9, 0xC9, 0xCA, 0xCA, 0xCA,
+    0xCB, 0xCB, 0xCB, 0xCC, 0xCC, 0xCC, 0xCC, 0xCD, 0xCD, 0xCD, 0xCE, 0xCE, 0xCE, 0xCE, 0xCF, 0xCF,
+    0xCF, 0xD0, 0xD0, 0xD0, 0xD0, 0xD1, 0xD1, 0xD1, 0xD2, 0xD2, 0xD2, 0xD2, 0xD3, 0xD3, 0xD3, 0xD4,
+    0xD4, 0xD4, 0xD4, 0xD5, 0xD5, 0xD5, 0xD6, 0xD6, 0xD6, 0xD6, 0xD7, 0xD7, 0xD7, 0xD7, 0xD8, 0xD8,
+    0xD8, 0xD9, 0xD9, 0xD9, 0xD9, 0xDA, 0xDA, 0xDA, 0xDA, 0xDB, 0xDB, 0xDB, 0xDC, 0xDC, 0xDC, 0xDC,
+    0xDD, 0xDD, 0xDD, 0xDD, 0xDE, 0xDE, 0xDE, 0xDE, 0xDF, 0xDF, 0xDF, 0xE0, 0xE0, 0xE0, 0xE0, 0xE1,
+    0xE1, 0xE1, 0xE1, 0xE2, 0xE2, 0xE2, 0xE2, 0xE3, 0xE3, 0xE3, 0xE3, 0xE4, 0xE4, 0xE4, 0xE4, 0xE5,
+    0xE5, 0xE5, 0xE5, 0xE6, 0xE6, 0xE6, 0xE6, 0xE7, 0xE7, 0xE7, 0xE7, 0xE8, 0xE8, 0xE8, 0xE8, 0xE9,
+    0xE9, 0xE9, 0xE9, 0xEA, 0xEA, 0xEA, 0xEA, 0xEB, 0xEB, 0xEB, 0xEB, 0xEC, 0xEC, 0xEC, 0xEC, 0xED,
+    0xED, 0xED, 0xED, 0xEE, 0xEE, 0xEE, 0xEE, 0xEF, 0xEF, 0xEF, 0xEF, 0xEF, 0xF0, 0xF0, 0xF0, 0xF0,
+    0xF1, 0xF1, 0xF1, 0xF1, 0xF2, 0xF2, 0xF2, 0xF2, 0xF3, 0xF3, 0xF3, 0xF3, 0xF3, 0xF4, 0xF4, 0xF4,
+    0xF4, 0xF5, 0xF5, 0xF5, 0xF5, 0xF6, 0xF6, 0xF6, 0xF6, 0xF6, 0xF7, 0xF7, 0xF7, 0xF7, 0xF8, 0xF8,
+    0xF8, 0xF8, 0xF9, 0xF9, 0xF9, 0xF9, 0xF9, 0xFA, 0xFA, 0xFA, 0xFA, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB,
+    0xFC, 0xFC, 0xFC, 0xFC, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFE, 0xFE, 0xFE, 0xFE, 0xFF, 0xFF, 0xFF,
+};
+
+static uint8_t
+SQZ_linear_i32_to_sRGB_u8(int32_t const v)
+{
+    if (v <= 0)
+    {
+        return 0;
+    }
+    if (v >= SQZ_COLOR_LINEAR_MAX)
+    {
+        return 0xFF;
+    }
+    int32_t const vmul = v * SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE;
+    int32_t const offset = vmul >> SQZ_COLOR_LINEAR_PRECISION;
+    int32_t const interpoland = vmul & SQZ_COLOR_LINEAR_MAX;
+    int32_t const base = SQZ_linear_to_sRGB[offset];
+    return base + ((interpoland * (SQZ_linear_to_sRGB[offset + 1] - base)) >> SQZ_COLOR_LINEAR_PRECISION);
+}
+
+static int32_t
+SQZ_i32_cbrt_01(int32_t const v)
+{
+    if (v <= 0)
+    {
+        return 0;
+    }
+    if (v >= SQZ_COLOR_LINEAR_MAX)
+    {
+        return SQZ_COLOR_LINEAR_MAX;
+    }
+    int64_t root = ((v * (((v * (v - 144107LL)) >> SQZ_COLOR_LINEAR_PRECISION) + 132114LL)) >> SQZ_COLOR_LINEAR_PRECISION) + 14379LL;
+    for (int i = 0; i < 2; i++)
+    {
+        int64_t const n = root * root * root, denominator = v + (n >> (SQZ_COLOR_LINEAR_PRECISION * 2 - 1));
+        root = (root * (2LL * v + (n >> (SQZ_COLOR_LINEAR_PRECISION * 2)))) / denominator;
+    }
+    return (int32_t)root;
+}
+
+#define SQZ_COLOR_OKLAB_PRECISION   12
+#define SQZ_COLOR_OKLAB_MUL         (1LL << (SQZ_COLOR_LINEAR_PRECISION - SQZ_COLOR_OKLAB_PRECISION))
+#define SQZ_COLOR_OKLAB_LEVEL_OFFSET (1 << (SQZ_COLOR_OKLAB_PRECISION - 1))
+
+static void
+SQZ_color_process_oklab(SQZ_context_t* const ctx, void* const buffer, int const read)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return;
+    }
+#endif
+    SQZ_dwt_coefficient_t * restrict L = ctx->plane[0].data, * restrict a = ctx->plane[1].data, * restrict b = ctx->plane[2].data;
+    uint8_t* ptr = (uint8_t*)buffer;
+    size_t const length = ctx->image.width * ctx->image.height;
+    if (read)
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            int32_t const R = (int32_t)SQZ_sRGB_to_linear[*ptr++];
+            int32_t const G = (int32_t)SQZ_sRGB_to_linear[*ptr++];
+            int32_t const B = (int32_t)SQZ_sRGB_to_linear[*ptr++];
+            int32_t const l = SQZ_i32_cbrt_01((int32_t)((27015LL * R + 35149LL * G +  3372LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
+            int32_t const m = SQZ_i32_cbrt_01((int32_t)((13887LL * R + 44610LL * G +  7038LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
+            int32_t const s = SQZ_i32_cbrt_01((int32_t)(( 5787LL * R + 18462LL * G + 41286LL * B) >> SQZ_COLOR_LINEAR_PRECISION));
+            *L++ =(( 862L * l + 3250L * m -   17L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION) - SQZ_COLOR_OKLAB_LEVEL_OFFSET;
+            *a++ = (8100L * l - 9945L * m + 1845L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION;
+            *b++ = ( 106L * l + 3205L * m - 3311L * s + (SQZ_COLOR_LINEAR_MAX / 2)) >> SQZ_COLOR_LINEAR_PRECISION;
+        }
+    }
+    else
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            SQZ_dwt_coefficient_t const L_ = (*L++) + SQZ_COLOR_OKLAB_LEVEL_OFFSET, a_ = (*a++), b_ = (*b++);
+            int64_t const l_ = L_ * SQZ_COLOR_OKLAB_MUL + ((25974LL * a_ + 14143LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
+            int64_t const m_ = L_ * SQZ_COLOR_OKLAB_MUL + ((-6918LL * a_ -  4185LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
+            int64_t const s_ = L_ * SQZ_COLOR_OKLAB_MUL + ((-5864LL * a_ - 84638LL * b_) >> SQZ_COLOR_OKLAB_PRECISION);
+            int64_t const l = (l_ * l_ * l_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
+            int64_t const m = (m_ * m_ * m_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
+            int64_t const s = (s_ * s_ * s_) >> (SQZ_COLOR_LINEAR_PRECISION * 2);
+            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((267169LL * l - 216771LL * m +  15137LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
+            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((-83127LL * l + 171030LL * m -  22368LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
+            *ptr++ = SQZ_linear_i32_to_sRGB_u8((int32_t)((  -275LL * l -  46099LL * m + 111909LL * s) >> SQZ_COLOR_LINEAR_PRECISION));
+        }
+    }
+}
+
+#undef SQZ_COLOR_OKLAB_PRECISION
+#undef SQZ_COLOR_OKLAB_MUL
+#undef SQZ_COLOR_OKLAB_LEVEL_OFFSET
+#undef SQZ_COLOR_LINEAR_PRECISION
+#undef SQZ_COLOR_LINEAR_MAX
+#undef SQZ_COLOR_LINEAR_TO_SRGB_PRECISION
+#undef SQZ_COLOR_LINEAR_TO_SRGB_LUT_SIZE
+
+#define SQZ_COLOR_LOGL1_LEVEL_OFFSET    221
+
+/*
+Based on "Exploiting context dependence for image compression with upsampling" - by Jarek Duda
+                            [https://arxiv.org/abs/2004.03391]
+*/
+
+static void
+SQZ_color_process_logl1(SQZ_context_t* const ctx, void* const buffer, int const read)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return;
+    }
+#endif
+    SQZ_dwt_coefficient_t * restrict Y = ctx->plane[0].data, * restrict c0 = ctx->plane[1].data, * restrict c1 = ctx->plane[2].data;
+    uint8_t* ptr = (uint8_t*)buffer;
+    size_t const length = ctx->image.width * ctx->image.height;
+    if (read)
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            SQZ_dwt_coefficient_t const R = *ptr++, G = *ptr++, B = *ptr++;
+            *Y++ = (( 33779 * R + 41184 * G + 38182 * B) >> 16) - SQZ_COLOR_LOGL1_LEVEL_OFFSET;
+            *c0++ = (-52830 * R +  8188 * G + 37906 * B) >> 16;
+            *c1++ = ( 19051 * R - 50317 * G + 37420 * B) >> 16;
+
+        }
+    }
+    else
+    {
+        for (size_t i = 0u; i < length; ++i)
+        {
+            SQZ_dwt_coefficient_t const Y_ = (*Y++) + SQZ_COLOR_LOGL1_LEVEL_OFFSET, c0_ = (*c0++), c1_ = (*c1++);
+            SQZ_dwt_coefficient_t const R = (33779 * Y_ - 52830 * c0_ + 19051 * c1_) >> 16;
+            SQZ_dwt_coefficient_t const G = (41184 * Y_ +  8188 * c0_ - 50317 * c1_) >> 16;
+            SQZ_dwt_coefficient_t const B = (38182 * Y_ + 37906 * c0_ + 37420 * c1_) >> 16;
+            *ptr++ = SQZ_COLOR_CLIP(R);
+            *ptr++ = SQZ_COLOR_CLIP(G);
+            *ptr++ = SQZ_COLOR_CLIP(B);
+        }
+    }
+}
+
+#undef SQZ_COLOR_LOGL1_LEVEL_OFFSET
+#undef SQZ_COLOR_CLIP
+
+static void
+SQZ_color_process(SQZ_context_t* const ctx, void* const buffer, int const read)
+{
+    switch (ctx->image.color_mode)
+    {
+    case SQZ_COLOR_MODE_GRAYSCALE:
+    {
+        SQZ_color_process_grayscale(ctx, buffer, read);
+        break;
+    }
+    case SQZ_COLOR_MODE_YCOCG_R:
+    {
+        SQZ_color_process_ycocg_r(ctx, buffer, read);
+        break;
+    }
+    case SQZ_COLOR_MODE_OKLAB:
+    {
+        SQZ_color_process_oklab(ctx, buffer, read);
+        break;
+    }
+    case SQZ_COLOR_MODE_LOG_L1:
+    {
+        SQZ_color_process_logl1(ctx, buffer, read);
+        break;
+    }
+    case SQZ_COLOR_MODE_MULTISPECTRAL:
+    {
+        SQZ_color_process_multispectral(ctx, buffer, read);
+        break;
+    }
+    case SQZ_COLOR_MODE_YCBCR_420:
+    {
+        SQZ_color_process_ycbcr_420(ctx, buffer, read);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * \brief           Converts a line of the spectral planes to the output color space
+ * \param[in,out]   ctx: The codec context, whose plane pointers are used to process the line, and restored on return
+ * \param[in]       lines: The line of each spectral plane
+ * \param[out]      dest: The interleaved 8-bit output line
+ * \param           width: Width of the line
+ */
+static void
+SQZ_color_process_line(SQZ_context_t* const ctx, SQZ_dwt_coefficient_t* const * const lines, uint8_t* const dest, size_t const width)
+{
+    SQZ_image_descriptor_t const image = ctx->image;
     SQZ_dwt_coefficient_t* const data = ctx->data;
-    size_t const size = ctx->image.width * ctx->image.height * ctx->image.num_planes;
-    for (size_t i = 0u; i < size; ++i)
+    SQZ_dwt_coefficient_t* planes[SQZ_MAX_PLANES];
+    ctx->image.width = width;
+    ctx->image.height = 1u;
+    for (size_t plane = 0u; plane < image.num_planes; ++plane)
+    {
+        planes[plane] = ctx->plane[plane].data;
+        ctx->plane[plane].data = lines[plane];
+    }
+    ctx->data = ctx->plane[0].data;
+    SQZ_color_process(ctx, dest, 0);
+    for (size_t plane = 0u; plane < image.num_planes; ++plane)
+    {
+        ctx->plane[plane].data = planes[plane];
+    }
+    if (image.max_error > 0)
+    {
+        /* the samples were quantized by the encoder, each reconstructed value lies in the middle of its interval */
+        uint32_t const step = 2u * (uint32_t)image.max_error + 1u;
+        size_t const length = width * SQZ_color_output_planes(ctx);
+        for (size_t i = 0u; i < length; ++i)
+        {
+            uint32_t const value = dest[i] * step + (uint32_t)image.max_error;
+            dest[i] = (uint8_t)((value < UINT8_MAX) ? value : UINT8_MAX);
+        }
+    }
+    ctx->image = image;
+    ctx->data = data;
+}
+
+/**
+ * \brief           Converts a region of the spectral planes to the output color space
+ * \param[in,out]   ctx: The codec context, whose plane pointers are used to process each line, and restored on return
+ * \param[in]       samples: The spectral planes, of the dimensions of the image
+ * \param[out]      dest: The interleaved 8-bit output image
+ * \param[in]       region: The region to convert
+ */
+static void
+SQZ_color_process_region(SQZ_context_t* const ctx, SQZ_dwt_coefficient_t* const samples, uint8_t* const dest, SQZ_region_t const * const region)
+{
+    size_t const width = ctx->image.width, height = ctx->image.height, num_planes = ctx->image.num_planes, outputs = SQZ_color_output_planes(ctx);
+    SQZ_dwt_coefficient_t* lines[SQZ_MAX_PLANES];
+    for (size_t y = region->y; y < region->y + region->height; ++y)
+    {
+        for (size_t plane = 0u; plane < num_planes; ++plane)
+        {
+            lines[plane] = samples + (plane * height + y) * width + region->x;
+        }
+        SQZ_color_process_line(ctx, lines, dest + (y * width + region->x) * outputs, region->width);
+    }
+}
+
+/**
+ * \brief           Finds how many bitplanes a coefficient of a subband is shifted by, according to the regions of interest
+ * \param[in]       band: The subband
+ * \param           x: Horizontal coordinate of the coefficient, relative to the subband
+ * \param           y: Vertical coordinate of the coefficient, relative to the subband
+ * \return          The shift of the regions of interest if the coefficient is in one of them, 0 otherwise
+ */
+static int
+SQZ_roi_shift(SQZ_dwt_subband_t const * const band, size_t const x, size_t const y)
+{
+    for (size_t i = 0u; i < band->roi_count; ++i)
+    {
+        uint16_t const * const region = band->roi[i];
+        if ((x >= region[0]) && (y >= region[1]) && (x < region[2]) && (y < region[3]))
+        {
+            return band->roi_shift;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief           Finds the highest bitplane of a subband, with the coefficients in the regions of interest shifted up
+ * \param[in]       band: The subband, in sign-magnitude format
+ * \return          The highest shifted bitplane containing at least one coefficient, or 0 if all are zero
+ */
+static int
+SQZ_roi_max_bitplane(SQZ_dwt_subband_t const * const band)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (band->data == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_dwt_coefficient_t max[2] = { 0, 0 };
+    for (size_t y = 0u; y < band->height; ++y)
+    {
+        SQZ_dwt_coefficient_t const * const ptr = band->data + y * band->stride;
+        for (size_t x = 0u; x < band->width; ++x)
+        {
+            size_t const inside = (SQZ_roi_shift(band, x, y) > 0);
+            if (ptr[x] > max[inside])
+            {
+                max[inside] = ptr[x];
+            }
+        }
+    }
+    int const outside = SQZ_ilog2(max[0] >> 1), inside = SQZ_ilog2(max[1] >> 1);
+    return ((inside > 0) && (inside + band->roi_shift > outside)) ? inside + band->roi_shift : outside;
+}
+
+/**
+ * \brief           Advances through a list until a node that can be coded at the current bitplane of the subband
+ * \note            With regions of interest, the bitplanes of a subband are shifted, and the coefficients outside
+ *                  of their current range are skipped without being coded
+ * \param[in]       band: The subband the list belongs to
+ * \param[in,out]   pixel: The current node, updated to the first one that can be coded, or `NULL`
+ * \param[in,out]   previous: The node preceding the current one, updated accordingly
+ */
+static void
+SQZ_roi_skip(SQZ_dwt_subband_t const * const band, SQZ_list_node_t** const pixel, SQZ_list_node_t** const previous)
+{
+    if (band->roi_count == 0u)
+    {
+        return;
+    }
+    while ((*pixel != NULL) && (band->bitplane - SQZ_roi_shift(band, (*pixel)->x, (*pixel)->y) < 1))
+    {
+        *previous = *pixel;
+        *pixel = SQZ_list_node_next(*pixel, band->cache.nodes);
+    }
+}
+
+/**
+ * \brief           Finds the maximum of the coefficient values in a subband
+ * \note            Assumes that all of the subband coefficients have been converted to an explicit
+ *                  sign-magnitude representation, forgoing the need to check against absolute values
+ * \param[in]       band: The subband to be scanned
+ * \return          Maximum coefficient value present in the subband
+ */
+static SQZ_dwt_coefficient_t
+SQZ_dwt_get_max(SQZ_dwt_subband_t* const band)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (band->data == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_kernels_t const* const kernels = SQZ_kernels();
+    SQZ_dwt_coefficient_t max = *band->data;
+    for (size_t y = 0u; y < band->height; ++y)
+    {
+        max = kernels->max(band->data + y * band->stride, band->width, max);
+    }
+    return max;
+}
+
+static void
+SQZ_dwt_convert_to_sign_magnitude(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    SQZ_kernels()->to_sign_magnitude(ctx->data, ctx->image.width * ctx->image.height * ctx->image.num_planes);
+}
+
+static void
+SQZ_dwt_convert_from_sign_magnitude(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    SQZ_kernels()->from_sign_magnitude(ctx->data, ctx->image.width * ctx->image.height * ctx->image.num_planes);
+}
+
+/*
+DWT and iDWT routines are based on the Snow video codec (FFmpeg), by Michael Niedermayer
+*/
+
+static void
+SQZ_dwt_5_3i_horizontal_pass(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width)
+{
+    if (width < (SQZ_MIN_DIMENSION >> 1u))
+    {
+        return;
+    }
+    SQZ_dwt_coefficient_t * restrict odds, * restrict evens = scratch, * restrict l_band = data, * restrict h_band;
+    int32_t cf0, cf1, cf2, cf3;
+    size_t half_w = width >> 1u, stride = half_w, w = half_w - 1u, i;
+    int const odd_w = !!(width & 1u);
+    if (odd_w)
+    {
+        ++stride;
+    }
+    odds = scratch + stride;
+    h_band = data + stride;
+    for (i = 0u; i < half_w; ++i)
+    {
+        evens[i] = data[2u * i];
+        odds[i] = data[2u * i + 1u];
+    }
+    if (odd_w)
+        evens[half_w] = data[2u * half_w];
+    cf0 = evens[0];
+    cf2 = evens[1];
+    h_band[0] = cf1 = odds[0] + ((-(cf0 + cf2)) >> 1);
+    l_band[0] = cf0 += ((cf1 + 1) >> 1);
+    for (i = 1u; i < w; ++i)
+    {
+        cf3 = odds[i];
+        cf0 = evens[i + 1u];
+        h_band[i] = cf3 += ((-(cf2 + cf0)) >> 1);
+        l_band[i] = cf2 += (cf1 + cf3 + 2) >> 2;
+        ++i;
+        cf1 = odds[i];
+        cf2 = evens[i + 1u];
+        h_band[i] = cf1 += ((-(cf2 + cf0)) >> 1);
+        l_band[i] = cf0 += (cf1 + cf3 + 2) >> 2;
+    }
+    h_band[w] = cf3 = odds[w] + (odd_w ? ((-(evens[w] + evens[w + 1u])) >> 1) : -evens[w]);
+    l_band[w] = evens[w] + ((h_band[w - 1u] + cf3 + 2) >> 2);
+    if (odd_w)
+    {
+        l_band[w + 1u] = evens[w + 1u] + ((cf3 + 1) >> 1);
+    }
+}
+
+static void
+SQZ_dwt_5_3i(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width, size_t const height, size_t const stride)
+{
+    SQZ_kernels_t const* const kernels = SQZ_kernels();
+    SQZ_dwt_coefficient_t *nnn = data + SQZ_mirror(-3, height - 1) * stride,
+                           *nn  = data + SQZ_mirror(-2, height - 1) * stride;
+    for (int32_t i = -2; i < (int32_t)height; i += 2)
+    {
+        SQZ_dwt_coefficient_t *n = data + SQZ_mirror(i + 1, height - 1) * stride,
+                               *r = data + SQZ_mirror(i + 2, height - 1) * stride;
+        if (nn <= r)
+        {
+            SQZ_dwt_5_3i_horizontal_pass(n, scratch, width);
+        }
+        if ((i + 2) < (int32_t)height)
+        {
+            SQZ_dwt_5_3i_horizontal_pass(r, scratch, width);
+        }
+        if (nn <= r)
+        {
+            kernels->dwt_predict(n, nn, r, width, 0);
+        }
+        if (nnn <= n)
+        {
+            kernels->dwt_update(nn, nnn, n, width, 0);
+        }
+        nnn = n;
+        nn = r;
+    }
+}
+
+/**
+ * \brief           Approximates the base-2 logarithm of an integer, with 4 fractional bits
+ * \param           x: The value whose logarithm we want
+ * \return          log2(x) in Q4 fixed-point, or 0 if `x` is 0
+ */
+static uint32_t
+SQZ_log2_q4(uint64_t x)
+{
+    uint32_t log = 0u;
+    while (x > UINT32_MAX)
+    {
+        x >>= 1u;
+        log += 16u;
+    }
+    if (x == 0u)
+    {
+        return 0u;
+    }
+    uint32_t const n = SQZ_ilog2((uint32_t)x) - 1u;
+    return log + (n << 4u) + (uint32_t)((((x << 4u) >> n)) & 15u);
+}
+
+/**
+ * \brief           Estimates if decomposing a LL subband once more would reduce the compressed size
+ * \note            The magnitude of the new detail coefficients is approximated by the residuals of the 5/3 predict
+ *                  step, in both directions, and compared to the mean absolute deviation of the LL subband. Three
+ *                  quarters of the coefficients would then be coded with the smaller magnitude, and that gain must
+ *                  pay for the cost of signalling 3 more subbands per plane
+ * \param[in]       data: Pointer to the LL subband
+ * \param           width: Width of the LL subband
+ * \param           height: Height of the LL subband
+ * \param           stride: Stride size, in number of coefficients, between the lines of the LL subband
+ * \param           num_planes: Number of spectral planes in the image
+ * \return          1 if another DWT level is estimated to be worthwhile, 0 otherwise
+ */
+static int
+SQZ_dwt_next_level_gain(SQZ_dwt_coefficient_t const * const data, size_t const width, size_t const height, size_t const stride, size_t const num_planes)
+{
+    if ((width < 3u) || (height < 3u))
+    {
+        return 0;
+    }
+    size_t const count = (width - 2u) * (height - 2u);
+    int64_t sum = 0;
+    for (size_t y = 1u; y < height - 1u; ++y)
+    {
+        SQZ_dwt_coefficient_t const * const row = data + y * stride;
+        for (size_t x = 1u; x < width - 1u; ++x)
+        {
+            sum += row[x];
+        }
+    }
+    int64_t const mean = sum / (int64_t)count;
+    uint64_t deviation = 0u, residual = 0u;
+    for (size_t y = 1u; y < height - 1u; ++y)
+    {
+        SQZ_dwt_coefficient_t const * const row = data + y * stride;
+        for (size_t x = 1u; x < width - 1u; ++x)
+        {
+            int32_t const v = row[x], h = 2 * v - row[x - 1u] - row[x + 1u], w = 2 * v - row[x - stride] - row[x + stride];
+            deviation += (uint64_t)llabs(v - mean);
+            residual += (uint64_t)(abs(h) + abs(w));
+        }
+    }
+    if (deviation == 0u)
+    {
+        return 0;
+    }
+    int64_t const gain = (3 * (int64_t)count * ((int64_t)SQZ_log2_q4(deviation * 4u) - (int64_t)SQZ_log2_q4(residual))) / 4;
+    return (residual == 0u) || (gain > (int64_t)(num_planes * (SQZ_DWT_SUBBANDS - 1u) * 4u * 16u));
+}
+
+/**
+ * \brief           Performs the forward DWT on all the planes of the image
+ * \note            The chroma planes of \ref SQZ_COLOR_MODE_YCBCR_420 already hold their samples in the LL subband of the
+ *                  first decomposition, so it isn't performed on them, leaving its detail subbands empty
+ * \param[in,out]   ctx: The codec context
+ * \param           automatic_levels: If set, the number of decompositions is chosen while transforming the
+ *                  first plane, as long as another level is estimated to be worthwhile, up to `dwt_levels`
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_dwt(SQZ_context_t* const ctx, int const automatic_levels)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    size_t const stride = ctx->image.width;
+    SQZ_dwt_coefficient_t* scratch = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(ctx->workspace, stride * sizeof(SQZ_dwt_coefficient_t), 0);
+    if (scratch == NULL)
+    {
+        return SQZ_OUT_OF_MEMORY;
+    }
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        size_t width = stride, height = ctx->image.height;
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            if ((automatic_levels) && (plane == 0u) && (level > 0u) &&
+                (!SQZ_dwt_next_level_gain(ctx->plane[plane].data, width, height, stride << level, ctx->image.num_planes)))
+            {
+                ctx->image.dwt_levels = level;
+                break;
+            }
+            if ((level > 0u) || (plane == 0u) || (ctx->image.color_mode != SQZ_COLOR_MODE_YCBCR_420))
+            {
+                SQZ_dwt_5_3i(ctx->plane[plane].data, scratch, width, height, stride << level);
+            }
+            width = (width + 1u) >> 1u;
+            height = (height + 1u) >> 1u;
+        }
+    }
+    SQZ_workspace_release(ctx->workspace, scratch);
+    return SQZ_RESULT_OK;
+}
+
+static void
+SQZ_idwt_5_3i_horizontal_pass(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width)
+{
+    if (width < (SQZ_MIN_DIMENSION >> 1u))
+    {
+        return;
+    }
+    SQZ_dwt_coefficient_t * restrict odds, * restrict evens = scratch, * restrict l_band = data, * restrict h_band;
+    int32_t cf0, cf1, cf2, cf3;
+    size_t half_w = width >> 1u, stride = half_w, w = half_w - 1u, i;
+    int const odd_w = !!(width & 1u);
+    if (odd_w)
+    {
+        ++stride;
+    }
+    odds = scratch + stride;
+    h_band = data + stride;
+    cf1 = h_band[0];
+    evens[0] = cf0 = l_band[0] - ((cf1 + 1) >> 1);
+    for (i = 1u; i < w; ++i)
+    {
+        cf2 = l_band[i];
+        cf3 = h_band[i];
+        evens[i] = cf2 -= ((cf1 + cf3 + 2) >> 2);
+        odds[i - 1] = cf1 - (-(cf0 + cf2) >> 1);
+        ++i;
+        cf0 = l_band[i];
+        cf1 = h_band[i];
+        evens[i] = cf0 -= ((cf1 + cf3 + 2) >> 2);
+        odds[i - 1] = cf3 - (-(cf0 + cf2) >> 1);
+    }
+    evens[w] = l_band[w] - ((h_band[w - 1u] + h_band[w] + 2) >> 2);
+    odds[w - 1] = h_band[w - 1] - ((-(evens[w - 1] + evens[w])) >> 1);
+    if (odd_w)
+    {
+        evens[w + 1] = l_band[w + 1] - ((h_band[w] + 1) >> 1);
+    }
+    odds[w] = h_band[w] - (odd_w ? ((-(evens[w] + evens[w + 1u])) >> 1) : -evens[w]);
+    for (i = 0u; i < half_w; ++i)
+    {
+        data[2u * i] = evens[i];
+        data[2u * i + 1u] = odds[i];
+    }
+    if (odd_w)
+        data[2u * half_w] = evens[half_w];
+}
+
+static void
+SQZ_idwt_5_3i(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width, size_t const height, size_t const stride)
+{
+    SQZ_kernels_t const* const kernels = SQZ_kernels();
+    SQZ_dwt_coefficient_t *nn = data + SQZ_mirror(-2, height - 1) * stride,
+                           *n  = data + SQZ_mirror(-1, height - 1) * stride;
+    for (int32_t i = -1; i <= (int32_t)height; i += 2)
+    {
+        SQZ_dwt_coefficient_t *r = data + SQZ_mirror(i + 1, height - 1) * stride,
+                               *s = data + SQZ_mirror(i + 2, height - 1) * stride;
+        if (n <= s)
+        {
+            kernels->dwt_update(r, n, s, width, 1);
+        }
+        if (nn <= r)
+        {
+            kernels->dwt_predict(n, nn, r, width, 1);
+        }
+        if (i - 1 >= 0)
+        {
+            SQZ_idwt_5_3i_horizontal_pass(nn, scratch, width);
+        }
+        if (nn <= r)
+        {
+            SQZ_idwt_5_3i_horizontal_pass(n, scratch, width);
+        }
+        nn = r;
+        n = s;
+    }
+}
+
+/**
+ * \brief           Number of coefficients of the coarsest DWT level by which a region is enlarged when reconstructed
+ *                  on its own, so that the mirroring at its borders doesn't reach the samples inside of it
+ * \hideinitializer
+ */
+#define SQZ_IDWT_REGION_MARGIN  4
+
+/**
+ * \brief           Reconstructs a spectral plane from its DWT coefficients, in place
+ * \param[in,out]   data: The plane, with the layout of the image
+ * \param[out]      scratch: Buffer of at least `width` coefficients
+ * \param           width: Width of the plane
+ * \param           height: Height of the plane
+ * \param           levels: Number of DWT levels
+ */
+static void
+SQZ_idwt_plane(SQZ_dwt_coefficient_t* const data, SQZ_dwt_coefficient_t* const scratch, size_t const width, size_t const height, size_t const levels)
+{
+    for (int32_t level = (int32_t)levels - 1; level >= 0; --level)
+    {
+        size_t w = width, h = height;
+        for (int32_t l = level; l > 0; --l)
+        {
+            w = (w + 1u) >> 1u;
+            h = (h + 1u) >> 1u;
+        }
+        SQZ_idwt_5_3i(data, scratch, w, h, width << level);
+    }
+}
+
+/**
+ * \brief           Reconstructs a region of the spectral planes from the DWT coefficients
+ * \note            The coefficients covering the region, enlarged by a margin and aligned to the coarsest level, are
+ *                  gathered in a window with the same layout as the whole image, so that the regular iDWT gives the
+ *                  exact same samples inside the region
+ * \param[in]       ctx: The codec context
+ * \param[in]       coefficients: The DWT coefficients of the spectral planes, with the layout of the image
+ * \param[out]      samples: The spectral planes, of the dimensions of the image, where the region is written
+ * \param[in]       region: The region to reconstruct
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_idwt_region(SQZ_context_t const* const ctx, SQZ_dwt_coefficient_t const* const coefficients, SQZ_dwt_coefficient_t* const samples, SQZ_region_t const* const region)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (coefficients == NULL) || (samples == NULL) || (region == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    size_t const width = ctx->image.width, height = ctx->image.height, levels = ctx->image.dwt_levels;
+    size_t const align = (size_t)1u << levels, margin = (size_t)SQZ_IDWT_REGION_MARGIN << levels;
+    size_t const x0 = (region->x > margin) ? (region->x - margin) & ~(align - 1u) : 0u;
+    size_t const y0 = (region->y > margin) ? (region->y - margin) & ~(align - 1u) : 0u;
+    size_t x1 = (region->x + region->width + margin + align - 1u) & ~(align - 1u);
+    size_t y1 = (region->y + region->height + margin + align - 1u) & ~(align - 1u);
+    x1 = (x1 < width) ? x1 : width;
+    y1 = (y1 < height) ? y1 : height;
+    size_t const stride = x1 - x0;
+    SQZ_dwt_coefficient_t* const window = (SQZ_dwt_coefficient_t*)malloc(stride * (y1 - y0) * sizeof(SQZ_dwt_coefficient_t));
+    SQZ_dwt_coefficient_t* const scratch = (SQZ_dwt_coefficient_t*)malloc(stride * sizeof(SQZ_dwt_coefficient_t));
+    if ((window == NULL) || (scratch == NULL))
+    {
+        free(window);
+        free(scratch);
+        return SQZ_OUT_OF_MEMORY;
+    }
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        SQZ_dwt_coefficient_t const * const data = coefficients + plane * width * height;
+        for (size_t level = 0u; level < levels; ++level)
+        {
+            size_t const round = ((size_t)1u << level) - 1u;
+            size_t const w = ((x1 + round) >> level) - (x0 >> level), h = ((y1 + round) >> level) - (y0 >> level);
+            size_t const low = (w + 1u) >> 1u, offset = x0 >> (level + 1u);
+            size_t const high = ((((width + round) >> level) + 1u) >> 1u) + offset;
+            for (size_t y = 0u; y < h; ++y)
+            {
+                SQZ_dwt_coefficient_t const * const src = data + (((y0 >> level) + y) << level) * width;
+                SQZ_dwt_coefficient_t* const dst = window + (y << level) * stride;
+                /* the lowpass half of the even lines holds the next coarser level, if there's one */
+                if ((y & 1u) || (level + 1u == levels))
+                {
+                    memcpy(dst, src + offset, low * sizeof(SQZ_dwt_coefficient_t));
+                }
+                memcpy(dst + low, src + high, (w - low) * sizeof(SQZ_dwt_coefficient_t));
+            }
+        }
+        for (int32_t level = (int32_t)levels - 1; level >= 0; --level)
+        {
+            size_t const round = ((size_t)1u << level) - 1u;
+            SQZ_idwt_5_3i(window, scratch, ((x1 + round) >> level) - (x0 >> level), ((y1 + round) >> level) - (y0 >> level), stride << level);
+        }
+        for (size_t y = region->y; y < region->y + region->height; ++y)
+        {
+            memcpy(samples + (plane * height + y) * width + region->x, window + (y - y0) * stride + (region->x - x0), region->width * sizeof(SQZ_dwt_coefficient_t));
+        }
+    }
+    free(window);
+    free(scratch);
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Reconstructs a line of a DWT level whose detail subbands are all zero, from the next coarser level
+ * \note            Without detail coefficients, the vertical lifting steps leave the even lines as they are and set
+ *                  the odd ones to the mean of their neighbours, which is done here, the horizontal ones being left to
+ *                  the regular horizontal pass. As the lines are requested in order, two of them are kept per level
+ * \param[in,out]   cache: The line caches of the levels expanded, from the coarsest one
+ * \param           level: Index of the level of the line in `cache`
+ * \param[in]       source: The samples of the level from which the first one in `cache` is expanded
+ * \param           y: Index of the line
+ * \param[out]      scratch: Buffer of at least the width of the image
+ * \return          The line
+ */
+static SQZ_dwt_coefficient_t*
+SQZ_idwt_expand_line(SQZ_idwt_line_cache_t* const cache, size_t const level, SQZ_dwt_coefficient_t* const source, size_t const y, SQZ_dwt_coefficient_t* const scratch)
+{
+    SQZ_idwt_line_cache_t* const current = &cache[level];
+    if ((current->index[0] == y) || (current->index[1] == y))
+    {
+        return current->line[current->index[1] == y];
+    }
+    size_t const width = (current->width + 1u) >> 1u, above = y >> 1u;
+    SQZ_dwt_coefficient_t* const line = current->line[current->next];
+    SQZ_dwt_coefficient_t const * const upper = (level > 0u) ? SQZ_idwt_expand_line(cache, level - 1u, source, above, scratch) : source + above * width;
+    if (y & 1u)
+    {
+        /* the line below is always the next one, or the one reached first, which is still cached */
+        size_t const below = (size_t)SQZ_mirror((int32_t)y + 1, (int32_t)current->height - 1) >> 1u;
+        SQZ_dwt_coefficient_t const * const lower = (level > 0u) ? SQZ_idwt_expand_line(cache, level - 1u, source, below, scratch) : source + below * width;
+        for (size_t x = 0u; x < width; ++x)
+        {
+            line[x] = (SQZ_dwt_coefficient_t)((((int32_t)upper[x]) + ((int32_t)lower[x])) >> 1);
+        }
+    }
+    else
+    {
+        memcpy(line, upper, width * sizeof(SQZ_dwt_coefficient_t));
+    }
+    memset(line + width, 0, (current->width - width) * sizeof(SQZ_dwt_coefficient_t));
+    SQZ_idwt_5_3i_horizontal_pass(line, scratch, current->width);
+    current->index[current->next] = y;
+    current->next ^= 1u;
+    return line;
+}
+
+/**
+ * \brief           Reconstructs the image from the coefficients of the subbands reached, and converts it to the output
+ *                  color space
+ * \note            The levels up to the finest one with a subband reached are reconstructed at their resolution, and
+ *                  the finer ones, which are all zero, are expanded line by line into the output, so that a small
+ *                  prefix of a large image needs little more memory than the output itself
+ * \param[in,out]   ctx: The codec context, with sparse storage, whose subbands are released
+ * \param[out]      dest: The interleaved 8-bit output image
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_idwt_sparse(SQZ_context_t* const ctx, uint8_t* const dest)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (dest == NULL) || (!ctx->sparse))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    size_t const width = ctx->image.width, height = ctx->image.height, levels = ctx->image.dwt_levels, num_planes = ctx->image.num_planes;
+    size_t const outputs = SQZ_color_output_planes(ctx);
+    uint32_t const needed = SQZ_color_bands_needed(ctx);
+    SQZ_idwt_line_cache_t cache[SQZ_MAX_PLANES][SQZ_DWT_MAX_LEVEL];
+    SQZ_dwt_coefficient_t* lines[SQZ_MAX_PLANES];
+    size_t depth = 0u, w = width, h = height, length = width;
+    for (size_t plane = 0u; plane < num_planes; ++plane)
+    {
+        for (size_t level = depth; (needed & (1u << plane)) && (level < levels); ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                depth = (ctx->plane[plane].band[level][orientation].data != NULL) ? level + 1u : depth;
+            }
+        }
+    }
+    for (int32_t level = (int32_t)levels - 1; level >= (int32_t)depth; --level)
+    {
+        for (size_t plane = 0u; plane < num_planes; ++plane)
+        {
+            cache[plane][level - depth].width = w;
+            cache[plane][level - depth].height = h;
+        }
+        length += w * 2u * num_planes;
+        w = (w + 1u) >> 1u;
+        h = (h + 1u) >> 1u;
+    }
+    SQZ_dwt_coefficient_t* const samples = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(ctx->workspace, w * h * num_planes * sizeof(SQZ_dwt_coefficient_t), 1);
+    SQZ_dwt_coefficient_t* const scratch = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(ctx->workspace, length * sizeof(SQZ_dwt_coefficient_t), 0);
+    if ((samples == NULL) || (scratch == NULL))
+    {
+        SQZ_workspace_release(ctx->workspace, samples);
+        SQZ_workspace_release(ctx->workspace, scratch);
+        return SQZ_OUT_OF_MEMORY;
+    }
+    SQZ_dwt_coefficient_t* buffer = scratch + width;
+    for (size_t plane = 0u; plane < num_planes; ++plane)
+    {
+        size_t level_width = width;
+        if (!(needed & (1u << plane)))
+        {
+            /* a band of a multispectral image that isn't output, whose subbands are left to be released with the context */
+            continue;
+        }
+        for (size_t level = levels; level-- > 0u; )
+        {
+            if (level < depth)
+            {
+                size_t const stride = w << (depth - level);
+                for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+                {
+                    SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+                    SQZ_dwt_coefficient_t* const output = samples + plane * w * h + ((orientation & 1u) ? (level_width + 1u) >> 1u : 0u) + ((orientation > 1u) ? stride >> 1u : 0u);
+                    if (band->data == NULL)
+                    {
+                        continue;
+                    }
+                    for (size_t y = 0u; y < band->height; ++y)
+                    {
+                        for (size_t x = 0u; x < band->width; ++x)
+                        {
+                            SQZ_dwt_coefficient_t const v = band->data[y * band->width + x];
+                            output[y * stride + x] = (v & 1) ? - (v >> 1) : v >> 1;
+                        }
+                    }
+                    SQZ_workspace_release(band->workspace, band->data);
+                    band->data = NULL;
+                }
+            }
+            else
+            {
+                SQZ_idwt_line_cache_t* const level_cache = &cache[plane][level - depth];
+                for (size_t i = 0u; i < 2u; ++i)
+                {
+                    level_cache->line[i] = buffer;
+                    level_cache->index[i] = SIZE_MAX;
+                    buffer += level_cache->width;
+                }
+                level_cache->next = 0u;
+            }
+            level_width = (level_width + 1u) >> 1u;
+        }
+        SQZ_idwt_plane(samples + plane * w * h, scratch, w, h, depth);
+    }
+    for (size_t y = 0u; y < height; ++y)
+    {
+        for (size_t plane = 0u; plane < num_planes; ++plane)
+        {
+            SQZ_dwt_coefficient_t* const source = samples + plane * w * h;
+            if (!(needed & (1u << plane)))
+            {
+                lines[plane] = NULL;
+            }
+            else
+            {
+                lines[plane] = (depth < levels) ? SQZ_idwt_expand_line(cache[plane], levels - depth - 1u, source, y, scratch) : source + y * w;
+            }
+        }
+        SQZ_color_process_line(ctx, lines, dest + y * width * outputs, width);
+    }
+    SQZ_workspace_release(ctx->workspace, samples);
+    SQZ_workspace_release(ctx->workspace, scratch);
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Reconstructs the image one DWT level at a time, converting each intermediate LL subband to the output
+ *                  color space, as a reduction of the image by a power of 2
+ * \param[in,out]   ctx: The codec context, with the DWT coefficients, which are reconstructed in place
+ * \param[out]      dest: The interleaved 8-bit output images, the full resolution one first, followed by the reductions
+ *                  from the finest to the coarsest, each half the dimensions of the previous one, rounded up
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_idwt_pyramid(SQZ_context_t* const ctx, uint8_t* const dest)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (dest == NULL) || (ctx->sparse))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    size_t const width = ctx->image.width, height = ctx->image.height, levels = ctx->image.dwt_levels, num_planes = ctx->image.num_planes;
+    size_t const outputs = SQZ_color_output_planes(ctx);
+    SQZ_dwt_coefficient_t* lines[SQZ_MAX_PLANES];
+    uint8_t* output[SQZ_DWT_MAX_LEVEL + 1];
+    size_t w[SQZ_DWT_MAX_LEVEL + 1], h[SQZ_DWT_MAX_LEVEL + 1];
+    w[0] = width;
+    h[0] = height;
+    output[0] = dest;
+    for (size_t level = 1u; level <= levels; ++level)
+    {
+        w[level] = (w[level - 1u] + 1u) >> 1u;
+        h[level] = (h[level - 1u] + 1u) >> 1u;
+        output[level] = output[level - 1u] + w[level - 1u] * h[level - 1u] * outputs;
+    }
+    SQZ_dwt_coefficient_t* const scratch = (SQZ_dwt_coefficient_t*)malloc(width * sizeof(SQZ_dwt_coefficient_t));
+    if (scratch == NULL)
+    {
+        return SQZ_OUT_OF_MEMORY;
+    }
+    for (int32_t level = (int32_t)levels; level >= 0; --level)
+    {
+        /* the LL subband of each level is at the top left of the plane, spread by the strides of the coarser levels */
+        size_t const stride = width << level;
+        for (size_t plane = 0u; plane < num_planes; ++plane)
+        {
+            if (level < (int32_t)levels)
+            {
+                SQZ_idwt_5_3i(ctx->plane[plane].data, scratch, w[level], h[level], stride);
+            }
+        }
+        for (size_t y = 0u; y < h[level]; ++y)
+        {
+            for (size_t plane = 0u; plane < num_planes; ++plane)
+            {
+                lines[plane] = ctx->plane[plane].data + y * stride;
+            }
+            SQZ_color_process_line(ctx, lines, output[level] + y * w[level] * outputs, w[level]);
+        }
+    }
+    free(scratch);
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Projects the regions of interest onto a subband
+ * \note            The regions are enlarged by one coefficient on each side, to account for the support of the
+ *                  synthesis filters
+ * \param[in]       roi: The regions of interest
+ * \param[in,out]   band: The subband, with its dimensions already set
+ */
+static void
+SQZ_roi_project(SQZ_roi_t const * const roi, SQZ_dwt_subband_t* const band)
+{
+    size_t const dimension[2] = { band->width, band->height }, round = (1u << SQZ_ROI_GRID_BITS) - 1u;
+    band->roi_count = roi->count;
+    band->roi_shift = roi->shift;
+    for (size_t i = 0u; i < roi->count; ++i)
+    {
+        for (size_t axis = 0u; axis < 2u; ++axis)
+        {
+            size_t const start = (roi->region[i][axis] * dimension[axis]) >> SQZ_ROI_GRID_BITS;
+            size_t const end = (roi->region[i][axis + 2u] * dimension[axis] + round) >> SQZ_ROI_GRID_BITS;
+            band->roi[i][axis] = (uint16_t)((start > 0u) ? start - 1u : 0u);
+            band->roi[i][axis + 2u] = (uint16_t)((end < dimension[axis]) ? end + 1u : dimension[axis]);
+        }
+    }
+}
+
+/**
+ * \brief           Sets up the geometry and starting rounds of the subbands, for the number of DWT levels in use
+ * \param[in,out]   ctx: The codec context, with the plane buffers already allocated
+ */
+static void
+SQZ_common_init_subbands(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        size_t w = ctx->image.width, h = ctx->image.height;
+        for (int32_t level = (int32_t)ctx->image.dwt_levels - 1; level >= 0; --level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+                band->width  = (w + !(orientation & 1u)) >> 1u; /* width of the horizontal lowpass subbands is rounded up */
+                band->height = (h + !(orientation > 1u)) >> 1u; /* height of the vertical lowpass subbands is rounded up*/
+                band->round = (int)ctx->schedule[plane][level][orientation] + (ctx->image.subsampling & (plane > 0u));
+                band->stride = ctx->image.width << (ctx->image.dwt_levels - level);
+                if (ctx->sparse)
+                {
+                    /* allocated when the subband is reached */
+                    band->data = NULL;
+                    band->stride = band->width;
+                }
+                else
+                {
+                    band->data = ctx->plane[plane].data + ((orientation & 1u) ? (w + 1u) >> 1u : 0u) + ((orientation > 1u) ? band->stride >> 1u : 0u);
+                }
+                SQZ_roi_project(&ctx->roi, band);
+                band->min_bitplane = ((plane > 0u) && (ctx->chroma_floor > 1)) ? ctx->chroma_floor : 1;
+                if ((ctx->sequence != NULL) && (ctx->sequence->precision[plane][level][orientation] > band->min_bitplane))
+                {
+                    /* the residuals are only coded down to the precision of the previous frame */
+                    band->min_bitplane = ctx->sequence->precision[plane][level][orientation];
+                }
+                band->rice = !!(ctx->extensions & SQZ_HEADER_EXTENSION_RICE);
+                band->dense = !!(ctx->extensions & SQZ_HEADER_EXTENSION_DENSE);
+                band->workspace = ctx->workspace;
+            }
+            w = (w + 1u) >> 1u;
+            h = (h + 1u) >> 1u;
+        }
+    }
+}
+
+static SQZ_status_t
+SQZ_common_init_context(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    /* only the planes of the image are allocated, as those of multispectral images would make the context too large for the stack */
+    ctx->plane = (SQZ_spectral_plane_t*)SQZ_workspace_alloc(ctx->workspace, ctx->image.num_planes * sizeof(SQZ_spectral_plane_t), 1);
+    if (ctx->plane == NULL)
+    {
+        return SQZ_OUT_OF_MEMORY;
+    }
+    if (!ctx->sparse)
+    {
+        ctx->data = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(ctx->workspace, ctx->image.width * ctx->image.height * ctx->image.num_planes * sizeof(SQZ_dwt_coefficient_t), 1);
+        if (ctx->data == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
+        for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+        {
+            ctx->plane[plane].data = ctx->data + plane * ctx->image.width * ctx->image.height;
+        }
+    }
+    SQZ_common_init_subbands(ctx);
+    return SQZ_RESULT_OK;
+}
+
+static void
+SQZ_common_free_context(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    SQZ_workspace_release(ctx->workspace, ctx->data);
+    ctx->data = NULL;
+    for (size_t plane = 0u; (ctx->plane != NULL) && (plane < ctx->image.num_planes); ++plane)
+    {
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+                if (band != NULL)
+                {
+                    SQZ_workspace_release(ctx->workspace, band->cache.nodes);
+                    if (ctx->sparse)
+                    {
+                        SQZ_workspace_release(ctx->workspace, band->data);
+                    }
+                }
+            }
+        }
+    }
+    SQZ_workspace_release(ctx->workspace, ctx->plane);
+    ctx->plane = NULL;
+}
+
+static SQZ_status_t
+SQZ_common_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (scan_ctx == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    SQZ_status_t result = SQZ_node_cache_init(&band->cache, band->width * band->height, band->workspace);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    SQZ_scan_fn const scan = scan_ctx->scan;
+    SQZ_list_init(&band->LIP, &band->cache);
+    SQZ_list_init(&band->LSP, &band->cache);
+    SQZ_list_init(&band->NSP, &band->cache);
+    for (size_t i = 0u; i < SQZ_CONTEXT_COUNT; ++i)
+    {
+        band->contexts[i] = SQZ_ARITHMETIC_HALF;
+    }
+    band->run_bits = SQZ_RICE_INITIAL_BITS << SQZ_RICE_RATE;
+    do
+    {
+        SQZ_list_add(&band->LIP, (uint16_t)scan_ctx->x, (uint16_t)scan_ctx->y);
+    }
+    while (scan(scan_ctx));
+    return SQZ_RESULT_OK;
+}
+
+static SQZ_status_t
+SQZ_encode_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (scan_ctx == NULL) || (buffer == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    if (band->data == NULL)
+    {
+        /* a finer subband left out of a preview, see SQZ_encode_preview, is all zero and never refined */
+        band->max_bitplane = band->bitplane = 0;
+        SQZ_bit_buffer_write_bits(buffer, 0u, 4u + (band->roi_count > 0u));
+        return SQZ_RESULT_OK;
+    }
+    SQZ_status_t result = SQZ_common_init_subband(band, scan_ctx);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    band->max_bitplane = (band->roi_count > 0u) ? SQZ_roi_max_bitplane(band) : (int)SQZ_ilog2(SQZ_dwt_get_max(band) >> 1);
+    band->bitplane = band->max_bitplane;
+    SQZ_bit_buffer_write_bits(buffer, band->max_bitplane, 4u + (band->roi_count > 0u));
+    return SQZ_RESULT_OK;
+}
+
+static SQZ_status_t
+SQZ_decode_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (scan_ctx == NULL) || (buffer == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    if (band->data == NULL)
+    {
+        /* sparse storage, see SQZ_idwt_sparse */
+        band->data = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(band->workspace, band->width * band->height * sizeof(SQZ_dwt_coefficient_t), 1);
+        if (band->data == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
+    }
+    SQZ_status_t result = SQZ_common_init_subband(band, scan_ctx);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    band->max_bitplane = SQZ_bit_buffer_read_bits(buffer, 4u + (band->roi_count > 0u));
+    band->bitplane = band->max_bitplane;
+    return SQZ_RESULT_OK;
+}
+
+static int
+SQZ_encode_write_wdr_run(SQZ_bit_buffer_t* const buffer, uint32_t const run)
+{
+#ifdef DEBUG
+    if (buffer == NULL)
+    {
+        return 0;
+    }
+#endif
+    uint32_t cost = SQZ_ilog2(run) - 1u;
+    if (cost <= 16u)
+    {
+        return SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run), cost * 2u);
+    }
+    else
+    {
+        return SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run >> 16), (cost - 16) * 2u) && SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run), 32u);
+    }
+}
+
+static int
+SQZ_decode_read_wdr_run(SQZ_bit_buffer_t* const buffer, uint32_t* const run)
+{
+#ifdef DEBUG
+    if ((buffer == NULL) || (run == NULL))
+    {
+        return 0;
+    }
+#endif
+    *run = 1u;
+    while (SQZ_bit_buffer_read_bit(buffer) == 0)
+    {
+        int const bit = SQZ_bit_buffer_read_bit(buffer);
+        if (bit < 0)
+        {
+            return 0;
+        }
+        *run += *run + bit;
+    }
+    return 1;
+}
+
+/**
+ * \brief           Arithmetic codes a WDR run, using the same code as in raw mode
+ * \note            Each bit of the code is coded in a context given by its position, and unlike in raw mode, the
+ *                  terminating bit is coded along with the run
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \param           run: The run length, at least 1
+ * \param[in,out]   contexts: The contexts of the subband
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_arithmetic_encode_run(SQZ_bit_buffer_t* const buffer, uint32_t const run, uint16_t* const contexts)
+{
+#ifdef DEBUG
+    if ((buffer == NULL) || (contexts == NULL) || (run == 0u))
+    {
+        return 0;
+    }
+#endif
+    uint32_t const length = SQZ_ilog2(run) - 1u;
+    for (uint32_t i = 0u; i < length; ++i)
+    {
+        uint32_t const position = (i < SQZ_CONTEXT_RUN_LENGTH) ? i : SQZ_CONTEXT_RUN_LENGTH - 1u;
+        if ((!SQZ_arithmetic_encode_bit(buffer, 0u, &contexts[SQZ_CONTEXT_RUN_FLAG + position])) ||
+            (!SQZ_arithmetic_encode_bit(buffer, (run >> (length - i - 1u)) & 1u, &contexts[SQZ_CONTEXT_RUN_BIT + position])))
+        {
+            return 0;
+        }
+    }
+    return SQZ_arithmetic_encode_bit(buffer, 1u, &contexts[SQZ_CONTEXT_RUN_FLAG + ((length < SQZ_CONTEXT_RUN_LENGTH) ? length : SQZ_CONTEXT_RUN_LENGTH - 1u)]);
+}
+
+/**
+ * \brief           Decodes an arithmetic coded WDR run, including its terminating bit
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \param[out]      run: The run length
+ * \param[in,out]   contexts: The contexts of the subband
+ * \return          1 on success, 0 if the buffer is exhausted or the run is invalid
+ */
+static int
+SQZ_arithmetic_decode_run(SQZ_bit_buffer_t* const buffer, uint32_t* const run, uint16_t* const contexts)
+{
+#ifdef DEBUG
+    if ((buffer == NULL) || (run == NULL) || (contexts == NULL))
+    {
+        return 0;
+    }
+#endif
+    *run = 1u;
+    for (uint32_t i = 0u; ; ++i)
+    {
+        uint32_t const position = (i < SQZ_CONTEXT_RUN_LENGTH) ? i : SQZ_CONTEXT_RUN_LENGTH - 1u;
+        int32_t const flag = SQZ_arithmetic_decode_bit(buffer, &contexts[SQZ_CONTEXT_RUN_FLAG + position]);
+        if (flag > 0)
+        {
+            return 1;
+        }
+        int32_t const bit = (flag == 0) ? SQZ_arithmetic_decode_bit(buffer, &contexts[SQZ_CONTEXT_RUN_BIT + position]) : -1;
+        if ((bit < 0) || (i >= 31u))
+        {
+            return 0;
+        }
+        *run += *run + bit;
+    }
+}
+
+/**
+ * \brief           Derives the Rice parameter from the running mean of the number of bits of the runs of a subband
+ * \note            The run lengths are heavy-tailed, so the mean of their logarithm is a more robust estimate than
+ *                  their mean. The parameter is one less than that mean, biased down by a quarter of a bit
+ * \param[in]       band: The subband
+ * \return          The number of low bits of the runs coded verbatim
+ */
+static uint32_t
+SQZ_rice_parameter(SQZ_dwt_subband_t const * const band)
+{
+    uint32_t const bias = 1u << (SQZ_RICE_RATE - 2u);
+    uint32_t const bits = (band->run_bits > bias) ? (band->run_bits - bias) >> SQZ_RICE_RATE : 0u;
+    return (bits > 1u) ? bits - 1u : 0u;
+}
+
+/**
+ * \brief           Updates the running mean of the number of bits of the runs of a subband
+ * \param[in,out]   band: The subband
+ * \param           run: The run length just coded
+ */
+static void
+SQZ_rice_update(SQZ_dwt_subband_t* const band, uint32_t const run)
+{
+    band->run_bits += SQZ_ilog2(run) - (band->run_bits >> SQZ_RICE_RATE);
+}
+
+/**
+ * \brief           Writes a WDR run with an adaptive Rice code
+ * \note            The run minus 1 is split into a quotient, coded in unary as zeros terminated by a one, and a
+ *                  remainder of a number of bits that follows the previous runs in the subband.
+ *                  Quotients of \ref SQZ_RICE_LIMIT or more are escaped, and coded with the WDR run code instead.
+ *                  Unlike the raw WDR run code, the code is self-terminated
+ * \param[in,out]   band: The subband, whose running mean is updated
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \param           run: The run length, at least 1
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_write_rice_run(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer, uint32_t const run)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL) || (run == 0u))
+    {
+        return 0;
+    }
+#endif
+    uint32_t const k = SQZ_rice_parameter(band), value = run - 1u, quotient = value >> k;
+    SQZ_rice_update(band, run);
+    if (quotient < SQZ_RICE_LIMIT)
+    {
+        if (!SQZ_bit_buffer_write_bits(buffer, 1u, quotient + 1u))
+        {
+            return 0;
+        }
+    }
+    else if ((!SQZ_bit_buffer_write_bits(buffer, 0u, SQZ_RICE_LIMIT)) || (!SQZ_encode_write_wdr_run(buffer, quotient - SQZ_RICE_LIMIT + 1u)) ||
+        (!SQZ_bit_buffer_write_bit(buffer, 1u)))
+    {
+        return 0;
+    }
+    return (k == 0u) || SQZ_bit_buffer_write_bits(buffer, value, k);
+}
+
+/**
+ * \brief           Reads a WDR run coded with the adaptive Rice code
+ * \param[in,out]   band: The subband, whose running mean is updated
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \param[out]      run: The run length
+ * \return          1 on success, 0 if the buffer is exhausted or the run is invalid
+ */
+static int
+SQZ_decode_read_rice_run(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer, uint32_t* const run)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL) || (run == NULL))
+    {
+        return 0;
+    }
+#endif
+    uint32_t const k = SQZ_rice_parameter(band);
+    uint32_t quotient = 0u;
+    int32_t bit = SQZ_bit_buffer_read_bit(buffer);
+    while ((bit == 0) && (quotient < SQZ_RICE_LIMIT - 1u))
+    {
+        ++quotient;
+        bit = SQZ_bit_buffer_read_bit(buffer);
+    }
+    if (bit < 0)
+    {
+        return 0;
+    }
+    if (bit == 0)
+    {
+        uint32_t escaped;
+        if ((!SQZ_decode_read_wdr_run(buffer, &escaped)) || (SQZ_bit_buffer_eob(buffer)))
+        {
+            return 0;
+        }
+        quotient = escaped + SQZ_RICE_LIMIT - 1u;
+    }
+    int32_t const remainder = (k > 0u) ? SQZ_bit_buffer_read_bits(buffer, k) : 0;
+    if ((remainder < 0) || (quotient > ((UINT32_MAX - 1u) >> k)))
+    {
+        return 0;
+    }
+    *run = ((quotient << k) | (uint32_t)remainder) + 1u;
+    SQZ_rice_update(band, *run);
+    return 1;
+}
+
+/**
+ * \brief           Writes a WDR run with a self-terminated code, the arithmetic or the Rice one
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \param           run: The run length, at least 1
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_write_run(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer, uint32_t const run)
+{
+    return (buffer->arithmetic) ? SQZ_arithmetic_encode_run(buffer, run, band->contexts) : SQZ_encode_write_rice_run(band, buffer, run);
+}
+
+/**
+ * \brief           Reads a WDR run, with the code in use for the subband
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \param[out]      run: The run length
+ * \return          1 on success, 0 if the buffer is exhausted or the run is invalid
+ */
+static int
+SQZ_decode_read_run(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer, uint32_t* const run)
+{
+    if (buffer->arithmetic)
+    {
+        return SQZ_arithmetic_decode_run(buffer, run, band->contexts);
+    }
+    return (band->rice) ? SQZ_decode_read_rice_run(band, buffer, run) : SQZ_decode_read_wdr_run(buffer, run);
+}
+
+/**
+ * \brief           Finds the default processing schedule of a spectral plane
+ * \param[in]       image: The image descriptor
+ * \param           plane: The spectral plane
+ * \return          Pointer to the default schedule of the plane for the color mode of the image
+ */
+static SQZ_schedule_t const*
+SQZ_schedule_default(SQZ_image_descriptor_t const * const image, size_t const plane)
+{
+    if (image->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL)
+    {
+        return &SQZ_schedule[SQZ_COLOR_MODE_GRAYSCALE][0];
+    }
+    if (image->color_mode == SQZ_COLOR_MODE_YCBCR_420)
+    {
+        return &SQZ_schedule[SQZ_COLOR_MODE_YCOCG_R][plane];
+    }
+    return &SQZ_schedule[image->color_mode][plane];
+}
+
+/**
+ * \brief           Checks whether a schedule differs from the default one of the color mode in any subband that is coded
+ * \note            Only the levels in use and the LL subband of the coarsest one are compared, as in \ref SQZ_encode_schedule
+ * \param[in]       image: The image descriptor, with the color mode, planes and levels actually coded
+ * \param[in]       schedule: The schedule of each spectral plane
+ * \return          1 if the schedule is a custom one, 0 otherwise
+ */
+static int
+SQZ_schedule_custom(SQZ_image_descriptor_t const * const image, SQZ_schedule_t const * const schedule)
+{
+    for (size_t plane = 0u; plane < image->num_planes; ++plane)
+    {
+        SQZ_schedule_t const * const base = SQZ_schedule_default(image, plane);
+        for (size_t level = 0u; level < image->dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                if (schedule[plane][level][orientation] != (*base)[level][orientation])
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief           Loads the processing schedule to be used, either the default one for the color mode or the custom one from the descriptor
+ * \param[in,out]   ctx: The codec context
+ */
+static void
+SQZ_schedule_init(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        if (ctx->image.schedule != NULL)
+        {
+            memcpy(ctx->schedule[plane], ctx->image.schedule[plane], sizeof(SQZ_schedule_t));
+        }
+        else
+        {
+            memcpy(ctx->schedule[plane], SQZ_schedule_default(&ctx->image, plane), sizeof(SQZ_schedule_t));
+        }
+    }
+}
+
+/**
+ * \brief           Writes a custom schedule as the per subband differences to the default schedule
+ * \note            Each plane starts with a flag signalling that it repeats the differences of the previous plane,
+ *                  so the default schedule costs 1 bit per plane. Otherwise, each difference is zigzag mapped and
+ *                  written with the same code used for the WDR runs, followed by its terminating bit
+ * \param[in]       ctx: The codec context
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \return          1 if successful, 0 otherwise
+ */
+static int
+SQZ_encode_schedule(SQZ_context_t const * const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    int32_t delta[SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS], previous[SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS] = { { 0 } };
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        SQZ_schedule_t const * const base = SQZ_schedule_default(&ctx->image, plane);
+        int same = 1;
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                delta[level][orientation] = (int32_t)ctx->schedule[plane][level][orientation] - (int32_t)(*base)[level][orientation];
+                same &= (delta[level][orientation] == previous[level][orientation]);
+            }
+        }
+        SQZ_bit_buffer_write_bit(buffer, same);
+        for (size_t level = 0u; (!same) && (level < ctx->image.dwt_levels); ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                int32_t const d = delta[level][orientation];
+                SQZ_encode_write_wdr_run(buffer, (uint32_t)((d < 0) ? (-2 * d) - 1 : 2 * d) + 1u);
+                SQZ_bit_buffer_write_bit(buffer, 1u);
+                previous[level][orientation] = d;
+            }
+        }
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Reads a custom schedule, applying the stored differences to the default schedule
+ * \param[in,out]   ctx: The codec context, with the default schedule already loaded
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \return          1 if successful, 0 otherwise
+ */
+static int
+SQZ_decode_schedule(SQZ_context_t* const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    int32_t delta[SQZ_DWT_MAX_LEVEL][SQZ_DWT_SUBBANDS] = { { 0 } };
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        int const same = SQZ_bit_buffer_read_bit(buffer);
+        if (same < 0)
+        {
+            return 0;
+        }
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                uint32_t run;
+                if (!same)
+                {
+                    if ((!SQZ_decode_read_wdr_run(buffer, &run)) || (run > 2u * UINT8_MAX + 1u))
+                    {
+                        return 0;
+                    }
+                    --run;
+                    delta[level][orientation] = (run & 1u) ? -(int32_t)((run + 1u) >> 1u) : (int32_t)(run >> 1u);
+                }
+                int32_t const round = (int32_t)ctx->schedule[plane][level][orientation] + delta[level][orientation];
+                if ((round < 0) || (round > UINT8_MAX))
+                {
+                    return 0;
+                }
+                ctx->schedule[plane][level][orientation] = (uint8_t)round;
+            }
+        }
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Snaps the regions of interest of the image descriptor to the grid used for signalling them
+ * \note            The regions are enlarged to whole grid cells
+ * \param[in,out]   ctx: The codec context, with the image descriptor already validated
+ */
+static void
+SQZ_roi_init(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    SQZ_image_descriptor_t const * const descriptor = &ctx->image;
+    size_t const cells = 1u << SQZ_ROI_GRID_BITS;
+    ctx->roi.count = descriptor->roi_count;
+    ctx->roi.shift = descriptor->roi_shift;
+    for (size_t i = 0u; i < descriptor->roi_count; ++i)
+    {
+        SQZ_region_t const * const region = &descriptor->roi[i];
+        ctx->roi.region[i][0] = (uint8_t)((region->x * cells) / descriptor->width);
+        ctx->roi.region[i][1] = (uint8_t)((region->y * cells) / descriptor->height);
+        ctx->roi.region[i][2] = (uint8_t)(((region->x + region->width) * cells + descriptor->width - 1u) / descriptor->width);
+        ctx->roi.region[i][3] = (uint8_t)(((region->y + region->height) * cells + descriptor->height - 1u) / descriptor->height);
+    }
+}
+
+/**
+ * \brief           Writes the regions of interest to the header
+ * \note            Stores the number of regions and the shift, followed by the position and size of each region
+ *                  on the grid
+ * \param[in]       ctx: The codec context
+ * \param[out]      buffer: The bit buffer to write to
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_roi(SQZ_context_t const * const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_bit_buffer_write_bits(buffer, (uint32_t)ctx->roi.count - 1u, 3u);
+    SQZ_bit_buffer_write_bits(buffer, (uint32_t)ctx->roi.shift - 1u, 4u);
+    for (size_t i = 0u; i < ctx->roi.count; ++i)
+    {
+        uint8_t const * const region = ctx->roi.region[i];
+        SQZ_bit_buffer_write_bits(buffer, region[0], SQZ_ROI_GRID_BITS);
+        SQZ_bit_buffer_write_bits(buffer, region[1], SQZ_ROI_GRID_BITS);
+        SQZ_bit_buffer_write_bits(buffer, region[2] - region[0] - 1u, SQZ_ROI_GRID_BITS);
+        SQZ_bit_buffer_write_bits(buffer, region[3] - region[1] - 1u, SQZ_ROI_GRID_BITS);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Reads the regions of interest from the header
+ * \param[in,out]   ctx: The codec context
+ * \param[in]       buffer: The bit buffer to read from
+ * \return          1 on success, 0 if the buffer is exhausted or the regions are invalid
+ */
+static int
+SQZ_decode_roi(SQZ_context_t* const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    int32_t const count = SQZ_bit_buffer_read_bits(buffer, 3u), shift = SQZ_bit_buffer_read_bits(buffer, 4u);
+    if ((count < 0) || (shift < 0))
+    {
+        return 0;
+    }
+    ctx->roi.count = (size_t)count + 1u;
+    ctx->roi.shift = shift + 1;
+    for (size_t i = 0u; i < ctx->roi.count; ++i)
+    {
+        int32_t value[4];
+        for (size_t j = 0u; j < 4u; ++j)
+        {
+            value[j] = SQZ_bit_buffer_read_bits(buffer, SQZ_ROI_GRID_BITS);
+            if (value[j] < 0)
+            {
+                return 0;
+            }
+        }
+        value[2] += value[0] + 1;
+        value[3] += value[1] + 1;
+        if ((value[2] > (1 << SQZ_ROI_GRID_BITS)) || (value[3] > (1 << SQZ_ROI_GRID_BITS)))
+        {
+            return 0;
+        }
+        for (size_t j = 0u; j < 4u; ++j)
+        {
+            ctx->roi.region[i][j] = (uint8_t)value[j];
+        }
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Writes the limits on the coding of the chroma planes to the header
+ * \param[in]       ctx: The codec context
+ * \param[out]      buffer: The bit buffer to write to
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_chroma_limits(SQZ_context_t const * const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_bit_buffer_write_bits(buffer, (uint32_t)ctx->chroma_floor, 4u);
+    SQZ_encode_write_wdr_run(buffer, (uint32_t)ctx->chroma_budget + 1u);
+    SQZ_bit_buffer_write_bit(buffer, 1u);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Reads the limits on the coding of the chroma planes from the header
+ * \param[in,out]   ctx: The codec context
+ * \param[in]       buffer: The bit buffer to read from
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_decode_chroma_limits(SQZ_context_t* const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    int32_t const floor = SQZ_bit_buffer_read_bits(buffer, 4u);
+    uint32_t budget;
+    if ((floor < 0) || (!SQZ_decode_read_wdr_run(buffer, &budget)))
+    {
+        return 0;
+    }
+    ctx->chroma_floor = floor;
+    ctx->chroma_budget = budget - 1u;
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Writes the number of bands of a multispectral image to the header, followed by a flag per band after
+ *                  the first one, set if it's coded as its difference to the previous band
+ * \param[in]       ctx: The codec context
+ * \param[out]      buffer: The bit buffer to write to
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_multispectral(SQZ_context_t const * const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_bit_buffer_write_bits(buffer, (uint32_t)ctx->image.num_planes - 1u, 4u);
+    if (ctx->image.num_planes > 1u)
+    {
+        SQZ_bit_buffer_write_bits(buffer, ctx->band_differences >> 1u, (uint32_t)ctx->image.num_planes - 1u);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Reads the number of bands of a multispectral image from the header, and those coded as differences
+ * \param[in,out]   ctx: The codec context
+ * \param[in]       buffer: The bit buffer to read from
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_decode_multispectral(SQZ_context_t* const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    int32_t const planes = SQZ_bit_buffer_read_bits(buffer, 4u);
+    int32_t const differences = (planes > 0) ? SQZ_bit_buffer_read_bits(buffer, (uint32_t)planes) : 0;
+    if ((planes < 0) || (differences < 0))
+    {
+        return 0;
+    }
+    ctx->image.num_planes = (size_t)planes + 1u;
+    ctx->band_differences = (uint32_t)differences << 1u;
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_encode_header(SQZ_context_t const * const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_image_descriptor_t const * const descriptor = &ctx->image;
+    SQZ_bit_buffer_write_bits(buffer, (ctx->extensions) ? SQZ_HEADER_MAGIC_EXTENDED : SQZ_HEADER_MAGIC, 8u);
+    SQZ_bit_buffer_write_bits(buffer, descriptor->width -  1u,    16u);
+    SQZ_bit_buffer_write_bits(buffer, descriptor->height - 1u,    16u);
+    /* multispectral and Y'CbCr images are signalled by their extension, the planes being coded as grayscale or YCoCg-R ones */
+    SQZ_color_mode_t const color_mode = (descriptor->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL) ? SQZ_COLOR_MODE_GRAYSCALE :
+                                        ((descriptor->color_mode == SQZ_COLOR_MODE_YCBCR_420) ? SQZ_COLOR_MODE_YCOCG_R : descriptor->color_mode);
+    SQZ_bit_buffer_write_bits(buffer, color_mode, 2u);
+    SQZ_bit_buffer_write_bits(buffer, descriptor->dwt_levels - 1u, 3u);
+    SQZ_bit_buffer_write_bits(buffer, descriptor->scan_order,      2u);
+    SQZ_bit_buffer_write_bit(buffer, !!descriptor->subsampling);
+    if (ctx->extensions)
+    {
+        uint32_t flags = ctx->extensions;
+        do
+        {
+            SQZ_bit_buffer_write_bits(buffer, flags & ((1u << SQZ_HEADER_EXTENSION_GROUP_BITS) - 1u), SQZ_HEADER_EXTENSION_GROUP_BITS);
+            flags >>= SQZ_HEADER_EXTENSION_GROUP_BITS;
+            SQZ_bit_buffer_write_bit(buffer, flags != 0u);
+        }
+        while (flags != 0u);
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_MULTISPECTRAL) && (!SQZ_encode_multispectral(ctx, buffer)))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_SCHEDULE) && (!SQZ_encode_schedule(ctx, buffer)))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_ROI) && (!SQZ_encode_roi(ctx, buffer)))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_CHROMA) && (!SQZ_encode_chroma_limits(ctx, buffer)))
+        {
+            return 0;
+        }
+        if (ctx->extensions & SQZ_HEADER_EXTENSION_NEAR_LOSSLESS)
+        {
+            SQZ_bit_buffer_write_bits(buffer, (uint32_t)descriptor->max_error, 4u);
+        }
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_decode_header(SQZ_context_t* const ctx, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_image_descriptor_t* const descriptor = &ctx->image;
+    int32_t const magic = SQZ_bit_buffer_read_bits(buffer, 8u);
+    if ((magic != SQZ_HEADER_MAGIC) && (magic != SQZ_HEADER_MAGIC_EXTENDED))
+    {
+        return 0;
+    }
+    int32_t const width       = SQZ_bit_buffer_read_bits(buffer, 16u);
+    int32_t const height      = SQZ_bit_buffer_read_bits(buffer, 16u);
+    int32_t const color_mode  = SQZ_bit_buffer_read_bits(buffer,  2u);
+    int32_t const dwt_levels  = SQZ_bit_buffer_read_bits(buffer,  3u);
+    int32_t const scan_order  = SQZ_bit_buffer_read_bits(buffer,  2u);
+    int32_t const subsampling = SQZ_bit_buffer_read_bit(buffer);
+    if ((width < 0) || (height < 0) || (color_mode < 0) || (dwt_levels < 0) || (scan_order < 0) || (subsampling < 0))
+    {
+        /* truncated header, whose fields would index the tables of planes and schedules out of bounds */
+        return 0;
+    }
+    descriptor->width      = (size_t)width + 1u;
+    descriptor->height     = (size_t)height + 1u;
+    descriptor->color_mode = (SQZ_color_mode_t)color_mode;
+    descriptor->dwt_levels = (size_t)dwt_levels + 1u;
+    descriptor->scan_order = (SQZ_scan_order_t)scan_order;
+    descriptor->num_planes = SQZ_number_of_planes[descriptor->color_mode];
+    descriptor->subsampling = subsampling;
+    descriptor->schedule = NULL;
+    SQZ_schedule_init(ctx);
+    ctx->extensions = 0u;
+    ctx->roi.count = 0u;
+    ctx->chroma_floor = 0;
+    ctx->chroma_budget = 0u;
+    ctx->band_differences = 0u;
+    descriptor->arithmetic_coding = 0;
+    descriptor->rice_coding = 0;
+    descriptor->resolution_order = 0;
+    descriptor->dense_coding = 0;
+    descriptor->max_error = 0;
+    descriptor->band_transform = 0;
+    if (magic == SQZ_HEADER_MAGIC_EXTENDED)
+    {
+        uint32_t shift = 0u;
+        int32_t more;
+        do
+        {
+            int32_t const flags = SQZ_bit_buffer_read_bits(buffer, SQZ_HEADER_EXTENSION_GROUP_BITS);
+            more = SQZ_bit_buffer_read_bit(buffer);
+            if ((flags < 0) || (more < 0) || (shift >= sizeof(ctx->extensions) * CHAR_BIT))
+            {
+                return 0;
+            }
+            ctx->extensions |= (uint32_t)flags << shift;
+            shift += SQZ_HEADER_EXTENSION_GROUP_BITS;
+        }
+        while (more);
+        if ((ctx->extensions == 0u) || (ctx->extensions & ~SQZ_HEADER_EXTENSION_SUPPORTED))
+        {
+            return 0;
+        }
+        if (ctx->extensions & SQZ_HEADER_EXTENSION_MULTISPECTRAL)
+        {
+            if ((descriptor->color_mode != SQZ_COLOR_MODE_GRAYSCALE) || (!SQZ_decode_multispectral(ctx, buffer)))
+            {
+                return 0;
+            }
+            descriptor->color_mode = SQZ_COLOR_MODE_MULTISPECTRAL;
+            descriptor->band_transform = (ctx->band_differences != 0u);
+            SQZ_schedule_init(ctx);
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_TEMPORAL) && (ctx->sequence == NULL))
+        {
+            /* the residuals of a frame can only be decoded along with the previous one */
+            return 0;
+        }
+        if (ctx->extensions & SQZ_HEADER_EXTENSION_YCBCR_420)
+        {
+            if ((descriptor->color_mode != SQZ_COLOR_MODE_YCOCG_R) || (ctx->extensions & SQZ_HEADER_EXTENSION_MULTISPECTRAL))
+            {
+                return 0;
+            }
+            descriptor->color_mode = SQZ_COLOR_MODE_YCBCR_420;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_GRAY) &&
+            ((descriptor->color_mode != SQZ_COLOR_MODE_GRAYSCALE) || (ctx->extensions & (SQZ_HEADER_EXTENSION_MULTISPECTRAL | SQZ_HEADER_EXTENSION_TEMPORAL))))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_SCHEDULE) && (!SQZ_decode_schedule(ctx, buffer)))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_ROI) && (!SQZ_decode_roi(ctx, buffer)))
+        {
+            return 0;
+        }
+        if ((ctx->extensions & SQZ_HEADER_EXTENSION_CHROMA) && (!SQZ_decode_chroma_limits(ctx, buffer)))
+        {
+            return 0;
+        }
+        if (ctx->extensions & SQZ_HEADER_EXTENSION_NEAR_LOSSLESS)
+        {
+            descriptor->max_error = SQZ_bit_buffer_read_bits(buffer, 4u);
+            if (descriptor->max_error <= 0)
+            {
+                return 0;
+            }
+        }
+        descriptor->arithmetic_coding = !!(ctx->extensions & SQZ_HEADER_EXTENSION_ARITHMETIC);
+        descriptor->rice_coding = !!(ctx->extensions & SQZ_HEADER_EXTENSION_RICE);
+        descriptor->resolution_order = !!(ctx->extensions & SQZ_HEADER_EXTENSION_RESOLUTION);
+        descriptor->dense_coding = !!(ctx->extensions & SQZ_HEADER_EXTENSION_DENSE);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Finds whether the sorting pass is smaller coded as a raw significance map than as WDR runs
+ * \note            Each run costs 2 bits per bit of its length with the raw WDR code, its sign and terminating bit
+ *                  included, so the runs of 1 of a dense bitplane cost 2 bits per new significant coefficient, while
+ *                  the map costs 1 bit per coefficient coded, plus the signs. The runs are costed with the raw code
+ *                  even when the Rice or the arithmetic code is used.
+ *                  The difference between the costs of the map and of the runs, counting the pending run as if it
+ *                  ended, drops by 1 for at most every other coefficient, so the walk stops on sparse bitplanes as
+ *                  soon as it exceeds half of the coefficients left
+ * \param[in]       band: The subband
+ * \return          1 if the map is smaller, 0 otherwise
+ */
+static int
+SQZ_sorting_dense(SQZ_dwt_subband_t const * const band)
+{
+#ifdef DEBUG
+    if (band == NULL)
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t const * const data = band->data;
+    size_t const stride = band->stride;
+    uint32_t i = 1u, last = 0u;
+    size_t runs = 0u, map = 0u, left = band->LIP.length;
+    for (SQZ_list_node_t const * pixel = band->LIP.head; pixel != NULL; pixel = SQZ_list_node_next(pixel, base))
+    {
+        --left;
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        if (bitplane < 1)
+        {
+            continue;
+        }
+        if (data[pixel->y * stride + pixel->x] & (SQZ_dwt_coefficient_t)(1u << bitplane))
+        {
+            runs += 2u * SQZ_ilog2(i - last);
+            last = i;
+            ++map;
+        }
+        ++map;
+        ++i;
+        size_t const cost = runs + 2u * SQZ_ilog2(i - last);
+        if ((map > cost) && (2u * (map - cost) > left))
+        {
+            return 0;
+        }
+    }
+    return map < runs + 2u * SQZ_ilog2(i - last);
+}
+
+/**
+ * \brief           Codes the sorting pass as a raw significance map, with a bit per coefficient coded, followed by the
+ *                  sign of those that become significant
+ * \note            The new significant coefficients are moved to the NSP in a single walk over the LIP
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_significance_map(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_t * restrict const LIP = &band->LIP;
+    SQZ_list_t * restrict const NSP = &band->NSP;
+    SQZ_list_node_t *pixel = LIP->head, *kept = NULL, *moved = NSP->tail;
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t const * const data = band->data;
+    size_t const stride = band->stride;
+    size_t count = 0u;
+    while (pixel != NULL)
+    {
+        SQZ_list_node_t* const next = SQZ_list_node_next(pixel, base);
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        int significant = 0;
+        if (bitplane >= 1)
+        {
+            SQZ_dwt_coefficient_t const v = data[pixel->y * stride + pixel->x];
+            significant = !!(v & (SQZ_dwt_coefficient_t)(1u << bitplane));
+            if ((!SQZ_bit_buffer_encode_bit(buffer, significant, &band->contexts[SQZ_CONTEXT_SIGNIFICANCE])) ||
+                ((significant) && (!SQZ_bit_buffer_encode_bit(buffer, v & 1, &band->contexts[SQZ_CONTEXT_SIGN]))))
+            {
+                break;
+            }
+        }
+        if (significant)
+        {
+            if (moved != NULL)
+            {
+                moved->next = pixel - base;
+            }
+            else
+            {
+                NSP->head = pixel;
+            }
+            moved = pixel;
+            ++count;
+        }
+        else
+        {
+            if (kept != NULL)
+            {
+                kept->next = pixel - base;
+            }
+            else
+            {
+                LIP->head = pixel;
+            }
+            kept = pixel;
+        }
+        pixel = next;
+    }
+    SQZ_list_partition(LIP, NSP, kept, moved, pixel, count);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Decodes the sorting pass coded as a raw significance map
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_decode_significance_map(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_t * restrict const LIP = &band->LIP;
+    SQZ_list_t * restrict const NSP = &band->NSP;
+    SQZ_list_node_t *pixel = LIP->head, *kept = NULL, *moved = NSP->tail;
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t* const data = band->data;
+    size_t const stride = band->stride;
+    size_t count = 0u;
+    while (pixel != NULL)
+    {
+        SQZ_list_node_t* const next = SQZ_list_node_next(pixel, base);
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        int32_t significant = 0;
+        if (bitplane >= 1)
+        {
+            significant = SQZ_bit_buffer_decode_bit(buffer, &band->contexts[SQZ_CONTEXT_SIGNIFICANCE]);
+            int32_t const sign = (significant > 0) ? SQZ_bit_buffer_decode_bit(buffer, &band->contexts[SQZ_CONTEXT_SIGN]) : 0;
+            if ((significant < 0) || (sign < 0))
+            {
+                break;
+            }
+            if (significant)
+            {
+                data[pixel->y * stride + pixel->x] |= ((SQZ_dwt_coefficient_t)(1u << bitplane) | sign);
+            }
+        }
+        if (significant)
+        {
+            if (moved != NULL)
+            {
+                moved->next = pixel - base;
+            }
+            else
+            {
+                NSP->head = pixel;
+            }
+            moved = pixel;
+            ++count;
+        }
+        else
+        {
+            if (kept != NULL)
+            {
+                kept->next = pixel - base;
+            }
+            else
+            {
+                LIP->head = pixel;
+            }
+            kept = pixel;
+        }
+        pixel = next;
+    }
+    SQZ_list_partition(LIP, NSP, kept, moved, pixel, count);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Codes the new significant coefficients among the insignificant ones
+ * \note            With the dense extension, a flag first signals whether the pass is coded as a raw significance map
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to write to
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_encode_sorting_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_t * restrict const LIP = &band->LIP;
+    if ((LIP->length == 0u) || (band->bitplane <= 0))
+    {
+        return 1;
+    }
+    if (band->dense)
+    {
+        int const dense = SQZ_sorting_dense(band);
+        if (!SQZ_bit_buffer_encode_bit(buffer, dense, &band->contexts[SQZ_CONTEXT_DENSE]))
+        {
+            return 0;
+        }
+        if (dense)
+        {
+            return SQZ_encode_significance_map(band, buffer);
+        }
+    }
+    SQZ_list_t * restrict const NSP = &band->NSP;
+    SQZ_list_node_t *pixel = LIP->head, *previous = NULL;
+    SQZ_list_node_t* const base = LIP->cache->nodes;
+    SQZ_dwt_coefficient_t const * const data = band->data;
+    size_t const stride = band->stride;
+    uint32_t i = 1u, last = 0u;
+    while (pixel != NULL)
+    {
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        if (bitplane < 1)
+        {
+            /* not coded at this bitplane, so not counted in the runs */
+            previous = pixel;
+            pixel = SQZ_list_node_next(pixel, base);
+            continue;
+        }
+        SQZ_dwt_coefficient_t const v = data[pixel->y * stride + pixel->x];
+        if (!!(v & (SQZ_dwt_coefficient_t)(1u << bitplane)))
+        {
+            if ((buffer->arithmetic) || (band->rice))
+            {
+                if ((!SQZ_bit_buffer_encode_bit(buffer, v & 1, &band->contexts[SQZ_CONTEXT_SIGN])) || (!SQZ_encode_write_run(band, buffer, i - last)))
+                {
+                    break;
+                }
+            }
+            else if ((!SQZ_bit_buffer_write_bits(buffer, 2u | (v & 1), 1u + !!last)) || (!SQZ_encode_write_wdr_run(buffer, i - last)))
+            {
+                break;
+            }
+            last = i;
+            pixel = SQZ_list_exchange(LIP, NSP, pixel, previous);
+        }
+        else
+        {
+            previous = pixel;
+            pixel = SQZ_list_node_next(pixel, base);
+        }
+        ++i;
+    }
+    /* now handle WDR termination */
+    if ((buffer->arithmetic) || (band->rice))
+    {
+        if (SQZ_bit_buffer_encode_bit(buffer, 1u, &band->contexts[SQZ_CONTEXT_SIGN]))
+        {
+            SQZ_encode_write_run(band, buffer, i - last);
+        }
+    }
+    else
+    {
+        SQZ_bit_buffer_write_bits(buffer, 3u, 1u + (NSP->length > 0u));
+        SQZ_encode_write_wdr_run(buffer, i - last);
+        SQZ_bit_buffer_write_bit(buffer, 1u);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+/**
+ * \brief           Decodes the new significant coefficients among the insignificant ones
+ * \param[in,out]   band: The subband
+ * \param[in,out]   buffer: The bit buffer to read from
+ * \return          1 on success, 0 if the buffer is exhausted
+ */
+static int
+SQZ_decode_sorting_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_t * restrict const LIP = &band->LIP;
+    if ((LIP->length == 0u) || (band->bitplane <= 0))
+    {
+        return 1;
+    }
+    if (band->dense)
+    {
+        int32_t const dense = SQZ_bit_buffer_decode_bit(buffer, &band->contexts[SQZ_CONTEXT_DENSE]);
+        if (dense < 0)
+        {
+            return 0;
+        }
+        if (dense)
+        {
+            return SQZ_decode_significance_map(band, buffer);
+        }
+    }
+    SQZ_list_t * restrict const NSP = &band->NSP;
+    SQZ_list_node_t *pixel = LIP->head, *previous = NULL;
+    SQZ_list_node_t* const base = LIP->cache->nodes;
+    SQZ_dwt_coefficient_t* const data = band->data;
+    size_t const stride = band->stride;
+    uint32_t run;
+    int sign;
+    SQZ_roi_skip(band, &pixel, &previous);
+    do
+    {
+        sign = SQZ_bit_buffer_decode_bit(buffer, &band->contexts[SQZ_CONTEXT_SIGN]);
+        if ((sign < 0) || (!SQZ_decode_read_run(band, buffer, &run)))
+        {
+            break;
+        }
+        while ((--run > 0) && (pixel != NULL))
+        {
+            previous = pixel;
+            pixel = SQZ_list_node_next(pixel, base);
+            SQZ_roi_skip(band, &pixel, &previous);
+        }
+        if (pixel != NULL)
+        {
+            int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+            data[pixel->y * stride + pixel->x] |= ((SQZ_dwt_coefficient_t)(1u << bitplane) | sign);
+            pixel = SQZ_list_exchange(LIP, NSP, pixel, previous);
+            SQZ_roi_skip(band, &pixel, &previous);
+        }
+        else
+        {
+            break;
+        }
+    }
+    while (1);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_encode_refinement_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_node_t* pixel = band->LSP.head;
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t const * const data = band->data;
+    size_t const stride = band->stride;
+    while (pixel != NULL)
+    {
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        SQZ_dwt_coefficient_t const v = data[pixel->y * stride + pixel->x];
+        if ((bitplane > 0) && (!SQZ_bit_buffer_encode_bit(buffer, !!(v & (SQZ_dwt_coefficient_t)(1u << bitplane)), &band->contexts[SQZ_CONTEXT_REFINEMENT + (((uint16_t)v >> (bitplane + 1)) > 1)])))
+        {
+            break;
+        }
+        pixel = SQZ_list_node_next(pixel, base);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_decode_refinement_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    SQZ_list_node_t* pixel = band->LSP.head;
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t* const data = band->data;
+    size_t const stride = band->stride;
+    while (pixel != NULL)
+    {
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        if (bitplane < 1)
+        {
+            pixel = SQZ_list_node_next(pixel, base);
+            continue;
+        }
+        SQZ_dwt_coefficient_t* const coefficient = &data[pixel->y * stride + pixel->x];
+        int v = SQZ_bit_buffer_decode_bit(buffer, &band->contexts[SQZ_CONTEXT_REFINEMENT + (((uint16_t)*coefficient >> (bitplane + 1)) > 1)]);
+        if (v > 0)
+        {
+            *coefficient |= (SQZ_dwt_coefficient_t)(1u << bitplane);
+        }
+        else if (v < 0)
+        {
+            break;
+        }
+        pixel = SQZ_list_node_next(pixel, base);
+    }
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_encode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    if (band->bitplane < band->min_bitplane)
+    {
+        return !SQZ_bit_buffer_eob(buffer);
+    }
+    if ((!SQZ_encode_sorting_pass(band, buffer)) || (!SQZ_encode_refinement_pass(band, buffer)))
+    {
+        return 0;
+    }
+    /* now merge NSP into LSP */
+    SQZ_list_merge(&band->NSP, &band->LSP);
+    band->bitplane -= (band->bitplane > 0);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+static int
+SQZ_decode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+#ifdef DEBUG
+    if ((band == NULL) || (buffer == NULL))
+    {
+        return 0;
+    }
+#endif
+    if (band->bitplane < band->min_bitplane)
+    {
+        return !SQZ_bit_buffer_eob(buffer);
+    }
+    if ((!SQZ_decode_sorting_pass(band, buffer)) || (!SQZ_decode_refinement_pass(band, buffer)))
+    {
+        return 0;
+    }
+    /* now merge NSP into LSP */
+    SQZ_list_merge(&band->NSP, &band->LSP);
+    band->bitplane -= (band->bitplane > 0);
+    return !SQZ_bit_buffer_eob(buffer);
+}
+
+#ifdef SQZ_SIMD_X86
+
+/*
+The bitplane passes of the AVX2 and AVX-512 kernels are the same code, with every function they call inlined and compiled
+for BMI2 and LZCNT: the variable shifts and masks of the bit IO use SHLX, SHRX and BZHI, and the bit lengths of the run
+codes use LZCNT
+*/
+
+static int SQZ_TARGET("bmi,bmi2,lzcnt") SQZ_FLATTEN
+SQZ_encode_bitplane_bmi2(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+    return SQZ_encode_bitplane(band, buffer);
+}
+
+static int SQZ_TARGET("bmi,bmi2,lzcnt") SQZ_FLATTEN
+SQZ_decode_bitplane_bmi2(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+{
+    return SQZ_decode_bitplane(band, buffer);
+}
+
+#endif /* SQZ_SIMD_X86 */
+
+#undef SQZ_TARGET
+#undef SQZ_FLATTEN
+
+static void
+SQZ_decode_round_subband(SQZ_dwt_subband_t* const band)
+{
+#ifdef DEBUG
+    if (band == NULL)
+    {
+        return;
+    }
+#endif
+    if ((band->max_bitplane == 0) || (band->bitplane < 2))
+    {
+        return;
+    }
+    SQZ_list_node_t* pixel = band->LSP.head;
+    SQZ_list_node_t* const base = band->cache.nodes;
+    SQZ_dwt_coefficient_t* const data = band->data;
+    size_t const stride = band->stride;
+    while (pixel != NULL)
+    {
+        /* with regions of interest, the coefficients in them may already be complete */
+        int const bitplane = band->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+        if (bitplane > 1)
+        {
+            data[pixel->y * stride + pixel->x] |= (SQZ_dwt_coefficient_t)(((1u << bitplane) - 1u) ^ 1u);
+        }
+        pixel = SQZ_list_node_next(pixel, base);
+    }
+}
+
+static void
+SQZ_decode_round_coefficients(SQZ_context_t* const ctx)
+{
+#ifdef DEBUG
+    if (ctx == NULL)
+    {
+        return;
+    }
+#endif
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                SQZ_decode_round_subband(&ctx->plane[plane].band[level][orientation]);
+            }
+        }
+    }
+}
+
+/**
+ * \brief           Dequantizes the coefficients of the subbands processed since the last call, as they would be for display
+ * \note            Each coefficient is taken to affect the samples within 2 of its positions on each side, at the
+ *                  scale of its subband, which covers the support of the 5/3 synthesis filters over all the levels
+ * \param[in,out]   ctx: The codec context, holding the decoded DWT coefficients, which are left as they are
+ * \param[in,out]   coefficients: The dequantized DWT coefficients, with the layout of the image, updated
+ * \param[out]      region: The region of the image affected by the coefficients that changed, empty if none did
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_decode_dequantize(SQZ_context_t* const ctx, SQZ_dwt_coefficient_t* const coefficients, SQZ_region_t* const region)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (coefficients == NULL) || (region == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    size_t const width = ctx->image.width, height = ctx->image.height;
+    SQZ_dwt_coefficient_t* const scratch = (SQZ_dwt_coefficient_t*)malloc(((width + 1u) >> 1u) * ((height + 1u) >> 1u) * sizeof(SQZ_dwt_coefficient_t));
+    if (scratch == NULL)
+    {
+        return SQZ_OUT_OF_MEMORY;
+    }
+    size_t x0 = width, y0 = height, x1 = 0u, y1 = 0u;
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
+            {
+                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+                if (!band->updated)
+                {
+                    continue;
+                }
+                band->updated = 0;
+                /* the rounding is done on a copy, as the decoder may still refine the coefficients */
+                SQZ_dwt_subband_t view = *band;
+                view.data = scratch;
+                view.stride = band->width;
+                for (size_t y = 0u; y < band->height; ++y)
+                {
+                    memcpy(scratch + y * band->width, band->data + y * band->stride, band->width * sizeof(SQZ_dwt_coefficient_t));
+                }
+                SQZ_decode_round_subband(&view);
+                SQZ_dwt_coefficient_t* const output = coefficients + (band->data - ctx->data);
+                size_t bx0 = band->width, by0 = band->height, bx1 = 0u, by1 = 0u;
+                for (size_t y = 0u; y < band->height; ++y)
+                {
+                    for (size_t x = 0u; x < band->width; ++x)
+                    {
+                        SQZ_dwt_coefficient_t const v = scratch[y * band->width + x];
+                        SQZ_dwt_coefficient_t const value = (v & 1) ? - (v >> 1) : v >> 1;
+                        if (output[y * band->stride + x] != value)
+                        {
+                            output[y * band->stride + x] = value;
+                            bx0 = (x < bx0) ? x : bx0;
+                            bx1 = (x >= bx1) ? x + 1u : bx1;
+                            by0 = (y < by0) ? y : by0;
+                            by1 = y + 1u;
+                        }
+                    }
+                }
+                if (bx1 > 0u)
+                {
+                    size_t const shift = ctx->image.dwt_levels - level;
+                    bx0 = (bx0 > 2u) ? (bx0 - 2u) << shift : 0u;
+                    by0 = (by0 > 2u) ? (by0 - 2u) << shift : 0u;
+                    x0 = (bx0 < x0) ? bx0 : x0;
+                    y0 = (by0 < y0) ? by0 : y0;
+                    x1 = ((bx1 + 2u) << shift > x1) ? (bx1 + 2u) << shift : x1;
+                    y1 = ((by1 + 2u) << shift > y1) ? (by1 + 2u) << shift : y1;
+                }
+            }
+        }
+    }
+    free(scratch);
+    x1 = (x1 < width) ? x1 : width;
+    y1 = (y1 < height) ? y1 : height;
+    region->x = (x0 < x1) ? x0 : 0u;
+    region->y = (y0 < y1) ? y0 : 0u;
+    region->width = (x0 < x1) ? x1 - x0 : 0u;
+    region->height = (y0 < y1) ? y1 - y0 : 0u;
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Saves the state of the decoder before a task of the scheduler
+ * \param[in,out]   ctx: The codec context
+ * \param[in]       band: The subband about to be processed
+ */
+static void
+SQZ_schedule_checkpoint(SQZ_context_t* const ctx, SQZ_dwt_subband_t const * const band)
+{
+    SQZ_checkpoint_t* const checkpoint = &ctx->checkpoint;
+    checkpoint->position = (size_t)(ctx->buffer.ptr - ctx->buffer.data);
+    checkpoint->index = ctx->buffer.index;
+    checkpoint->low = ctx->buffer.low;
+    checkpoint->high = ctx->buffer.high;
+    checkpoint->code = ctx->buffer.code;
+    checkpoint->chroma_bits = ctx->chroma_bits;
+    checkpoint->tail = band->LSP.tail;
+    checkpoint->length = band->LSP.length;
+    checkpoint->initialized = (band->cache.nodes != NULL);
+    checkpoint->max_bitplane = band->max_bitplane;
+    checkpoint->bitplane = band->bitplane;
+    checkpoint->run_bits = band->run_bits;
+    memcpy(checkpoint->contexts, band->contexts, sizeof(checkpoint->contexts));
+}
+
+/**
+ * \brief           Releases the scan context of the scheduler, or keeps it in the workspace of the codec context for the next call
+ * \param[in,out]   ctx: The codec context
+ * \param[in]       scan: The scan context
+ */
+static void
+SQZ_schedule_release_scan(SQZ_context_t* const ctx, SQZ_scan_context_t const * const scan)
+{
+    if (ctx->workspace != NULL)
+    {
+        ctx->workspace->scan = *scan;
+    }
+    else
+    {
+        free(scan->workspace);
+    }
+}
+
+/**
+ * \brief           Undoes the task of the scheduler interrupted by the end of the data, so that it can be resumed
+ * \note            The coefficients found significant by the task are in the NSP, or at the end of the LSP if the task
+ *                  completed, and are returned to the LIP at their original positions, as it keeps the scanning order.
+ *                  The bits set by the refinement pass are cleared, as they were still unknown before the task
+ * \param[in,out]   ctx: The codec context, with its bit buffer pointing to the data that will resume decoding
+ */
+static void
+SQZ_decode_rollback(SQZ_context_t* const ctx)
+{
+    SQZ_checkpoint_t const * const checkpoint = &ctx->checkpoint;
+    SQZ_dwt_subband_t* const band = &ctx->plane[ctx->cursor.plane].band[ctx->cursor.level][ctx->cursor.orientation];
+    SQZ_dwt_coefficient_t* const data = band->data;
+    size_t const stride = band->stride;
+    ctx->buffer.ptr = ctx->buffer.data + checkpoint->position;
+    ctx->buffer.index = checkpoint->index;
+    ctx->buffer.low = checkpoint->low;
+    ctx->buffer.high = checkpoint->high;
+    ctx->buffer.code = checkpoint->code;
+    ctx->chroma_bits = checkpoint->chroma_bits;
+    if (!checkpoint->initialized)
+    {
+        /* the task started the subband, which is entirely cleared */
+        for (size_t y = 0u; y < band->height; ++y)
+        {
+            memset(data + y * stride, 0, band->width * sizeof(SQZ_dwt_coefficient_t));
+        }
+        SQZ_workspace_release(band->workspace, band->cache.nodes);
+        band->cache.nodes = NULL;
+    }
+    else
+    {
+        SQZ_list_node_t* const base = band->cache.nodes;
+        SQZ_list_split(&band->LSP, checkpoint->tail, checkpoint->length, &band->NSP);
+        for (SQZ_list_node_t* pixel = band->LSP.head; pixel != NULL; pixel = SQZ_list_node_next(pixel, base))
+        {
+            int const bitplane = checkpoint->bitplane - SQZ_roi_shift(band, pixel->x, pixel->y);
+            if (bitplane > 0)
+            {
+                data[pixel->y * stride + pixel->x] &= (SQZ_dwt_coefficient_t)~(1u << bitplane);
+            }
+        }
+        for (SQZ_list_node_t* pixel = band->NSP.head; pixel != NULL; pixel = SQZ_list_node_next(pixel, base))
+        {
+            data[pixel->y * stride + pixel->x] = 0;
+        }
+        SQZ_list_reinsert(&band->NSP, &band->LIP);
+    }
+    band->max_bitplane = checkpoint->max_bitplane;
+    band->bitplane = checkpoint->bitplane;
+    band->run_bits = checkpoint->run_bits;
+    memcpy(band->contexts, checkpoint->contexts, sizeof(band->contexts));
+    band->updated = 1;
+}
+
+static SQZ_status_t
+SQZ_schedule_task(SQZ_context_t* const ctx, SQZ_init_subband_fn const init, SQZ_bitplane_task_fn const task)
+{
+#ifdef DEBUG
+    if ((ctx == NULL) || (init == NULL) || (task == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    SQZ_scan_context_t scan = { 0 };
+    SQZ_bit_buffer_t* const buffer = &ctx->buffer;
+    SQZ_schedule_cursor_t* const cursor = &ctx->cursor;
+    size_t state = cursor->state, plane = cursor->plane, level = cursor->level, orientation = cursor->orientation, resolution = cursor->resolution;
+    int const ordered = !!(ctx->extensions & SQZ_HEADER_EXTENSION_RESOLUTION);
+    int round = cursor->round, done = cursor->done;
+    /* a task that was rolled back is resumed in the middle of its round, even without more data, as it first ran */
+    int resume = cursor->active;
+    scan.type = ctx->image.scan_order;
+    if ((ctx->workspace != NULL) && (ctx->workspace->scan.type == scan.type))
+    {
+        /* the workspace of the scan of the previous call is reused, being for the same order */
+        scan = ctx->workspace->scan;
+    }
+    else if (ctx->workspace != NULL)
+    {
+        free(ctx->workspace->scan.workspace);
+        ctx->workspace->scan.workspace = NULL;
+    }
+    if (!resume)
+    {
+        ctx->chroma_bits = 0u;
+    }
+    while ((resume) || (!SQZ_bit_buffer_eob(buffer)))
+    {
+        if ((done) && (!resume))
+        {
+            /* in resolution order, each level is scheduled on its own, once the coarser ones are complete */
+            if ((!ordered) || (++resolution >= (size_t)ctx->image.dwt_levels))
+            {
+                break;
+            }
+            round = 0;
+        }
+        done = (resume) ? done : 1;
+        resume = 0;
+        for (;;)
+        {
+            SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+            if ((ordered) && (level != resolution))
+            {
+                /* coded in the pass of its own level */
+            }
+            else if ((round < band->round) || ((round > band->round) && (band->bitplane < band->min_bitplane)))
+            {
+                done &= (round > band->round);
+            }
+            else if ((plane > 0u) && (ctx->chroma_budget > 0u) && (ctx->chroma_bits >= ctx->chroma_budget * CHAR_BIT))
+            {
+                /* chroma budget exhausted, the subband ends at its current bitplane */
+                band->min_bitplane = band->bitplane + 1;
+            }
+            else
+            {
+                size_t const start = SQZ_bit_buffer_bits_used(buffer);
+                SQZ_schedule_checkpoint(ctx, band);
+                band->updated = 1;
+                if (band->round == round)
+                {
+                    SQZ_scan_init(&scan, band);
+                    SQZ_status_t result = init(band, &scan, buffer);
+                    if (result != SQZ_RESULT_OK)
+                    {
+                        SQZ_schedule_release_scan(ctx, &scan);
+                        return result;
+                    }
+                }
+                if (!task(band, buffer))
+                {
+                    SQZ_schedule_release_scan(ctx, &scan);
+                    ctx->round = round;
+                    *cursor = (SQZ_schedule_cursor_t){ state, plane, level, orientation, resolution, round, done, 1 };
+                    return SQZ_RESULT_OK;
+                }
+                if (plane > 0u)
+                {
+                    ctx->chroma_bits += SQZ_bit_buffer_bits_used(buffer) - start;
+                }
+                done &= (band->bitplane < band->min_bitplane);
+            }
+            if (!state)
+            {
+                ++orientation;
+                if (orientation >= SQZ_DWT_SUBBANDS)
+                {
+                    ++level;
+                    orientation = !!(level < (size_t)ctx->image.dwt_levels);
+                    if (orientation == 0u)
+                    {
+                        level = 0u;
+                        state = plane = (ctx->image.num_planes > 1u);
+                        if (!state)
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                ++plane;
+                if (plane >= ctx->image.num_planes)
+                {
+                    plane = 1u;
+                    ++orientation;
+                    if (orientation >= SQZ_DWT_SUBBANDS)
+                    {
+                        ++level;
+                        orientation = !!(level < (size_t)ctx->image.dwt_levels);
+                        if (orientation == 0u)
+                        {
+                            level = 0u;
+                            state = plane = 0u;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        ++round;
+        ++ctx->rounds;
+    };
+    SQZ_schedule_release_scan(ctx, &scan);
+    ctx->round = round;
+    *cursor = (SQZ_schedule_cursor_t){ state, plane, level, orientation, resolution, round, done, 0 };
+    return SQZ_RESULT_OK;
+}
+
+#undef SQZ_DWT_SUBBANDS
+
+/**
+ * \brief           Finds the highest number of DWT decompositions allowed for the dimensions of an image
+ * \param[in]       descriptor: The image descriptor
+ * \return          Maximum number of DWT levels, so that the smallest dimension of the LL subband is at least 4
+ */
+static size_t
+SQZ_dwt_max_levels(SQZ_image_descriptor_t const * const descriptor)
+{
+    size_t const smallest_dimension = (descriptor->width > descriptor->height) ? descriptor->height : descriptor->width;
+    uint32_t const max_level = SQZ_ilog2(smallest_dimension) - 3u;
+    return (max_level > SQZ_DWT_MAX_LEVEL) ? SQZ_DWT_MAX_LEVEL : max_level;
+}
+
+static SQZ_status_t
+SQZ_validate_input(SQZ_image_descriptor_t* const descriptor, int const read_only)
+{
+#ifdef DEBUG
+    if (descriptor == NULL)
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+#endif
+    if ((descriptor->width  < SQZ_MIN_DIMENSION) || (descriptor->width  > SQZ_MAX_DIMENSION) ||
+            (descriptor->height < SQZ_MIN_DIMENSION) || (descriptor->height > SQZ_MAX_DIMENSION) ||
+            (descriptor->color_mode < SQZ_COLOR_MODE_GRAYSCALE) || (descriptor->color_mode >= SQZ_COLOR_MODE_COUNT) ||
+            (descriptor->scan_order < SQZ_SCAN_ORDER_RASTER) || (descriptor->scan_order >= SQZ_SCAN_ORDER_COUNT) ||
+            ((descriptor->dwt_levels == SQZ_DWT_LEVELS_AUTO) && read_only) || (descriptor->dwt_levels > SQZ_DWT_MAX_LEVEL)
+       )
+    {
+        return (read_only) ? SQZ_DATA_CORRUPTED : SQZ_INVALID_PARAMETER;
+    }
+    size_t const max_level = SQZ_dwt_max_levels(descriptor);
+    if (descriptor->dwt_levels > max_level)
+    {
+        if (read_only)
+        {
+            return SQZ_DATA_CORRUPTED;
+        }
+        else
+        {
+            descriptor->dwt_levels = max_level;
+        }
+    }
+    if (!read_only)
+    {
+        if (descriptor->color_mode != SQZ_COLOR_MODE_MULTISPECTRAL)
+        {
+            descriptor->num_planes = SQZ_number_of_planes[descriptor->color_mode];
+        }
+        else if ((descriptor->num_planes < 1u) || (descriptor->num_planes > SQZ_MAX_PLANES))
+        {
+            return SQZ_INVALID_PARAMETER;
+        }
+        if ((descriptor->chroma_floor < 0) || (descriptor->chroma_floor > 15) || (descriptor->chroma_budget > UINT32_MAX - 1u) ||
+            (descriptor->max_error < 0) || (descriptor->max_error > SQZ_NEAR_LOSSLESS_MAX_ERROR))
+        {
+            return SQZ_INVALID_PARAMETER;
+        }
+        if (descriptor->roi_count > 0u)
+        {
+            if ((descriptor->roi == NULL) || (descriptor->roi_count > SQZ_ROI_MAX_REGIONS) ||
+                (descriptor->roi_shift < 1) || (descriptor->roi_shift > SQZ_ROI_MAX_SHIFT))
+            {
+                return SQZ_INVALID_PARAMETER;
+            }
+            for (size_t i = 0u; i < descriptor->roi_count; ++i)
+            {
+                SQZ_region_t const * const region = &descriptor->roi[i];
+                if ((region->width == 0u) || (region->height == 0u) ||
+                    (region->x >= descriptor->width) || (region->width > descriptor->width - region->x) ||
+                    (region->y >= descriptor->height) || (region->height > descriptor->height - region->y))
+                {
+                    return SQZ_INVALID_PARAMETER;
+                }
+            }
+        }
+    }
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Applies the lowpass filter of the 5/3 DWT vertically, to 5 consecutive rows of an image
+ * \param[out]      row: The filtered row
+ * \param[in]       a: The first row, 2 rows above the center one
+ * \param[in]       b: The second row
+ * \param[in]       c: The center row
+ * \param[in]       d: The fourth row
+ * \param[in]       e: The last row, 2 rows below the center one
+ * \param           length: Number of samples in each row
+ */
+static void
+SQZ_downsample_rows(int32_t* restrict const row, uint8_t const * restrict const a, uint8_t const * restrict const b, uint8_t const * restrict const c,
+                    uint8_t const * restrict const d, uint8_t const * restrict const e, size_t const length)
+{
+    for (size_t i = 0u; i < length; ++i)
+    {
+        row[i] = 6 * c[i] + 2 * (b[i] + d[i]) - a[i] - e[i];
+    }
+}
+
+/**
+ * \brief           Halves the dimensions of an image, odd dimensions being rounded up
+ * \note            The lowpass filter of the 5/3 DWT is used, so that the result closely matches the LL subband
+ *                  that the transform itself would produce
+ * \param[in]       source: Pointer to the interleaved 8-bit samples of the image
+ * \param[out]      dest: Pointer to the buffer that will receive the downsampled image
+ * \param           width: Width of the source image, at least 3
+ * \param           height: Height of the source image, at least 3
+ * \param           num_planes: Number of interleaved samples per pixel
+ * \return          1 on success, 0 if out of memory
+ */
+static int
+SQZ_downsample_image(uint8_t const * const source, uint8_t* const dest, size_t const width, size_t const height, size_t const num_planes)
+{
+#ifdef DEBUG
+    if ((source == NULL) || (dest == NULL))
+    {
+        return 0;
+    }
+#endif
+    static int32_t const taps[5] = { -1, 2, 6, 2, -1 };
+    size_t const half_width = (width + 1u) >> 1u, half_height = (height + 1u) >> 1u, line = width * num_planes;
+    /* the rows are filtered vertically first, over contiguous samples, and then horizontally at half the width */
+    int32_t* const row = (int32_t*)malloc(line * sizeof(int32_t));
+    if (row == NULL)
     {
-        data[i] = (data[i] & 1) ? - (data[i] >> 1) : data[i] >> 1;
+        return 0;
+    }
+    uint8_t* ptr = dest;
+    for (size_t y = 0u; y < half_height; ++y)
+    {
+        uint8_t const * in[5];
+        for (size_t j = 0u; j < 5u; ++j)
+        {
+            in[j] = source + SQZ_mirror((int32_t)(y << 1u) + (int32_t)j - 2, (int32_t)height - 1) * line;
+        }
+        SQZ_downsample_rows(row, in[0], in[1], in[2], in[3], in[4], line);
+        for (size_t x = 0u; x < half_width; ++x)
+        {
+            if ((x > 0u) && ((x << 1u) + 2u < width))
+            {
+                int32_t const * const p = row + ((x << 1u) - 2u) * num_planes;
+                for (size_t i = 0u; i < num_planes; ++i)
+                {
+                    int32_t const sum = (6 * p[i + 2u * num_planes] + 2 * (p[i + num_planes] + p[i + 3u * num_planes]) - p[i] - p[i + 4u * num_planes] + 32) >> 6;
+                    *ptr++ = (sum < 0) ? 0u : ((sum > 255) ? 255u : (uint8_t)sum);
+                }
+                continue;
+            }
+            for (size_t i = 0u; i < num_planes; ++i)
+            {
+                int32_t sum = 32;
+                for (size_t k = 0u; k < 5u; ++k)
+                {
+                    sum += taps[k] * row[SQZ_mirror((int32_t)(x << 1u) + (int32_t)k - 2, (int32_t)width - 1) * num_planes + i];
+                }
+                sum >>= 6;
+                *ptr++ = (sum < 0) ? 0u : ((sum > 255) ? 255u : (uint8_t)sum);
+            }
+        }
     }
+    free(row);
+    return 1;
 }
 
-/*
-DWT and iDWT routines are based on the Snow video codec (FFmpeg), by Michael Niedermayer
-*/
+/**
+ * \brief           Number of pixels of a downsampled image per bit of budget, below which the image is encoded from it
+ * \hideinitializer
+ */
+#define SQZ_PREVIEW_PIXELS_PER_BIT  8u
 
-static void
-SQZ_dwt_5_3i_horizontal_pass(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width)
+/**
+ * \brief           Chooses how many times to halve the image before encoding a small budget
+ * \note            No trial encoding is needed, as the choice only depends on the budget and the dimensions of the
+ *                  image: it is halved as long as the budget stays below a bit for every \ref SQZ_PREVIEW_PIXELS_PER_BIT
+ *                  pixels of the halved image. On such a budget, few images get to start the subbands of the levels
+ *                  that are left out
+ * \param[in]       image: The image descriptor, with the number of DWT levels set
+ * \param           budget: Size of the output buffer
+ * \return          The number of halvings, 0 if the full image is to be encoded
+ */
+static size_t
+SQZ_preview_factor(SQZ_image_descriptor_t const * const image, size_t const budget)
 {
-    if (width < (SQZ_MIN_DIMENSION >> 1u))
+    size_t factor = 0u;
+    for (size_t d = 1u; d < image->dwt_levels; ++d)
     {
-        return;
+        size_t const width = ((image->width - 1u) >> d) + 1u, height = ((image->height - 1u) >> d) + 1u;
+        if (budget * CHAR_BIT * SQZ_PREVIEW_PIXELS_PER_BIT >= width * height)
+        {
+            break;
+        }
+        factor = d;
     }
-    SQZ_dwt_coefficient_t * restrict odds, * restrict evens = scratch, * restrict l_band = data, * restrict h_band;
-    int32_t cf0, cf1, cf2, cf3;
-    size_t half_w = width >> 1u, stride = half_w, w = half_w - 1u, i;
-    int const odd_w = !!(width & 1u);
-    if (odd_w)
+    return factor;
+}
+
+/**
+ * \brief           Encodes a small budget from a downsampled version of the image
+ * \note            An image downsampled by 2^d and transformed with d levels less has subbands with the same
+ *                  dimensions as the coarsest levels of the full image. Those are coded with the schedule of the full
+ *                  image, and the subbands of its d finest levels are coded as all zero, so the result is a valid
+ *                  stream for the full image whatever the budget reaches, only missing the details of those levels if
+ *                  it reaches them. With automatic DWT levels, only the levels coarser than the downsampled image are
+ *                  chosen from its content
+ * \param[in,out]   ctx: The codec context for the full image, with the schedule and header extensions set, updated with
+ *                  the number of DWT levels used
+ * \param[in]       source: Pointer to the interleaved 8-bit samples of the image
+ * \param[out]      dest: Pointer to the buffer that will receive the compressed image
+ * \param[in,out]   budget: Size of the buffer, updated with the size of the stream
+ * \param           factor: Number of halvings of the image, from \ref SQZ_preview_factor
+ * \param           automatic_levels: Specifies whether the number of DWT levels set in the context is only a maximum
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_encode_preview(SQZ_context_t* const ctx, uint8_t const * const source, void* const dest, size_t* const budget, size_t const factor,
+                   int const automatic_levels)
+{
+    size_t const num_planes = ctx->image.num_planes;
+    size_t width[SQZ_DWT_MAX_LEVEL] = { ctx->image.width }, height[SQZ_DWT_MAX_LEVEL] = { ctx->image.height }, length = 0u;
+    for (size_t d = 1u; d <= factor; ++d)
     {
-        ++stride;
+        width[d] = (width[d - 1u] + 1u) >> 1u;
+        height[d] = (height[d - 1u] + 1u) >> 1u;
+        length += width[d] * height[d] * num_planes;
     }
-    odds = scratch + stride;
-    h_band = data + stride;
-    for (i = 0u; i < half_w; ++i)
+    uint8_t* const pyramid = (uint8_t*)SQZ_workspace_alloc(ctx->workspace, length, 0);
+    if (pyramid == NULL)
     {
-        evens[i] = data[2u * i];
-        odds[i] = data[2u * i + 1u];
+        return SQZ_OUT_OF_MEMORY;
     }
-    if (odd_w)
-        evens[half_w] = data[2u * half_w];
-    cf0 = evens[0];
-    cf2 = evens[1];
-    h_band[0] = cf1 = odds[0] + ((-(cf0 + cf2)) >> 1);
-    l_band[0] = cf0 += ((cf1 + 1) >> 1);
-    for (i = 1u; i < w; ++i)
+    uint8_t const * image = source;
+    for (size_t d = 1u; (image != NULL) && (d <= factor); ++d)
+    {
+        uint8_t* const half = (d > 1u) ? (uint8_t*)image + width[d - 1u] * height[d - 1u] * num_planes : pyramid;
+        image = (SQZ_downsample_image(image, half, width[d - 1u], height[d - 1u], num_planes)) ? half : NULL;
+    }
+    SQZ_context_t preview = { 0 }, full = { 0 };
+    preview.workspace = full.workspace = ctx->workspace;
+    memcpy(&preview.image, &ctx->image, sizeof(preview.image));
+    preview.image.width = width[factor];
+    preview.image.height = height[factor];
+    preview.image.dwt_levels = ctx->image.dwt_levels - factor;
+    SQZ_status_t result = (image != NULL) ? SQZ_common_init_context(&preview) : SQZ_OUT_OF_MEMORY;
+    if (result == SQZ_RESULT_OK)
+    {
+        SQZ_color_process(&preview, (uint8_t*)image, 1);
+        /* only the levels coarser than the downsampled image are left to choose */
+        result = SQZ_dwt(&preview, automatic_levels);
+        if (automatic_levels)
+        {
+            SQZ_common_init_subbands(&preview);
+        }
+    }
+    SQZ_workspace_release(ctx->workspace, pyramid);
+    /* the coarsest subbands of the full image are each stored on their own, and the finer ones are left without data */
+    ctx->image.dwt_levels = preview.image.dwt_levels + factor;
+    memcpy(&full.image, &ctx->image, sizeof(full.image));
+    memcpy(full.schedule, ctx->schedule, sizeof(full.schedule));
+    full.extensions = ctx->extensions;
+    if ((automatic_levels) && (!SQZ_schedule_custom(&full.image, full.schedule)))
     {
-        cf3 = odds[i];
-        cf0 = evens[i + 1u];
-        h_band[i] = cf3 += ((-(cf2 + cf0)) >> 1);
-        l_band[i] = cf2 += (cf1 + cf3 + 2) >> 2;
-        ++i;
-        cf1 = odds[i];
-        cf2 = evens[i + 1u];
-        h_band[i] = cf1 += ((-(cf2 + cf0)) >> 1);
-        l_band[i] = cf0 += (cf1 + cf3 + 2) >> 2;
+        full.extensions &= ~SQZ_HEADER_EXTENSION_SCHEDULE;
     }
-    h_band[w] = cf3 = odds[w] + (odd_w ? ((-(evens[w] + evens[w + 1u])) >> 1) : -evens[w]);
-    l_band[w] = evens[w] + ((h_band[w - 1u] + cf3 + 2) >> 2);
-    if (odd_w)
+    full.roi = ctx->roi;
+    full.chroma_floor = ctx->chroma_floor;
+    full.chroma_budget = ctx->chroma_budget;
+    full.sparse = 1;
+    if (result == SQZ_RESULT_OK)
     {
-        l_band[w + 1u] = evens[w + 1u] + ((cf3 + 1) >> 1);
+        SQZ_dwt_convert_to_sign_magnitude(&preview);
+        result = SQZ_common_init_context(&full);
+    }
+    for (size_t plane = 0u; (result == SQZ_RESULT_OK) && (plane < num_planes); ++plane)
+    {
+        for (size_t level = 0u; (result == SQZ_RESULT_OK) && (level < preview.image.dwt_levels); ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
+            {
+                SQZ_dwt_subband_t* const band = &full.plane[plane].band[level][orientation];
+                SQZ_dwt_subband_t const * const coarse = &preview.plane[plane].band[level][orientation];
+                band->data = (SQZ_dwt_coefficient_t*)SQZ_workspace_alloc(full.workspace, band->width * band->height * sizeof(SQZ_dwt_coefficient_t), 0);
+                if (band->data == NULL)
+                {
+                    result = SQZ_OUT_OF_MEMORY;
+                    break;
+                }
+                for (size_t y = 0u; y < band->height; ++y)
+                {
+                    memcpy(band->data + y * band->stride, coarse->data + y * coarse->stride, band->width * sizeof(SQZ_dwt_coefficient_t));
+                }
+            }
+        }
+    }
+    SQZ_common_free_context(&preview);
+    if (result == SQZ_RESULT_OK)
+    {
+        SQZ_bit_buffer_init(&full.buffer, dest, *budget);
+        result = (SQZ_encode_header(&full, &full.buffer)) ? SQZ_RESULT_OK : SQZ_BUFFER_TOO_SMALL;
+    }
+    if (result == SQZ_RESULT_OK)
+    {
+        if (full.extensions & SQZ_HEADER_EXTENSION_ARITHMETIC)
+        {
+            SQZ_arithmetic_encoder_init(&full.buffer);
+        }
+        result = SQZ_schedule_task(&full, &SQZ_encode_init_subband, SQZ_kernels()->encode_bitplane);
+    }
+    if (result == SQZ_RESULT_OK)
+    {
+        if (full.buffer.arithmetic)
+        {
+            SQZ_arithmetic_encoder_flush(&full.buffer);
+        }
+        *budget = (SQZ_bit_buffer_bits_used(&full.buffer) + (CHAR_BIT - 1)) / CHAR_BIT;
     }
+    SQZ_common_free_context(&full);
+    return result;
 }
 
-static void
-SQZ_dwt_5_3i(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width, size_t const height, size_t const stride)
+/**
+ * \brief           Computes the number of bits needed to code a subband losslessly
+ * \note            Each coefficient becomes significant at the bitplane of its highest bit, ending a WDR run over the
+ *                  coefficients of lower bitplanes met in the scan order since the previous one of its bitplane. A
+ *                  single pass in the scan order thus measures every run, and the bits of the signs, of the refinement
+ *                  passes and of the termination of the sorting passes follow from the counts of each bitplane
+ * \param[in]       band: The subband, holding the DWT coefficients
+ * \param[in]       reference: Optional subband of the same dimensions, whose coefficients are subtracted, or `NULL`
+ * \param[in,out]   scan: The scan context, whose workspace is reused from one subband to the next
+ * \return          The number of bits
+ */
+static uint64_t
+SQZ_estimate_subband(SQZ_dwt_subband_t const * const band, SQZ_dwt_subband_t const * const reference, SQZ_scan_context_t* const scan)
 {
-    SQZ_dwt_coefficient_t *nnn = data + SQZ_mirror(-3, height - 1) * stride,
-                           *nn  = data + SQZ_mirror(-2, height - 1) * stride;
-    for (int32_t i = -2; i < (int32_t)height; i += 2)
+    size_t count[sizeof(SQZ_dwt_coefficient_t) * CHAR_BIT + 1u] = { 0 };
+    size_t last[sizeof(SQZ_dwt_coefficient_t) * CHAR_BIT + 1u] = { 0 };
+    uint32_t maximum = 0u;
+    /* the highest bitplane is coded with 4 bits */
+    uint64_t bits = 4u;
+    for (size_t y = 0u; y < band->height; ++y)
+    {
+        SQZ_dwt_coefficient_t const * const line = band->data + y * band->stride;
+        SQZ_dwt_coefficient_t const * const other = (reference != NULL) ? reference->data + y * reference->stride : NULL;
+        for (size_t x = 0u; x < band->width; ++x)
+        {
+            int32_t const value = (other != NULL) ? (int32_t)line[x] - (int32_t)other[x] : (int32_t)line[x];
+            maximum |= (uint32_t)((value < 0) ? -value : value);
+        }
+    }
+    if (maximum == 0u)
     {
-        SQZ_dwt_coefficient_t *n = data + SQZ_mirror(i + 1, height - 1) * stride,
-                               *r = data + SQZ_mirror(i + 2, height - 1) * stride;
-        if (nn <= r)
+        /* nothing to scan, as in the chroma of gray images */
+        return bits;
+    }
+    if (SQZ_scan_init(scan, band) != SQZ_RESULT_OK)
+    {
+        /* without the workspace of its scan order, the runs are measured in raster order */
+        SQZ_scan_init_raster_context(scan, band->width, band->height);
+    }
+    SQZ_scan_fn const next = scan->scan;
+    do
+    {
+        int32_t const coefficient = band->data[scan->y * band->stride + scan->x];
+        int32_t const value = (reference != NULL) ? coefficient - (int32_t)reference->data[scan->y * reference->stride + scan->x] : coefficient;
+        uint32_t const magnitude = (uint32_t)((value < 0) ? -value : value);
+        uint32_t const bitplane = SQZ_ilog2(magnitude);
+        if (bitplane > 0u)
         {
-            SQZ_dwt_5_3i_horizontal_pass(n, scratch, width);
+            size_t below = 0u;
+            for (uint32_t lower = 0u; lower < bitplane; ++lower)
+            {
+                below += count[lower];
+            }
+            /* each run codes 2 bits per bit of its length, counting the coefficient that ends it */
+            bits += (uint64_t)(SQZ_ilog2((uint32_t)(below - last[bitplane] + 1u)) - 1u) << 1u;
+            last[bitplane] = below;
         }
-        if ((i + 2) < (int32_t)height)
+        count[bitplane]++;
+    }
+    while (next(scan));
+    size_t significant = 0u, insignificant = band->width * band->height;
+    for (uint32_t bitplane = SQZ_ilog2(maximum); bitplane >= 1u; --bitplane)
+    {
+        size_t const found = count[bitplane];
+        bits += significant;
+        if (insignificant == 0u)
         {
-            SQZ_dwt_5_3i_horizontal_pass(r, scratch, width);
+            continue;
         }
-        if (nn <= r)
+        insignificant -= found;
+        /* each coefficient found codes a sign and a continuation bit, and the pass ends with the run of the rest */
+        bits += (uint64_t)(found << 1u) + 2u;
+        bits += (uint64_t)(SQZ_ilog2((uint32_t)(insignificant - last[bitplane] + 1u)) - 1u) << 1u;
+        significant += found;
+    }
+    return bits;
+}
+
+/**
+ * \brief           Estimates the number of bits needed to code a spectral plane losslessly
+ * \param[in]       ctx: The codec context, holding the DWT coefficients
+ * \param           plane: The spectral plane
+ * \param[in]       reference: Optional spectral plane whose coefficients are subtracted, or `NULL`
+ * \return          The number of bits
+ */
+static uint64_t
+SQZ_estimate_plane(SQZ_context_t const * const ctx, size_t const plane, SQZ_spectral_plane_t const * const reference)
+{
+    SQZ_scan_context_t scan = { 0 };
+    uint64_t bits = 0u;
+    scan.type = ctx->image.scan_order;
+    for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+    {
+        for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
+        {
+            bits += SQZ_estimate_subband(&ctx->plane[plane].band[level][orientation], (reference != NULL) ? &reference->band[level][orientation] : NULL, &scan);
+        }
+    }
+    free(scan.workspace);
+    return bits;
+}
+
+/**
+ * \brief           Selects the bands of a multispectral image to be coded as their difference to the previous band
+ * \note            The DWT is linear but for its rounding, so the transform of the difference of two bands is close
+ *                  to the difference of their transforms, and both choices are estimated from the bands on their own
+ * \param[in]       ctx: The codec context, holding the DWT coefficients of the bands coded on their own
+ * \return          Mask of the bands whose difference to the previous band is estimated to be smaller
+ */
+static uint32_t
+SQZ_estimate_band_differences(SQZ_context_t const * const ctx)
+{
+    uint32_t mask = 0u;
+    for (size_t plane = 1u; plane < ctx->image.num_planes; ++plane)
+    {
+        if (SQZ_estimate_plane(ctx, plane, &ctx->plane[plane - 1u]) < SQZ_estimate_plane(ctx, plane, NULL))
+        {
+            mask |= 1u << plane;
+        }
+    }
+    return mask;
+}
+
+/**
+ * \brief           Checks whether a frame of a sequence is estimated to be smaller as its residual to the previous frame
+ * \note            A scene change makes the residual larger than the frame itself, which is then coded as a key frame
+ * \param[in]       ctx: The codec context, holding the DWT coefficients of the frame and the reconstruction of the previous one
+ * \return          1 if the residual is estimated to be smaller, 0 otherwise
+ */
+static int
+SQZ_estimate_residual_gain(SQZ_context_t const * const ctx)
+{
+    uint64_t frame = 0u, residual = 0u;
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    {
+        /* the reconstruction has the layout of the spectral planes, so its subbands are at the same offsets */
+        SQZ_spectral_plane_t reference = ctx->plane[plane];
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
         {
-            for (size_t k = 0u; k < width; ++k)
+            for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
             {
-                n[k] -= (((int32_t)nn[k]) + ((int32_t)r[k])) >> 1;
+                SQZ_dwt_subband_t* const band = &reference.band[level][orientation];
+                band->data = ctx->sequence->reference + (band->data - ctx->data);
             }
         }
-        if (nnn <= n)
+        frame += SQZ_estimate_plane(ctx, plane, NULL);
+        residual += SQZ_estimate_plane(ctx, plane, &reference);
+    }
+    return residual < frame;
+}
+
+SQZ_status_t
+SQZ_estimate_size(void* const source, SQZ_image_descriptor_t* const descriptor, size_t* const size)
+{
+    if ((source == NULL) || (size == NULL))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+    SQZ_status_t result = SQZ_validate_input(descriptor, 0);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    SQZ_context_t ctx = { 0 };
+    memcpy(&ctx.image, descriptor, sizeof(*descriptor));
+    int const automatic_levels = (descriptor->dwt_levels == SQZ_DWT_LEVELS_AUTO);
+    if (automatic_levels)
+    {
+        ctx.image.dwt_levels = SQZ_dwt_max_levels(&ctx.image);
+    }
+    result = SQZ_common_init_context(&ctx);
+    if (result != SQZ_RESULT_OK)
+    {
+        SQZ_common_free_context(&ctx);
+        return result;
+    }
+    SQZ_color_process(&ctx, source, 1);
+    result = SQZ_dwt(&ctx, automatic_levels);
+    if (result != SQZ_RESULT_OK)
+    {
+        SQZ_common_free_context(&ctx);
+        return result;
+    }
+    if (automatic_levels)
+    {
+        SQZ_common_init_subbands(&ctx);
+        descriptor->dwt_levels = ctx.image.dwt_levels;
+    }
+    uint64_t bits = (uint64_t)SQZ_HEADER_SIZE * CHAR_BIT;
+    uint32_t const differences = ((descriptor->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL) && (descriptor->band_transform)) ? SQZ_estimate_band_differences(&ctx) : 0u;
+    for (size_t plane = 0u; plane < ctx.image.num_planes; ++plane)
+    {
+        bits += SQZ_estimate_plane(&ctx, plane, (differences & (1u << plane)) ? &ctx.plane[plane - 1u] : NULL);
+    }
+    *size = (size_t)((bits + CHAR_BIT - 1u) / CHAR_BIT);
+    SQZ_common_free_context(&ctx);
+    return SQZ_RESULT_OK;
+}
+
+/**
+ * \brief           Encodes an image, whose samples were already quantized if the descriptor has a bound on their error
+ * \param[in]       source: The input pixel data
+ * \param           yuv_format: Layout of the input YUV frame, or `NULL` if the input holds interleaved samples
+ * \param[in]       sequence: Reconstruction of the previous frame of a sequence, whose coefficients are subtracted from
+ *                  those of the image, or `NULL`
+ * \param           extensions: Header extensions signalling how the samples were prepared, such as \ref SQZ_HEADER_EXTENSION_GRAY
+ * \param[out]      dest: The buffer that will receive the compressed data
+ * \param[in,out]   descriptor: The image descriptor, already validated
+ * \param[in,out]   budget: The byte budget allowed for compression, updated with the compressed data size
+ * \param[in,out]   workspace: Workspace the buffers are taken from, or `NULL` to allocate them
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_encode_image(void* const source, SQZ_yuv_format_t const * const yuv_format, SQZ_sequence_context_t const * const sequence, uint32_t const extensions,
+                 void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget, SQZ_workspace_context_t* const workspace)
+{
+    SQZ_status_t result;
+    if (*budget <= SQZ_HEADER_SIZE)
+    {
+        return SQZ_BUFFER_TOO_SMALL;
+    }
+    SQZ_context_t ctx = { 0 };
+    memcpy(&ctx.image, descriptor, sizeof(*descriptor));
+    ctx.yuv_format = yuv_format;
+    ctx.sequence = sequence;
+    ctx.extensions = extensions;
+    ctx.workspace = workspace;
+    int const automatic_levels = (descriptor->dwt_levels == SQZ_DWT_LEVELS_AUTO);
+    if (automatic_levels)
+    {
+        ctx.image.dwt_levels = SQZ_dwt_max_levels(&ctx.image);
+    }
+    SQZ_schedule_init(&ctx);
+    if ((descriptor->schedule != NULL) && (SQZ_schedule_custom(&ctx.image, ctx.schedule)))
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_SCHEDULE;
+    }
+    SQZ_roi_init(&ctx);
+    if (ctx.roi.count > 0u)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_ROI;
+    }
+    if ((ctx.image.num_planes > 1u) && ((descriptor->chroma_floor > 1) || (descriptor->chroma_budget > 0u)))
+    {
+        ctx.chroma_floor = descriptor->chroma_floor;
+        ctx.chroma_budget = descriptor->chroma_budget;
+        ctx.extensions |= SQZ_HEADER_EXTENSION_CHROMA;
+    }
+    if (descriptor->arithmetic_coding)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_ARITHMETIC;
+    }
+    else if (descriptor->rice_coding)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_RICE;
+    }
+    if (descriptor->resolution_order)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_RESOLUTION;
+    }
+    if (descriptor->dense_coding)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_DENSE;
+    }
+    if (descriptor->max_error > 0)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_NEAR_LOSSLESS;
+    }
+    if (descriptor->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_MULTISPECTRAL;
+    }
+    else if (descriptor->color_mode == SQZ_COLOR_MODE_YCBCR_420)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_YCBCR_420;
+    }
+    if (sequence != NULL)
+    {
+        ctx.extensions |= SQZ_HEADER_EXTENSION_TEMPORAL;
+    }
+    /* in resolution order, the coarsest levels are coded down to the bitplanes where the downsampled image differs,
+       the bands to be differenced are chosen from the transform of the full image, and downsampling the image
+       wouldn't keep the half resolution chroma in the LL subband of the first decomposition */
+    int const band_transform = (descriptor->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL) && (descriptor->band_transform);
+    size_t const factor = ((descriptor->fast_preview) && (!descriptor->resolution_order) && (descriptor->max_error == 0) && (!band_transform) &&
+        (descriptor->color_mode != SQZ_COLOR_MODE_YCBCR_420) && (sequence == NULL)) ? SQZ_preview_factor(&ctx.image, *budget) : 0u;
+    if (factor > 0u)
+    {
+        result = SQZ_encode_preview(&ctx, (uint8_t const*)source, dest, budget, factor, automatic_levels);
+        descriptor->dwt_levels = ctx.image.dwt_levels;
+        return result;
+    }
+    result = SQZ_common_init_context(&ctx);
+    if (result != SQZ_RESULT_OK)
+    {
+        SQZ_common_free_context(&ctx);
+        return result;
+    }
+    SQZ_color_process(&ctx, source, 1);
+    result = SQZ_dwt(&ctx, automatic_levels);
+    if (result != SQZ_RESULT_OK)
+    {
+        SQZ_common_free_context(&ctx);
+        return result;
+    }
+    if (automatic_levels)
+    {
+        SQZ_common_init_subbands(&ctx);
+        descriptor->dwt_levels = ctx.image.dwt_levels;
+        if ((descriptor->schedule != NULL) && (!SQZ_schedule_custom(&ctx.image, ctx.schedule)))
+        {
+            ctx.extensions &= ~SQZ_HEADER_EXTENSION_SCHEDULE;
+        }
+    }
+    ctx.band_differences = (band_transform) ? SQZ_estimate_band_differences(&ctx) : 0u;
+    if (ctx.band_differences != 0u)
+    {
+        SQZ_color_process(&ctx, source, 1);
+        result = SQZ_dwt(&ctx, 0);
+        if (result != SQZ_RESULT_OK)
+        {
+            SQZ_common_free_context(&ctx);
+            return result;
+        }
+    }
+    if ((sequence != NULL) && (!SQZ_estimate_residual_gain(&ctx)))
+    {
+        ctx.sequence = NULL;
+        ctx.extensions &= ~SQZ_HEADER_EXTENSION_TEMPORAL;
+        SQZ_common_init_subbands(&ctx);
+    }
+    if (ctx.sequence != NULL)
+    {
+        size_t const length = ctx.image.width * ctx.image.height * ctx.image.num_planes;
+        for (size_t i = 0u; i < length; ++i)
         {
-            for (size_t k = 0u; k < width; ++k)
-            {
-                nn[k] += (((int32_t)nnn[k]) + ((int32_t)n[k]) + 2) >> 2;
-            }
+            int32_t const residual = (int32_t)ctx.data[i] - (int32_t)sequence->reference[i];
+            /* bounded so that it fits in sign-magnitude format */
+            ctx.data[i] = (SQZ_dwt_coefficient_t)((residual < -(INT16_MAX >> 1)) ? -(INT16_MAX >> 1) : ((residual > (INT16_MAX >> 1)) ? (INT16_MAX >> 1) : residual));
         }
-        nnn = n;
-        nn = r;
     }
-}
-
-static SQZ_status_t
-SQZ_dwt(SQZ_context_t const * const ctx)
-{
-#ifdef DEBUG
-    if (ctx == NULL)
+    SQZ_bit_buffer_init(&ctx.buffer, dest, *budget);
+    if (!SQZ_encode_header(&ctx, &ctx.buffer))
     {
-        return SQZ_INVALID_PARAMETER;
+        SQZ_common_free_context(&ctx);
+        return SQZ_BUFFER_TOO_SMALL;
     }
-#endif
-    size_t const stride = ctx->image.width;
-    SQZ_dwt_coefficient_t* scratch = (SQZ_dwt_coefficient_t*)malloc(stride * sizeof(SQZ_dwt_coefficient_t));
-    if (scratch == NULL)
+    if (ctx.extensions & SQZ_HEADER_EXTENSION_ARITHMETIC)
     {
-        return SQZ_OUT_OF_MEMORY;
+        SQZ_arithmetic_encoder_init(&ctx.buffer);
     }
-    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    SQZ_dwt_convert_to_sign_magnitude(&ctx);
+    result = SQZ_schedule_task(&ctx, &SQZ_encode_init_subband, SQZ_kernels()->encode_bitplane);
+    if (result != SQZ_RESULT_OK)
     {
-        size_t width = stride, height = ctx->image.height;
-        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
-        {
-            SQZ_dwt_5_3i(ctx->plane[plane].data, scratch, width, height, stride << level);
-            width = (width + 1u) >> 1u;
-            height = (height + 1u) >> 1u;
-        }
+        SQZ_common_free_context(&ctx);
+        return result;
     }
-    free(scratch);
+    if (ctx.buffer.arithmetic)
+    {
+        SQZ_arithmetic_encoder_flush(&ctx.buffer);
+    }
+    *budget = (SQZ_bit_buffer_bits_used(&ctx.buffer) + (CHAR_BIT - 1)) / CHAR_BIT;
+    SQZ_common_free_context(&ctx);
     return SQZ_RESULT_OK;
 }
 
-static void
-SQZ_idwt_5_3i_horizontal_pass(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width)
+/**
+ * \brief           Encodes an image of interleaved samples, as a grayscale one if it was given as RGB but all its pixels are gray
+ * \note            Only a plane of the image is then transformed and coded, instead of 3 of which 2 are all zero, so it takes
+ *                  about a third of the memory and time, and all the budget goes to its single plane
+ * \param[in]       source: The input pixel data
+ * \param[out]      dest: The buffer that will receive the compressed data
+ * \param[in,out]   descriptor: The image descriptor, already validated
+ * \param[in,out]   budget: The byte budget allowed for compression, updated with the compressed data size
+ * \param[in,out]   workspace: Workspace the buffers are taken from, or `NULL` to allocate them
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_encode_samples(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget, SQZ_workspace_context_t* const workspace)
 {
-    if (width < (SQZ_MIN_DIMENSION >> 1u))
+    uint8_t const * const samples = (uint8_t const*)source;
+    size_t const length = descriptor->width * descriptor->height;
+    size_t gray = 0u;
+    if ((descriptor->color_mode == SQZ_COLOR_MODE_YCOCG_R) || (descriptor->color_mode == SQZ_COLOR_MODE_OKLAB) ||
+        (descriptor->color_mode == SQZ_COLOR_MODE_LOG_L1))
     {
-        return;
+        while ((gray < length) && (samples[3u * gray] == samples[3u * gray + 1u]) && (samples[3u * gray] == samples[3u * gray + 2u]))
+        {
+            ++gray;
+        }
     }
-    SQZ_dwt_coefficient_t * restrict odds, * restrict evens = scratch, * restrict l_band = data, * restrict h_band;
-    int32_t cf0, cf1, cf2, cf3;
-    size_t half_w = width >> 1u, stride = half_w, w = half_w - 1u, i;
-    int const odd_w = !!(width & 1u);
-    if (odd_w)
+    uint8_t* const plane = (gray == length) ? (uint8_t*)SQZ_workspace_alloc(workspace, length, 0) : NULL;
+    if (plane == NULL)
     {
-        ++stride;
+        return SQZ_encode_image(source, NULL, NULL, 0u, dest, descriptor, budget, workspace);
     }
-    odds = scratch + stride;
-    h_band = data + stride;
-    cf1 = h_band[0];
-    evens[0] = cf0 = l_band[0] - ((cf1 + 1) >> 1);
-    for (i = 1u; i < w; ++i)
+    for (size_t i = 0u; i < length; ++i)
     {
-        cf2 = l_band[i];
-        cf3 = h_band[i];
-        evens[i] = cf2 -= ((cf1 + cf3 + 2) >> 2);
-        odds[i - 1] = cf1 - (-(cf0 + cf2) >> 1);
-        ++i;
-        cf0 = l_band[i];
-        cf1 = h_band[i];
-        evens[i] = cf0 -= ((cf1 + cf3 + 2) >> 2);
-        odds[i - 1] = cf3 - (-(cf0 + cf2) >> 1);
+        plane[i] = samples[3u * i];
     }
-    evens[w] = l_band[w] - ((h_band[w - 1u] + h_band[w] + 2) >> 2);
-    odds[w - 1] = h_band[w - 1] - ((-(evens[w - 1] + evens[w])) >> 1);
-    if (odd_w)
+    SQZ_image_descriptor_t image = *descriptor;
+    if (image.dwt_levels == SQZ_DWT_LEVELS_AUTO)
     {
-        evens[w + 1] = l_band[w + 1] - ((h_band[w] + 1) >> 1);
+        image.dwt_levels = SQZ_dwt_max_levels(&image);
     }
-    odds[w] = h_band[w] - (odd_w ? ((-(evens[w] + evens[w + 1u])) >> 1) : -evens[w]);
-    for (i = 0u; i < half_w; ++i)
+    if ((image.schedule != NULL) && (!SQZ_schedule_custom(&image, image.schedule)))
     {
-        data[2u * i] = evens[i];
-        data[2u * i + 1u] = odds[i];
+        image.schedule = NULL;
     }
-    if (odd_w)
-        data[2u * half_w] = evens[half_w];
+    image.color_mode = SQZ_COLOR_MODE_GRAYSCALE;
+    image.num_planes = 1u;
+    SQZ_status_t const result = SQZ_encode_image(plane, NULL, NULL, SQZ_HEADER_EXTENSION_GRAY, dest, &image, budget, workspace);
+    descriptor->dwt_levels = image.dwt_levels;
+    SQZ_workspace_release(workspace, plane);
+    return result;
 }
 
-static void
-SQZ_idwt_5_3i(SQZ_dwt_coefficient_t* restrict data, SQZ_dwt_coefficient_t* restrict scratch, size_t const width, size_t const height, size_t const stride)
+/**
+ * \brief           Checks whether a prefix of a compressed image decodes within a bound on the error of each sample
+ * \param[in]       source: The original pixel data
+ * \param[in]       stream: The compressed image
+ * \param           size: Size of the prefix
+ * \param[out]      decoded: Buffer receiving the decoded image, of the size of the original one
+ * \param           length: Size of the original pixel data
+ * \param           max_error: Bound on the absolute error of each sample
+ * \return          1 if the bound is met, 0 otherwise
+ */
+static int
+SQZ_encode_check_error(uint8_t const* const source, void* const stream, size_t const size, uint8_t* const decoded, size_t const length, int const max_error)
 {
-    SQZ_dwt_coefficient_t *nn = data + SQZ_mirror(-2, height - 1) * stride,
-                           *n  = data + SQZ_mirror(-1, height - 1) * stride;
-    for (int32_t i = -1; i <= (int32_t)height; i += 2)
+    size_t decoded_size = length;
+    if (SQZ_decode(stream, decoded, size, &decoded_size, NULL) != SQZ_RESULT_OK)
     {
-        SQZ_dwt_coefficient_t *r = data + SQZ_mirror(i + 1, height - 1) * stride,
-                               *s = data + SQZ_mirror(i + 2, height - 1) * stride;
-        if (n <= s)
-        {
-            for (size_t k = 0u; k < width; ++k)
-            {
-                r[k] -= (((int32_t)n[k]) + ((int32_t)s[k]) + 2) >> 2;
-            }
-        }
-        if (nn <= r)
-        {
-            for (size_t k = 0u; k < width; ++k)
-            {
-                n[k] += (((int32_t)nn[k]) + ((int32_t)r[k])) >> 1;
-            }
-        }
-        if (i - 1 >= 0)
-        {
-            SQZ_idwt_5_3i_horizontal_pass(nn, scratch, width);
-        }
-        if (nn <= r)
+        return 0;
+    }
+    for (size_t i = 0u; i < length; ++i)
+    {
+        if (abs((int)source[i] - (int)decoded[i]) > max_error)
         {
-            SQZ_idwt_5_3i_horizontal_pass(n, scratch, width);
+            return 0;
         }
-        nn = r;
-        n = s;
     }
+    return 1;
 }
 
+/**
+ * \brief           Encodes an image within a bound on the error of each sample
+ * \note            Both the lossless stream of the quantized samples and the shortest prefix of the lossless stream meeting
+ *                  the bound, found by bisection below the size of the former, are tried, and the smaller one is kept.
+ *                  The embedded streams don't get more accurate with every byte, so each candidate is checked by decoding it
+ * \param[in]       source: The input pixel data
+ * \param[out]      dest: The buffer that will receive the compressed data
+ * \param[in,out]   descriptor: The image descriptor, already validated, updated with the error of the quantization used
+ * \param[in,out]   budget: The byte budget allowed for compression, updated with the compressed data size
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
 static SQZ_status_t
-SQZ_idwt(SQZ_context_t const* const ctx)
+SQZ_encode_near_lossless(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget)
 {
-#ifdef DEBUG
-    if (ctx == NULL)
+    size_t const length = descriptor->width * descriptor->height * descriptor->num_planes;
+    int const max_error = descriptor->max_error;
+    uint8_t* const decoded = (uint8_t*)malloc(length);
+    if (decoded == NULL)
     {
-        return SQZ_INVALID_PARAMETER;
+        return SQZ_OUT_OF_MEMORY;
     }
-#endif
-    size_t const stride = ctx->image.width;
-    SQZ_dwt_coefficient_t* scratch = (SQZ_dwt_coefficient_t*)malloc(stride * sizeof(SQZ_dwt_coefficient_t));
-    if (scratch == NULL)
+    SQZ_image_descriptor_t chosen = *descriptor;
+    SQZ_status_t result = SQZ_RESULT_OK;
+    size_t size, best = 0u;
+    /* the quantized samples must be recovered exactly, which the lossy color modes can't guarantee */
+    if ((descriptor->color_mode == SQZ_COLOR_MODE_GRAYSCALE) || (descriptor->color_mode == SQZ_COLOR_MODE_YCOCG_R) ||
+        (descriptor->color_mode == SQZ_COLOR_MODE_MULTISPECTRAL))
     {
-        return SQZ_OUT_OF_MEMORY;
+        uint8_t* const quantized = (uint8_t*)malloc(length);
+        if (quantized == NULL)
+        {
+            free(decoded);
+            return SQZ_OUT_OF_MEMORY;
+        }
+        uint32_t const step = 2u * (uint32_t)max_error + 1u;
+        for (size_t i = 0u; i < length; ++i)
+        {
+            quantized[i] = (uint8_t)(((uint8_t*)source)[i] / step);
+        }
+        size = *budget;
+        result = SQZ_encode_samples(quantized, dest, &chosen, &size, NULL);
+        if ((result == SQZ_RESULT_OK) && (SQZ_encode_check_error((uint8_t*)source, dest, size, decoded, length, max_error)))
+        {
+            best = size;
+        }
+        free(quantized);
     }
-    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    size_t const capacity = (best > 0u) ? best : *budget;
+    uint8_t* const stream = (uint8_t*)calloc(capacity, sizeof(uint8_t));
+    if (stream == NULL)
     {
-        for (int32_t level = (int32_t)ctx->image.dwt_levels - 1; level >= 0; --level)
+        free(decoded);
+        return (best > 0u) ? SQZ_RESULT_OK : SQZ_OUT_OF_MEMORY;
+    }
+    SQZ_image_descriptor_t image = *descriptor;
+    image.max_error = 0;
+    size = capacity;
+    result = SQZ_encode_samples(source, stream, &image, &size, NULL);
+    if ((result == SQZ_RESULT_OK) && (SQZ_encode_check_error((uint8_t*)source, stream, size, decoded, length, max_error)))
+    {
+        size_t low = SQZ_HEADER_SIZE + 1u, high = size;
+        while (low < high)
         {
-            size_t width = ctx->image.width, height = ctx->image.height;
-            for (int32_t l = level; l > 0; --l)
+            size_t const middle = low + ((high - low) >> 1u);
+            if (SQZ_encode_check_error((uint8_t*)source, stream, middle, decoded, length, max_error))
+            {
+                high = middle;
+            }
+            else
             {
-                width = (width + 1u) >> 1u;
-                height = (height + 1u) >> 1u;
+                low = middle + 1u;
             }
-            SQZ_idwt_5_3i(ctx->plane[plane].data, scratch, width, height, stride << level);
+        }
+        if ((best == 0u) || (high < best))
+        {
+            memcpy(dest, stream, high);
+            best = high;
+            chosen = image;
         }
     }
-    free(scratch);
+    free(stream);
+    free(decoded);
+    if (best == 0u)
+    {
+        return (result != SQZ_RESULT_OK) ? result : SQZ_BUFFER_TOO_SMALL;
+    }
+    descriptor->dwt_levels = chosen.dwt_levels;
+    descriptor->max_error = chosen.max_error;
+    *budget = best;
     return SQZ_RESULT_OK;
 }
 
-static SQZ_status_t
-SQZ_common_init_context(SQZ_context_t* const ctx)
+SQZ_status_t
+SQZ_encode(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget)
 {
-#ifdef DEBUG
-    if (ctx == NULL)
+    SQZ_status_t result = SQZ_validate_input(descriptor, 0);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    if (descriptor->max_error > 0)
+    {
+        return SQZ_encode_near_lossless(source, dest, descriptor, budget);
+    }
+    return SQZ_encode_samples(source, dest, descriptor, budget, NULL);
+}
+
+SQZ_status_t
+SQZ_encode_with_workspace(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget, SQZ_workspace_t* const workspace)
+{
+    if (workspace == NULL)
     {
         return SQZ_INVALID_PARAMETER;
     }
-#endif
-    ctx->data = (SQZ_dwt_coefficient_t*)calloc(ctx->image.width * ctx->image.height * ctx->image.num_planes, sizeof(SQZ_dwt_coefficient_t));
-    if (ctx->data == NULL)
+    SQZ_status_t result = SQZ_validate_input(descriptor, 0);
+    if (result != SQZ_RESULT_OK)
     {
-        return SQZ_OUT_OF_MEMORY;
+        return result;
     }
-    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    if (descriptor->max_error > 0)
     {
-        size_t w = ctx->image.width, h = ctx->image.height;
-        ctx->plane[plane].data = ctx->data + plane * w * h;
-        for (int32_t level = (int32_t)ctx->image.dwt_levels - 1; level >= 0; --level)
+        return SQZ_encode_near_lossless(source, dest, descriptor, budget);
+    }
+    if (workspace->context == NULL)
+    {
+        workspace->context = calloc(1u, sizeof(SQZ_workspace_context_t));
+        if (workspace->context == NULL)
         {
-            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
-            {
-                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
-                band->data = ctx->plane[plane].data;
-                band->width  = (w + !(orientation & 1u)) >> 1u; /* width of the horizontal lowpass subbands is rounded up */
-                band->height = (h + !(orientation > 1u)) >> 1u; /* height of the vertical lowpass subbands is rounded up*/
-                band->round = (int)SQZ_schedule[ctx->image.color_mode][plane][level][orientation] + (ctx->image.subsampling & (plane > 0u));
-                band->stride = ctx->image.width << (ctx->image.dwt_levels - level);
-                if (orientation & 1u)
-                {
-                    band->data += (w + 1u) >> 1u;
-                }
-                if (orientation > 1u)
-                {
-                    band->data += band->stride >> 1u;
-                }
-            }
-            w = (w + 1u) >> 1u;
-            h = (h + 1u) >> 1u;
+            return SQZ_OUT_OF_MEMORY;
         }
     }
-    return SQZ_RESULT_OK;
+    return SQZ_encode_samples(source, dest, descriptor, budget, (SQZ_workspace_context_t*)workspace->context);
 }
 
-static void
-SQZ_common_free_context(SQZ_context_t* const ctx)
+SQZ_status_t
+SQZ_encode_yuv(void* const source, SQZ_yuv_format_t const format, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget)
 {
-#ifdef DEBUG
-    if (ctx == NULL)
+    if ((source == NULL) || (dest == NULL) || (descriptor == NULL) || (budget == NULL) ||
+        (format < SQZ_YUV_FORMAT_I420) || (format >= SQZ_YUV_FORMAT_COUNT) || (descriptor->max_error != 0))
     {
-        return;
+        return SQZ_INVALID_PARAMETER;
     }
-#endif
-    free(ctx->data);
-    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+    descriptor->color_mode = SQZ_COLOR_MODE_YCBCR_420;
+    SQZ_status_t const result = SQZ_validate_input(descriptor, 0);
+    if (result != SQZ_RESULT_OK)
     {
-        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
-        {
-            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
-            {
-                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
-                if (band != NULL)
-                {
-                    free(band->cache.nodes);
-                }
-            }
-        }
+        return result;
     }
+    return SQZ_encode_image(source, &format, NULL, 0u, dest, descriptor, budget, NULL);
 }
 
+/**
+ * \brief           Decodes the DWT coefficients of an image
+ * \note            The lists of the subbands are released, only their coefficients are kept
+ * \param[in,out]   ctx: The codec context, with the header decoded and the bit buffer positioned after it, and the
+ *                  storage of the coefficients selected
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise, in which case the context is freed
+ */
 static SQZ_status_t
-SQZ_common_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx)
+SQZ_decode_coefficients(SQZ_context_t* const ctx)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (scan_ctx == NULL))
+    SQZ_status_t result = SQZ_common_init_context(ctx);
+    if (result != SQZ_RESULT_OK)
     {
-        return SQZ_INVALID_PARAMETER;
+        SQZ_common_free_context(ctx);
+        return result;
     }
-#endif
-    SQZ_status_t result = SQZ_node_cache_init(&band->cache, band->width * band->height);
+    if (ctx->extensions & SQZ_HEADER_EXTENSION_ARITHMETIC)
+    {
+        SQZ_arithmetic_decoder_init(&ctx->buffer);
+    }
+    result = SQZ_schedule_task(ctx, &SQZ_decode_init_subband, SQZ_kernels()->decode_bitplane);
     if (result != SQZ_RESULT_OK)
     {
+        SQZ_common_free_context(ctx);
         return result;
     }
-    SQZ_scan_fn const scan = scan_ctx->scan;
-    SQZ_list_init(&band->LIP, &band->cache);
-    SQZ_list_init(&band->LSP, &band->cache);
-    SQZ_list_init(&band->NSP, &band->cache);
-    do
+    SQZ_decode_round_coefficients(ctx);
+    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
     {
-        SQZ_list_add(&band->LIP, (uint16_t)scan_ctx->x, (uint16_t)scan_ctx->y);
+        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
+            {
+                /* the lists are no longer needed */
+                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
+                SQZ_workspace_release(ctx->workspace, band->cache.nodes);
+                band->cache.nodes = NULL;
+            }
+        }
+    }
+    if (!ctx->sparse)
+    {
+        SQZ_dwt_convert_from_sign_magnitude(ctx);
     }
-    while (scan(scan_ctx));
     return SQZ_RESULT_OK;
 }
 
+/**
+ * \brief           Decodes an image, or a subset of the bands of a multispectral image
+ * \param[in]       source: The input compressed data
+ * \param[out]      dest: The buffer that will receive the decompressed pixel data
+ * \param           src_size: Size of the input buffer
+ * \param[in,out]   dest_size: Size of the output buffer, updated with the required size if too small
+ * \param[out]      descriptor: Optional image descriptor, filled with information about the image
+ * \param           bands: Mask of the bands of a multispectral image to output, 0 for all the planes of any image
+ * \param[in,out]   workspace: Workspace the buffers are taken from, or `NULL` to allocate them
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
 static SQZ_status_t
-SQZ_encode_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx, SQZ_bit_buffer_t* const buffer)
+SQZ_decode_image(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor, uint32_t const bands,
+                 SQZ_workspace_context_t* const workspace)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (scan_ctx == NULL) || (buffer == NULL))
+    if ((source == NULL) || (dest_size == NULL) || ((dest == NULL) && (*dest_size != 0u)))
     {
         return SQZ_INVALID_PARAMETER;
     }
-#endif
-    SQZ_status_t result = SQZ_common_init_subband(band, scan_ctx);
+    SQZ_context_t ctx = { 0 };
+    SQZ_bit_buffer_init(&ctx.buffer, source, src_size);
+    if (!SQZ_decode_header(&ctx, &ctx.buffer))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+    SQZ_status_t result = SQZ_validate_input(&ctx.image, 1);
     if (result != SQZ_RESULT_OK)
     {
         return result;
     }
-    band->max_bitplane = SQZ_ilog2(SQZ_dwt_get_max(band) >> 1);
-    band->bitplane = band->max_bitplane;
-    SQZ_bit_buffer_write_bits(buffer, band->max_bitplane, 4u);
-    return SQZ_RESULT_OK;
-}
-
-static SQZ_status_t
-SQZ_decode_init_subband(SQZ_dwt_subband_t* const band, SQZ_scan_context_t* const scan_ctx, SQZ_bit_buffer_t* const buffer)
-{
-#ifdef DEBUG
-    if ((band == NULL) || (scan_ctx == NULL) || (buffer == NULL))
+    if ((bands != 0u) && ((ctx.image.color_mode != SQZ_COLOR_MODE_MULTISPECTRAL) || (bands >> ctx.image.num_planes)))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+    if (descriptor != NULL)
     {
-        return SQZ_INVALID_PARAMETER;
+        SQZ_color_describe(&ctx, descriptor);
     }
-#endif
-    SQZ_status_t result = SQZ_common_init_subband(band, scan_ctx);
+    ctx.band_output = bands;
+    size_t const length = ctx.image.width * ctx.image.height * SQZ_color_output_planes(&ctx);
+    if (*dest_size < length)
+    {
+        *dest_size = length;
+        return SQZ_BUFFER_TOO_SMALL;
+    }
+    /* the coefficients are only stored for the subbands reached, as most aren't with small prefixes */
+    ctx.sparse = 1;
+    ctx.workspace = workspace;
+    result = SQZ_decode_coefficients(&ctx);
     if (result != SQZ_RESULT_OK)
     {
         return result;
     }
-    band->max_bitplane = SQZ_bit_buffer_read_bits(buffer, 4u);
-    band->bitplane = band->max_bitplane;
-    return SQZ_RESULT_OK;
+    result = SQZ_idwt_sparse(&ctx, (uint8_t*)dest);
+    SQZ_common_free_context(&ctx);
+    return result;
 }
 
-static int
-SQZ_encode_header(SQZ_image_descriptor_t const * const descriptor, SQZ_bit_buffer_t* const buffer)
+SQZ_status_t
+SQZ_decode(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor)
 {
-#ifdef DEBUG
-    if ((descriptor == NULL) || (buffer == NULL))
-    {
-        return 0;
-    }
-#endif
-    SQZ_bit_buffer_write_bits(buffer, SQZ_HEADER_MAGIC,            8u);
-    SQZ_bit_buffer_write_bits(buffer, descriptor->width -  1u,    16u);
-    SQZ_bit_buffer_write_bits(buffer, descriptor->height - 1u,    16u);
-    SQZ_bit_buffer_write_bits(buffer, descriptor->color_mode,      2u);
-    SQZ_bit_buffer_write_bits(buffer, descriptor->dwt_levels - 1u, 3u);
-    SQZ_bit_buffer_write_bits(buffer, descriptor->scan_order,      2u);
-    SQZ_bit_buffer_write_bit(buffer, !!descriptor->subsampling);
-    return !SQZ_bit_buffer_eob(buffer);
+    return SQZ_decode_image(source, dest, src_size, dest_size, descriptor, 0u, NULL);
 }
 
-static int
-SQZ_decode_header(SQZ_image_descriptor_t* const descriptor, SQZ_bit_buffer_t* const buffer)
+SQZ_status_t
+SQZ_decode_bands(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor, uint32_t const bands)
 {
-#ifdef DEBUG
-    if ((descriptor == NULL) || (buffer == NULL))
-    {
-        return 0;
-    }
-#endif
-    if (SQZ_bit_buffer_read_bits(buffer, 8u) != SQZ_HEADER_MAGIC)
+    if (bands == 0u)
     {
-        return 0;
+        return SQZ_INVALID_PARAMETER;
     }
-    descriptor->width      = SQZ_bit_buffer_read_bits(buffer, 16u) + 1u;
-    descriptor->height     = SQZ_bit_buffer_read_bits(buffer, 16u) + 1u;
-    descriptor->color_mode = (SQZ_color_mode_t)SQZ_bit_buffer_read_bits(buffer,  2u);
-    descriptor->dwt_levels = SQZ_bit_buffer_read_bits(buffer,  3u) + 1u;
-    descriptor->scan_order = (SQZ_scan_order_t)SQZ_bit_buffer_read_bits(buffer,  2u);
-    descriptor->num_planes = SQZ_number_of_planes[descriptor->color_mode];
-    descriptor->subsampling = !!SQZ_bit_buffer_read_bit(buffer);
-    return !SQZ_bit_buffer_eob(buffer);
+    return SQZ_decode_image(source, dest, src_size, dest_size, descriptor, bands, NULL);
 }
 
-static int
-SQZ_encode_write_wdr_run(SQZ_bit_buffer_t* const buffer, uint32_t const run)
+SQZ_status_t
+SQZ_decode_with_workspace(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor,
+                          SQZ_workspace_t* const workspace)
 {
-#ifdef DEBUG
-    if (buffer == NULL)
-    {
-        return 0;
-    }
-#endif
-    uint32_t cost = SQZ_ilog2(run) - 1u;
-    if (cost <= 16u)
+    if (workspace == NULL)
     {
-        return SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run), cost * 2u);
+        return SQZ_INVALID_PARAMETER;
     }
-    else
+    if (workspace->context == NULL)
     {
-        return SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run >> 16), (cost - 16) * 2u) && SQZ_bit_buffer_write_bits(buffer, SQZ_interleave_u16_to_u32(run), 32u);
+        workspace->context = calloc(1u, sizeof(SQZ_workspace_context_t));
+        if (workspace->context == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
     }
+    return SQZ_decode_image(source, dest, src_size, dest_size, descriptor, 0u, (SQZ_workspace_context_t*)workspace->context);
 }
 
-static int
-SQZ_decode_read_wdr_run(SQZ_bit_buffer_t* const buffer, uint32_t* const run)
+void
+SQZ_workspace_free(SQZ_workspace_t* const workspace)
 {
-#ifdef DEBUG
-    if ((buffer == NULL) || (run == NULL))
-    {
-        return 0;
-    }
-#endif
-    *run = 1u;
-    while (SQZ_bit_buffer_read_bit(buffer) == 0)
+    if ((workspace != NULL) && (workspace->context != NULL))
     {
-        int const bit = SQZ_bit_buffer_read_bit(buffer);
-        if (bit < 0)
+        SQZ_workspace_context_t* const context = (SQZ_workspace_context_t*)workspace->context;
+        for (size_t i = 0u; i < context->count; ++i)
         {
-            return 0;
+            free(context->blocks[i].data);
         }
-        *run += *run + bit;
+        free(context->blocks);
+        free(context->scan.workspace);
+        free(context);
+        workspace->context = NULL;
     }
-    return 1;
 }
 
-static int
-SQZ_encode_sorting_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+/**
+ * \brief           Halves the dimensions of an image by averaging each 2x2 block of pixels, odd dimensions being rounded up
+ * \param[in]       source: Pointer to the interleaved 8-bit samples of the image
+ * \param[out]      dest: Pointer to the buffer that will receive the reduced image
+ * \param           width: Width of the source image
+ * \param           height: Height of the source image
+ * \param           num_planes: Number of interleaved samples per pixel
+ */
+static void
+SQZ_mipmap_reduce(uint8_t const * const source, uint8_t* const dest, size_t const width, size_t const height, size_t const num_planes)
 {
 #ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
+    if ((source == NULL) || (dest == NULL))
     {
-        return 0;
+        return;
     }
 #endif
-    SQZ_list_t * restrict const LIP = &band->LIP;
-    if ((LIP->length == 0u) || (band->bitplane <= 0))
-    {
-        return 1;
-    }
-    SQZ_list_t * restrict const NSP = &band->NSP;
-    SQZ_list_node_t *pixel = LIP->head, *previous = NULL;
-    SQZ_list_node_t* const base = LIP->cache->nodes;
-    SQZ_dwt_coefficient_t const * const data = band->data;
-    SQZ_dwt_coefficient_t const bitplane_mask = 1u << band->bitplane;
-    size_t const stride = band->stride;
-    uint32_t i = 1u, last = 0u;
-    while (pixel != NULL)
-    {
-        SQZ_dwt_coefficient_t const v = data[pixel->y * stride + pixel->x];
-        if (!!(v & bitplane_mask))
+    size_t const half_width = (width + 1u) >> 1u, half_height = (height + 1u) >> 1u;
+    uint8_t* ptr = dest;
+    for (size_t y = 0u; y < half_height; ++y)
+    {
+        /* the last row and column are repeated on odd dimensions */
+        uint8_t const * const top = source + (y << 1u) * width * num_planes;
+        uint8_t const * const bottom = ((y << 1u) + 1u < height) ? top + width * num_planes : top;
+        for (size_t x = 0u; x < half_width; ++x)
         {
-            if ((!SQZ_bit_buffer_write_bits(buffer, 2u | (v & 1), 1u + !!last)) || (!SQZ_encode_write_wdr_run(buffer, i - last)))
+            size_t const left = (x << 1u) * num_planes, right = ((x << 1u) + 1u < width) ? left + num_planes : left;
+            for (size_t i = 0u; i < num_planes; ++i)
             {
-                break;
+                *ptr++ = (uint8_t)((top[left + i] + top[right + i] + bottom[left + i] + bottom[right + i] + 2u) >> 2u);
             }
-            last = i;
-            pixel = SQZ_list_exchange(LIP, NSP, pixel, previous);
-        }
-        else
-        {
-            previous = pixel;
-            pixel = SQZ_list_node_next(pixel, base);
         }
-        ++i;
     }
-    /* now handle WDR termination */
-    SQZ_bit_buffer_write_bits(buffer, 3u, 1u + (NSP->length > 0u));
-    SQZ_encode_write_wdr_run(buffer, i - last);
-    SQZ_bit_buffer_write_bit(buffer, 1u);
-    return !SQZ_bit_buffer_eob(buffer);
 }
 
-static int
-SQZ_decode_sorting_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+/**
+ * \brief           Decodes an image along with its reductions by powers of 2
+ * \param[in]       source: Pointer to the input compressed data
+ * \param[out]      dest: Pointer to the buffer that will receive the decompressed images, one after the other
+ * \param           src_size: Size of the input buffer
+ * \param[in,out]   dest_size: Pointer to the size of the output buffer (or 0 to request the appropriate size)
+ * \param[in,out]   descriptor: Pointer to an image descriptor, to be filled with information about the image
+ * \param           mipmaps: If not 0, the reductions continue past the coarsest DWT level, down to a single pixel
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise
+ */
+static SQZ_status_t
+SQZ_decode_reductions(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor, int const mipmaps)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
+    if ((source == NULL) || (dest_size == NULL) || ((dest == NULL) && (*dest_size != 0u)))
     {
-        return 0;
+        return SQZ_INVALID_PARAMETER;
     }
-#endif
-    SQZ_list_t * restrict const LIP = &band->LIP;
-    if ((LIP->length == 0u) || (band->bitplane <= 0))
+    SQZ_context_t ctx = { 0 };
+    SQZ_bit_buffer_init(&ctx.buffer, source, src_size);
+    if (!SQZ_decode_header(&ctx, &ctx.buffer))
     {
-        return 1;
+        return SQZ_INVALID_PARAMETER;
     }
-    SQZ_list_t * restrict const NSP = &band->NSP;
-    SQZ_list_node_t *pixel = LIP->head, *previous = NULL;
-    SQZ_list_node_t* const base = LIP->cache->nodes;
-    SQZ_dwt_coefficient_t* const data = band->data;
-    SQZ_dwt_coefficient_t const bitplane_mask = 1u << band->bitplane;
-    size_t const stride = band->stride;
-    uint32_t run;
-    int sign;
-    do
+    SQZ_status_t result = SQZ_validate_input(&ctx.image, 1);
+    if (result != SQZ_RESULT_OK)
     {
-        sign = SQZ_bit_buffer_read_bit(buffer);
-        if ((sign < 0) || (!SQZ_decode_read_wdr_run(buffer, &run)))
-        {
-            break;
-        }
-        while ((--run > 0) && (pixel != NULL))
-        {
-            previous = pixel;
-            pixel = SQZ_list_node_next(pixel, base);
-        }
-        if (pixel != NULL)
+        return result;
+    }
+    if (descriptor != NULL)
+    {
+        SQZ_color_describe(&ctx, descriptor);
+    }
+    size_t length = 0u, width = ctx.image.width, height = ctx.image.height, coarsest = 0u, coarsest_width = 0u, coarsest_height = 0u;
+    for (size_t level = 0u; ; ++level)
+    {
+        if (level == ctx.image.dwt_levels)
         {
-            data[pixel->y * stride + pixel->x] |= (bitplane_mask | sign);
-            pixel = SQZ_list_exchange(LIP, NSP, pixel, previous);
+            coarsest = length;
+            coarsest_width = width;
+            coarsest_height = height;
         }
-        else
+        length += width * height * SQZ_color_output_planes(&ctx);
+        if ((level >= ctx.image.dwt_levels) && ((!mipmaps) || ((width == 1u) && (height == 1u))))
         {
             break;
         }
+        width = (width + 1u) >> 1u;
+        height = (height + 1u) >> 1u;
     }
-    while (1);
-    return !SQZ_bit_buffer_eob(buffer);
-}
-
-static int
-SQZ_encode_refinement_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
-{
-#ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
+    if (*dest_size < length)
     {
-        return 0;
+        *dest_size = length;
+        return SQZ_BUFFER_TOO_SMALL;
     }
-#endif
-    SQZ_list_node_t* pixel = band->LSP.head;
-    SQZ_list_node_t* const base = band->cache.nodes;
-    SQZ_dwt_coefficient_t const * const data = band->data;
-    SQZ_dwt_coefficient_t const bitplane_mask = 1u << band->bitplane;
-    size_t const stride = band->stride;
-    while (pixel != NULL)
+    result = SQZ_decode_coefficients(&ctx);
+    if (result != SQZ_RESULT_OK)
     {
-        SQZ_dwt_coefficient_t const v = data[pixel->y * stride + pixel->x];
-        if (!SQZ_bit_buffer_write_bit(buffer, !!(v & bitplane_mask)))
-        {
-            break;
-        }
-        pixel = SQZ_list_node_next(pixel, base);
+        return result;
     }
-    return !SQZ_bit_buffer_eob(buffer);
+    result = SQZ_idwt_pyramid(&ctx, (uint8_t*)dest);
+    SQZ_common_free_context(&ctx);
+    /* the levels past the coarsest LL subband are each reduced from the previous one */
+    uint8_t* image = (uint8_t*)dest + coarsest;
+    width = coarsest_width;
+    height = coarsest_height;
+    size_t const outputs = SQZ_color_output_planes(&ctx);
+    while ((result == SQZ_RESULT_OK) && (image + width * height * outputs < (uint8_t*)dest + length))
+    {
+        uint8_t* const next = image + width * height * outputs;
+        SQZ_mipmap_reduce(image, next, width, height, outputs);
+        image = next;
+        width = (width + 1u) >> 1u;
+        height = (height + 1u) >> 1u;
+    }
+    return result;
 }
 
-static int
-SQZ_decode_refinement_pass(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+SQZ_status_t
+SQZ_decode_pyramid(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
-    {
-        return 0;
-    }
-#endif
-    SQZ_list_node_t* pixel = band->LSP.head;
-    SQZ_list_node_t* const base = band->cache.nodes;
-    SQZ_dwt_coefficient_t* const data = band->data;
-    SQZ_dwt_coefficient_t const bitplane_mask = 1u << band->bitplane;
-    size_t const stride = band->stride;
-    while (pixel != NULL)
+    return SQZ_decode_reductions(source, dest, src_size, dest_size, descriptor, 0);
+}
+
+SQZ_status_t
+SQZ_decode_mipmaps(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor)
+{
+    return SQZ_decode_reductions(source, dest, src_size, dest_size, descriptor, 1);
+}
+
+/**
+ * \brief           Sums the coefficients of a cell of a grid laid over a subband
+ * \param[in]       band: The subband, holding the decoded DWT coefficients in sign-magnitude format
+ * \param[in]       column: The column of the cell, out of 9
+ * \param[in]       row: The row of the cell, out of 8
+ * \param[out]      count: The number of coefficients in the cell, at least 1, as they overlap on small subbands
+ * \return          The sum of the coefficients
+ */
+static int64_t
+SQZ_hash_cell(SQZ_dwt_subband_t const * const band, size_t const column, size_t const row, size_t* const count)
+{
+    size_t const x0 = (column * band->width) / 9u, y0 = (row * band->height) / 8u;
+    size_t const x1 = ((column + 1u) * band->width) / 9u, y1 = ((row + 1u) * band->height) / 8u;
+    int64_t sum = 0;
+    *count = 0u;
+    for (size_t y = y0; (y < y1) || (y == y0); ++y)
     {
-        int v = SQZ_bit_buffer_read_bit(buffer);
-        if (v > 0)
+        for (size_t x = x0; (x < x1) || (x == x0); ++x)
         {
-            data[pixel->y * stride + pixel->x] |= bitplane_mask;
+            SQZ_dwt_coefficient_t const v = band->data[y * band->stride + x];
+            sum += (v & 1) ? - (v >> 1) : v >> 1;
+            (*count)++;
         }
-        else if (v < 0)
-        {
-            break;
-        }
-        pixel = SQZ_list_node_next(pixel, base);
     }
-    return !SQZ_bit_buffer_eob(buffer);
+    return sum;
 }
 
-static int
-SQZ_encode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
+SQZ_status_t
+SQZ_perceptual_hash(void* const source, size_t const src_size, uint64_t* const hash)
 {
-#ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
+    if ((source == NULL) || (hash == NULL))
     {
-        return 0;
+        return SQZ_INVALID_PARAMETER;
     }
-#endif
-    if ((!SQZ_encode_sorting_pass(band, buffer)) || (!SQZ_encode_refinement_pass(band, buffer)))
+    SQZ_context_t ctx = { 0 };
+    SQZ_bit_buffer_init(&ctx.buffer, source, src_size);
+    if (!SQZ_decode_header(&ctx, &ctx.buffer))
     {
-        return 0;
+        return SQZ_INVALID_PARAMETER;
     }
-    /* now merge NSP into LSP */
-    SQZ_list_merge(&band->NSP, &band->LSP);
-    band->bitplane -= (band->bitplane > 0);
-    return !SQZ_bit_buffer_eob(buffer);
-}
-
-static int
-SQZ_decode_bitplane(SQZ_dwt_subband_t* const band, SQZ_bit_buffer_t* const buffer)
-{
-#ifdef DEBUG
-    if ((band == NULL) || (buffer == NULL))
+    SQZ_status_t result = SQZ_validate_input(&ctx.image, 1);
+    if (result != SQZ_RESULT_OK)
     {
-        return 0;
+        return result;
     }
-#endif
-    if ((!SQZ_decode_sorting_pass(band, buffer)) || (!SQZ_decode_refinement_pass(band, buffer)))
+    /* no full resolution storage, only the subbands in the prefix are allocated */
+    ctx.sparse = 1;
+    result = SQZ_decode_coefficients(&ctx);
+    if (result != SQZ_RESULT_OK)
     {
-        return 0;
+        return result;
     }
-    /* now merge NSP into LSP */
-    SQZ_list_merge(&band->NSP, &band->LSP);
-    band->bitplane -= (band->bitplane > 0);
-    return !SQZ_bit_buffer_eob(buffer);
-}
-
-static void
-SQZ_decode_round_coefficients(SQZ_context_t* const ctx)
-{
-#ifdef DEBUG
-    if (ctx == NULL)
+    SQZ_dwt_subband_t const * const band = &ctx.plane[0].band[0][0];
+    if (band->data == NULL)
     {
-        return;
-    }
-#endif
-    for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+        SQZ_common_free_context(&ctx);
+        return SQZ_BUFFER_TOO_SMALL;
+    }
+    *hash = 0u;
+    for (size_t row = 0u; row < 8u; ++row)
     {
-        for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
+        size_t count[2];
+        int64_t sum[2] = { SQZ_hash_cell(band, 0u, row, &count[0]) };
+        for (size_t column = 0u; column < 8u; ++column)
         {
-            for (size_t orientation = !!(level > 0); orientation < SQZ_DWT_SUBBANDS; ++orientation)
-            {
-                SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
-                if ((band->max_bitplane == 0) || (band->bitplane < 2))
-                {
-                    continue;
-                }
-                SQZ_list_node_t* pixel = band->LSP.head;
-                SQZ_list_node_t* const base = band->cache.nodes;
-                SQZ_dwt_coefficient_t* const data = band->data;
-                SQZ_dwt_coefficient_t const round_mask = ((1u << band->bitplane) - 1u) ^ 1u;
-                size_t const stride = band->stride;
-                while (pixel != NULL)
-                {
-                    data[pixel->y * stride + pixel->x] |= round_mask;
-                    pixel = SQZ_list_node_next(pixel, base);
-                }
-            }
+            sum[~column & 1u] = SQZ_hash_cell(band, column + 1u, row, &count[~column & 1u]);
+            /* compares the means of the neighboring cells, which may hold different numbers of coefficients */
+            *hash = (*hash << 1u) | (uint64_t)(sum[column & 1u] * (int64_t)count[~column & 1u] < sum[~column & 1u] * (int64_t)count[column & 1u]);
         }
     }
+    SQZ_common_free_context(&ctx);
+    return SQZ_RESULT_OK;
 }
 
-static SQZ_status_t
-SQZ_schedule_task(SQZ_context_t* const ctx, SQZ_init_subband_fn const init, SQZ_bitplane_task_fn const task)
+SQZ_status_t
+SQZ_decode_update(void* const source, void* const dest, size_t const src_size, SQZ_decoder_state_t* const state)
 {
-#ifdef DEBUG
-    if ((ctx == NULL) || (init == NULL) || (task == NULL))
+    if ((source == NULL) || (dest == NULL) || (state == NULL))
     {
         return SQZ_INVALID_PARAMETER;
     }
-#endif
-    SQZ_scan_context_t scan = { 0 };
-    SQZ_bit_buffer_t* const buffer = &ctx->buffer;
-    size_t state = 0u, plane = 0u, level = 0u, orientation = 0u;
-    int round = 0, done = 0;
-    scan.type = ctx->image.scan_order;
-    while ((!done) && (!SQZ_bit_buffer_eob(buffer)))
+    SQZ_context_t* ctx = (SQZ_context_t*)state->context;
+    SQZ_status_t result = SQZ_RESULT_OK;
+    if ((ctx != NULL) && (src_size < (size_t)(ctx->buffer.eob - ctx->buffer.data)))
     {
-        done = 1;
-        for (;;)
+        /* can't go back further than the last task, so start over */
+        SQZ_common_free_context(ctx);
+        free(ctx);
+        state->context = ctx = NULL;
+    }
+    if (ctx == NULL)
+    {
+        ctx = (SQZ_context_t*)calloc(1u, sizeof(SQZ_context_t));
+        if (ctx == NULL)
         {
-            SQZ_dwt_subband_t* const band = &ctx->plane[plane].band[level][orientation];
-            if ((round < band->round) || ((round > band->round) && (band->bitplane == 0)))
+            return SQZ_OUT_OF_MEMORY;
+        }
+        SQZ_bit_buffer_init(&ctx->buffer, source, src_size);
+        if (!SQZ_decode_header(ctx, &ctx->buffer))
+        {
+            result = SQZ_INVALID_PARAMETER;
+        }
+        else if ((result = SQZ_validate_input(&ctx->image, 1)) == SQZ_RESULT_OK)
+        {
+            SQZ_image_descriptor_t image;
+            SQZ_color_describe(ctx, &image);
+            if ((state->coefficients != NULL) &&
+                ((image.width != state->descriptor.width) || (image.height != state->descriptor.height) ||
+                 (image.num_planes != state->descriptor.num_planes) || (image.color_mode != state->descriptor.color_mode) ||
+                 (image.dwt_levels != state->descriptor.dwt_levels)))
             {
-                done &= (round > band->round);
+                result = SQZ_INVALID_PARAMETER;
             }
             else
             {
-                if (band->round == round)
-                {
-                    SQZ_scan_init(&scan, band);
-                    SQZ_status_t result = init(band, &scan, buffer);
-                    if (result != SQZ_RESULT_OK)
-                    {
-                        free(scan.workspace);
-                        return result;
-                    }
-                }
-                if (!task(band, buffer))
-                {
-                    free(scan.workspace);
-                    return SQZ_RESULT_OK;
-                }
-                done &= (band->bitplane == 0);
-            }
-            if (!state)
-            {
-                ++orientation;
-                if (orientation >= SQZ_DWT_SUBBANDS)
-                {
-                    ++level;
-                    orientation = !!(level < (size_t)ctx->image.dwt_levels);
-                    if (orientation == 0u)
-                    {
-                        level = 0u;
-                        state = plane = (ctx->image.num_planes > 1u);
-                        if (!state)
-                        {
-                            break;
-                        }
-                    }
-                }
+                result = SQZ_common_init_context(ctx);
             }
-            else
+        }
+        if (result != SQZ_RESULT_OK)
+        {
+            SQZ_common_free_context(ctx);
+            free(ctx);
+            return result;
+        }
+        if (ctx->extensions & SQZ_HEADER_EXTENSION_ARITHMETIC)
+        {
+            SQZ_arithmetic_decoder_init(&ctx->buffer);
+        }
+        /* all the subbands are dequantized, in case the previous output came from a longer stream */
+        for (size_t plane = 0u; plane < ctx->image.num_planes; ++plane)
+        {
+            for (size_t level = 0u; level < ctx->image.dwt_levels; ++level)
             {
-                ++plane;
-                if (plane >= ctx->image.num_planes)
+                for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
                 {
-                    plane = 1u;
-                    ++orientation;
-                    if (orientation >= SQZ_DWT_SUBBANDS)
-                    {
-                        ++level;
-                        orientation = !!(level < (size_t)ctx->image.dwt_levels);
-                        if (orientation == 0u)
-                        {
-                            level = 0u;
-                            state = plane = 0u;
-                            break;
-                        }
-                    }
+                    ctx->plane[plane].band[level][orientation].updated = 1;
                 }
             }
         }
-        ++round;
-    };
-    free(scan.workspace);
-    return SQZ_RESULT_OK;
-}
-
-#undef SQZ_DWT_SUBBANDS
-
-static SQZ_status_t
-SQZ_validate_input(SQZ_image_descriptor_t* const descriptor, int const read_only)
-{
-#ifdef DEBUG
-    if (descriptor == NULL)
+        state->context = ctx;
+    }
+    else
     {
-        return SQZ_INVALID_PARAMETER;
+        size_t const position = (size_t)(ctx->buffer.ptr - ctx->buffer.data);
+        ctx->buffer.data = (uint8_t*)source;
+        ctx->buffer.ptr = ctx->buffer.data + position;
+        ctx->buffer.eob = ctx->buffer.data + src_size;
+        if (ctx->cursor.active)
+        {
+            SQZ_decode_rollback(ctx);
+        }
     }
-#endif
-    if ((descriptor->width  < SQZ_MIN_DIMENSION) || (descriptor->width  > SQZ_MAX_DIMENSION) ||
-            (descriptor->height < SQZ_MIN_DIMENSION) || (descriptor->height > SQZ_MAX_DIMENSION) ||
-            (descriptor->color_mode < SQZ_COLOR_MODE_GRAYSCALE) || (descriptor->color_mode >= SQZ_COLOR_MODE_COUNT) ||
-            (descriptor->scan_order < SQZ_SCAN_ORDER_RASTER) || (descriptor->scan_order >= SQZ_SCAN_ORDER_COUNT) ||
-            (descriptor->dwt_levels == 0u) || (descriptor->dwt_levels > SQZ_DWT_MAX_LEVEL)
-       )
+    /* without a checkpoint, the arithmetic decoder can't be resumed if the data ran out before the first task */
+    int const resumable = !SQZ_bit_buffer_eob(&ctx->buffer);
+    size_t const length = ctx->image.width * ctx->image.height * ctx->image.num_planes;
+    int const first = (state->samples == NULL);
+    if (first)
     {
-        return (read_only) ? SQZ_DATA_CORRUPTED : SQZ_INVALID_PARAMETER;
+        state->coefficients = (int16_t*)calloc(length, sizeof(SQZ_dwt_coefficient_t));
+        state->samples = (int16_t*)malloc(length * sizeof(SQZ_dwt_coefficient_t));
+        SQZ_color_describe(ctx, &state->descriptor);
     }
-    size_t const smallest_dimension = (descriptor->width > descriptor->height) ? descriptor->height : descriptor->width;
-    uint32_t max_level = SQZ_ilog2(smallest_dimension) - 3u;
-    if (max_level > SQZ_DWT_MAX_LEVEL)
+    if ((state->coefficients == NULL) || (state->samples == NULL))
     {
-        max_level = SQZ_DWT_MAX_LEVEL;
+        result = SQZ_OUT_OF_MEMORY;
     }
-    if (descriptor->dwt_levels > max_level)
+    else
     {
-        if (read_only)
-        {
-            return SQZ_DATA_CORRUPTED;
-        }
-        else
+        result = SQZ_schedule_task(ctx, &SQZ_decode_init_subband, SQZ_kernels()->decode_bitplane);
+    }
+    if (result == SQZ_RESULT_OK)
+    {
+        state->rounds = ctx->rounds;
+        result = SQZ_decode_dequantize(ctx, state->coefficients, &state->region);
+    }
+    if ((result == SQZ_RESULT_OK) && (first))
+    {
+        state->region.x = state->region.y = 0u;
+        state->region.width = ctx->image.width;
+        state->region.height = ctx->image.height;
+    }
+    if ((result == SQZ_RESULT_OK) && (state->region.width > 0u))
+    {
+        result = SQZ_idwt_region(ctx, state->coefficients, state->samples, &state->region);
+        if (result == SQZ_RESULT_OK)
         {
-            descriptor->dwt_levels = max_level;
+            SQZ_color_process_region(ctx, state->samples, (uint8_t*)dest, &state->region);
         }
     }
-    if (!read_only)
+    if ((result != SQZ_RESULT_OK) || (!resumable))
     {
-        descriptor->num_planes = SQZ_number_of_planes[descriptor->color_mode];
+        SQZ_common_free_context(ctx);
+        free(ctx);
+        state->context = NULL;
     }
-    return SQZ_RESULT_OK;
+    if ((result != SQZ_RESULT_OK) && (first))
+    {
+        SQZ_decoder_state_free(state);
+    }
+    return result;
 }
 
 SQZ_status_t
-SQZ_encode(void* const source, void* const dest, SQZ_image_descriptor_t* const descriptor, size_t* const budget)
+SQZ_decode_append(void* const chunk, void* const dest, size_t const chunk_size, size_t const dest_size, SQZ_decoder_state_t* const state)
 {
-    SQZ_status_t result = SQZ_validate_input(descriptor, 0);
-    if (result != SQZ_RESULT_OK)
+    if ((state == NULL) || ((chunk == NULL) && (chunk_size > 0u)))
     {
-        return result;
+        return SQZ_INVALID_PARAMETER;
     }
-    SQZ_context_t ctx = { 0 };
-    memcpy(&ctx.image, descriptor, sizeof(*descriptor));
-    SQZ_bit_buffer_init(&ctx.buffer, dest, *budget);
-    if (!SQZ_encode_header(descriptor, &ctx.buffer))
+    if (chunk_size > state->window_capacity - state->window_size)
     {
-        return SQZ_BUFFER_TOO_SMALL;
+        size_t capacity = (state->window_capacity > 0u) ? state->window_capacity : 256u;
+        while (capacity - state->window_size < chunk_size)
+        {
+            capacity <<= 1u;
+        }
+        uint8_t* const window = (uint8_t*)realloc(state->window, capacity);
+        if (window == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
+        state->window = window;
+        state->window_capacity = capacity;
     }
-    result = SQZ_common_init_context(&ctx);
-    if (result != SQZ_RESULT_OK)
+    if (chunk_size > 0u)
     {
-        SQZ_common_free_context(&ctx);
-        return result;
+        memcpy(state->window + state->window_size, chunk, chunk_size);
+        state->window_size += chunk_size;
     }
-    SQZ_color_process(&ctx, source, 1);
-    result = SQZ_dwt(&ctx);
-    if (result != SQZ_RESULT_OK)
+    state->region = (SQZ_region_t){ 0u, 0u, 0u, 0u };
+    size_t length = state->descriptor.width * state->descriptor.height * state->descriptor.num_planes;
+    if (state->samples == NULL)
     {
-        SQZ_common_free_context(&ctx);
-        return result;
+        /* nothing was decoded yet, the header may still be incomplete */
+        SQZ_image_descriptor_t image;
+        length = 0u;
+        if (SQZ_decode(state->window, NULL, state->window_size, &length, &image) != SQZ_BUFFER_TOO_SMALL)
+        {
+            return SQZ_RESULT_OK;
+        }
+        state->descriptor = image;
     }
-    SQZ_dwt_convert_to_sign_magnitude(&ctx);
-    result = SQZ_schedule_task(&ctx, &SQZ_encode_init_subband, &SQZ_encode_bitplane);
-    if (result != SQZ_RESULT_OK)
+    if ((dest == NULL) || (dest_size < length))
     {
-        SQZ_common_free_context(&ctx);
-        return result;
+        return SQZ_BUFFER_TOO_SMALL;
     }
-    *budget = (SQZ_bit_buffer_bits_used(&ctx.buffer) + (CHAR_BIT - 1)) / CHAR_BIT;
-    SQZ_common_free_context(&ctx);
-    return SQZ_RESULT_OK;
+    SQZ_status_t const result = SQZ_decode_update(state->window, dest, state->window_size, state);
+    SQZ_context_t* const ctx = (SQZ_context_t*)state->context;
+    if ((result == SQZ_RESULT_OK) && (ctx != NULL))
+    {
+        /* the next call resumes at the current byte, or at the start of the task to be rolled back */
+        size_t const position = (size_t)(ctx->buffer.ptr - ctx->buffer.data);
+        size_t const consumed = (ctx->cursor.active) ? ctx->checkpoint.position : position;
+        memmove(state->window, state->window + consumed, state->window_size - consumed);
+        state->window_size -= consumed;
+        if (ctx->cursor.active)
+        {
+            ctx->checkpoint.position -= consumed;
+        }
+        ctx->buffer.data = state->window;
+        ctx->buffer.ptr = state->window + (position - consumed);
+        ctx->buffer.eob = state->window + state->window_size;
+    }
+    return result;
 }
 
-SQZ_status_t
-SQZ_decode(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_image_descriptor_t* const descriptor)
+void
+SQZ_decoder_state_free(SQZ_decoder_state_t* const state)
 {
-    if ((source == NULL) || (dest_size == NULL) || ((dest == NULL) && (*dest_size != 0u)))
+    if (state != NULL)
     {
-        return SQZ_INVALID_PARAMETER;
+        if (state->context != NULL)
+        {
+            SQZ_common_free_context((SQZ_context_t*)state->context);
+            free(state->context);
+        }
+        free(state->coefficients);
+        free(state->samples);
+        free(state->window);
+        memset(state, 0, sizeof(*state));
     }
+}
+
+/**
+ * \brief           Decodes a frame of a sequence, keeping the reconstruction of its coefficients for the next one
+ * \param[in,out]   state: The sequence state, with its context allocated
+ * \param[in]       source: The compressed frame
+ * \param           src_size: Size of the compressed frame
+ * \param[out]      dest: The buffer that will receive the decompressed pixel data, or `NULL` to only keep the reconstruction
+ * \param[in,out]   dest_size: Size of the output buffer, updated with the required size if too small, or `NULL`
+ * \param[out]      descriptor: Descriptor receiving the information about the frame, or `NULL` when encoding, as the
+ *                  options that aren't signalled in the header must be kept
+ * \return          \ref SQZ_RESULT_OK on success, member of \ref SQZ_status_t otherwise, in which case the sequence must
+ *                  start over from a key frame
+ */
+static SQZ_status_t
+SQZ_sequence_reconstruct(SQZ_sequence_state_t* const state, void* const source, size_t const src_size, void* const dest, size_t* const dest_size,
+                         SQZ_image_descriptor_t* const descriptor)
+{
+    SQZ_sequence_context_t* const sequence = (SQZ_sequence_context_t*)state->context;
     SQZ_context_t ctx = { 0 };
+    ctx.sequence = (sequence->reference != NULL) ? sequence : NULL;
     SQZ_bit_buffer_init(&ctx.buffer, source, src_size);
-    if (!SQZ_decode_header(&ctx.image, &ctx.buffer))
+    if (!SQZ_decode_header(&ctx, &ctx.buffer))
     {
         return SQZ_INVALID_PARAMETER;
     }
@@ -2677,39 +7870,164 @@ SQZ_decode(void* const source, void* const dest, size_t const src_size, size_t*
     {
         return result;
     }
-    if (descriptor != NULL)
+    int const predicted = !!(ctx.extensions & SQZ_HEADER_EXTENSION_TEMPORAL);
+    if (!predicted)
+    {
+        ctx.sequence = NULL;
+    }
+    else if ((ctx.image.width != state->descriptor.width) || (ctx.image.height != state->descriptor.height) ||
+             (ctx.image.num_planes != state->descriptor.num_planes) || (ctx.image.color_mode != state->descriptor.color_mode) ||
+             (ctx.image.dwt_levels != state->descriptor.dwt_levels) ||
+             (sequence->length != ctx.image.width * ctx.image.height * ctx.image.num_planes))
     {
-        memcpy(descriptor, &ctx.image, sizeof(*descriptor));
+        return SQZ_DATA_CORRUPTED;
     }
     size_t const length = ctx.image.width * ctx.image.height * ctx.image.num_planes;
-    if (*dest_size < length)
+    if ((dest_size != NULL) && (*dest_size < ctx.image.width * ctx.image.height * SQZ_color_output_planes(&ctx)))
     {
-        *dest_size = length;
+        *dest_size = ctx.image.width * ctx.image.height * SQZ_color_output_planes(&ctx);
         return SQZ_BUFFER_TOO_SMALL;
     }
-    result = SQZ_common_init_context(&ctx);
-    if (result != SQZ_RESULT_OK)
+    if ((!predicted) && (sequence->length != length))
     {
-        SQZ_common_free_context(&ctx);
-        return result;
+        free(sequence->reference);
+        sequence->reference = (SQZ_dwt_coefficient_t*)malloc(length * sizeof(SQZ_dwt_coefficient_t));
+        sequence->length = (sequence->reference != NULL) ? length : 0u;
+        if (sequence->reference == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
     }
-    result = SQZ_schedule_task(&ctx, &SQZ_decode_init_subband, &SQZ_decode_bitplane);
+    result = SQZ_decode_coefficients(&ctx);
     if (result != SQZ_RESULT_OK)
     {
-        SQZ_common_free_context(&ctx);
+        free(sequence->reference);
+        sequence->reference = NULL;
+        sequence->length = 0u;
         return result;
     }
-    SQZ_decode_round_coefficients(&ctx);
-    SQZ_dwt_convert_from_sign_magnitude(&ctx);
-    result = SQZ_idwt(&ctx);
-    if (result != SQZ_RESULT_OK)
+    for (size_t i = 0u; i < length; ++i)
     {
-        SQZ_common_free_context(&ctx);
-        return result;
+        int32_t const v = (int32_t)ctx.data[i] + ((predicted) ? (int32_t)sequence->reference[i] : 0);
+        sequence->reference[i] = ctx.data[i] = (SQZ_dwt_coefficient_t)((v < -INT16_MAX) ? -INT16_MAX : ((v > INT16_MAX) ? INT16_MAX : v));
+    }
+    for (size_t plane = 0u; plane < ctx.image.num_planes; ++plane)
+    {
+        for (size_t level = 0u; level < ctx.image.dwt_levels; ++level)
+        {
+            for (size_t orientation = !!(level > 0); orientation < 4u; ++orientation)
+            {
+                /* the subbands not reached keep the precision of the previous frame, whose coefficients they still hold,
+                   and a bitplane the data ran out in is coded again in the next frame */
+                SQZ_dwt_subband_t const * const band = &ctx.plane[plane].band[level][orientation];
+                if (band->updated)
+                {
+                    sequence->precision[plane][level][orientation] = (band->bitplane < band->min_bitplane) ? band->min_bitplane : band->bitplane;
+                }
+                else if (!predicted)
+                {
+                    sequence->precision[plane][level][orientation] = INT_MAX;
+                }
+            }
+        }
+    }
+    if (descriptor != NULL)
+    {
+        SQZ_color_describe(&ctx, descriptor);
+    }
+    state->frame = (predicted) ? state->frame + 1u : 0u;
+    if (dest != NULL)
+    {
+        SQZ_dwt_coefficient_t* const scratch = (SQZ_dwt_coefficient_t*)malloc(ctx.image.width * sizeof(SQZ_dwt_coefficient_t));
+        if (scratch == NULL)
+        {
+            SQZ_common_free_context(&ctx);
+            return SQZ_OUT_OF_MEMORY;
+        }
+        for (size_t plane = 0u; plane < ctx.image.num_planes; ++plane)
+        {
+            SQZ_idwt_plane(ctx.plane[plane].data, scratch, ctx.image.width, ctx.image.height, ctx.image.dwt_levels);
+        }
+        SQZ_color_process(&ctx, dest, 0);
+        free(scratch);
     }
-    SQZ_color_process(&ctx, dest, 0);
     SQZ_common_free_context(&ctx);
     return SQZ_RESULT_OK;
 }
 
+SQZ_status_t
+SQZ_encode_frame(void* const source, void* const dest, size_t* const budget, SQZ_sequence_state_t* const state)
+{
+    if ((source == NULL) || (dest == NULL) || (budget == NULL) || (state == NULL) || (state->descriptor.max_error != 0))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+    if (state->context == NULL)
+    {
+        state->context = calloc(1u, sizeof(SQZ_sequence_context_t));
+        if (state->context == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
+    }
+    SQZ_sequence_context_t const * const sequence = (SQZ_sequence_context_t const*)state->context;
+    int const key = (sequence->reference == NULL) || (state->key_interval <= 1u) || (state->frame + 1u >= state->key_interval) ||
+                    (sequence->length != state->descriptor.width * state->descriptor.height * state->descriptor.num_planes);
+    if (key)
+    {
+        /* the bands are coded as they are, so that the reconstruction is of the same planes in every frame */
+        state->descriptor.band_transform = 0;
+        SQZ_status_t const result = SQZ_validate_input(&state->descriptor, 0);
+        if (result != SQZ_RESULT_OK)
+        {
+            return result;
+        }
+    }
+    SQZ_status_t const result = SQZ_encode_image(source, NULL, (key) ? NULL : sequence, 0u, dest, &state->descriptor, budget, NULL);
+    if (result != SQZ_RESULT_OK)
+    {
+        return result;
+    }
+    /* the next frame is predicted from what the decoder will reconstruct, not from the original frame */
+    return SQZ_sequence_reconstruct(state, dest, *budget, NULL, NULL, NULL);
+}
+
+SQZ_status_t
+SQZ_decode_frame(void* const source, void* const dest, size_t const src_size, size_t* const dest_size, SQZ_sequence_state_t* const state)
+{
+    if ((source == NULL) || (dest_size == NULL) || (state == NULL) || ((dest == NULL) && (*dest_size != 0u)))
+    {
+        return SQZ_INVALID_PARAMETER;
+    }
+    if (state->context == NULL)
+    {
+        state->context = calloc(1u, sizeof(SQZ_sequence_context_t));
+        if (state->context == NULL)
+        {
+            return SQZ_OUT_OF_MEMORY;
+        }
+    }
+    return SQZ_sequence_reconstruct(state, source, src_size, dest, dest_size, &state->descriptor);
+}
+
+void
+SQZ_sequence_state_free(SQZ_sequence_state_t* const state)
+{
+    if (state != NULL)
+    {
+        if (state->context != NULL)
+        {
+            free(((SQZ_sequence_context_t*)state->context)->reference);
+            free(state->context);
+        }
+        memset(state, 0, sizeof(*state));
+    }
+}
+
+char const*
+SQZ_kernels_name(void)
+{
+    return SQZ_kernels()->name;
+}
+
 #endif /* SQZ_IMPLEMENTATION */
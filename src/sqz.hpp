@@ -0,0 +1,592 @@
+/**
+ * \file            sqz.hpp
+ * \brief           C++20 wrapper for the SQZ image compression library
+ */
+
+/*
+                    Copyright (c) 2024, Márcio Pais
+
+                    SPDX-License-Identifier: MIT
+
+Optional header-only wrapper over the C API of "sqz.h", for C++20 code. The pixels and
+the compressed data are passed as spans, so the encoders and decoders read from and write
+to the caller's own storage without any copies. The encoder and decoder objects own
+their output buffers and a workspace of the library, both reused from one call to the
+next, and the progressive decoder its state. Errors are reported by throwing sqz::error, holding the status returned by
+the C API.
+
+With coroutine support, sqz::async_decode decodes a stream as it arrives from an
+asynchronous source, such as a socket of an event loop, yielding a preview each time
+the bytes received complete a round of the schedule, where every subband reached is
+refined by a bitplane, without blocking the thread.
+
+The implementation of SQZ must still be compiled in one file, C or C++, as usual:
+
+#define SQZ_IMPLEMENTATION
+#include "sqz.h"
+
+The workspace of an encoder or a decoder keeps the context, lists and coefficients of the
+library between the calls, see SQZ_encode_with_workspace, so that coding images of the
+same size and settings doesn't allocate memory after the first one.
+*/
+
+#pragma once
+#ifndef SQZ_HPP
+#define SQZ_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#include <exception>
+#endif
+
+#include "sqz.h"
+
+namespace sqz
+{
+
+/**
+ * \brief           Exception thrown when a call to the C API fails
+ */
+class error : public std::runtime_error
+{
+public:
+    explicit error(SQZ_status_t const status) : std::runtime_error(describe(status)), status_(status) {}
+
+    /**
+     * \brief           Get the status returned by the C API
+     * \return          Member of \ref SQZ_status_t other than \ref SQZ_RESULT_OK
+     */
+    SQZ_status_t status() const noexcept { return status_; }
+
+private:
+    static char const* describe(SQZ_status_t const status) noexcept
+    {
+        switch (status)
+        {
+        case SQZ_OUT_OF_MEMORY:
+            return "SQZ: out of memory";
+        case SQZ_INVALID_PARAMETER:
+            return "SQZ: invalid parameter";
+        case SQZ_BUFFER_TOO_SMALL:
+            return "SQZ: buffer too small";
+        case SQZ_DATA_CORRUPTED:
+            return "SQZ: data corrupted";
+        default:
+            return "SQZ: unknown error";
+        }
+    }
+
+    SQZ_status_t status_;
+};
+
+namespace detail
+{
+
+inline void check(SQZ_status_t const status)
+{
+    if (status != SQZ_RESULT_OK)
+    {
+        throw error(status);
+    }
+}
+
+/* The C API takes its sources as `void*`, but never writes to them */
+inline void* source(std::span<uint8_t const> const data) noexcept
+{
+    return const_cast<uint8_t*>(data.data());
+}
+
+/* Smallest region holding both regions, either of which may be empty */
+inline SQZ_region_t merge(SQZ_region_t const a, SQZ_region_t const b) noexcept
+{
+    if ((a.width == 0u) || (b.width == 0u))
+    {
+        return (a.width == 0u) ? b : a;
+    }
+    size_t const x = std::min(a.x, b.x), y = std::min(a.y, b.y);
+    return { x, y, std::max(a.x + a.width, b.x + b.width) - x, std::max(a.y + a.height, b.y + b.height) - y };
+}
+
+/* Owner of a workspace of the C API */
+class workspace
+{
+public:
+    workspace() noexcept = default;
+    workspace(workspace&& other) noexcept : workspace_(std::exchange(other.workspace_, SQZ_workspace_t{})) {}
+    workspace& operator=(workspace&& other) noexcept
+    {
+        if (this != &other)
+        {
+            SQZ_workspace_free(&workspace_);
+            workspace_ = std::exchange(other.workspace_, SQZ_workspace_t{});
+        }
+        return *this;
+    }
+    workspace(workspace const&) = delete;
+    workspace& operator=(workspace const&) = delete;
+    ~workspace() { SQZ_workspace_free(&workspace_); }
+
+    SQZ_workspace_t* get() noexcept { return &workspace_; }
+
+private:
+    SQZ_workspace_t workspace_ = {};
+};
+
+} /* namespace detail */
+
+/**
+ * \brief           Move-only byte buffer, whose storage is kept when it shrinks so that it can be reused
+ * \note            The bytes aren't initialized when the storage grows
+ */
+class buffer
+{
+public:
+    buffer() noexcept = default;
+    explicit buffer(size_t const size) { resize(size); }
+    buffer(buffer&& other) noexcept : data_(std::move(other.data_)), size_(std::exchange(other.size_, 0u)), capacity_(std::exchange(other.capacity_, 0u)) {}
+    buffer& operator=(buffer&& other) noexcept
+    {
+        data_ = std::move(other.data_);
+        size_ = std::exchange(other.size_, 0u);
+        capacity_ = std::exchange(other.capacity_, 0u);
+        return *this;
+    }
+    buffer(buffer const&) = delete;
+    buffer& operator=(buffer const&) = delete;
+
+    /**
+     * \brief           Set the size of the buffer, only reallocating its storage if it must grow
+     * \param           size: The new size, in bytes
+     */
+    void resize(size_t const size)
+    {
+        if (size > capacity_)
+        {
+            data_.reset(new uint8_t[size]);
+            capacity_ = size;
+        }
+        size_ = size;
+    }
+
+    uint8_t* data() noexcept { return data_.get(); }
+    uint8_t const* data() const noexcept { return data_.get(); }
+    size_t size() const noexcept { return size_; }
+    size_t capacity() const noexcept { return capacity_; }
+    std::span<uint8_t> span() noexcept { return { data_.get(), size_ }; }
+    std::span<uint8_t const> span() const noexcept { return { data_.get(), size_ }; }
+    operator std::span<uint8_t>() noexcept { return span(); }
+    operator std::span<uint8_t const>() const noexcept { return span(); }
+
+private:
+    std::unique_ptr<uint8_t[]> data_;
+    size_t size_ = 0u;
+    size_t capacity_ = 0u;
+};
+
+/**
+ * \brief           Image encoder, with the descriptor of the images to encode, a reusable output buffer and workspace
+ * \note            The workspace is only used by \ref encode, YUV frames and near-lossless encoding still allocating the
+ *                  working memory of the library on each call
+ */
+class encoder
+{
+public:
+    explicit encoder(SQZ_image_descriptor_t const& descriptor) noexcept : descriptor_(descriptor), encoded_(descriptor) {}
+    encoder(encoder&&) noexcept = default;
+    encoder& operator=(encoder&&) noexcept = default;
+
+    /**
+     * \brief           Access the descriptor of the images to encode
+     */
+    SQZ_image_descriptor_t& descriptor() noexcept { return descriptor_; }
+    SQZ_image_descriptor_t const& descriptor() const noexcept { return descriptor_; }
+
+    /**
+     * \brief           Get the descriptor of the last image encoded, as updated by \ref SQZ_encode, with the number of
+     *                  DWT levels chosen and the error of the near-lossless quantization used
+     */
+    SQZ_image_descriptor_t const& encoded() const noexcept { return encoded_; }
+
+    /**
+     * \brief           Encode an image into the caller's storage, the whole of it being the budget
+     * \param[in]       pixels: The interleaved samples of the image
+     * \param[out]      output: The storage receiving the compressed image, which is cleared first
+     * \return          The prefix of `output` holding the compressed image
+     */
+    std::span<uint8_t> encode(std::span<uint8_t const> const pixels, std::span<uint8_t> const output)
+    {
+        encoded_ = descriptor_;
+        size_t size = output.size();
+        std::memset(output.data(), 0, output.size());
+        detail::check(SQZ_encode_with_workspace(detail::source(pixels), output.data(), &encoded_, &size, workspace_.get()));
+        return output.first(size);
+    }
+
+    /**
+     * \brief           Encode a YUV 4:2:0 frame into the caller's storage, see \ref SQZ_encode_yuv
+     * \param[in]       samples: The planes of the frame
+     * \param           format: The layout of the planes
+     * \param[out]      output: The storage receiving the compressed frame, which is cleared first
+     * \return          The prefix of `output` holding the compressed frame
+     */
+    std::span<uint8_t> encode_yuv(std::span<uint8_t const> const samples, SQZ_yuv_format_t const format, std::span<uint8_t> const output)
+    {
+        encoded_ = descriptor_;
+        size_t size = output.size();
+        std::memset(output.data(), 0, output.size());
+        detail::check(SQZ_encode_yuv(detail::source(samples), format, output.data(), &encoded_, &size));
+        return output.first(size);
+    }
+
+    /**
+     * \brief           Encode an image into the buffer of the encoder, reused by the next calls
+     * \param[in]       pixels: The interleaved samples of the image
+     * \param           budget: Maximum size of the compressed image, in bytes
+     * \return          The compressed image, valid until the next call or until the buffer is released
+     */
+    std::span<uint8_t const> encode(std::span<uint8_t const> const pixels, size_t const budget)
+    {
+        output_.resize(budget);
+        output_.resize(encode(pixels, output_.span()).size());
+        return output_.span();
+    }
+
+    /**
+     * \brief           Take the buffer holding the last image encoded by \ref encode(std::span<uint8_t const>, size_t)
+     * \return          The buffer, the encoder allocating a new one on its next call
+     */
+    buffer release() noexcept { return std::move(output_); }
+
+private:
+    SQZ_image_descriptor_t descriptor_;
+    SQZ_image_descriptor_t encoded_;
+    buffer output_;
+    detail::workspace workspace_;
+};
+
+/**
+ * \brief           Description of a compressed image, as found in its header
+ */
+struct image_info
+{
+    SQZ_image_descriptor_t descriptor;          /*!< Descriptor of the image, with the number of planes of the output */
+    size_t size;                                /*!< Size of the decoded image, in bytes */
+};
+
+/**
+ * \brief           Image decoder, with a reusable output buffer and workspace
+ */
+class decoder
+{
+public:
+    decoder() noexcept = default;
+    decoder(decoder&&) noexcept = default;
+    decoder& operator=(decoder&&) noexcept = default;
+
+    /**
+     * \brief           Read the header of a compressed image
+     * \param[in]       stream: A prefix of the compressed image, of at least its header
+     * \return          The description of the image
+     */
+    static image_info info(std::span<uint8_t const> const stream)
+    {
+        image_info info = {};
+        SQZ_status_t const status = SQZ_decode(detail::source(stream), nullptr, stream.size(), &info.size, &info.descriptor);
+        if (status != SQZ_BUFFER_TOO_SMALL)
+        {
+            throw error((status == SQZ_RESULT_OK) ? SQZ_INVALID_PARAMETER : status);
+        }
+        return info;
+    }
+
+    /**
+     * \brief           Decode an image into the caller's storage, such as a frame buffer
+     * \param[in]       stream: The compressed image, or any prefix of it
+     * \param[out]      output: The storage receiving the interleaved samples, of at least the size given by \ref info
+     * \return          The descriptor of the image
+     */
+    SQZ_image_descriptor_t decode(std::span<uint8_t const> const stream, std::span<uint8_t> const output)
+    {
+        SQZ_image_descriptor_t descriptor = {};
+        size_t size = output.size();
+        detail::check(SQZ_decode_with_workspace(detail::source(stream), output.data(), stream.size(), &size, &descriptor, workspace_.get()));
+        return descriptor;
+    }
+
+    /**
+     * \brief           Decode an image into the buffer of the decoder, reused by the next calls
+     * \param[in]       stream: The compressed image, or any prefix of it
+     * \return          The interleaved samples, valid until the next call or until the buffer is released
+     */
+    std::span<uint8_t const> decode(std::span<uint8_t const> const stream)
+    {
+        output_.resize(info(stream).size);
+        decode(stream, output_.span());
+        return output_.span();
+    }
+
+    /**
+     * \brief           Take the buffer holding the last image decoded by \ref decode(std::span<uint8_t const>)
+     * \return          The buffer, the decoder allocating a new one on its next call
+     */
+    buffer release() noexcept { return std::move(output_); }
+
+private:
+    buffer output_;
+    detail::workspace workspace_;
+};
+
+/**
+ * \brief           Progressive decoder, refining its output as longer prefixes of a stream arrive, see \ref SQZ_decode_update
+ * \note            The decoder state, with the coefficients and samples of the last reconstruction, is kept between the
+ *                  calls, so each of them only decodes the new bytes and reconstructs the region that changed
+ */
+class progressive_decoder
+{
+public:
+    progressive_decoder() noexcept = default;
+    progressive_decoder(progressive_decoder&& other) noexcept : state_(std::exchange(other.state_, SQZ_decoder_state_t{})) {}
+    progressive_decoder& operator=(progressive_decoder&& other) noexcept
+    {
+        if (this != &other)
+        {
+            SQZ_decoder_state_free(&state_);
+            state_ = std::exchange(other.state_, SQZ_decoder_state_t{});
+        }
+        return *this;
+    }
+    progressive_decoder(progressive_decoder const&) = delete;
+    progressive_decoder& operator=(progressive_decoder const&) = delete;
+    ~progressive_decoder() { SQZ_decoder_state_free(&state_); }
+
+    /**
+     * \brief           Decode a longer prefix of the stream, refining the previous output
+     * \param[in]       stream: The prefix received so far
+     * \param[in,out]   output: The storage holding the previous output, of at least the size given by \ref decoder::info
+     * \return          The region of the output that changed
+     */
+    SQZ_region_t update(std::span<uint8_t const> const stream, std::span<uint8_t> const output)
+    {
+        image_info const image = decoder::info(stream);
+        if (output.size() < image.size)
+        {
+            throw error(SQZ_BUFFER_TOO_SMALL);
+        }
+        detail::check(SQZ_decode_update(detail::source(stream), output.data(), stream.size(), &state_));
+        return state_.region;
+    }
+
+    /**
+     * \brief           Decode the next bytes of the stream, refining the previous output, see \ref SQZ_decode_append
+     * \param[in]       chunk: The bytes received since the previous call
+     * \param[in,out]   output: The buffer holding the previous output, sized once the header is complete
+     * \return          The region of the output that changed, empty until the header is complete
+     */
+    SQZ_region_t append(std::span<uint8_t const> const chunk, buffer& output)
+    {
+        SQZ_status_t status = SQZ_decode_append(detail::source(chunk), output.data(), chunk.size(), output.size(), &state_);
+        if ((status == SQZ_BUFFER_TOO_SMALL) && (state_.descriptor.width > 0u))
+        {
+            /* the header was just completed, the bytes are kept for the next call */
+            output.resize(state_.descriptor.width * state_.descriptor.height * state_.descriptor.num_planes);
+            status = SQZ_decode_append(nullptr, output.data(), 0u, output.size(), &state_);
+        }
+        detail::check(status);
+        return state_.region;
+    }
+
+    /**
+     * \brief           Get the descriptor of the image, set by the first call to \ref update, or by the call to \ref append
+     *                  completing the header
+     */
+    SQZ_image_descriptor_t const& descriptor() const noexcept { return state_.descriptor; }
+
+    /**
+     * \brief           Get the number of rounds of the schedule completed so far, each refining every subband reached
+     */
+    size_t rounds() const noexcept { return state_.rounds; }
+
+    /**
+     * \brief           Release the decoder state, so that the next call decodes a new stream from scratch
+     */
+    void reset() noexcept { SQZ_decoder_state_free(&state_); }
+
+private:
+    SQZ_decoder_state_t state_ = {};
+};
+
+#ifdef __cpp_impl_coroutine
+
+/**
+ * \brief           Preview of an image being decoded by \ref async_decode
+ */
+struct preview
+{
+    std::span<uint8_t const> pixels;            /*!< The interleaved samples decoded so far, valid until the stream is resumed */
+    SQZ_image_descriptor_t descriptor;          /*!< Descriptor of the image */
+    SQZ_region_t region;                        /*!< Region of the pixels that changed since the previous preview */
+    size_t bytes;                               /*!< Size of the prefix of the stream decoded */
+    bool final;                                 /*!< Set on the last preview, once the budget or the end of the stream is reached */
+};
+
+/**
+ * \brief           Asynchronous generator of the previews of an image, as returned by \ref async_decode
+ * \note            Each `co_await next()` resumes decoding until the next preview, suspending the awaiting coroutine
+ *                  while the decoder waits for input, and returns `nullptr` once the last preview was consumed
+ */
+class preview_stream
+{
+public:
+    struct promise_type
+    {
+        preview const* current = nullptr;
+        std::coroutine_handle<> consumer;
+        std::exception_ptr exception;
+
+        /* yielding, and finishing, transfer control back to the coroutine awaiting the preview */
+        struct yield_awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> const handle) noexcept { return handle.promise().consumer; }
+            void await_resume() const noexcept {}
+        };
+
+        preview_stream get_return_object() noexcept { return preview_stream(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        yield_awaiter final_suspend() noexcept
+        {
+            current = nullptr;
+            return {};
+        }
+        yield_awaiter yield_value(preview const& value) noexcept
+        {
+            current = &value;
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    struct next_awaiter
+    {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> const consumer) noexcept
+        {
+            handle.promise().consumer = consumer;
+            return handle;
+        }
+        preview const* await_resume() const
+        {
+            if (!handle || handle.done())
+            {
+                if (handle && handle.promise().exception)
+                {
+                    std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+                }
+                return nullptr;
+            }
+            return handle.promise().current;
+        }
+    };
+
+    preview_stream(preview_stream&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    preview_stream& operator=(preview_stream&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+            {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    preview_stream(preview_stream const&) = delete;
+    preview_stream& operator=(preview_stream const&) = delete;
+    ~preview_stream()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    /**
+     * \brief           Wait for the next preview
+     * \return          Awaitable giving a pointer to the preview, or `nullptr` when decoding is finished. Decoding errors
+     *                  are rethrown by it
+     */
+    next_awaiter next() const noexcept { return { handle_ }; }
+
+private:
+    explicit preview_stream(std::coroutine_handle<promise_type> const handle) noexcept : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * \brief           Decode an image as its stream arrives from an asynchronous source
+ * \note            The source must provide `read(std::span<uint8_t>)`, returning an awaitable whose result is the number
+ *                  of bytes read into the span, 0 at the end of the stream, and it must outlive the returned stream.
+ *                  Each chunk read is passed to the decoder on its own, see \ref progressive_decoder::append, and a
+ *                  preview is yielded whenever it completes a round of the schedule, the last one being flagged
+ * \param[in]       source: The source of the compressed stream
+ * \param           budget: Maximum number of bytes to read and decode
+ * \param           chunk: Maximum number of bytes requested from the source by each read
+ * \return          The stream of previews
+ */
+template <typename Source>
+preview_stream async_decode(Source& source, size_t const budget = SIZE_MAX, size_t const chunk = 1u << 16u)
+{
+    buffer received;
+    progressive_decoder decoder;
+    buffer frame;
+    preview current = {};
+    SQZ_region_t changed = {};
+    size_t rounds = 0u, total = 0u;
+    for (bool last = false; !last;)
+    {
+        size_t const request = std::min(chunk, budget - total);
+        size_t count = 0u;
+        if (request > 0u)
+        {
+            received.resize(request);
+            count = std::min(static_cast<size_t>(co_await source.read(received.span())), request);
+            total += count;
+        }
+        last = (count == 0u) || (total >= budget);
+        changed = detail::merge(changed, decoder.append(received.span().first(count), frame));
+        if (frame.size() == 0u)
+        {
+            /* the header isn't complete yet */
+            if (last)
+            {
+                throw error(SQZ_INVALID_PARAMETER);
+            }
+            continue;
+        }
+        if ((decoder.rounds() > rounds) || (last))
+        {
+            rounds = decoder.rounds();
+            current = { frame.span(), decoder.descriptor(), changed, total, last };
+            changed = {};
+            co_yield current;
+        }
+    }
+}
+
+#endif /* __cpp_impl_coroutine */
+
+} /* namespace sqz */
+
+#endif /* SQZ_HPP */
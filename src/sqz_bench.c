@@ -0,0 +1,557 @@
+﻿/**
+ * \file            sqz_bench.c
+ * \brief           Speed and compression benchmark for SQZ, over a synthetic corpus
+ */
+
+/*
+                    Copyright (c) 2024, Márcio Pais
+
+                    SPDX-License-Identifier: MIT
+
+Generates a fixed corpus of synthetic images (smooth photographic-like noise, flat
+graphics, gradients and fine textures), and measures the compressed size, quality
+and encoding/decoding throughput at a few budgets, for each of the coding modes.
+No external files are needed, so the results are reproducible across machines.
+
+The concurrency benchmark instead runs the same mix of encodings and decodings on
+every thread, from 1 thread to the number of cores, and reports how the throughput
+scales. Its first round runs on all the threads at once, before any other use of
+the library, so that the one-time initialization of the library happens on several
+threads. Each result is checked against that of a single thread, to catch any state
+shared by the threads, and a poor scaling points to contention on shared state,
+on the allocator or on cache lines.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#define SQZ_IMPLEMENTATION
+#include "sqz.h"
+
+#define CORPUS_SIZE     4
+#define NUM_BUDGETS     3
+#define NUM_MODES       4
+#define MAX_THREADS     64
+#define NUM_JOBS        (CORPUS_SIZE * NUM_MODES * 2)
+
+typedef struct
+{
+    char const* name;
+    uint8_t* pixels;
+    SQZ_image_descriptor_t descriptor;
+} image_t;
+
+typedef struct
+{
+    size_t bytes;
+    double psnr;
+    double encode_time;
+    double decode_time;
+} result_t;
+
+/* Encoding and decoding of an image by the concurrency benchmark, with the results of a single thread */
+typedef struct
+{
+    image_t const* image;
+    SQZ_image_descriptor_t descriptor;
+    size_t size;
+    uint32_t stream_hash;
+    uint32_t pixels_hash;
+} job_t;
+
+/* Thread of the concurrency benchmark, running every job once, starting from its own, with the results of each job */
+typedef struct
+{
+    job_t const* jobs;
+    size_t first;
+    size_t capacity;
+    size_t length;
+    double time;
+    int failed;
+    size_t sizes[NUM_JOBS];
+    uint32_t stream_hashes[NUM_JOBS];
+    uint32_t pixels_hashes[NUM_JOBS];
+} worker_t;
+
+static char const* const mode_names[NUM_MODES] = { "raw", "arithmetic", "rice", "dense" };
+
+/* Budgets in bits per pixel, 0 being lossless */
+static double const budgets[NUM_BUDGETS] = { 0.0, 1.0, 0.25 };
+
+void usage(char* progname)
+{
+    fprintf(stderr,
+        "%s %s %s\n",
+        "Usage:", progname, "[-h] [-m mode] [-n repetitions] [-o order] [-s size] [-t threads]\n"
+        "Benchmark SQZ over a synthetic corpus of images.\n"
+     );
+}
+
+void help()
+{
+    fprintf(stderr,
+        "%s\n",
+        "-m mode           Internal color mode (default: YCoCg-R)\n0: Grayscale\n1: YCoCg-R\n2: Oklab\n3: logl1\n"
+        "-n repetitions    Number of timed runs, the fastest one being reported (default: 3)\n"
+        "-o order          DWT coefficient scanning order (default: Snake)\n0: Raster\n1: Snake\n2: Morton\n3: Hilbert\n"
+        "-s size           Width of the images, the height being 3/4 of it (default: 1024)\n"
+        "-t threads        Run the concurrency benchmark instead, on up to the given number of threads (0: one per core)\n"
+        "\n"
+        "The SQZ_CPU environment variable selects the kernels to benchmark (scalar, sse2, avx2 or avx512),\n"
+        "the best ones supported by the CPU being used by default.\n"
+    );
+}
+
+double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+double psnr(uint8_t const* a, uint8_t const* b, size_t length)
+{
+    double error = 0.0;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        double const d = (double)a[i] - (double)b[i];
+        error += d * d;
+    }
+    return (error > 0.0) ? 10.0 * log10(255.0 * 255.0 * (double)length / error) : INFINITY;
+}
+
+uint32_t random_next(uint32_t* const state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Bilinearly interpolated random lattice, with the given cell size, in the range [0..255] */
+int value_noise(uint32_t const seed, size_t const x, size_t const y, size_t const cell)
+{
+    size_t const cx = x / cell, cy = y / cell, fx = x % cell, fy = y % cell;
+    int corner[4];
+    for (size_t i = 0u; i < 4u; ++i)
+    {
+        uint32_t state = seed ^ (uint32_t)((cx + (i & 1u)) * 73856093u) ^ (uint32_t)((cy + (i >> 1u)) * 19349663u);
+        state |= 1u;
+        random_next(&state);
+        corner[i] = (int)(random_next(&state) & 0xFFu);
+    }
+    int const top = corner[0] * (int)(cell - fx) + corner[1] * (int)fx;
+    int const bottom = corner[2] * (int)(cell - fx) + corner[3] * (int)fx;
+    return (top * (int)(cell - fy) + bottom * (int)fy) / (int)(cell * cell);
+}
+
+uint8_t clip(int const v)
+{
+    return (v < 0) ? 0u : ((v > 255) ? 255u : (uint8_t)v);
+}
+
+/* Fills an image with one of the synthetic patterns of the corpus */
+void generate(image_t* const image, size_t const kind)
+{
+    size_t const width = image->descriptor.width, height = image->descriptor.height, planes = image->descriptor.num_planes;
+    uint32_t state = 0x9E3779B9u + (uint32_t)kind;
+    for (size_t y = 0u; y < height; ++y)
+    {
+        for (size_t x = 0u; x < width; ++x)
+        {
+            for (size_t c = 0u; c < planes; ++c)
+            {
+                uint32_t const seed = (uint32_t)(kind * 7u + c * 131u);
+                int v;
+                switch (kind)
+                {
+                    case 0: /* photographic, fractal noise with correlated planes */
+                        v = (value_noise(1u, x, y, 128u) * 8 + value_noise(2u, x, y, 32u) * 4 + value_noise(3u, x, y, 8u) * 2 + value_noise(seed, x, y, 4u)) / 15;
+                        v += (value_noise(seed + 5u, x, y, 64u) - 128) / 4 + (int)(random_next(&state) % 5u) - 2;
+                        break;
+                    case 1: /* graphics, flat blocks with hard edges and thin lines */
+                        v = (value_noise(seed, (x / 48u) * 48u, (y / 40u) * 40u, 48u) > 128) ? 40 + (int)c * 60 : 220 - (int)c * 50;
+                        if (((x + 2u * y) % 61u) < 2u)
+                        {
+                            v = 0;
+                        }
+                        break;
+                    case 2: /* smooth gradients with sensor-like noise */
+                        v = (int)((x * 255u) / width + (y * 128u) / height) / 2 + (int)c * 30 + (int)(random_next(&state) % 9u) - 4;
+                        break;
+                    default: /* fine textures */
+                        v = (value_noise(seed, x, y, 2u) + value_noise(seed + 1u, x, y, 6u)) / 2;
+                        break;
+                }
+                image->pixels[(y * width + x) * planes + c] = clip(v);
+            }
+        }
+    }
+}
+
+/* FNV-1a hash, to compare the results of the threads */
+uint32_t hash(uint8_t const* data, size_t length)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Runs one configuration, keeping the fastest of the repetitions */
+int run(image_t const* const image, int const mode, double const bpp, int const repetitions, result_t* const result)
+{
+    size_t const length = image->descriptor.width * image->descriptor.height * image->descriptor.num_planes;
+    size_t const capacity = (bpp > 0.0) ? (size_t)(bpp * (double)(image->descriptor.width * image->descriptor.height) / 8.0) : length * 2u;
+    uint8_t* const stream = (uint8_t*)malloc(capacity);
+    uint8_t* const decoded = (uint8_t*)malloc(length);
+    if ((stream == NULL) || (decoded == NULL))
+    {
+        free(stream);
+        free(decoded);
+        return 0;
+    }
+    result->encode_time = result->decode_time = INFINITY;
+    for (int i = 0; i < repetitions; ++i)
+    {
+        SQZ_image_descriptor_t descriptor = image->descriptor;
+        descriptor.arithmetic_coding = (mode == 1);
+        descriptor.rice_coding = (mode == 2);
+        descriptor.dense_coding = (mode == 3);
+        size_t size = capacity, decoded_size = length;
+        memset(stream, 0, capacity);
+        double const start = now();
+        if (SQZ_encode(image->pixels, stream, &descriptor, &size) != SQZ_RESULT_OK)
+        {
+            break;
+        }
+        double const middle = now();
+        if (SQZ_decode(stream, decoded, size, &decoded_size, NULL) != SQZ_RESULT_OK)
+        {
+            break;
+        }
+        double const end = now();
+        result->encode_time = (middle - start < result->encode_time) ? middle - start : result->encode_time;
+        result->decode_time = (end - middle < result->decode_time) ? end - middle : result->decode_time;
+        result->bytes = size;
+    }
+    result->psnr = psnr(image->pixels, decoded, length);
+    free(stream);
+    free(decoded);
+    return isfinite(result->decode_time);
+}
+
+/* Encodes and decodes the images of all the jobs, keeping the sizes and hashes of the results */
+void* work(void* argument)
+{
+    worker_t* const worker = (worker_t*)argument;
+    uint8_t* const stream = (uint8_t*)malloc(worker->capacity);
+    uint8_t* const decoded = (uint8_t*)malloc(worker->length);
+    int failed = (stream == NULL) || (decoded == NULL);
+    double const start = now();
+    for (size_t i = 0u; (i < NUM_JOBS) && (!failed); ++i)
+    {
+        size_t const index = (worker->first + i) % NUM_JOBS;
+        job_t const* const job = &worker->jobs[index];
+        SQZ_image_descriptor_t descriptor = job->descriptor;
+        size_t size = worker->capacity, decoded_size = worker->length;
+        memset(stream, 0, size);
+        if ((SQZ_encode(job->image->pixels, stream, &descriptor, &size) != SQZ_RESULT_OK) ||
+            (SQZ_decode(stream, decoded, size, &decoded_size, NULL) != SQZ_RESULT_OK))
+        {
+            failed = 1;
+            break;
+        }
+        worker->sizes[index] = size;
+        worker->stream_hashes[index] = hash(stream, size);
+        worker->pixels_hashes[index] = hash(decoded, decoded_size);
+    }
+    worker->time = now() - start;
+    worker->failed = failed;
+    free(stream);
+    free(decoded);
+    return NULL;
+}
+
+/* Runs the jobs on the given number of threads, returning 0 if not all of them could be started */
+int launch(job_t const* const jobs, worker_t* const workers, int const count, size_t const capacity, size_t const length, double* const elapsed)
+{
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+    double const start = now();
+    for (; started < count; ++started)
+    {
+        worker_t* const worker = &workers[started];
+        worker->jobs = jobs;
+        worker->first = (size_t)started * 3u;
+        worker->capacity = capacity;
+        worker->length = length;
+        if (pthread_create(&threads[started], NULL, &work, worker) != 0)
+        {
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    *elapsed = now() - start;
+    if (started < count)
+    {
+        fprintf(stderr, "Error starting thread %d\n", started + 1);
+        return 0;
+    }
+    return 1;
+}
+
+/* Counts the results of a thread differing from those of a single thread */
+int mismatches(job_t const* const jobs, worker_t const* const worker)
+{
+    int count = 0;
+    for (size_t j = 0u; j < NUM_JOBS; ++j)
+    {
+        count += (worker->sizes[j] != jobs[j].size) || (worker->stream_hashes[j] != jobs[j].stream_hash) || (worker->pixels_hashes[j] != jobs[j].pixels_hash);
+    }
+    return count;
+}
+
+/* Measures the throughput of 1 thread up to the given number, each of them running all the jobs */
+int scale(image_t const* const corpus, int const max_threads)
+{
+    image_t const* const first = &corpus[0];
+    size_t const pixels = first->descriptor.width * first->descriptor.height;
+    size_t const length = pixels * first->descriptor.num_planes;
+    size_t const capacity = pixels / 8u;
+    job_t jobs[NUM_JOBS];
+    worker_t workers[MAX_THREADS];
+
+    /* every coding mode, with both the chosen color mode and another one, so that Oklab and its LUTs are always used */
+    SQZ_color_mode_t const color_mode = first->descriptor.color_mode;
+    SQZ_color_mode_t const other = (color_mode == SQZ_COLOR_MODE_GRAYSCALE) ? SQZ_COLOR_MODE_GRAYSCALE :
+        ((color_mode == SQZ_COLOR_MODE_OKLAB) ? SQZ_COLOR_MODE_YCOCG_R : SQZ_COLOR_MODE_OKLAB);
+    memset(jobs, 0, sizeof(jobs));
+    for (size_t j = 0u; j < NUM_JOBS; ++j)
+    {
+        job_t* const job = &jobs[j];
+        int const mode = (int)((j / CORPUS_SIZE) % NUM_MODES);
+        job->image = &corpus[j % CORPUS_SIZE];
+        job->descriptor = job->image->descriptor;
+        job->descriptor.color_mode = (j < NUM_JOBS / 2u) ? color_mode : other;
+        job->descriptor.arithmetic_coding = (mode == 1);
+        job->descriptor.rice_coding = (mode == 2);
+        job->descriptor.dense_coding = (mode == 3);
+    }
+
+    printf("Concurrency: %d encodings and decodings per thread, %zux%zu pixels at 1 bpp\n\n", NUM_JOBS, first->descriptor.width, first->descriptor.height);
+    /* the cold start runs before the library has been used at all, its results being checked once those of a single thread are known */
+    double elapsed;
+    int result = launch(jobs, workers, max_threads, capacity, length, &elapsed);
+    uint8_t* const stream = (uint8_t*)malloc(capacity);
+    uint8_t* const decoded = (uint8_t*)malloc(length);
+    result = result && (stream != NULL) && (decoded != NULL);
+    for (size_t j = 0u; (j < NUM_JOBS) && (result); ++j)
+    {
+        job_t* const job = &jobs[j];
+        SQZ_image_descriptor_t descriptor = job->descriptor;
+        size_t decoded_size = length;
+        job->size = capacity;
+        memset(stream, 0, capacity);
+        result = (SQZ_encode(job->image->pixels, stream, &descriptor, &job->size) == SQZ_RESULT_OK) &&
+            (SQZ_decode(stream, decoded, job->size, &decoded_size, NULL) == SQZ_RESULT_OK);
+        if (result)
+        {
+            job->stream_hash = hash(stream, job->size);
+            job->pixels_hash = hash(decoded, decoded_size);
+        }
+    }
+    free(stream);
+    free(decoded);
+    int regressions = 0;
+    if (result)
+    {
+        int cold = 0, failed = 0;
+        for (int i = 0; i < max_threads; ++i)
+        {
+            cold += mismatches(jobs, &workers[i]);
+            failed |= workers[i].failed;
+        }
+        regressions += failed || (cold > 0);
+        result = !failed;
+        printf("Cold start on %d threads: %s\n\n", max_threads, failed ? "FAILED" : ((cold > 0) ? "MISMATCH" : "ok"));
+    }
+
+    printf("%7s %10s %8s %10s %8s  %s\n", "threads", "MP/s", "speedup", "efficiency", "spread", "check");
+    double base = 0.0;
+    /* powers of 2, then the maximum */
+    for (int count = 1; result; count = (count * 2 < max_threads) ? count * 2 : max_threads)
+    {
+        if (!launch(jobs, workers, count, capacity, length, &elapsed))
+        {
+            result = 0;
+            break;
+        }
+        double fastest = INFINITY, slowest = 0.0;
+        int different = 0, failed = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            fastest = (workers[i].time < fastest) ? workers[i].time : fastest;
+            slowest = (workers[i].time > slowest) ? workers[i].time : slowest;
+            different += mismatches(jobs, &workers[i]);
+            failed |= workers[i].failed;
+        }
+        double const throughput = (double)count * (double)(NUM_JOBS * 2) * (double)pixels * 1e-6 / elapsed;
+        base = (count == 1) ? throughput : base;
+        double const efficiency = throughput / (base * (double)count);
+        char const* const check = failed ? "FAILED" : ((different > 0) ? "MISMATCH" : ((efficiency < 0.8) ? "slow" : "ok"));
+        regressions += failed || (different > 0) || (efficiency < 0.8);
+        result = !failed;
+        printf("%7d %10.2f %8.2f %9.0f%% %8.2f  %s\n", count, throughput, throughput / base, 100.0 * efficiency, slowest / fastest, check);
+        if (count >= max_threads)
+        {
+            break;
+        }
+    }
+    if (regressions > 0)
+    {
+        printf("\nEfficiency under 80%% points to contention on shared state, on the allocator or on cache lines, unless the\n"
+            "threads outnumber the physical cores. Mismatches are results differing from those of a single thread.\n");
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    static char const* const names[CORPUS_SIZE] = { "photo", "graphics", "gradient", "texture" };
+    image_t corpus[CORPUS_SIZE];
+    result_t results[CORPUS_SIZE][NUM_BUDGETS][NUM_MODES];
+    int color_mode = 1, scan_order = 1, repetitions = 3, size = 1024, max_threads = -1;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "m:n:o:s:t:h")) != -1 )
+    {
+        switch(opt)
+        {
+            case 'm':
+                color_mode = atoi(optarg);
+                break;
+            case 'n':
+                repetitions = atoi(optarg);
+                break;
+            case 'o':
+                scan_order = atoi(optarg);
+                break;
+            case 's':
+                size = atoi(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                help();
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((color_mode < SQZ_COLOR_MODE_GRAYSCALE) || (color_mode >= SQZ_COLOR_MODE_MULTISPECTRAL) || (repetitions < 1) ||
+        (size < SQZ_MIN_DIMENSION * 2) || (size > (int)SQZ_MAX_DIMENSION) || (max_threads < -1) || (max_threads > MAX_THREADS))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0u; i < CORPUS_SIZE; ++i)
+    {
+        image_t* const image = &corpus[i];
+        memset(&image->descriptor, 0, sizeof(image->descriptor));
+        image->name = names[i];
+        image->descriptor.width = (size_t)size;
+        image->descriptor.height = ((size_t)size * 3u) / 4u;
+        image->descriptor.num_planes = (color_mode == SQZ_COLOR_MODE_GRAYSCALE) ? 1u : 3u;
+        image->descriptor.color_mode = color_mode;
+        image->descriptor.scan_order = scan_order;
+        image->descriptor.dwt_levels = SQZ_DWT_LEVELS_AUTO;
+        image->pixels = (uint8_t*)malloc(image->descriptor.width * image->descriptor.height * image->descriptor.num_planes);
+        if (image->pixels == NULL)
+        {
+            fprintf(stderr, "Insufficient memory");
+            return 2;
+        }
+        generate(image, i);
+    }
+
+    if (max_threads >= 0)
+    {
+        /* the kernels are only named afterwards, so that the cold start selects them */
+        long const cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int const result = scale(corpus, (max_threads > 0) ? max_threads : ((cores > MAX_THREADS) ? MAX_THREADS : ((cores > 0) ? (int)cores : 1)));
+        printf("\nKernels: %s\n", SQZ_kernels_name());
+        for (size_t i = 0u; i < CORPUS_SIZE; ++i)
+        {
+            free(corpus[i].pixels);
+        }
+        return result ? 0 : 3;
+    }
+    printf("Kernels: %s\n\n", SQZ_kernels_name());
+    printf("%-10s %8s %-11s %10s %8s %10s %10s\n", "image", "bpp", "coding", "bytes", "PSNR", "enc MP/s", "dec MP/s");
+    for (size_t i = 0u; i < CORPUS_SIZE; ++i)
+    {
+        double const megapixels = (double)(corpus[i].descriptor.width * corpus[i].descriptor.height) * 1e-6;
+        for (size_t b = 0u; b < NUM_BUDGETS; ++b)
+        {
+            for (int mode = 0; mode < NUM_MODES; ++mode)
+            {
+                result_t* const result = &results[i][b][mode];
+                if (!run(&corpus[i], mode, budgets[b], repetitions, result))
+                {
+                    fprintf(stderr, "Error processing image %s\n", corpus[i].name);
+                    return 3;
+                }
+                printf("%-10s %8s %-11s %10zu %8.2f %10.2f %10.2f\n", corpus[i].name, (b == 0u) ? "lossless" : ((b == 1u) ? "1" : "0.25"),
+                    mode_names[mode], result->bytes, result->psnr, megapixels / result->encode_time, megapixels / result->decode_time);
+            }
+        }
+    }
+
+    /* Summarize each mode relative to the raw one */
+    for (int mode = 1; mode < NUM_MODES; ++mode)
+    {
+        double bytes[2] = { 0.0 }, encode[2] = { 0.0 }, decode[2] = { 0.0 }, gain = 0.0;
+        for (size_t i = 0u; i < CORPUS_SIZE; ++i)
+        {
+            bytes[0] += (double)results[i][0][0].bytes;
+            bytes[1] += (double)results[i][0][mode].bytes;
+            for (size_t b = 0u; b < NUM_BUDGETS; ++b)
+            {
+                encode[0] += results[i][b][0].encode_time;
+                encode[1] += results[i][b][mode].encode_time;
+                decode[0] += results[i][b][0].decode_time;
+                decode[1] += results[i][b][mode].decode_time;
+                if (b > 0u)
+                {
+                    gain += (results[i][b][mode].psnr - results[i][b][0].psnr) / (double)(CORPUS_SIZE * (NUM_BUDGETS - 1u));
+                }
+            }
+        }
+        printf("\n%s vs %s: lossless size %+.2f%%, lossy quality %+.2f dB, encoding time %+.1f%%, decoding time %+.1f%%\n",
+            mode_names[mode], mode_names[0], 100.0 * (bytes[1] / bytes[0] - 1.0), gain,
+            100.0 * (encode[1] / encode[0] - 1.0), 100.0 * (decode[1] / decode[0] - 1.0));
+    }
+
+    for (size_t i = 0u; i < CORPUS_SIZE; ++i)
+    {
+        free(corpus[i].pixels);
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+﻿/**
+ * \file            sqz_test.cpp
+ * \brief           Compile-and-run test of the C++20 wrapper of SQZ
+ */
+
+/*
+                    Copyright (c) 2024, Márcio Pais
+
+                    SPDX-License-Identifier: MIT
+
+Builds the wrapper, along with the implementation of the library, in a C++20 translation
+unit, and runs its encoder, decoder, progressive decoder and asynchronous decoder over a
+few synthetic images. The lossless streams must decode to the original pixels, and the
+decoders fed with the stream in chunks must end on the same output as a single decode.
+Prints the failed checks, and returns a non-zero status if there were any.
+*/
+
+#define SQZ_IMPLEMENTATION
+#include "sqz.hpp"
+
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool const condition, char const* const what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+/* smooth gradients with a little texture, so that every subband has some coefficients */
+std::vector<uint8_t> make_image(size_t const width, size_t const height, size_t const num_planes)
+{
+    std::vector<uint8_t> pixels(width * height * num_planes);
+    uint32_t state = 12345u;
+    for (size_t i = 0u; i < width * height; ++i)
+    {
+        size_t const x = i % width, y = i / width;
+        state = state * 1664525u + 1013904223u;
+        for (size_t k = 0u; k < num_planes; ++k)
+        {
+            pixels[i * num_planes + k] = static_cast<uint8_t>(((x * (k + 1u) + y * 2u) & 0xFFu) ^ ((state >> 28u) & 3u));
+        }
+    }
+    return pixels;
+}
+
+#ifdef __cpp_impl_coroutine
+
+/* source handing out the stream in chunks, each read completing without suspending */
+struct chunked_source
+{
+    std::span<uint8_t const> stream;
+    size_t offset = 0u;
+
+    struct read_awaiter
+    {
+        size_t size;
+
+        bool await_ready() const noexcept { return true; }
+        void await_suspend(std::coroutine_handle<>) const noexcept {}
+        size_t await_resume() const noexcept { return size; }
+    };
+
+    read_awaiter read(std::span<uint8_t> const output)
+    {
+        size_t const size = std::min(output.size(), stream.size() - offset);
+        std::memcpy(output.data(), stream.data() + offset, size);
+        offset += size;
+        return { size };
+    }
+};
+
+/* coroutine consuming the previews, started at once and kept until destroyed */
+struct consumer
+{
+    struct promise_type
+    {
+        consumer get_return_object() noexcept { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { ++failures; }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+consumer consume(sqz::preview_stream previews, std::vector<uint8_t>& output, size_t& count)
+{
+    while (sqz::preview const* const preview = co_await previews.next())
+    {
+        output.assign(preview->pixels.begin(), preview->pixels.end());
+        ++count;
+    }
+}
+
+#endif /* __cpp_impl_coroutine */
+
+void test_image(size_t const width, size_t const height, SQZ_color_mode_t const color_mode)
+{
+    size_t const num_planes = (color_mode == SQZ_COLOR_MODE_GRAYSCALE) ? 1u : 3u;
+    std::vector<uint8_t> const pixels = make_image(width, height, num_planes);
+    SQZ_image_descriptor_t descriptor = {};
+    descriptor.width = width;
+    descriptor.height = height;
+    descriptor.num_planes = num_planes;
+    descriptor.color_mode = color_mode;
+    descriptor.dwt_levels = SQZ_DWT_LEVELS_AUTO;
+    sqz::encoder encoder(descriptor);
+    sqz::decoder decoder;
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < 3; ++i)
+    {
+        /* the later calls reuse the buffers and workspace of the first one */
+        std::span<uint8_t const> const encoded = encoder.encode(pixels, pixels.size() * 2u);
+        check((i == 0) || std::equal(encoded.begin(), encoded.end(), stream.begin(), stream.end()), "encoding is repeatable");
+        stream.assign(encoded.begin(), encoded.end());
+        std::span<uint8_t const> const decoded = decoder.decode(stream);
+        check(std::equal(decoded.begin(), decoded.end(), pixels.begin(), pixels.end()), "lossless decoding");
+    }
+    sqz::image_info const info = sqz::decoder::info(stream);
+    check((info.descriptor.width == width) && (info.descriptor.height == height) && (info.size == pixels.size()), "header information");
+    std::vector<uint8_t> output(info.size);
+    decoder.decode(std::span<uint8_t const>(stream).first(stream.size() / 4u), output);
+
+    sqz::progressive_decoder progressive;
+    for (size_t size = 64u; ; size = std::min(size * 2u, stream.size()))
+    {
+        progressive.update(std::span<uint8_t const>(stream).first(size), output);
+        if (size == stream.size())
+        {
+            break;
+        }
+    }
+    check(output == pixels, "progressive decoding");
+
+#ifdef __cpp_impl_coroutine
+    chunked_source source = { stream };
+    std::vector<uint8_t> last;
+    size_t count = 0u;
+    consumer const task = consume(sqz::async_decode(source, SIZE_MAX, 1000u), last, count);
+    check(task.handle.done() && (count > 0u) && (last == pixels), "asynchronous decoding");
+    task.handle.destroy();
+#endif
+}
+
+} /* namespace */
+
+int main(void)
+{
+    test_image(64u, 64u, SQZ_COLOR_MODE_GRAYSCALE);
+    test_image(257u, 131u, SQZ_COLOR_MODE_YCOCG_R);
+    test_image(9u, 8u, SQZ_COLOR_MODE_YCOCG_R);
+    std::printf(failures ? "%d checks failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
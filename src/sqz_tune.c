@@ -0,0 +1,303 @@
+﻿/**
+ * \file            sqz_tune.c
+ * \brief           Offline optimizer for SQZ processing schedules
+ */
+
+/*
+                    Copyright (c) 2024, Márcio Pais
+
+                    SPDX-License-Identifier: MIT
+
+Requirements:
+    - "stb_image.h"         [https://github.com/nothings/stb/blob/master/stb_image.h]
+
+Searches for the processing schedule that minimizes the total number of bytes needed
+for a corpus of images to reach a target PSNR, by coordinate descent over the starting
+rounds of the subbands, starting from the default schedule. The chroma planes share
+their starting rounds, as do the HL and LH subbands of each level.
+
+The resulting schedule file can be used with "stbisqz -S".
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+
+#define SQZ_IMPLEMENTATION
+#include "sqz.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb/stb_image.h"
+
+typedef struct
+{
+    uint8_t* pixels;
+    uint8_t* stream;
+    uint8_t* decoded;
+    size_t size;
+    SQZ_image_descriptor_t descriptor;
+} image_t;
+
+void usage(char* progname)
+{
+    fprintf(stderr,
+        "%s %s %s\n",
+        "Usage:", progname, "[-h] [-i iterations] [-l level] [-m mode] [-o order] [-q psnr] [-s subsampling] output image...\n"
+        "Optimize an SQZ processing schedule for a corpus of images.\n"
+     );
+}
+
+void help()
+{
+    fprintf(stderr,
+        "%s\n",
+        "-i iterations     Maximum number of optimization sweeps (default: 4)\n"
+        "-l level          Number of DWT decompositions to perform (default: 5)\n"
+        "-m mode           Internal color mode (default: YCoCg-R)\n0: Grayscale\n1: YCoCg-R\n2: Oklab\n3: logl1\n"
+        "-o order          DWT coefficient scanning order (default: Snake)\n0: Raster\n1: Snake\n2: Morton\n3: Hilbert\n"
+        "-q psnr           Target quality, in dB (default: 32)\n"
+        "-s subsampling    Use additional chroma subsampling\n"
+        "\n"
+        "stb_image by Sean Barrett and others is used to read images.\n"
+    );
+}
+
+double psnr(uint8_t const* a, uint8_t const* b, size_t length)
+{
+    double error = 0.0;
+    for (size_t i = 0u; i < length; ++i)
+    {
+        double const d = (double)a[i] - (double)b[i];
+        error += d * d;
+    }
+    return (error > 0.0) ? 10.0 * log10(255.0 * 255.0 * (double)length / error) : INFINITY;
+}
+
+/* Smallest prefix of the compressed image reaching the target quality, found by bisection */
+size_t bytes_at_quality(image_t* const image, double const target)
+{
+    SQZ_image_descriptor_t descriptor;
+    size_t const length = image->descriptor.width * image->descriptor.height * image->descriptor.num_planes;
+    size_t low = SQZ_HEADER_SIZE + 1u, high = image->size;
+    while (low < high)
+    {
+        size_t const middle = low + ((high - low) >> 1u);
+        size_t size = length;
+        if ((SQZ_decode(image->stream, image->decoded, middle, &size, &descriptor) == SQZ_RESULT_OK) &&
+            (psnr(image->pixels, image->decoded, length) >= target))
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1u;
+        }
+    }
+    return high;
+}
+
+/* Total cost of a schedule over the corpus, or 0 on failure */
+size_t evaluate(image_t* const images, size_t const count, SQZ_schedule_t const* schedule, double const target)
+{
+    size_t total = 0u;
+    for (size_t i = 0u; i < count; ++i)
+    {
+        image_t* const image = &images[i];
+        size_t const length = image->descriptor.width * image->descriptor.height * image->descriptor.num_planes;
+        image->size = length + (length >> 2u);
+        memset(image->stream, 0, image->size);
+        image->descriptor.schedule = schedule;
+        if (SQZ_encode(image->pixels, image->stream, &image->descriptor, &image->size) != SQZ_RESULT_OK)
+        {
+            return 0u;
+        }
+        total += bytes_at_quality(image, target);
+    }
+    return total;
+}
+
+/* Copies a starting round to every plane, orientation and level sharing it */
+void set_round(SQZ_schedule_t* const schedule, size_t const num_planes, size_t const group, size_t const level, size_t const orientation, uint8_t const round)
+{
+    for (size_t plane = (group > 0u); plane < ((group > 0u) ? num_planes : 1u); ++plane)
+    {
+        schedule[plane][level][orientation] = round;
+        if ((orientation == 1u) || (orientation == 2u))
+        {
+            schedule[plane][level][3u - orientation] = round;
+        }
+    }
+}
+
+int write_schedule(char const* filename, SQZ_schedule_t const* const schedule, size_t const num_planes, double const target, size_t const cost)
+{
+    FILE* output = fopen(filename, "w");
+    if (output == NULL)
+    {
+        return 0;
+    }
+    fprintf(output, "# SQZ schedule: starting rounds of the LL, HL, LH and HH subbands, per plane and level (coarsest first)\n");
+    fprintf(output, "# %zu bytes for the corpus at %.2f dB\n", cost, target);
+    for (size_t plane = 0u; plane < num_planes; ++plane)
+    {
+        fprintf(output, "# plane %zu\n", plane);
+        for (size_t level = 0u; level < SQZ_DWT_MAX_LEVEL; ++level)
+        {
+            fprintf(output, "%3d %3d %3d %3d\n", schedule[plane][level][0], schedule[plane][level][1], schedule[plane][level][2], schedule[plane][level][3]);
+        }
+    }
+    fclose(output);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    SQZ_schedule_t schedule[3];
+    double target = 32.0;
+    int levels = 5, color_mode = 1, scan_order = 1, subsampling = 0, iterations = 4;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "i:l:m:o:q:s:h")) != -1 )
+    {
+        switch(opt)
+        {
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'l':
+                levels = atoi(optarg);
+                break;
+            case 'm':
+                color_mode = atoi(optarg);
+                break;
+            case 'o':
+                scan_order = atoi(optarg);
+                break;
+            case 'q':
+                target = atof(optarg);
+                break;
+            case 's':
+                subsampling = atoi(optarg);
+                break;
+            case 'h':
+                usage(argv[0]);
+                help();
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Need the output filename and at least one image
+    if ((argc < optind + 2) || (color_mode < SQZ_COLOR_MODE_GRAYSCALE) || (color_mode >= SQZ_COLOR_MODE_MULTISPECTRAL))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t const num_planes = (color_mode == SQZ_COLOR_MODE_GRAYSCALE) ? 1u : 3u;
+    size_t count = 0u;
+    image_t* images = (image_t*)calloc(argc - optind - 1, sizeof(image_t));
+    if (images == NULL)
+    {
+        fprintf(stderr, "Insufficient memory");
+        return 2;
+    }
+    for (int i = optind + 1; i < argc; ++i)
+    {
+        int width = 0, height = 0, channels = 0;
+        image_t* const image = &images[count];
+        image->pixels = (uint8_t*)stbi_load(argv[i], &width, &height, &channels, (int)num_planes);
+        if (image->pixels == NULL)
+        {
+            fprintf(stderr, "Skipping %s: %s\n", argv[i], stbi_failure_reason());
+            continue;
+        }
+        image->descriptor.width = (size_t)width;
+        image->descriptor.height = (size_t)height;
+        image->descriptor.num_planes = num_planes;
+        image->descriptor.dwt_levels = levels;
+        image->descriptor.color_mode = color_mode;
+        image->descriptor.scan_order = scan_order;
+        image->descriptor.subsampling = subsampling;
+        size_t const length = (size_t)width * (size_t)height * num_planes;
+        image->stream = (uint8_t*)malloc(length + (length >> 2u));
+        image->decoded = (uint8_t*)malloc(length);
+        if ((image->stream == NULL) || (image->decoded == NULL))
+        {
+            fprintf(stderr, "Insufficient memory");
+            return 2;
+        }
+        ++count;
+    }
+    if (count == 0u)
+    {
+        fprintf(stderr, "No images to optimize for");
+        return 3;
+    }
+
+    memcpy(schedule, SQZ_schedule[color_mode], sizeof(SQZ_schedule_t) * num_planes);
+    size_t best = evaluate(images, count, schedule, target);
+    if (best == 0u)
+    {
+        fprintf(stderr, "Error compressing images");
+        return 4;
+    }
+    fprintf(stderr, "Default schedule: %zu bytes\n", best);
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        bool improved = false;
+        for (size_t group = 0u; (group < num_planes) && (group < 2u); ++group)
+        {
+            for (size_t level = 0u; (level < (size_t)levels) && (level < SQZ_DWT_MAX_LEVEL); ++level)
+            {
+                /* HL and LH are tied, so only LL (coarsest level), HL and HH are searched */
+                for (size_t orientation = !!(level > 0u); orientation < 4u; orientation += 1u + (orientation == 1u))
+                {
+                    size_t const plane = group;
+                    int const current = schedule[plane][level][orientation];
+                    for (int step = -1; step <= 1; step += 2)
+                    {
+                        int const round = current + step;
+                        if ((round < 0) || (round > UINT8_MAX))
+                        {
+                            continue;
+                        }
+                        set_round(schedule, num_planes, group, level, orientation, (uint8_t)round);
+                        size_t const cost = evaluate(images, count, schedule, target);
+                        if ((cost > 0u) && (cost < best))
+                        {
+                            best = cost;
+                            improved = true;
+                            fprintf(stderr, "Plane %zu, level %zu, subband %zu: round %d, %zu bytes\n", plane, level, orientation, round, best);
+                            break;
+                        }
+                        set_round(schedule, num_planes, group, level, orientation, (uint8_t)current);
+                    }
+                }
+            }
+        }
+        if (!improved)
+        {
+            break;
+        }
+    }
+
+    if (!write_schedule(argv[optind], schedule, num_planes, target, best))
+    {
+        fprintf(stderr, "Error writing schedule file");
+        return 5;
+    }
+    for (size_t i = 0u; i < count; ++i)
+    {
+        stbi_image_free(images[i].pixels);
+        free(images[i].stream);
+        free(images[i].decoded);
+    }
+    free(images);
+    return 0;
+}